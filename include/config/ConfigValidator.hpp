@@ -22,6 +22,10 @@ private:
   std::map<int, std::map<std::string, Span> > hostnamesOnPort; 
   // port -> interface that used wildcard
   std::map<int, Span> portToWildcardSpan;
+  // upstream block name -> its span
+  std::map<std::string, Span> upstreamNames;
+  // access_log path -> its settings and where they were first given
+  std::map<std::string, std::pair<std::string, Span> > accessLogSettings;
 
 public:
   ConfigValidator(ErrorReporter &errorReporter);
@@ -33,6 +37,8 @@ private:
   void validateDirective(const Directive &directive, Context context);
   void validateServerConfig(const ServerConfig &serverConfig);
   void validateLocationConfig(const LocationConfig &locationConfig);
+  void validateUpstreamConfig(const UpstreamConfig &upstreamConfig);
+  void validateHttpConfig(const std::vector<Directive> &directives);
   // Helper functions for validating directive values
   void validateRequiredDirectives(const ServerConfig &serverConfig);
   void validateServerNameUniqueness(const ServerConfig &serverConfig);
@@ -56,6 +62,26 @@ private:
   bool checkUploadStoreDirective(const Directive &directive);
   bool checkCgiExtensionDirective(const Directive &directive);
   bool checkMethodsDirective(const Directive &directive);
+  bool checkAccessLogDirective(const Directive &directive);
+  bool checkFastcgiPassDirective(const Directive &directive);
+  bool checkCgiWorkersDirective(const Directive &directive);
+  bool checkCgiMaxConcurrencyDirective(const Directive &directive);
+  bool checkProxyPassDirective(const Directive &directive);
+  bool checkTimeDirective(const Directive &directive);
+  bool checkUpstreamServerDirective(const Directive &directive);
+  bool checkLeastConnDirective(const Directive &directive);
+  bool checkHashDirective(const Directive &directive);
+  bool checkCachePathDirective(const Directive &directive);
+  bool checkCacheDirective(const Directive &directive);
+  bool checkCacheValidDirective(const Directive &directive);
+  bool checkMicrocacheDirective(const Directive &directive);
+  bool checkCaptureDirective(const Directive &directive);
+  bool checkStatusDirective(const Directive &directive);
+  bool checkTraceDirective(const Directive &directive);
+  bool checkLimitReqDirective(const Directive &directive);
+  bool checkHttpCountDirective(const Directive &directive);
+  bool checkHttpSizeDirective(const Directive &directive);
+  bool checkLargeClientHeaderBuffersDirective(const Directive &directive);
   // Helper function to report invalid directives
   void reportInvalidDirective(const Directive &directive, const std::string &message);
   void reportError(const Span &span, const std::string &message);
@@ -5,7 +5,8 @@ enum Context
 {
   GLOBAL_CONTEXT,
   SERVER_CONTEXT,
-  LOCATION_CONTEXT
+  LOCATION_CONTEXT,
+  UPSTREAM_CONTEXT
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef RUNTIME_CONFIG_HPP
+#define RUNTIME_CONFIG_HPP
+
+#include <stddef.h>
+
+// Process-wide tuning from the http block. Every field starts at its
+// default in Constants; the Transformer sets them once, before any socket
+// or buffer is created, and they are only read after that.
+struct RuntimeConfig
+{
+  size_t workerConnections;  // worker_connections: open client connections
+  int epollMaxEvents;        // epoll_events: events taken per epoll_wait
+  int epollWaitTimeout;      // epoll_timeout, ms: longest sleep in epoll_wait
+  size_t readBufferSize;     // client_header_buffer_size: one recv of a request
+  size_t maxRequestLine;     // large_client_header_buffers: one buffer
+  size_t maxHeaderSize;      // large_client_header_buffers: all of them
+  size_t writeChunkSize;     // send_chunk_size: one file read and send
+  long clientHeaderTimeout;  // client_header_timeout, ms: the whole header block
+  long clientBodyTimeout;    // client_body_timeout, ms: between two body reads
+  long sendTimeout;          // send_timeout, ms: between two writes
+  long keepaliveTimeout;     // keepalive_timeout, ms: idle between requests
+  size_t maxPendingRequests; // max_pending_requests: requests in progress; 0: no limit
+  long overloadLag;          // overload_lag, ms: loop lag that sheds load; 0: off
+  size_t limitConn;          // limit_conn: connections per client address; 0: no limit
+
+  RuntimeConfig();
+
+  static const RuntimeConfig &get() { return current; }
+  static void set(const RuntimeConfig &config);
+
+private:
+  static RuntimeConfig current;
+};
+
+#endif
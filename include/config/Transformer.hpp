@@ -7,6 +7,7 @@
 #include "core/Location.hpp"
 #include "parser/ast/Config.hpp"
 #include "parser/ast/LocationConfig.hpp"
+#include "parser/ast/UpstreamConfig.hpp"
 
 class Transformer
 {
@@ -19,6 +20,8 @@ public:
   void transform();
   Server *transformServer(const ServerConfig &serverConfig);
   Location *transformLocation(const LocationConfig &locationConfig, Server *server);
+  void transformUpstream(const UpstreamConfig &upstreamConfig);
+  void transformHttp(const std::vector<Directive> &directives);
   const std::vector<Server *> &getServers() const;
   std::vector<Server *> releaseServers();
 };
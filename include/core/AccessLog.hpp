@@ -0,0 +1,86 @@
+#ifndef ACCESS_LOG_HPP
+#define ACCESS_LOG_HPP
+
+#include <exception>
+#include <map>
+#include <string>
+#include <stddef.h>
+
+enum AccessLogFormat
+{
+  ACCESS_LOG_MAIN,
+  ACCESS_LOG_JSON
+};
+
+struct AccessLogEntry
+{
+  const char *clientIp;
+  const std::string *host;
+  const std::string *method;
+  const std::string *path;
+  const std::string *version;
+  int status;
+  size_t bytesSent;
+  long requestTimeUs;
+  long upstreamTimeUs; // -1 when no upstream was involved
+
+  AccessLogEntry();
+};
+
+// Buffered access log. Entries are appended to an in-memory buffer and
+// reach the file in one write when the buffer fills or the flush interval
+// elapses. With a ring size the file is instead a fixed-size mmap'ed
+// circular log and logging costs no syscalls at all.
+//
+// Logs are shared per path and live until closeAll().
+class AccessLog
+{
+  static std::map<std::string, AccessLog *> registry;
+
+  std::string path;
+  AccessLogFormat format;
+  int fd;
+  char *buffer;
+  size_t capacity;
+  size_t used;
+  long flushIntervalMs;
+  long long oldestPendingMs;
+  bool failing; // the last write failed; warned once until one succeeds
+
+  char *ring;
+  size_t ringSize;
+
+  AccessLog(const std::string &path, AccessLogFormat format, size_t bufferSize,
+            long flushIntervalMs, size_t ringSize);
+  ~AccessLog();
+
+  size_t formatEntry(const AccessLogEntry &entry, char *out, size_t capacity) const;
+  void appendRing(const char *data, size_t length);
+  void flush();
+  void writeOut(const char *line, size_t length);
+
+public:
+  static const size_t DefaultBufferSize = 65536;
+  static const long DefaultFlushIntervalMs = 100;
+  static const size_t MinRingSize = 65536;
+
+  static AccessLog *open(const std::string &path, AccessLogFormat format,
+                         size_t bufferSize, long flushIntervalMs, size_t ringSize);
+  static bool parseFormat(const std::string &name, AccessLogFormat *format);
+  static void flushDue(long long nowMs);
+  static int nextFlushDelay(long long nowMs);
+  static void closeAll();
+
+  void write(const AccessLogEntry &entry);
+  const std::string &getPath() const;
+
+  class AccessLogOpenException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to open access log";
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+// A request being answered by another process (a CGI child, a FastCGI
+// application or an upstream server) or by an upload to disk. The owning
+// Connection feeds it the request body as it arrives and the backend
+// fills in a streamed response.
+class Backend
+{
+public:
+  virtual ~Backend() {}
+
+  virtual void onInputReady() = 0;   // more request body was buffered
+  virtual void updateInterest() = 0; // the client drained some output
+  virtual void abort() = 0;
+
+  virtual bool isClosed() const = 0;  // no further progress will be made
+  virtual bool hasFailed() const = 0; // closed without a complete response
+  virtual bool isExpired(long long nowMs) const = 0;
+  virtual bool getKeepAlive() const = 0;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef CGI_ENVIRONMENT_HPP
+#define CGI_ENVIRONMENT_HPP
+
+#include <string>
+#include <vector>
+
+class HttpRequest;
+
+// RFC 3875 meta-variables for a request, plus its headers as HTTP_*, as
+// NAME=value strings. Used for CGI children and FastCGI params alike.
+class CgiEnvironment
+{
+public:
+  static void build(std::vector<std::string> &env, const HttpRequest &request,
+                    const std::string &script, const char *clientIp, int port);
+};
+
+#endif
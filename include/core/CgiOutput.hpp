@@ -0,0 +1,34 @@
+#ifndef CGI_OUTPUT_HPP
+#define CGI_OUTPUT_HPP
+
+#include <string>
+#include <stddef.h>
+
+class HttpResponse;
+
+// Turns CGI-style output (a header block, then the body) into a streamed
+// HttpResponse. Status and Location set the status line; without a
+// Content-Length the body runs until end() and the connection closes.
+class CgiOutput
+{
+  HttpResponse &response;
+  std::string head; // header block until it is complete
+  bool headDone;
+  bool failed;
+  bool keepAlive;
+
+  bool parseHead();
+
+public:
+  CgiOutput(HttpResponse &response, bool keepAlive);
+
+  void feed(const char *data, size_t length);
+  void end();
+
+  bool isHeadDone() const;
+  bool hasFailed() const;
+  bool hasRoom() const; // the client is keeping up
+  bool getKeepAlive() const;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef CGI_POOL_HPP
+#define CGI_POOL_HPP
+
+#include <deque>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+class Connection;
+class EventLoop;
+class FastCgiUpstream;
+
+enum CgiAdmission
+{
+  CGI_ADMITTED,
+  CGI_QUEUED,
+  CGI_REJECTED
+};
+
+// A pre-spawned interpreter answering FastCGI on a listening socket it
+// got as fd 0 (FCGI_LISTENSOCK_FILENO), one request at a time
+struct CgiWorker
+{
+  std::string interpreter;
+  std::string socketPath;
+  FastCgiUpstream *upstream;
+  pid_t pid; // -1 while the slot is empty
+  bool busy;
+  long long idleSinceMs;
+  long long spawnedMs;
+};
+
+// Per-location CGI limits. At most cgi_max_concurrency scripts run at
+// once; the excess waits in a bounded queue or is refused with a 503.
+// With cgi_workers, scripts run on pre-spawned interpreters instead of a
+// fork per request: min workers per interpreter are started up front,
+// more up to max on demand, and extra ones exit after being idle.
+class CgiPool
+{
+  static std::vector<CgiPool *> pools;
+
+  unsigned id;
+  size_t maxConcurrency; // 0: unlimited
+  size_t queueLimit;
+  size_t maxWorkers;     // per interpreter; 0: fork per request
+  size_t minWorkers;
+  long idleMs;
+  size_t running;
+  std::deque<std::pair<Connection *, long long> > waiting;
+  std::vector<CgiWorker *> workers;
+  std::vector<pid_t> exiting;
+
+  CgiPool(unsigned id);
+  ~CgiPool();
+
+  size_t getLimit() const;
+  bool spawn(CgiWorker &worker);
+  void stop(CgiWorker &worker);
+  void promote(EventLoop &loop);
+  void maintain(EventLoop &loop, long long nowMs);
+
+public:
+  static CgiPool *create();
+  static void startAll();
+  static void collect(EventLoop &loop, long long nowMs);
+  static void closeAll();
+
+  void setConcurrency(size_t max, size_t queue);
+  void setWorkers(size_t max, size_t min, long idleMs);
+  void addInterpreter(const std::string &interpreter);
+  bool hasWorkers() const;
+  void print() const;
+
+  CgiAdmission admit(Connection *connection);
+  void release(EventLoop &loop);
+  void cancel(Connection *connection);
+  CgiWorker *acquireWorker(const std::string &interpreter);
+  void releaseWorker(CgiWorker *worker);
+
+  class CgiWorkerUnavailableException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "No CGI worker available";
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef CGI_PROCESS_HPP
+#define CGI_PROCESS_HPP
+
+#include "core/Backend.hpp"
+#include "core/CgiOutput.hpp"
+#include "core/IOHandler.hpp"
+#include <exception>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+class CgiProcess;
+class Connection;
+class EventLoop;
+class HttpRequest;
+class HttpResponse;
+
+// One end of a CGI child's stdin or stdout, registered with the EventLoop
+class CgiPipe : public IOHandler
+{
+  CgiProcess &process;
+  int fd;
+  uint32_t interest;
+  bool watched;
+
+  friend class CgiProcess;
+
+public:
+  CgiPipe(CgiProcess &process);
+
+  int getFd() const;
+  ConnectionType getType() const;
+  CgiProcess &getProcess();
+};
+
+// A running CGI script. The request body is written to the child's stdin
+// as it arrives and its stdout is parsed into a streamed response, all
+// through non-blocking pipes driven by the EventLoop.
+class CgiProcess : public Backend
+{
+  EventLoop &loop;
+  Connection &owner;
+  HttpRequest &request;
+  HttpResponse &response;
+  CgiPipe input;  // child's stdin
+  CgiPipe output; // child's stdout
+  CgiOutput reply;
+  pid_t pid;
+  long long deadlineMs;
+  bool closed;
+
+  static std::vector<pid_t> orphans;
+
+  CgiProcess(EventLoop &loop, Connection &owner, bool keepAlive);
+
+  void spawn(const std::string &interpreter, const std::string &script,
+             const char *clientIp, int port);
+  void closePipe(CgiPipe &pipe);
+  void setInterest(CgiPipe &pipe, uint32_t events);
+
+public:
+  ~CgiProcess();
+
+  static CgiProcess *start(EventLoop &loop, Connection &owner, const std::string &interpreter,
+                           const std::string &script, const char *clientIp, int port,
+                           bool keepAlive);
+  static void reapOrphans();
+
+  void onEvent(CgiPipe &pipe);
+  void onOutputReady();
+  Connection &getOwner();
+
+  void onInputReady();
+  void updateInterest();
+  void abort();
+  bool isClosed() const;
+  bool hasFailed() const;
+  bool isExpired(long long nowMs) const;
+  bool getKeepAlive() const;
+
+  class CgiStartException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to start CGI process";
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CLIENT_TABLE_HPP
+#define CLIENT_TABLE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What limit_conn and limit_req keep about one client address
+struct ClientSlot
+{
+  uint32_t addr;        // IPv4 address as accepted; 0: never used
+  uint32_t connections; // limit_conn: open connections; never evicted while > 0
+  long long lastSeenUs;
+  long long tatUs;      // limit_req: when the client's bucket is next empty (GCRA)
+};
+
+// Per-client state in a fixed number of slots, so a flood of addresses
+// cannot grow memory. Open addressing: an address lives in the window of
+// Window slots after its hash. Slots are never freed, so a lookup stops
+// at the first unused one; a new address takes that, or else evicts the
+// least recently seen slot of its window. A lookup touches two or three
+// cache lines.
+class ClientTable
+{
+  ClientSlot *slots;
+  size_t mask;
+  unsigned shift;
+
+  size_t home(uint32_t addr) const { return (addr * 2654435761u) >> shift; }
+
+public:
+  static const size_t Window = 8;
+
+  // size is rounded up to a power of two
+  explicit ClientTable(size_t size);
+  ~ClientTable();
+
+  // The address's slot, taken over for it if it had none; NULL when its
+  // whole window holds open connections of other addresses
+  ClientSlot *lookup(uint32_t addr, long long nowUs)
+  {
+    size_t start = home(addr);
+    ClientSlot *victim = NULL;
+    for (size_t i = 0; i < Window; i++)
+    {
+      ClientSlot *slot = &slots[(start + i) & mask];
+      if (slot->addr == addr)
+      {
+        slot->lastSeenUs = nowUs;
+        return slot;
+      }
+      if (slot->addr == 0)
+      {
+        victim = slot;
+        break;
+      }
+      if (slot->connections == 0 && (!victim || slot->lastSeenUs < victim->lastSeenUs))
+        victim = slot;
+    }
+    if (!victim)
+      return NULL;
+    victim->addr = addr;
+    victim->connections = 0;
+    victim->lastSeenUs = nowUs;
+    victim->tatUs = 0;
+    return victim;
+  }
+
+  // The address's slot if it has one
+  ClientSlot *find(uint32_t addr);
+
+private:
+  ClientTable(const ClientTable &);
+  ClientTable &operator=(const ClientTable &);
+};
+
+#endif
@@ -4,27 +4,112 @@
 #include "core/ConnectionType.hpp"
 #include "core/HttpRequest.hpp"
 #include "core/HttpResponse.hpp"
+#include "core/IOHandler.hpp"
+#include "core/RequestContext.hpp"
 #include "core/Server.hpp"
 #include "utils/Timer.hpp"
+#include <netinet/in.h>
+#include <stdint.h>
 
+class Backend;
+class CgiPool;
+struct CgiWorker;
 class ServerManager;
-class RequestContext;
+class UploadRequest;
+class ResponseCache;
+class MicroCache;
+class TrafficCapture;
+struct FileJob;
 
-class Connection {
+// What a client connection is waiting for; each has its own time limit
+enum ClientWait {
+  WAIT_KEEPALIVE, // keepalive_timeout: the next request, from the last one
+  WAIT_HEADER,    // client_header_timeout: the whole header block
+  WAIT_BODY,      // client_body_timeout: the next body bytes
+  WAIT_SEND,      // send_timeout: the client taking more of the response
+  WAIT_BACKEND    // a script, upstream or cache fill to produce output
+};
+
+class Connection : public IOHandler {
   int fd;
   int port;
   ConnectionType type;
-  Timer timer;
   HttpRequest request;
   HttpResponse response;
   Server *server;
   bool shouldCleanup;
   ServerManager &serverManager;
   bool keepAlive;
-  RequestContext *context;
+  RequestContext *context; // points at requestContext once headers resolve
+  RequestContext requestContext;
 
   char *buffer;
 
+  // File body staging: one chunk read from disk, possibly partly sent
+  char *fileChunk;
+  size_t chunkLength;
+  size_t chunkSent;
+  unsigned long pendingFileJob;
+  bool dispatched; // prepareResponse ran for the current request
+  bool admitted;   // the event loop counts it as pending
+  uint32_t watchedEvents;
+
+  // CGI/FastCGI: the interpreter chosen from the path's extension, and the
+  // backend answering the current request
+  const std::string *cgiInterpreter;
+  Backend *backend;
+  long long upstreamStartUs;
+  UploadRequest *upload; // backend, when it is an upload: reads go to its buffer
+
+  // cgi_max_concurrency / cgi_workers: the pool holding (or queueing) this
+  // request, the worker running it and the script kept while queued
+  CgiPool *cgiPool;
+  CgiWorker *cgiWorker;
+  bool cgiQueued;
+  std::string cgiScript;
+
+  // cache on / microcache: the cache whose fill of cacheKey this request
+  // waits for
+  ResponseCache *cacheWait;
+  MicroCache *microWait;
+  std::string cacheKey;
+
+  // Access log and latency bookkeeping
+  char clientIp[INET_ADDRSTRLEN];
+  uint32_t clientAddr; // as accepted; the limit_conn and limit_req key
+  bool connLimited;    // counted against limit_conn
+  long long requestStartUs;
+  long long firstByteUs; // first response byte sent
+
+  // Time limits: the last read or write that made progress, when the
+  // current headers started (accept, or the first byte after a previous
+  // request), and how long a silent backend may hold the client
+  long long activityMs;
+  long long headerStartMs;
+  long backendWaitMs;
+  bool servedOne; // a request finished; the next one starts keep-alive
+  long upstreamTimeUs;
+  unsigned long allocsAtStart;
+
+  // trace: the sampled request's id (0: not traced), and where its
+  // request span and pending file job started
+  uint32_t traceId;
+  uint64_t traceStart;
+  uint64_t traceFileStart;
+
+  // capture: where this client's bytes are recorded, and under which id
+  TrafficCapture *capture;
+  uint32_t captureId;
+
+  // Removed from the event loop; released once the batch is done
+  bool detached;
+
+  // Closed client connections are kept for reuse by the next accept
+  static Connection *freeList;
+  static size_t freeCount;
+  Connection *nextFree;
+  bool inPool; // on freeList; releasing it again would hand it out twice
+
 public:
   Connection(int fd, int port, ConnectionType type,
              ServerManager &serverManager);
@@ -36,8 +121,9 @@ public:
   bool getKeepAlive() const;
 
   void updateActivity();
-  bool isTimedOut() const;
-  void setTimeout(int seconds);
+  ClientWait clientWait() const;
+  bool isTimedOut(long long nowMs) const;
+  void setBackendWait(long ms);
   void readData();
   void writeData();
   ServerManager &getServerManager();
@@ -45,11 +131,40 @@ public:
   HttpResponse &getResponse();
   void processHeaders();
   bool getShouldCleanup() const;
+  bool isIdle() const;
+  bool isDispatched() const;
+  const char *getClientIp() const;
+  uint32_t getClientAddr() const;
+  bool isConnLimited() const;
+  void setConnLimited(bool counted);
+  bool isWaitingOnDisk() const;
+  unsigned long getPendingFileJob() const;
+  void onFileJobDone(FileJob &job);
+  void onBackendProgress();
+  bool checkBackendTimeout(long long nowMs);
+  void onCgiSlotGranted();
+  void onCgiQueueTimeout();
+  void onCacheFilled(bool stored);
+  void onMicroCacheFilled(bool stored);
+  uint32_t getInterest() const;
+  uint32_t getWatchedEvents() const;
+  void setWatchedEvents(uint32_t events);
+  void setClientAddress(const struct sockaddr_in &addr);
+  void startCapture();
+  void endCapture();
 
   static Connection *createListener(int fd, ServerManager &serverManager,
                                     int port);
   static Connection *createClient(int fd, ServerManager &serverManager,
                                   int port);
+  static void release(Connection *connection);
+
+  // Lets go of what the connection holds (backend, CGI slot, cache
+  // waits, capture) when it leaves the event loop; the object stays
+  // valid for events of the same batch until release()
+  void detach();
+  bool isDetached() const;
+  static void drainPool();
 
   class ConnectionClosedException : public std::exception {
     const char *what() const throw() { return "Connection closed by peer"; }
@@ -63,7 +178,32 @@ public:
 
 private:
   void resolveConnectionHeaders();
+  void startRequest();
+  void parseInput();
   void prepareResponse();
+  void serveStatus();
+  bool isCacheable() const;
+  std::string cacheScope() const;
+  std::string cacheUri() const;
+  bool serveFromCache();
+  bool serveFromMicroCache();
+  void cancelCacheWait();
+  void dispatchRequest();
+  bool fillFileChunk();
+  bool canBufferBody() const;
+  const std::string *findCgiInterpreter() const;
+  void startCgi(const std::string &script);
+  void launchCgi(const std::string &script);
+  void releaseCgiSlot();
+  void finishRequest();
+  void startFastCgi();
+  void startProxy();
+  bool isUpload() const;
+  bool allowsMethod() const;
+  void startUpload();
+  void finishBackend();
+  void logAccess();
+  void reset(int fd, int port);
 };
 
 #endif
\ No newline at end of file
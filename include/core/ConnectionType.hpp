@@ -4,7 +4,11 @@
 enum ConnectionType
 {
   LISTENER,
-  CLIENT
+  CLIENT,
+  FILE_IO,
+  CGI_PIPE,
+  FASTCGI,
+  PROXY
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,8 +3,18 @@
 
 #include <exception>
 #include <map>
+#include <vector>
 #include <sys/epoll.h>
 #include "core/Connection.hpp"
+#include "core/FileIOPool.hpp"
+#include "core/Metrics.hpp"
+#include "utils/Histogram.hpp"
+
+class Backend;
+class ClientTable;
+class CgiPipe;
+class FastCgiConnection;
+class ProxyConnection;
 
 class EventLoop
 {
@@ -12,6 +22,32 @@ class EventLoop
   epoll_event *events;
   std::map<int, Connection *> connections;
   bool running;
+  FileIOPool fileIO;
+  std::vector<Backend *> retired;
+  std::vector<Connection *> dirty;
+  std::vector<Connection *> removed; // released by freeRetired()
+  Histogram loopLag; // µs each pass over a batch of events took
+  size_t clientCount; // CLIENT connections, against worker_connections
+  size_t pendingRequests; // admitted and not yet answered, against max_pending_requests
+  long long recentLagUs;  // moving average of loopLag, against overload_lag
+  long long acceptPausedUntilMs; // listeners are off until then; 0: accepting
+  ClientTable *connLimits; // open connections per client address, for limit_conn
+
+  void updateInterest(Connection *connection);
+  void handleFileCompletions();
+  void handleCgiEvent(CgiPipe *pipe);
+  void handleFastCgiEvent(FastCgiConnection *connection, uint32_t events);
+  void handleProxyEvent(ProxyConnection *connection, uint32_t events);
+  void flushDirty();
+  void handleClientEvent(Connection *connection, uint32_t events);
+  void dispatchEvent(IOHandler *handler, uint32_t events);
+  void reportStall(ConnectionType type, int fd, uint32_t events, long long elapsedUs);
+  void acceptClient(Connection *listener);
+  void shedConnection(int fd, MetricCounter counter, const char *reason);
+  void pauseAccepting(long long nowMs);
+  void resumeAccepting();
+  bool isLagging() const;
+  void freeRetired();
 
 public:
   EventLoop();
@@ -21,6 +57,22 @@ public:
   void removeConnection(Connection *connection);
   void run();
   void stop();
+  FileIOPool &getFileIO();
+  ConnectionCounts countConnections() const;
+  const Histogram &getLoopLag() const;
+
+  // Admission: false when the request is to be shed; an admitted one is
+  // finished once, when it is answered or its connection goes
+  bool admitRequest();
+  void finishRequest();
+
+  // Extra descriptors (CGI pipes, FastCGI and proxy sockets) dispatched through
+  // their IOHandler
+  void watch(IOHandler *handler, uint32_t events);
+  void modify(IOHandler *handler, uint32_t events);
+  void unwatch(IOHandler *handler);
+  void retireBackend(Backend *backend);
+  void markDirty(Connection *connection);
 
   class EpollCreationException : public std::exception
   {
@@ -0,0 +1,63 @@
+#ifndef FASTCGI_REQUEST_HPP
+#define FASTCGI_REQUEST_HPP
+
+#include "core/Backend.hpp"
+#include "core/CgiOutput.hpp"
+#include <string>
+
+class Connection;
+class EventLoop;
+class FastCgiConnection;
+class FastCgiUpstream;
+class HttpRequest;
+
+// A request answered by a FastCGI application. The request body goes out
+// as FCGI_STDIN records as it arrives and FCGI_STDOUT is streamed into the
+// response. A request that dies with a reused socket before anything was
+// exchanged is retried once on a fresh one.
+class FastCgiRequest : public Backend
+{
+  EventLoop &loop;
+  FastCgiUpstream &upstream;
+  Connection &owner;
+  HttpRequest &request;
+  FastCgiConnection *connection;
+  unsigned short id;
+  std::string params; // encoded FCGI_PARAMS stream, kept for a retry
+  CgiOutput reply;
+  long long deadlineMs;
+  bool bodySent;  // some of the body went out; no retry after that
+  bool stdinDone;
+  bool received;
+  bool retried;
+  bool closed;
+  bool failed;
+
+  FastCgiRequest(EventLoop &loop, FastCgiUpstream &upstream, Connection &owner, bool keepAlive);
+
+  void dispatch();
+
+public:
+  ~FastCgiRequest();
+
+  static FastCgiRequest *start(EventLoop &loop, FastCgiUpstream &upstream, Connection &owner,
+                               const std::string &script, const char *clientIp, int port,
+                               bool keepAlive);
+
+  // FastCgiConnection callbacks
+  void onStdout(const char *data, size_t length);
+  void onEnd(unsigned char protocolStatus);
+  void onConnectionLost();
+  void onWritable();
+  bool hasRoom() const;
+
+  void onInputReady();
+  void updateInterest();
+  void abort();
+  bool isClosed() const;
+  bool hasFailed() const;
+  bool isExpired(long long nowMs) const;
+  bool getKeepAlive() const;
+};
+
+#endif
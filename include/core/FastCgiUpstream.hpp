@@ -0,0 +1,142 @@
+#ifndef FASTCGI_UPSTREAM_HPP
+#define FASTCGI_UPSTREAM_HPP
+
+#include "core/IOHandler.hpp"
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/socket.h>
+
+class EventLoop;
+class FastCgiRequest;
+class FastCgiUpstream;
+
+enum FastCgiRecordType
+{
+  FCGI_BEGIN_REQUEST = 1,
+  FCGI_ABORT_REQUEST = 2,
+  FCGI_END_REQUEST = 3,
+  FCGI_PARAMS = 4,
+  FCGI_STDIN = 5,
+  FCGI_STDOUT = 6,
+  FCGI_STDERR = 7,
+  FCGI_GET_VALUES = 9,
+  FCGI_GET_VALUES_RESULT = 10
+};
+
+// One socket to a FastCGI application. Requests are sent with
+// FCGI_KEEP_CONN so the socket outlives them; several run at once only if
+// the application answered FCGI_MPXS_CONNS=1 to our FCGI_GET_VALUES.
+//
+// Records are streamed in both directions: STDOUT content is handed to
+// its request as it is read, and reading pauses while any request's
+// client is behind.
+class FastCgiConnection : public IOHandler
+{
+  FastCgiUpstream &upstream;
+  EventLoop &loop;
+  int fd;
+  bool connecting;
+  bool dead;
+  bool hangup;
+  bool multiplexed;
+  size_t maxRequests;
+  bool watched;
+  uint32_t interest;
+  long long lastActivityMs;
+  std::string out;
+  size_t outSent;
+  std::map<unsigned short, FastCgiRequest *> active; // NULL once aborted
+  unsigned short nextId;
+
+  // Record being read
+  unsigned char header[8];
+  size_t headerRead;
+  unsigned char recordType;
+  unsigned short recordId;
+  size_t contentLeft;
+  size_t paddingLeft;
+  std::string control; // content of END_REQUEST / GET_VALUES_RESULT
+
+  void consume(const char *data, size_t length);
+  void deliver(const char *data, size_t length);
+  void finishRecord();
+  void readValues();
+  bool writeOut();
+  void flush();
+  void fail();
+  bool canRead() const;
+
+public:
+  FastCgiConnection(FastCgiUpstream &upstream, EventLoop &loop, int fd, bool connecting);
+  ~FastCgiConnection();
+
+  int getFd() const;
+  ConnectionType getType() const;
+
+  void onEvent(uint32_t events);
+  void updateInterest();
+  bool isDead() const;
+  bool isIdle() const;
+  bool hasLiveRequests() const;
+  bool canAccept() const;
+  long long getLastActivity() const;
+  size_t getPendingOutput() const;
+
+  unsigned short attach(FastCgiRequest *request);
+  void cancel(unsigned short id);
+  void send(unsigned char type, unsigned short id, const char *data, size_t length);
+  void close();
+
+  static void appendPair(std::string &out, const char *name, size_t nameLength,
+                         const char *value, size_t valueLength);
+};
+
+// A FastCGI application address (unix:/path or host:port) and its pool of
+// connections. Upstreams are shared per address and live until closeAll().
+class FastCgiUpstream
+{
+  static std::map<std::string, FastCgiUpstream *> registry;
+
+  std::string address;
+  struct sockaddr_storage addr;
+  socklen_t addrLength;
+  std::vector<FastCgiConnection *> connections;
+
+  FastCgiUpstream(const std::string &address);
+  ~FastCgiUpstream();
+
+  FastCgiConnection *connect(EventLoop &loop);
+  void sweep(long long nowMs);
+
+public:
+  static FastCgiUpstream *open(const std::string &address);
+  static bool parseAddress(const std::string &address, struct sockaddr_storage *addr,
+                           socklen_t *length);
+  static void collect(long long nowMs);
+  static void closeAll();
+
+  FastCgiConnection *acquire(EventLoop &loop);
+  void closeIdle();
+  const std::string &getAddress() const;
+
+  class FastCgiAddressException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Invalid FastCGI address";
+    }
+  };
+
+  class FastCgiConnectException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to connect to FastCGI application";
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef FILE_IO_POOL_HPP
+#define FILE_IO_POOL_HPP
+
+#include <exception>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include "core/IOHandler.hpp"
+
+enum FileJobType
+{
+  FILE_JOB_OPEN,
+  FILE_JOB_READ
+};
+
+enum FileJobStatus
+{
+  FILE_OK,
+  FILE_NOT_FOUND,
+  FILE_NOT_REGULAR,
+  FILE_IS_DIRECTORY,
+  FILE_ERROR
+};
+
+// A blocking disk operation handed to a worker thread. Jobs are owned by
+// the pool and recycled through a free list; the loop thread fills one in,
+// submits it, and gets it back through takeCompleted().
+struct FileJob
+{
+  FileJobType type;
+  unsigned long id;
+  int ownerFd;
+
+  // FILE_JOB_OPEN: resolve path (appending index for directories that end
+  // in '/'), open it and fstat it.
+  std::string path;
+  std::string index;
+  size_t size;
+
+  // FILE_JOB_READ: pread length bytes at offset into data.
+  off_t offset;
+  size_t length;
+  char *data;
+
+  // Result
+  int fd;
+  FileJobStatus status;
+  ssize_t bytes;
+  int error;
+
+  FileJob *next;
+
+  FileJob();
+  ~FileJob();
+};
+
+class FileIOPool : public IOHandler
+{
+  int eventFd;
+  std::vector<pthread_t> threads;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool stopping;
+
+  FileJob *pendingHead;
+  FileJob *pendingTail;
+  FileJob *completedHead;
+  FileJob *completedTail;
+  FileJob *freeList; // loop thread only
+  unsigned long nextId;
+
+  static void *workerMain(void *arg);
+  void workerLoop();
+  void process(FileJob &job);
+  void shutdown();
+
+public:
+  FileIOPool(int workers);
+  ~FileIOPool();
+
+  int getFd() const;
+  ConnectionType getType() const;
+
+  FileJob *acquire();
+  void submit(FileJob *job);
+  FileJob *takeCompleted();
+  void release(FileJob *job);
+
+  class PoolCreationException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to start file I/O workers";
+    }
+  };
+};
+
+#endif
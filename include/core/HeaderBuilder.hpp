@@ -0,0 +1,31 @@
+#ifndef HEADER_BUILDER_HPP
+#define HEADER_BUILDER_HPP
+
+#include <string>
+#include <stddef.h>
+
+// Appends an HTTP/1.1 response head to a caller-owned buffer. Headers are
+// written in the order they are added; the buffer keeps its capacity
+// between responses, so building a head does not allocate.
+class HeaderBuilder
+{
+  std::string &out;
+
+public:
+  HeaderBuilder(std::string &out, int status);
+  // Status line with the given reason phrase (a relayed response)
+  HeaderBuilder(std::string &out, int status, const char *reason, size_t reasonLength);
+  // Continues a stored status line and headers (a cached response)
+  HeaderBuilder(std::string &out, const std::string &head);
+
+  HeaderBuilder &add(const char *name, const char *value, size_t length);
+  HeaderBuilder &add(const char *name, const char *value);
+  HeaderBuilder &add(const char *name, const std::string &value);
+  HeaderBuilder &add(const char *name, unsigned long long value);
+  HeaderBuilder &add(const char *name, size_t nameLength, const char *value, size_t valueLength);
+  void finish();
+
+  static const char *statusMessage(int status);
+};
+
+#endif
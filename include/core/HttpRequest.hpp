@@ -2,8 +2,8 @@
 #define HTTP_REQUEST_HPP
 
 #include <map>
-#include <set>
 #include <string>
+#include <vector>
 
 enum HttpParseState {
   PARSE_REQUEST_LINE,
@@ -14,25 +14,40 @@ enum HttpParseState {
   PARSE_ERROR
 };
 
+struct HeaderField {
+  std::string name; // lower-cased
+  std::string value;
+};
+
+// Request storage is recycled across keep-alive requests: clear() keeps
+// string capacity and header slots, so steady-state parsing does not
+// allocate. next() does the same but keeps whatever the client sent past
+// the request, the start of the next one when it pipelines.
 class HttpRequest {
 private:
   HttpParseState state;
   int errorCode;
   std::string buffer;
+  size_t parsed; // bytes of buffer already consumed
+  size_t headerStart; // where the header fields begin
   std::string method;
   std::string path;
+  std::string query;
   std::string version;
   std::map<std::string, std::string> queryParams;
-  std::map<std::string, std::string> headers;
+  std::vector<HeaderField> headers;
+  size_t headerCount;
   std::string body;
-
-  std::set<std::string> allowedMethods;
+  // Streamed bodies stay in buffer and are handed out piecewise
+  bool streamBody;
+  size_t bodyLeft;
 
   void parseRequestLine();
   void parseHeaders();
   void parseBody();
-  void parseUri(std::string uri);
-  bool isMethodAllowed(const std::string &method) const;
+  void parseUri(size_t start, size_t end);
+  void resetFields();
+  static bool isMethodAllowed(const std::string &method);
 
 public:
   HttpRequest();
@@ -44,13 +59,26 @@ public:
   void appendData(const char *data, size_t length);
   void parse();
   void print() const;
-  std::string getMethod() const { return method; }
-  std::string getPath() const { return path; }
-  std::string getVersion() const { return version; }
-  std::map<std::string, std::string> getHeaders() const { return headers; }
-  std::string getHeader(const std::string &name) const;
-  std::string getBody() const { return body; }
+  const std::string &getMethod() const { return method; }
+  const std::string &getPath() const { return path; }
+  const std::string &getQuery() const { return query; }
+  const std::string &getVersion() const { return version; }
+  const std::string &getHeader(const char *name) const;
+  size_t getHeaderCount() const { return headerCount; }
+  const HeaderField &getHeaderField(size_t i) const { return headers[i]; }
+  const std::string &getBody() const { return body; }
+
+  // Body streaming: parsing completes after the headers and the caller
+  // drains the body as it arrives.
+  void setBodyStreaming(bool enabled);
+  bool isBodyStreaming() const { return streamBody; }
+  size_t getBodyLeft() const { return bodyLeft; }
+  size_t getBufferedBody(const char **data) const;
+  void consumeBody(size_t length);
+  void skipBody(size_t length);
   void clear();
+  void next();
+  bool hasPendingData() const { return parsed < buffer.size(); }
   class RequestLineTooLongException : public std::exception {
     const char *what() const throw() { return "Request line too long"; }
   };
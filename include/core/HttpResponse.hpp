@@ -2,8 +2,11 @@
 #define HTTP_RESPONSE_HPP
 
 #include <string>
-#include <map>
 #include <sys/types.h>
+#include "core/HeaderBuilder.hpp"
+
+class ResponseTee;
+struct MicroCacheBody;
 
 enum ResponseState
 {
@@ -18,42 +21,78 @@ class HttpResponse
 private:
   ResponseState state;
   int statusCode;
-  std::map<std::string, std::string> headers;
   std::string headersBuffer;
   size_t headersSent;
 
   // Body source
   int fileFd;
+  size_t fileOffset; // where the body starts in the file (cached entries)
   size_t fileSize;
+  bool sendfileBody;
   size_t bodySent;
   std::string stringBody;
+  MicroCacheBody *sharedBody; // microcache hit: sent instead of stringBody
+
+  // Streamed body (CGI output): stringBody holds the unsent tail
+  bool streaming;
+  bool streamEnded;
+  size_t streamOffset;
+
+  // Stores the streamed response in a cache as it goes out
+  ResponseTee *cacheFill;
 
 public:
+  // Whole responses with Retry-After, serialized once, for shedding load
+  // (503) and refusing a client over limit_req (429)
+  static const char Overloaded[];
+  static const size_t OverloadedLength;
+  static const char RateLimited[];
+  static const size_t RateLimitedLength;
+
   HttpResponse();
   ~HttpResponse();
 
   void prepareFromFile(const std::string &path, int status);
+  void prepareFromFd(int fd, size_t size, const std::string &path, int status);
   void prepareFromError(int status, const std::string &message = "");
   void prepareRedirect(int status, const std::string &url);
-  void setHeader(const std::string &key, const std::string &value);
+  void prepareOverloaded();
+  void prepareRateLimited();
+  void prepareFromString(int status, const char *contentType, const std::string &body, bool keepAlive);
+  void prepareFromCache(int fd, int status, const std::string &head, size_t offset, size_t size,
+                        unsigned long age, bool keepAlive);
+  void prepareFromMemory(int status, const std::string &head, MicroCacheBody *body, unsigned long age, bool stale,
+                         bool keepAlive);
+
+  // Streamed responses: the caller finishes the returned head, then
+  // appends body bytes as they are produced and ends the stream.
+  HeaderBuilder beginStream(int status);
+  HeaderBuilder beginStream(int status, const char *reason, size_t reasonLength);
+  void appendStream(const char *data, size_t length);
+  // Transfer framing around appended data; not part of the body
+  void appendFraming(const char *data, size_t length);
+  void endStream();
+  void setCacheFill(ResponseTee *fill);
+  bool isStreaming() const;
+  size_t getStreamOffset() const;
+  size_t getStreamBuffered() const;
 
   // Streaming interface
   ResponseState getState() const;
+  int getStatusCode() const;
   const std::string &getHeadersBuffer() const;
   size_t getHeadersSent() const;
   void updateHeadersSent(size_t bytes);
 
   int getFileFd() const;
+  size_t getFileOffset() const;
+  bool usesSendfile() const;
   size_t getBodySent() const;
   size_t getFileSize() const;
   void updateBodySent(size_t bytes);
 
   const std::string &getStringBody() const;
   void clear();
-
-private:
-  void generateHeaders();
-  std::string getStatusMessage(int code) const;
 };
 
 #endif
\ No newline at end of file
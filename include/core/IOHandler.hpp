@@ -0,0 +1,16 @@
+#ifndef IO_HANDLER_HPP
+#define IO_HANDLER_HPP
+
+#include "core/ConnectionType.hpp"
+
+// Anything registered with the EventLoop's epoll instance. The loop
+// dispatches on getType(), so data.ptr always points to an IOHandler.
+class IOHandler
+{
+public:
+  virtual ~IOHandler() {}
+  virtual int getFd() const = 0;
+  virtual ConnectionType getType() const = 0;
+};
+
+#endif
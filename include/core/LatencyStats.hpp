@@ -0,0 +1,52 @@
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+#include "utils/Histogram.hpp"
+#include <csignal>
+#include <string>
+#include <vector>
+
+// Latency of the requests one location (or a server outside its
+// locations) answered, in microseconds from the first byte of the
+// request: to the first byte of the response (TTFB) and to the last.
+// The histograms take 60 KB, so they are allocated on the first request;
+// recording is then two Histogram::record calls.
+//
+// Stats are created per location by the Transformer and live until
+// closeAll().
+class LatencyStats
+{
+  static std::vector<LatencyStats *> registry;
+  static volatile sig_atomic_t dumpRequested;
+
+  std::string server;
+  std::string location;
+  Histogram *ttfb;
+  Histogram *total;
+
+  LatencyStats(const std::string &server, const std::string &location);
+  ~LatencyStats();
+
+  void allocate();
+
+public:
+  static LatencyStats *create(const std::string &server, const std::string &location);
+  static void closeAll();
+
+  // Safe to call from a signal handler; the event loop does the dump
+  static void requestDump();
+  static void dumpIfRequested();
+
+  static void renderText(std::string &out);
+  static void renderPrometheus(std::string &out);
+
+  void record(long long ttfbUs, long long totalUs)
+  {
+    if (!ttfb)
+      allocate();
+    ttfb->record(static_cast<uint64_t>(ttfbUs));
+    total->record(static_cast<uint64_t>(totalUs));
+  }
+};
+
+#endif
@@ -1,11 +1,20 @@
 #ifndef LOCATION_HPP
 #define LOCATION_HPP
 
+#include "core/ProxyUpstream.hpp"
+#include "core/ResponseCache.hpp"
+#include "core/UpstreamGroup.hpp"
 #include <map>
 #include <string>
 #include <vector>
 
 class Server;
+class AccessLog;
+class FastCgiUpstream;
+class CgiPool;
+class MicroCache;
+class LatencyStats;
+class RequestLimiter;
 
 class Location
 {
@@ -27,6 +36,20 @@ private:
   std::string returnUrl;
   std::string uploadStore;
   std::map<std::string, std::string> cgiExtensions;
+  AccessLog *accessLog;
+  bool accessLogSet;
+  FastCgiUpstream *fastCgiPass; // location-only, no fallback
+  CgiPool *cgiPool;             // location-only, no fallback
+  UpstreamGroup *proxyPass;     // location-only, no fallback
+  std::string proxyUri;         // replaces the location prefix; empty: path as is
+  ProxyTimeouts proxyTimeouts;
+  ResponseCache *cache;         // location-only: `cache on` picks the server's
+  CacheValidity cacheValidity;
+  MicroCache *microCache;       // location-only
+  bool statusPage;              // location-only
+  LatencyStats *latency;        // location-only
+  RequestLimiter *requestLimiter;
+  bool requestLimiterSet;
 
 public:
   Location(const std::string &path);
@@ -44,6 +67,17 @@ public:
   void setReturn(int code, const std::string &url);
   void setUploadStore(const std::string &path);
   void addCgiExtension(const std::string &ext, const std::string &binary);
+  void setAccessLog(AccessLog *log);
+  void setFastCgiPass(FastCgiUpstream *upstream);
+  void setCgiPool(CgiPool *pool);
+  void setProxyPass(UpstreamGroup *group, const std::string &uri);
+  void setProxyTimeouts(const ProxyTimeouts &timeouts);
+  void setCache(ResponseCache *cache);
+  void addCacheValidity(int status, long ms);
+  void setMicroCache(MicroCache *cache);
+  void setStatusPage(bool enabled);
+  void setLatencyStats(LatencyStats *stats);
+  void setRequestLimiter(RequestLimiter *limiter);
 
   // Resolving getters (fall back to server when not set locally)
   const std::string &getPath() const;
@@ -57,6 +91,18 @@ public:
   const std::string &getReturnUrl() const;
   const std::string &getUploadStore() const;
   const std::map<std::string, std::string> &getCgiExtensions() const;
+  AccessLog *getAccessLog() const;
+  FastCgiUpstream *getFastCgiPass() const;
+  CgiPool *getCgiPool() const;
+  UpstreamGroup *getProxyPass() const;
+  const std::string &getProxyUri() const;
+  const ProxyTimeouts &getProxyTimeouts() const;
+  ResponseCache *getCache() const;
+  const CacheValidity &getCacheValidity() const;
+  MicroCache *getMicroCache() const;
+  bool hasStatusPage() const;
+  LatencyStats *getLatencyStats() const;
+  RequestLimiter *getRequestLimiter() const;
   bool hasReturn() const;
 
   void print() const;
@@ -0,0 +1,74 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+class Histogram;
+
+enum MetricCounter
+{
+  METRIC_ACCEPTS,
+  METRIC_REQUESTS,
+  METRIC_BYTES_IN,
+  METRIC_BYTES_OUT,
+  METRIC_RESPONSES_1XX,
+  METRIC_RESPONSES_2XX,
+  METRIC_RESPONSES_3XX,
+  METRIC_RESPONSES_4XX,
+  METRIC_RESPONSES_5XX,
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_TIMEOUTS,
+  METRIC_LOOP_STALLS,
+  METRIC_SHED,
+  METRIC_LIMITED_CONNECTIONS, // limit_conn, turned away at accept
+  METRIC_LIMITED_REQUESTS,    // limit_req, answered with a 429
+  METRIC_COUNTERS
+};
+
+// One thread's counters, on cache lines of their own so that threads
+// counting at the same time never write to a shared line
+struct MetricSlot
+{
+  uint64_t values[METRIC_COUNTERS];
+} __attribute__((aligned(64)));
+
+// Client connections by what they are doing, counted when scraped
+struct ConnectionCounts
+{
+  size_t reading; // a request is arriving
+  size_t writing; // a request is being answered
+  size_t idle;    // keep-alive, between requests
+};
+
+// Server-wide counters for the `status` endpoint. Every thread that
+// counts gets its own slot; a slot has a single writer, so counting is a
+// plain load and store with no lock or locked instruction. Slots are
+// only summed when the endpoint is scraped.
+class Metrics
+{
+  static __thread MetricSlot *local;
+
+  static MetricSlot *registerThread();
+
+public:
+  static void count(MetricCounter counter, uint64_t amount = 1)
+  {
+    MetricSlot *slot = local ? local : registerThread();
+    // Atomic only so a scrape from another thread never reads a torn value
+    uint64_t value = __atomic_load_n(&slot->values[counter], __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->values[counter], value + amount, __ATOMIC_RELAXED);
+  }
+
+  static void countResponse(int status);
+  // Sums every thread's slot into totals[METRIC_COUNTERS]
+  static void snapshot(uint64_t *totals);
+
+  // loopLag: the event loop's pass times, in microseconds
+  static void renderText(std::string &out, const ConnectionCounts &connections, const Histogram &loopLag);
+  static void renderPrometheus(std::string &out, const ConnectionCounts &connections, const Histogram &loopLag);
+};
+
+#endif
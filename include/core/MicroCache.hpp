@@ -0,0 +1,116 @@
+#ifndef MICRO_CACHE_HPP
+#define MICRO_CACHE_HPP
+
+#include "core/ResponseTee.hpp"
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+class Connection;
+class EventLoop;
+class HttpResponse;
+class MicroCache;
+
+// A stored body, shared by the entry and every response still sending
+// it; whoever drops the last reference frees it
+struct MicroCacheBody
+{
+  std::string data;
+  unsigned refs;
+
+  static MicroCacheBody *retain(MicroCacheBody *body);
+  static void release(MicroCacheBody *body);
+};
+
+// One response on its way into a microcache, collected in memory as the
+// client is sent it. Requests for the same key wait until it is stored or
+// given up.
+class MicroCacheFill : public ResponseTee
+{
+  friend class MicroCache;
+
+  MicroCache &cache;
+  EventLoop &loop;
+  std::string key;
+  bool pending;  // head not seen yet
+  bool settled;  // stored, rejected or failed; nothing more is kept
+  int status;
+  std::string head;
+  long ttlMs;
+  std::string body;
+  long long startedMs;
+  std::vector<Connection *> waiters;
+
+  MicroCacheFill(MicroCache &cache, EventLoop &loop, const std::string &key);
+
+  bool start(const std::string &responseHead);
+  void settle(bool stored);
+
+public:
+  ~MicroCacheFill();
+
+  void write(const std::string &responseHead, const char *data, size_t length);
+  void finish(const std::string &responseHead);
+};
+
+// microcache: responses of a proxied or CGI location kept in memory for
+// a short time, so a burst of identical requests costs one backend call.
+// Misses for a key in flight wait for that fill instead of going to the
+// backend. An expired entry stays usable for the stale window: the first
+// request after expiry refreshes it while the others are sent the stale
+// copy. Least recently used entries go once max_size is exceeded.
+class MicroCache
+{
+  friend class MicroCacheFill;
+
+  struct Entry
+  {
+    std::string head;
+    int status;
+    MicroCacheBody *body;
+    size_t size;
+    long long storedMs;
+    long long expiresMs;
+    long long staleUntilMs;
+    std::list<std::string>::iterator recent;
+  };
+
+  static std::vector<MicroCache *> registry;
+  static long long lastSweepMs;
+
+  long ttlMs;
+  long staleMs;
+  size_t maxSize;
+  size_t usedSize;
+  std::map<std::string, Entry> entries;
+  std::list<std::string> recent; // keys, most recent first
+  std::map<std::string, MicroCacheFill *> filling;
+
+  MicroCache(long ttlMs, long staleMs, size_t maxSize);
+  ~MicroCache();
+
+  void remove(std::map<std::string, Entry>::iterator it);
+  void sweep(long long nowMs);
+  void store(MicroCacheFill &fill);
+  void settle(MicroCacheFill &fill, bool stored);
+
+public:
+  static MicroCache *create(long ttlMs, long staleMs, size_t maxSize);
+  static void collect(long long nowMs);
+  static void forgetWaiters();
+  static void closeAll();
+
+  bool serve(const std::string &key, HttpResponse &response, bool keepAlive);
+  bool wait(const std::string &key, Connection *connection);
+  void cancel(const std::string &key, Connection *connection);
+  MicroCacheFill *startFill(EventLoop &loop, const std::string &key);
+
+  long getTtl() const;
+  long getStaleTime() const;
+  size_t getMaxSize() const;
+  size_t getEntryCount() const;
+  size_t getUsedSize() const;
+};
+
+#endif
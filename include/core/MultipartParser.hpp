@@ -0,0 +1,55 @@
+#ifndef MULTIPART_PARSER_HPP
+#define MULTIPART_PARSER_HPP
+
+#include <string>
+#include <stddef.h>
+
+// Receives the parts of a multipart body as the parser finds them; a
+// callback returning false stops the parse
+class MultipartSink
+{
+public:
+  virtual ~MultipartSink() {}
+
+  virtual bool onPartBegin(const std::string &name, const std::string &filename) = 0;
+  virtual bool onPartData(const char *data, size_t length) = 0;
+  virtual bool onPartEnd() = 0;
+};
+
+enum MultipartState
+{
+  MULTIPART_PREAMBLE,
+  MULTIPART_DELIMITER, // after a delimiter: "--" ends the body, CRLF starts a part
+  MULTIPART_HEADERS,
+  MULTIPART_DATA,
+  MULTIPART_EPILOGUE,
+  MULTIPART_ERROR
+};
+
+// multipart/form-data (RFC 7578), parsed in whatever pieces the body
+// arrives in. Part data goes to the sink straight from the input; only a
+// possible delimiter split across two pieces and the part headers are
+// kept back.
+class MultipartParser
+{
+  MultipartSink &sink;
+  std::string delimiter; // CRLF "--" boundary
+  MultipartState state;
+  std::string pending;   // a delimiter prefix, or the part headers so far
+
+  size_t scan(const char *data, size_t length, bool *found);
+  bool emit(const char *data, size_t length);
+  size_t readHeaders(const char *data, size_t length);
+  bool startPart(const std::string &headers);
+
+public:
+  MultipartParser(MultipartSink &sink, const std::string &boundary);
+
+  static bool parseBoundary(const std::string &contentType, std::string *boundary);
+
+  bool feed(const char *data, size_t length);
+  bool isComplete() const; // the closing delimiter was seen
+  MultipartState getState() const;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef PROXY_REQUEST_HPP
+#define PROXY_REQUEST_HPP
+
+#include "core/Backend.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "core/UpstreamGroup.hpp"
+#include <string>
+#include <vector>
+
+class Connection;
+class EventLoop;
+class HttpRequest;
+class HttpResponse;
+
+enum ProxyResponseState
+{
+  PROXY_HEAD,
+  PROXY_BODY_LENGTH,
+  PROXY_BODY_CHUNKED,
+  PROXY_BODY_CLOSE,
+  PROXY_DONE
+};
+
+enum ProxyChunkState
+{
+  CHUNK_SIZE,
+  CHUNK_DATA,
+  CHUNK_DATA_END,
+  CHUNK_TRAILER
+};
+
+// A request passed to an upstream HTTP server. The request body goes out
+// as it arrives; the response is parsed only as far as framing needs and
+// its body is streamed to the client, re-chunked if the upstream chunked
+// it. A request that dies on a reused socket before anything came back is
+// retried once on a fresh one; one whose server failed moves on to the
+// next server of the group if nothing was sent it could have acted on.
+class ProxyRequest : public Backend
+{
+  EventLoop &loop;
+  UpstreamGroup &group;
+  UpstreamPeer *peer; // server of the current attempt
+  std::vector<bool> tried;
+  std::string key;    // hash key, for hash groups
+  Connection &owner;
+  HttpRequest &request;
+  HttpResponse &response;
+  ProxyConnection *connection;
+  ProxyTimeouts timeouts;
+  std::string head; // request head, kept for a retry
+  long long progressMs; // last progress not seen by the socket, for timeouts
+  bool keepAlive;
+  bool clientChunked; // re-chunk a chunked upstream body for the client
+  bool bodySent;      // some of the body went out; no retry after that
+  bool onReused;      // the current attempt runs on a pooled socket
+  bool connected;
+  bool received;
+  bool retried;
+  bool closed;
+  bool failed;
+  mutable bool expired; // isExpired() fired; the server is blamed on abort
+
+  // Response parsing
+  ProxyResponseState state;
+  std::string line; // status line/headers, or a chunk size/trailer line
+  size_t bodyLeft;
+  ProxyChunkState chunkState;
+  size_t chunkLeft;
+  bool reusable; // the upstream may keep the socket open
+
+  ProxyRequest(EventLoop &loop, UpstreamGroup &group, Connection &owner, bool keepAlive,
+               const ProxyTimeouts &timeouts);
+
+  void buildHead(const std::string &uri, const char *clientIp);
+  void buildKey(const char *clientIp);
+  const std::string &upstreamName() const;
+  void dispatch();
+  void leavePeer(bool failure);
+  size_t parseHead(const char *data, size_t length);
+  bool startResponse(const std::string &block);
+  size_t parseChunked(const char *data, size_t length);
+  bool readLine(const char *data, size_t length, size_t *used);
+  void finish();
+  void fail();
+  void retryOrFail();
+
+public:
+  ~ProxyRequest();
+
+  static ProxyRequest *start(EventLoop &loop, UpstreamGroup &group, Connection &owner,
+                             const std::string &uri, const char *clientIp, bool keepAlive,
+                             const ProxyTimeouts &timeouts);
+
+  // ProxyConnection callbacks
+  void onConnected();
+  void onData(const char *data, size_t length);
+  void onEof();
+  void onConnectionLost();
+  void onWritable();
+  bool hasRoom() const;
+
+  void onInputReady();
+  void updateInterest();
+  void abort();
+  bool isClosed() const;
+  bool hasFailed() const;
+  bool isExpired(long long nowMs) const;
+  bool getKeepAlive() const;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef PROXY_UPSTREAM_HPP
+#define PROXY_UPSTREAM_HPP
+
+#include "core/IOHandler.hpp"
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/socket.h>
+
+class EventLoop;
+class ProxyRequest;
+class ProxyUpstream;
+
+// proxy_connect_timeout / proxy_read_timeout / proxy_send_timeout
+struct ProxyTimeouts
+{
+  long connectMs;
+  long readMs;
+  long sendMs;
+
+  ProxyTimeouts();
+};
+
+// One HTTP/1.1 socket to an upstream server. It carries one request at a
+// time; between requests it sits in its upstream's idle pool, watched so
+// that a server closing it is noticed before it is handed out again.
+class ProxyConnection : public IOHandler
+{
+  ProxyUpstream &upstream;
+  EventLoop &loop;
+  int fd;
+  bool connecting;
+  bool dead;
+  bool hangup;
+  bool reused; // served an earlier request
+  bool watched;
+  uint32_t interest;
+  long long lastActivityMs;
+  std::string out;
+  size_t outSent;
+  ProxyRequest *request; // NULL while idle
+
+  bool writeOut();
+  void fail();
+  void readResponse();
+
+public:
+  ProxyConnection(ProxyUpstream &upstream, EventLoop &loop, int fd, bool connecting);
+  ~ProxyConnection();
+
+  int getFd() const;
+  ConnectionType getType() const;
+
+  void onEvent(uint32_t events);
+  void updateInterest();
+  bool isDead() const;
+  bool isIdle() const;
+  bool isConnecting() const;
+  bool isReused() const;
+  bool isStale();
+  long long getLastActivity() const;
+  size_t getPendingOutput() const;
+
+  void attach(ProxyRequest *request);
+  void release(bool reusable);
+  void send(const char *data, size_t length);
+  void close();
+};
+
+// An upstream server address (host:port) and its pool of keep-alive
+// connections. Upstreams are shared per address and live until closeAll().
+class ProxyUpstream
+{
+  static std::map<std::string, ProxyUpstream *> registry;
+
+  std::string address;
+  struct sockaddr_storage addr;
+  socklen_t addrLength;
+  std::vector<ProxyConnection *> connections;
+
+  ProxyUpstream(const std::string &address);
+  ~ProxyUpstream();
+
+  ProxyConnection *connect(EventLoop &loop);
+  void sweep(long long nowMs);
+
+public:
+  static ProxyUpstream *open(const std::string &address);
+  static bool parseUrl(const std::string &url, std::string *address, std::string *uri);
+  static bool parseAddress(const std::string &hostPort, std::string *address);
+  static void collect(long long nowMs);
+  static void closeAll();
+
+  ProxyConnection *acquire(EventLoop &loop);
+  const std::string &getAddress() const;
+
+  class ProxyAddressException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Invalid proxy_pass address";
+    }
+  };
+
+  class ProxyConnectException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to connect to upstream server";
+    }
+  };
+};
+
+#endif
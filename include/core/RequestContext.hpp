@@ -8,6 +8,15 @@
 class Server;
 class Location;
 class HttpRequest;
+class AccessLog;
+class FastCgiUpstream;
+class CgiPool;
+class UpstreamGroup;
+struct ProxyTimeouts;
+class ResponseCache;
+class MicroCache;
+class LatencyStats;
+class RequestLimiter;
 
 class RequestContext
 {
@@ -17,21 +26,34 @@ private:
   const HttpRequest *request;
 
 public:
+  RequestContext();
   RequestContext(const Server *server, const Location *location, const HttpRequest *request);
   ~RequestContext();
 
   // Resolving getters — delegate to location (with fallback) or server
-  std::string getRoot() const;
-  std::string getIndex() const;
+  const std::string &getRoot() const;
+  const std::string &getIndex() const;
   bool getAutoindex() const;
   size_t getMaxClientBodySize() const;
-  std::vector<std::string> getMethods() const;
-  std::map<int, std::string> getErrorPages() const;
+  const std::vector<std::string> &getMethods() const;
+  const std::map<int, std::string> &getErrorPages() const;
   int getReturnCode() const;
-  std::string getReturnUrl() const;
+  const std::string &getReturnUrl() const;
   bool hasReturn() const;
-  std::string getUploadStore() const;
-  std::map<std::string, std::string> getCgiExtensions() const;
+  const std::string &getUploadStore() const;
+  const std::map<std::string, std::string> &getCgiExtensions() const;
+  AccessLog *getAccessLog() const;
+  FastCgiUpstream *getFastCgiPass() const;
+  CgiPool *getCgiPool() const;
+  UpstreamGroup *getProxyPass() const;
+  const std::string &getProxyUri() const;
+  const ProxyTimeouts &getProxyTimeouts() const;
+  ResponseCache *getCache() const;
+  const std::map<int, long> &getCacheValidity() const;
+  MicroCache *getMicroCache() const;
+  bool hasStatusPage() const;
+  LatencyStats *getLatencyStats() const;
+  RequestLimiter *getRequestLimiter() const;
 
   const Server *getServer() const;
   const Location *getLocation() const;
@@ -0,0 +1,55 @@
+#ifndef REQUEST_LIMITER_HPP
+#define REQUEST_LIMITER_HPP
+
+#include "core/ClientTable.hpp"
+#include "utils/Constants.hpp"
+#include <string>
+#include <vector>
+
+// limit_req: a token bucket per client address, kept as the time the
+// bucket is next empty (GCRA). A request is let through unless it would
+// take the client more than `burst` requests ahead of its rate; nothing
+// is queued. The table takes ClientSlots * 24 bytes, so it is allocated
+// on the first request.
+//
+// Limiters are created per server and location by the Transformer and
+// live until closeAll().
+class RequestLimiter
+{
+  static std::vector<RequestLimiter *> registry;
+
+  long rate;
+  bool perMinute;
+  unsigned burst;
+  long long intervalUs;  // one request's worth of the rate
+  long long toleranceUs; // burst requests' worth
+  ClientTable *table;
+
+  RequestLimiter(long rate, bool perMinute, unsigned burst);
+  ~RequestLimiter();
+
+public:
+  // rate requests a second, or a minute
+  static RequestLimiter *create(long rate, bool perMinute, unsigned burst);
+  static void closeAll();
+
+  // "<n>r/s" or "<n>r/m", n up to Constants::Limit::MaxRate
+  static bool parseRate(const std::string &value, long *rate, bool *perMinute);
+
+  std::string describe() const;
+
+  bool allow(uint32_t addr, long long nowUs)
+  {
+    if (!table)
+      table = new ClientTable(Constants::Limit::ClientSlots);
+    // Never NULL: no slot of this table holds connections
+    ClientSlot *slot = table->lookup(addr, nowUs);
+    long long tat = slot->tatUs > nowUs ? slot->tatUs : nowUs;
+    if (tat - nowUs > toleranceUs)
+      return false;
+    slot->tatUs = tat + intervalUs;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef RESPONSE_CACHE_HPP
+#define RESPONSE_CACHE_HPP
+
+#include "core/ResponseTee.hpp"
+#include <ctime>
+#include <exception>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class Connection;
+class EventLoop;
+class HttpResponse;
+class ResponseCache;
+
+// cache_valid: status -> lifetime in ms when the response sets none;
+// status 0 stands for `any`
+typedef std::map<int, long> CacheValidity;
+
+// One response on its way into the cache. The filling request's
+// HttpResponse owns it and tees the head and the decoded body through;
+// requests for the same key wait until it is stored or given up.
+class CacheFill : public ResponseTee
+{
+  friend class ResponseCache;
+
+  enum FillState
+  {
+    FILL_PENDING, // head not seen yet
+    FILL_WRITING,
+    FILL_SETTLED  // stored, rejected or failed; nothing more is written
+  };
+
+  ResponseCache &cache;
+  EventLoop &loop;
+  std::string key;
+  const CacheValidity &validity;
+  FillState state;
+  int fd;
+  std::string tempPath;
+  int status;
+  std::string head;
+  time_t expiresAt;
+  size_t headerSize;
+  size_t bodySize;
+  long long startedMs;
+  std::vector<Connection *> waiters;
+
+  CacheFill(ResponseCache &cache, EventLoop &loop, const std::string &key, const CacheValidity &validity);
+
+  bool start(const std::string &responseHead);
+  void settle(bool stored);
+
+public:
+  ~CacheFill();
+
+  void write(const std::string &responseHead, const char *data, size_t length);
+  void finish(const std::string &responseHead);
+};
+
+// cache_path: responses of proxied and CGI locations with `cache on`,
+// stored one file per key under dir in nginx's levels=1:2 layout. The
+// index of what is on disk lives in memory and is rebuilt from the files
+// at startup; the least recently used entries go once max_size is
+// exceeded. Hits are sent from the file with sendfile().
+class ResponseCache
+{
+  friend class CacheFill;
+
+  struct Entry
+  {
+    std::string key;
+    std::string head; // status line and end-to-end headers
+    int status;
+    size_t bodyOffset;
+    size_t bodySize;
+    size_t fileSize;
+    time_t storedAt;
+    time_t expiresAt;
+    std::list<std::string>::iterator recent;
+  };
+
+  static std::map<std::string, ResponseCache *> registry;
+
+  std::string dir;
+  size_t maxSize;
+  size_t usedSize;
+  std::map<std::string, Entry> entries; // file name -> entry
+  std::list<std::string> recent;        // file names, most recent first
+  std::map<std::string, CacheFill *> filling;
+  unsigned long tempCounter;
+
+  ResponseCache(const std::string &dir, size_t maxSize);
+  ~ResponseCache();
+
+  static std::string fileName(const std::string &key);
+  std::string filePath(const std::string &name) const;
+  void load();
+  void loadFile(const std::string &path, const std::string &name);
+  void remove(std::map<std::string, Entry>::iterator it, bool unlinkFile);
+  void evict();
+  bool store(CacheFill &fill);
+  void settle(CacheFill &fill, bool stored);
+
+public:
+  static bool parseHead(const std::string &responseHead, int *status, std::string *head, long *ownTtl);
+  static ResponseCache *open(const std::string &dir, size_t maxSize);
+  static void collect(long long nowMs);
+  static void forgetWaiters();
+  static void closeAll();
+
+  bool serve(const std::string &key, HttpResponse &response, bool keepAlive);
+  bool wait(const std::string &key, Connection *connection);
+  void cancel(const std::string &key, Connection *connection);
+  CacheFill *startFill(EventLoop &loop, const std::string &key, const CacheValidity &validity);
+
+  const std::string &getDir() const;
+  size_t getMaxSize() const;
+  size_t getEntryCount() const;
+  size_t getUsedSize() const;
+
+  class CacheOpenException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to open cache directory";
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef RESPONSE_TEE_HPP
+#define RESPONSE_TEE_HPP
+
+#include <string>
+#include <stddef.h>
+
+// Takes a copy of a streamed response as it goes out to the client: the
+// head as sent, then the body minus any transfer framing. Deleting a tee
+// before finish() means the response was cut short.
+class ResponseTee
+{
+public:
+  virtual ~ResponseTee() {}
+
+  virtual void write(const std::string &responseHead, const char *data, size_t length) = 0;
+  virtual void finish(const std::string &responseHead) = 0;
+};
+
+#endif
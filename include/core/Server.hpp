@@ -7,6 +7,11 @@
 #include <vector>
 
 class Location;
+class AccessLog;
+class ResponseCache;
+class TrafficCapture;
+class RequestLimiter;
+class LatencyStats;
 
 class Server {
 private:
@@ -25,6 +30,12 @@ private:
   std::string returnUrl;
   std::string uploadStore;
   std::map<std::string, std::string> cgiExtensions;
+  AccessLog *accessLog;
+  ResponseCache *cache;
+  TrafficCapture *capture;
+  LatencyStats *latency; // requests no location matched
+  unsigned traceSample;  // trace one request in n; 0: off
+  RequestLimiter *requestLimiter;
 
   // Locations
   std::vector<Location *> locations;
@@ -47,6 +58,12 @@ public:
   void setReturn(int code, const std::string &url);
   void setUploadStore(const std::string &path);
   void addCgiExtension(const std::string &ext, const std::string &binary);
+  void setAccessLog(AccessLog *log);
+  void setCache(ResponseCache *cache);
+  void setCapture(TrafficCapture *capture);
+  void setLatencyStats(LatencyStats *stats);
+  void setTraceSample(unsigned oneIn);
+  void setRequestLimiter(RequestLimiter *limiter);
 
   // Location management
   void addLocation(Location *location);
@@ -65,6 +82,12 @@ public:
   const std::string &getReturnUrl() const;
   const std::string &getUploadStore() const;
   const std::map<std::string, std::string> &getCgiExtensions() const;
+  AccessLog *getAccessLog() const;
+  ResponseCache *getCache() const;
+  TrafficCapture *getCapture() const;
+  LatencyStats *getLatencyStats() const;
+  unsigned getTraceSample() const;
+  RequestLimiter *getRequestLimiter() const;
   const std::vector<Location *> &getLocations() const;
   bool hasReturn() const;
 
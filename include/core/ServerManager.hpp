@@ -17,6 +17,9 @@ class ServerManager
 private:
   EventLoop eventloop;
   std::vector<Server *> servers;
+  std::string hostKey; // scratch for host lookups, reused across requests
+  std::map<int, TrafficCapture *> captures; // by listening port
+  std::map<int, unsigned> traceSamples;     // by listening port
 
   void initializeListener(const std::string &interface, int port);
 
@@ -25,9 +28,12 @@ public:
   ~ServerManager();
 
   Server *resolveServerForRequest(const HttpRequest &request, int port);
+  TrafficCapture *getCapture(int port) const;
+  unsigned getTraceSample(int port) const;
   void setup(const std::vector<Server *> &servers);
   void run();
   void stop();
+  EventLoop &getEventLoop();
 
   class ServerSetupException : public std::runtime_error
   {
@@ -4,12 +4,13 @@
 #include <string>
 
 class ServerManager;
+struct sockaddr_in;
 
 class Socket
 {
 public:
   static int createListener(const std::string &interface, int port);
-  static int acceptConnection(int fd);
+  static int acceptConnection(int fd, struct sockaddr_in *peer = NULL);
   static void setNonBlocking(int fd);
 
   class SocketCreationException : public std::exception
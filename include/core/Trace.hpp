@@ -0,0 +1,112 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+enum TracePhase
+{
+  TRACE_REQUEST,         // first request byte to last response byte
+  TRACE_RECV,            // one recv(); value: bytes
+  TRACE_PARSE,           // one HttpRequest::parse()
+  TRACE_PROCESS_HEADERS, // processHeaders(), resolution included
+  TRACE_RESOLVE,         // server and location lookup
+  TRACE_PREPARE,         // prepareResponse()
+  TRACE_FILE_OPEN,       // stat/open, from submit to the pool to done
+  TRACE_FILE_READ,       // one chunk read, inline or on the pool
+  TRACE_SEND,            // one send() or sendfile(); value: bytes
+  TRACE_PHASES
+};
+
+struct TraceSpan
+{
+  uint64_t start; // Trace::now() ticks
+  uint64_t end;
+  int64_t value;  // per phase, see TracePhase; the status for a request
+  uint32_t request;
+  int32_t fd;
+  uint32_t phase;
+};
+
+// The last Size spans one thread recorded, oldest overwritten first
+struct TraceRing
+{
+  static const size_t Size = 16384;
+
+  TraceSpan spans[Size];
+  uint64_t head; // spans ever recorded
+};
+
+// Sampled request tracing. A sampled request gets a nonzero id and every
+// phase it goes through is recorded as a span into its thread's ring;
+// requests that are not sampled pay one branch per phase. Ticks come
+// from the TSC where there is one and are converted to microseconds only
+// when the rings are dumped, as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev).
+//
+// Only the event loop thread records, and the dump runs on it, so rings
+// are read without locking.
+class Trace
+{
+  static __thread TraceRing *local;
+  static __thread unsigned sampleCount;
+
+  static TraceRing *registerThread();
+
+public:
+  static uint64_t now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+  }
+
+  // A new request id for one request in every `oneIn`, else 0
+  static uint32_t sample(unsigned oneIn);
+
+  // Where a span of a traced request starts; 0 for one not traced
+  static uint64_t start(uint32_t request) { return request ? now() : 0; }
+
+  // Ends a span started with start(); nothing for a request not traced
+  static void record(uint32_t request, int fd, TracePhase phase, uint64_t start, int64_t value = 0)
+  {
+    if (!request)
+      return;
+    uint64_t end = now();
+    TraceRing *ring = local ? local : registerThread();
+    TraceSpan &span = ring->spans[ring->head % TraceRing::Size];
+    span.start = start;
+    span.end = end;
+    span.value = value;
+    span.request = request;
+    span.fd = fd;
+    span.phase = phase;
+    ring->head++;
+  }
+
+  static void renderChrome(std::string &out);
+};
+
+// A span over a scope, for phases with no value to record
+class TraceScope
+{
+  uint32_t request;
+  int fd;
+  TracePhase phase;
+  uint64_t begin;
+
+public:
+  TraceScope(uint32_t request, int fd, TracePhase phase)
+      : request(request), fd(fd), phase(phase), begin(Trace::start(request))
+  {
+  }
+  ~TraceScope() { Trace::record(request, fd, phase, begin); }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef TRAFFIC_CAPTURE_HPP
+#define TRAFFIC_CAPTURE_HPP
+
+#include <exception>
+#include <map>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+enum CaptureRecordType
+{
+  CAPTURE_OPEN = 1,  // data: the client address
+  CAPTURE_DATA = 2,  // data: bytes as read from the client
+  CAPTURE_CLOSE = 3  // no data
+};
+
+// One record as stored: a fixed little-endian header followed by
+// `length` bytes of data
+struct CaptureRecord
+{
+  uint64_t timeUs; // since the capture was opened
+  uint32_t connection;
+  uint32_t length;
+  uint16_t port; // the listening port the client connected to
+  uint8_t type;
+
+  static const size_t HeaderSize = 20;
+
+  void encode(char *out) const;
+  void decode(const char *in);
+};
+
+// A capture file starts with the 8-byte magic and the wall-clock time
+// the capture was opened (microseconds since the epoch, little-endian)
+// before the records
+namespace CaptureFormat
+{
+  static const char Magic[8] = {'W', 'S', 'C', 'A', 'P', '0', '0', '1'};
+  static const size_t FileHeaderSize = 16;
+}
+
+// Records what clients send, as it arrives, for offline replay
+// (tools/web-replay). Records are buffered like the access log and
+// written when the buffer fills or the flush interval elapses. Once the
+// file reaches its size limit, capturing stops.
+//
+// Captures are shared per path and live until closeAll().
+class TrafficCapture
+{
+  static std::map<std::string, TrafficCapture *> registry;
+
+  std::string path;
+  int fd;
+  char *buffer;
+  size_t used;
+  size_t written;
+  size_t maxSize;
+  bool full;
+  long long startUs;
+  long long oldestPendingMs;
+  uint32_t nextConnection;
+
+  TrafficCapture(const std::string &path, size_t maxSize);
+  ~TrafficCapture();
+
+  void append(const char *data, size_t length);
+  void flush();
+
+public:
+  static const size_t BufferSize = 256 * 1024;
+  static const long FlushIntervalMs = 200;
+
+  static TrafficCapture *open(const std::string &path, size_t maxSize);
+  static void flushDue(long long nowMs);
+  static int nextFlushDelay(long long nowMs);
+  static void closeAll();
+
+  uint32_t openConnection(int port, const char *clientIp);
+  void record(CaptureRecordType type, uint32_t connection, int port, const char *data, size_t length);
+  const std::string &getPath() const;
+
+  class CaptureOpenException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to open capture file";
+    }
+  };
+};
+
+#endif
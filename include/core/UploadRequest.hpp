@@ -0,0 +1,87 @@
+#ifndef UPLOAD_REQUEST_HPP
+#define UPLOAD_REQUEST_HPP
+
+#include "core/Backend.hpp"
+#include "core/MultipartParser.hpp"
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+class Connection;
+class EventLoop;
+class HttpRequest;
+class HttpResponse;
+
+// A POST or PUT to an upload_store location. A multipart/form-data body
+// is parsed as each read arrives and its file parts are written straight
+// to a temporary file in the store, renamed to the part's filename once
+// complete; nothing beyond the current read is held in memory. Any other
+// body is the file named by the request path: what came in with the head
+// is written out, the rest is spliced from the socket to the file through
+// a pipe without passing through user space. The reply lists the files
+// stored.
+class UploadRequest : public Backend, private MultipartSink
+{
+  EventLoop &loop;
+  Connection &owner;
+  HttpRequest &request;
+  HttpResponse &response;
+  std::string store;
+  MultipartParser *parser; // NULL for a raw body
+  char *readBuffer;        // the connection receives the body into it
+  int pipeFds[2];          // raw body: socket -> pipe -> file; -1 if unavailable
+  size_t pipeSize;
+  int fd;                  // file being written, -1 between files
+  std::string tempPath;
+  std::string fileName;
+  size_t fileSize;
+  std::vector<std::pair<std::string, size_t> > stored;
+  bool diskError;
+  bool keepAlive;
+  bool closed;
+
+  static unsigned long tempCounter;
+
+  UploadRequest(EventLoop &loop, Connection &owner, const std::string &store, bool keepAlive);
+
+  void openPipe();
+  bool onPartBegin(const std::string &name, const std::string &filename);
+  bool onPartData(const char *data, size_t length);
+  bool onPartEnd();
+  void discardPart();
+  void complete();
+  void fail(int status, const char *reason);
+
+public:
+  ~UploadRequest();
+
+  static UploadRequest *start(EventLoop &loop, Connection &owner, const std::string &store,
+                              const std::string &boundary, bool keepAlive);
+  static UploadRequest *startRaw(EventLoop &loop, Connection &owner, const std::string &store,
+                                 const std::string &fileName, bool keepAlive);
+  static std::string safeFileName(const std::string &filename);
+
+  char *getReadBuffer();
+  bool isSplicing() const;
+  ssize_t receive(int socket);
+
+  void onInputReady();
+  void updateInterest();
+  void abort();
+  bool isClosed() const;
+  bool hasFailed() const;
+  bool isExpired(long long nowMs) const;
+  bool getKeepAlive() const;
+
+  class UploadOpenException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to create the upload file";
+    }
+  };
+};
+
+#endif
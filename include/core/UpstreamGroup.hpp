@@ -0,0 +1,112 @@
+#ifndef UPSTREAM_GROUP_HPP
+#define UPSTREAM_GROUP_HPP
+
+#include <exception>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+class ProxyUpstream;
+
+enum UpstreamMethod
+{
+  UPSTREAM_ROUND_ROBIN,
+  UPSTREAM_LEAST_CONN,
+  UPSTREAM_HASH
+};
+
+// What `hash` keys on
+enum UpstreamHashKey
+{
+  HASH_REQUEST_URI,
+  HASH_URI,
+  HASH_REMOTE_ADDR,
+  HASH_HOST
+};
+
+// One `server` line of an upstream block. The failure counters are the
+// passive health check: max_fails failures within fail_timeout take the
+// peer out of rotation for fail_timeout.
+struct UpstreamPeer
+{
+  ProxyUpstream *upstream;
+  size_t index;
+  unsigned weight;
+  unsigned maxFails; // 0: never ejected
+  long failTimeoutMs;
+  unsigned fails;
+  long long failWindowStartMs;
+  long long downUntilMs;
+  size_t active;            // requests in flight
+  unsigned long long picked; // selection order, breaks least_conn ties
+};
+
+// A set of upstream servers a proxy_pass spreads requests over. Named
+// groups come from `upstream name { ... }` blocks; proxy_pass to a plain
+// host:port gets an implicit group of one. Selection is O(1) for
+// round-robin (a precomputed smooth weighted schedule) and O(log n) for
+// least_conn (peers ordered by load) and hash (a consistent hash ring),
+// plus a walk past peers that are down or already tried.
+class UpstreamGroup
+{
+  struct LoadOrder
+  {
+    bool operator()(const UpstreamPeer *a, const UpstreamPeer *b) const;
+  };
+
+  static std::map<std::string, UpstreamGroup *> registry;
+
+  std::string name;
+  UpstreamMethod method;
+  UpstreamHashKey hashKey;
+  std::vector<UpstreamPeer> peers;
+  std::vector<size_t> schedule; // round-robin
+  size_t cursor;
+  std::set<UpstreamPeer *, LoadOrder> byLoad; // least_conn
+  std::vector<std::pair<uint32_t, size_t> > ring; // hash: point -> peer
+  unsigned long long picks;
+
+  UpstreamGroup(const std::string &name);
+
+  bool isUsable(const UpstreamPeer &peer, const std::vector<bool> &tried, long long nowMs) const;
+  UpstreamPeer *selectRoundRobin(const std::vector<bool> &tried, long long nowMs);
+  UpstreamPeer *selectLeastConn(const std::vector<bool> &tried, long long nowMs);
+  UpstreamPeer *selectHash(const std::string &key, const std::vector<bool> &tried, long long nowMs);
+
+public:
+  static UpstreamGroup *define(const std::string &name);
+  static UpstreamGroup *find(const std::string &name);
+  static UpstreamGroup *forAddress(const std::string &address);
+  static bool splitUrl(const std::string &url, std::string *host, std::string *uri);
+  static bool parseHashKey(const std::string &value, UpstreamHashKey *key);
+  static void closeAll();
+
+  void addPeer(ProxyUpstream *upstream, unsigned weight, unsigned maxFails, long failTimeoutMs);
+  void setMethod(UpstreamMethod method, UpstreamHashKey hashKey);
+  void build();
+
+  const std::string &getName() const;
+  UpstreamMethod getMethod() const;
+  UpstreamHashKey getHashKey() const;
+  size_t getPeerCount() const;
+  void print() const;
+
+  UpstreamPeer *select(const std::string &key, const std::vector<bool> &tried, long long nowMs);
+  void begin(UpstreamPeer *peer);
+  void end(UpstreamPeer *peer);
+  void succeeded(UpstreamPeer *peer);
+  void failed(UpstreamPeer *peer, long long nowMs);
+
+  class NoLiveUpstreamException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "No live upstream server";
+    }
+  };
+};
+
+#endif
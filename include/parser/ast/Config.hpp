@@ -3,15 +3,21 @@
 
 #include <vector>
 #include "parser/ast/ServerConfig.hpp"
+#include "parser/ast/UpstreamConfig.hpp"
 
 class Config : public Node
 {
 private:
   std::vector<ServerConfig> servers;
+  std::vector<UpstreamConfig> upstreams;
+  std::vector<Directive> httpDirectives; // the http block's own, for the whole process
 
 public:
-  Config(const std::vector<ServerConfig> &servers, const Span &span);
+  Config(const std::vector<ServerConfig> &servers, const std::vector<UpstreamConfig> &upstreams,
+         const std::vector<Directive> &httpDirectives, const Span &span);
   const std::vector<ServerConfig> &getServers() const;
+  const std::vector<UpstreamConfig> &getUpstreams() const;
+  const std::vector<Directive> &getHttpDirectives() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef UPSTREAM_CONFIG_HPP
+#define UPSTREAM_CONFIG_HPP
+
+#include <vector>
+#include <string>
+#include "parser/ast/Directive.hpp"
+#include "parser/ast/Node.hpp"
+
+// upstream <name> { server ...; least_conn; | hash ...; }
+class UpstreamConfig : public Node
+{
+  std::string name;
+  std::vector<Directive> directives;
+
+public:
+  UpstreamConfig(const std::string &name, const std::vector<Directive> &directives, const Span &span);
+  const std::string &getName() const;
+  const std::vector<Directive> &getDirectives() const;
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "parser/ast/Config.hpp"
 #include "parser/ast/ServerConfig.hpp"
 #include "parser/ast/LocationConfig.hpp"
+#include "parser/ast/UpstreamConfig.hpp"
 #include "parser/ast/Directive.hpp"
 #include "parser/TokenStream.hpp"
 
@@ -20,6 +21,9 @@ private:
     Config parseConfig();
     ServerConfig parseServerConfig();
     LocationConfig parseLocationConfig();
+    UpstreamConfig parseUpstreamConfig();
+    void parseHttpConfig(std::vector<ServerConfig> &servers, std::vector<UpstreamConfig> &upstreams,
+                         std::vector<Directive> &directives);
     Directive parseDirective();
 };
 
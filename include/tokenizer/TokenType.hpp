@@ -22,6 +22,39 @@ enum TokenType
   UPLOAD_STORE,
   CLIENT_MAX_BODY_SIZE,
   RETURN,
+  ACCESS_LOG,
+  FASTCGI_PASS,
+  CGI_WORKERS,
+  CGI_MAX_CONCURRENCY,
+  PROXY_PASS,
+  PROXY_CONNECT_TIMEOUT,
+  PROXY_READ_TIMEOUT,
+  PROXY_SEND_TIMEOUT,
+  UPSTREAM,
+  LEAST_CONN,
+  HASH,
+  CACHE_PATH,
+  CACHE,
+  CACHE_VALID,
+  MICROCACHE,
+  CAPTURE,
+  STATUS,
+  TRACE,
+  HTTP,
+  WORKER_CONNECTIONS,
+  EPOLL_EVENTS,
+  EPOLL_TIMEOUT,
+  CLIENT_HEADER_BUFFER_SIZE,
+  LARGE_CLIENT_HEADER_BUFFERS,
+  SEND_CHUNK_SIZE,
+  KEEPALIVE_TIMEOUT,
+  CLIENT_HEADER_TIMEOUT,
+  CLIENT_BODY_TIMEOUT,
+  SEND_TIMEOUT,
+  MAX_PENDING_REQUESTS,
+  OVERLOAD_LAG,
+  LIMIT_CONN,
+  LIMIT_REQ,
 
   // LITERALS
   IDENTIFIER,
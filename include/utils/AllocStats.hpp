@@ -0,0 +1,13 @@
+#ifndef ALLOC_STATS_HPP
+#define ALLOC_STATS_HPP
+
+// Heap allocation counter for profiling builds (`make ALLOC_STATS=1`).
+// Counts operator new calls made by the calling thread; always 0 otherwise.
+class AllocStats
+{
+public:
+  static bool enabled();
+  static unsigned long threadCount();
+};
+
+#endif
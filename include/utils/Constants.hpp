@@ -3,20 +3,29 @@
 
 #include <stddef.h>
 
+// Defaults for what the http block tunes (see RuntimeConfig) are marked
+// "http:"; read them through RuntimeConfig::get()
 namespace Constants {
   namespace Network {
-    static const int EpollMaxEvents = 1024;
-    static const int EpollWaitTimeout = 1000; // ms
+    static const size_t WorkerConnections = 4096; // http: worker_connections
+    static const int EpollMaxEvents = 1024;       // http: epoll_events
+    static const int EpollWaitTimeout = 1000;     // ms, http: epoll_timeout
+    static const long StallThresholdUs = 50000;   // a slower handler or loop pass is logged
+    static const size_t MaxPendingRequests = 0;   // http: max_pending_requests; 0 is no limit
+    static const size_t LimitConn = 0;            // http: limit_conn, per client address; 0 is no limit
+    static const long OverloadLag = 0;            // ms, http: overload_lag; 0 is off
+    static const int AcceptPause = 500;           // ms listeners rest after running out of fds
   }
 
   namespace Http {
-    static const size_t MaxRequestLine = 8192;    // 8 KB
-    static const size_t MaxHeaderSize = 65536;    // 64 KB
+    static const size_t MaxRequestLine = 8192;    // 8 KB, http: large_client_header_buffers
+    static const size_t MaxHeaderSize = 65536;    // 64 KB, http: large_client_header_buffers
     static const size_t DefaultMaxBodySize = 1048576; // 1 MB
   }
 
   namespace HttpStatus {
     static const int OK = 200;
+    static const int Created = 201;
     static const int MovedPermanently = 301;
     static const int Found = 302;
     static const int SeeOther = 303;
@@ -27,8 +36,11 @@ namespace Constants {
     static const int Forbidden = 403;
     static const int NotFound = 404;
     static const int MethodNotAllowed = 405;
+    static const int LengthRequired = 411;
     static const int PayloadTooLarge = 413;
     static const int UriTooLong = 414;
+    static const int UnsupportedMediaType = 415;
+    static const int TooManyRequests = 429;
     static const int RequestHeaderFieldsTooLarge = 431;
     static const int InternalServerError = 500;
     static const int NotImplemented = 501;
@@ -37,13 +49,102 @@ namespace Constants {
     static const int GatewayTimeout = 504;
   }
 
+  namespace Header {
+    static const char *const Connection = "Connection";
+    static const char *const ContentLength = "Content-Length";
+    static const char *const ContentType = "Content-Type";
+    static const char *const Location = "Location";
+  }
+
   namespace Buffer {
-    static const size_t ReadBufferSize = 4096;
-    static const size_t WriteChunkSize = 8192;
+    static const size_t ReadBufferSize = 4096;      // http: client_header_buffer_size
+    static const size_t WriteChunkSize = 8192;      // http: send_chunk_size
+    static const size_t MaxRetainedRequest = 65536; // kept across keep-alive requests
+  }
+
+  namespace FileIO {
+    static const int WorkerThreads = 4;
+  }
+
+  namespace Pool {
+    static const size_t MaxIdleConnections = 1024;
+  }
+
+  namespace Cgi {
+    static const size_t MaxBufferedInput = 65536;  // request body waiting for the script
+    static const size_t MaxBufferedOutput = 65536; // script output waiting for the client
+    static const size_t ReadChunkSize = 16384;
+    static const size_t MaxWorkers = 256;             // cgi_workers per interpreter
+    static const long WorkerRespawnDelayMs = 1000;    // between restarts of a crashing worker
+  }
+
+  namespace FastCgi {
+    static const size_t MaxPendingOutput = 65536; // request body queued per socket
+    static const size_t MaxIdleConnections = 32;  // per application
+    static const size_t MaxMultiplexed = 64;      // requests per socket when allowed
+  }
+
+  namespace Proxy {
+    static const size_t MaxPendingOutput = 65536;  // request body queued per socket
+    static const size_t MaxBufferedOutput = 65536; // response waiting for the client
+    static const size_t MaxIdleConnections = 32;   // per upstream server
+    static const size_t MaxLineSize = 8192;        // chunk size and trailer lines
+    static const size_t ReadChunkSize = 16384;
+  }
+
+  namespace Upstream {
+    static const unsigned MaxWeight = 100;
+    static const unsigned DefaultMaxFails = 1;
+    static const int DefaultFailTimeout = 10;         // seconds
+    static const unsigned RingPointsPerWeight = 160;  // hash ring points per unit of weight
+  }
+
+  namespace Cache {
+    static const size_t DefaultMaxSize = 268435456; // cache_path max_size, 256 MB
+    static const long LockTimeoutMs = 5000;          // a miss waits this long for another request's fill
+    static const size_t MaxKeySize = 4096;
+    static const size_t MaxFileHeader = 128;         // the line before the key
+  }
+
+  namespace MicroCache {
+    static const long DefaultStaleMs = 10000;        // an expired entry is served while refreshed
+    static const size_t DefaultMaxSize = 16777216;   // per location, 16 MB
+    static const size_t MaxEntrySize = 1048576;      // larger bodies are not kept
+    static const long SweepIntervalMs = 1000;
+  }
+
+  namespace Capture {
+    static const size_t DefaultMaxSize = 1073741824; // capture max_size, 1 GB
+  }
+
+  namespace Upload {
+    static const size_t MaxBoundary = 70;       // RFC 2046
+    static const size_t MaxPartHeaders = 8192;  // one part's header block
+    static const size_t ReadBufferSize = 65536;    // one recv of body, written straight out
+    static const size_t MaxReadPerEvent = 1048576; // body read per readable event
+    static const int PipeSize = 1048576;           // raw body splice batch; the default pipe-max-size
+  }
+
+  namespace Limit {
+    static const size_t ClientSlots = 16384; // addresses one limit_conn or limit_req table tracks
+    static const long MaxRate = 1000000;     // limit_req, requests a second or minute
+    static const long MaxBurst = 100000;     // limit_req burst
   }
 
   namespace Timeout {
-    static const int ConnectionIdle = 60; // seconds
+    static const int ClientHeader = 60;   // seconds, http: client_header_timeout
+    static const int ClientBody = 60;     // seconds, http: client_body_timeout
+    static const int Send = 60;           // seconds, http: send_timeout
+    static const int Keepalive = 60;      // seconds, http: keepalive_timeout
+    static const int ConnectionIdle = 60; // seconds a client waits on a silent backend
+    static const int CgiExecution = 30;   // seconds
+    static const int FastCgiIdle = 60;    // seconds
+    static const int CgiQueue = 10;       // seconds a request waits for a CGI slot
+    static const int CgiWorkerIdle = 60;  // seconds
+    static const int ProxyConnect = 60;   // seconds, proxy_connect_timeout default
+    static const int ProxyRead = 60;      // seconds, proxy_read_timeout default
+    static const int ProxySend = 60;      // seconds, proxy_send_timeout default
+    static const int ProxyIdle = 60;      // seconds a pooled upstream socket is kept
   }
 }
 
@@ -2,6 +2,7 @@
 #define FILE_HPP
 
 #include <string>
+#include <sys/types.h>
 
 class File
 {
@@ -10,6 +11,7 @@ public:
   static bool isDirectory(const std::string &path);
   static bool isFile(const std::string &path);
   static bool isExecutable(const std::string &path);
+  static ssize_t readCached(int fd, char *buf, size_t len, off_t offset);
 };
 
 #endif
\ No newline at end of file
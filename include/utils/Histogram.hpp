@@ -0,0 +1,62 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <stdint.h>
+
+// Log-linear (HDR-style) histogram of non-negative integers in fixed
+// memory: every power of two is split into 64 equal steps, so a value
+// reads back within 1/64 of what was recorded. Recording is a count
+// leading zeros, a shift and an increment.
+class Histogram
+{
+public:
+  static const int SubBucketBits = 7;
+  static const int SubBucketHalf = 1 << (SubBucketBits - 1);
+  static const int CountsLength = (64 - SubBucketBits + 2) * SubBucketHalf;
+
+private:
+  uint64_t counts[CountsLength];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t minValue;
+  uint64_t maxValue;
+
+  static int indexOf(uint64_t value)
+  {
+    int bucket = 64 - __builtin_clzll(value | ((1ULL << SubBucketBits) - 1)) - SubBucketBits;
+    return ((bucket + 1) << (SubBucketBits - 1)) + static_cast<int>(value >> bucket) - SubBucketHalf;
+  }
+
+public:
+  Histogram();
+
+  void record(uint64_t value)
+  {
+    counts[indexOf(value)]++;
+    total++;
+    sum += value;
+    if (value < minValue)
+      minValue = value;
+    if (value > maxValue)
+      maxValue = value;
+  }
+
+  void merge(const Histogram &other);
+  void reset();
+
+  uint64_t getCount() const;
+  uint64_t getSum() const;
+  uint64_t getMin() const;
+  uint64_t getMax() const;
+  double getMean() const;
+  // The smallest value at or below which percentile % of the values
+  // lie, as the top of its step; 0 when empty
+  uint64_t valueAtPercentile(double percentile) const;
+  // How many values are at most value, give or take the step holding it
+  uint64_t countAtOrBelow(uint64_t value) const;
+
+  static uint64_t lowestEquivalent(int index);
+  static uint64_t highestEquivalent(int index);
+};
+
+#endif
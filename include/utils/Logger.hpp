@@ -0,0 +1,95 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <exception>
+#include <string>
+#include <stddef.h>
+
+enum LogLevel
+{
+  LEVEL_DEBUG,
+  LEVEL_INFO,
+  LEVEL_WARN,
+  LEVEL_ERROR,
+  LEVEL_NONE
+};
+
+struct LogRing;
+
+// Asynchronous logger. Producers format into a stack buffer and copy the
+// line into a per-thread single-producer ring; a background thread drains
+// every ring and hands the batch to the kernel in one write().
+class Logger
+{
+  static LogLevel threshold;
+
+public:
+  static void start(const std::string &path, LogLevel level);
+  static void stop();
+  static void setLevel(LogLevel level);
+  static bool enabled(LogLevel level) { return level >= threshold; }
+  static void write(const char *data, size_t length);
+  static unsigned long getDropped();
+
+  class LoggerOpenException : public std::exception
+  {
+    const char *what() const throw()
+    {
+      return "Failed to open log file";
+    }
+  };
+
+private:
+  static LogRing *threadRing();
+  static void *flusherMain(void *arg);
+  static size_t drain(char *out, size_t capacity);
+};
+
+class LogLine
+{
+  static const size_t Capacity = 1024;
+  char buffer[Capacity];
+  size_t length;
+
+  void append(const char *data, size_t n);
+  void appendUnsigned(unsigned long long n);
+
+public:
+  LogLine(LogLevel level);
+  ~LogLine();
+
+  LogLine &operator<<(const char *s);
+  LogLine &operator<<(const std::string &s);
+  LogLine &operator<<(char c);
+  LogLine &operator<<(int n);
+  LogLine &operator<<(unsigned int n);
+  LogLine &operator<<(long n);
+  LogLine &operator<<(unsigned long n);
+  LogLine &operator<<(long long n);
+  LogLine &operator<<(unsigned long long n);
+};
+
+#define LOG_AT(level, expr)         \
+  do                                \
+  {                                 \
+    if (Logger::enabled(level))     \
+    {                               \
+      LogLine logLine_(level);      \
+      logLine_ << expr;             \
+    }                               \
+  } while (0)
+
+// Debug logging only exists in builds made with `make DEBUG_LOG=1`
+#ifdef WEBSERV_DEBUG_LOG
+#define LOG_DEBUG(expr) LOG_AT(LEVEL_DEBUG, expr)
+#else
+#define LOG_DEBUG(expr) \
+  do                    \
+  {                     \
+  } while (0)
+#endif
+#define LOG_INFO(expr) LOG_AT(LEVEL_INFO, expr)
+#define LOG_WARN(expr) LOG_AT(LEVEL_WARN, expr)
+#define LOG_ERROR(expr) LOG_AT(LEVEL_ERROR, expr)
+
+#endif
@@ -12,7 +12,7 @@ class MimeTypes
   static void initialize();
 
 public:
-  static std::string getMimeType(const std::string &path);
+  static const std::string &getMimeType(const std::string &path);
 };
 
 #endif
\ No newline at end of file
@@ -2,11 +2,15 @@
 #define NETWORK_RESOLVER_HPP
 
 #include <string>
+#include <sys/socket.h>
 
 class NetworkResolver
 {
 public:
   static std::pair<std::string, int> resolveListen(const std::string &listenStr);
+  // unix:/absolute/path or host:port (IPv4); host names are resolved here
+  static bool resolveAddress(const std::string &address, struct sockaddr_storage *addr,
+                             socklen_t *length);
 };
 
 #endif
\ No newline at end of file
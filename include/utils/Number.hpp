@@ -2,13 +2,21 @@
 #define NUMBER_HPP
 
 #include <string>
+#include <stddef.h>
 
 class Number
 {
 public:
   static bool isDigits(const std::string &str);
   static int toInt(const std::string &str, bool *ok = NULL);
+  static size_t toSize(const std::string &str, bool *ok = NULL);
   static std::string toString(long long n);
+  // Writes the decimal digits of n to out (at least MaxDigits bytes) and
+  // returns their count; no terminator.
+  static const size_t MaxDigits = 20;
+  static size_t format(char *out, unsigned long long n);
+  static size_t parseSize(const std::string &str, bool *ok = NULL);
+  static long parseDuration(const std::string &str, bool *ok = NULL);
 };
 
 #endif
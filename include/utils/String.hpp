@@ -8,6 +8,9 @@ namespace String
 {
   std::string toLower(const std::string &str);
   std::string trim(const std::string &str);
+  void toLowerInPlace(std::string &str);
+  bool equalsIgnoreCase(const std::string &str, const char *other, size_t length);
+  bool equalsIgnoreCase(const std::string &str, const char *other);
 }
 
 #endif
\ No newline at end of file
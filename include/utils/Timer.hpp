@@ -5,18 +5,9 @@
 
 class Timer
 {
-private:
-  time_t lastActivity;
-  int limit; // in seconds
-
 public:
-  Timer(int limitSeconds);
-  ~Timer();
-
-  void update();
-  bool isExpired() const;
-  void setLimit(int seconds);
-  int getLimit() const;
+  static long long monotonicMs();
+  static long long monotonicUs();
 };
 
-#endif
\ No newline at end of file
+#endif
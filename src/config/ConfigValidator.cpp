@@ -26,6 +26,37 @@ ConfigValidator::ConfigValidator(ErrorReporter &errorReporter) : errorReporter(e
   directiveValidators["upload_store"] = &ConfigValidator::checkUploadStoreDirective;
   directiveValidators["cgi_extension"] = &ConfigValidator::checkCgiExtensionDirective;
   directiveValidators["methods"] = &ConfigValidator::checkMethodsDirective;
+  directiveValidators["access_log"] = &ConfigValidator::checkAccessLogDirective;
+  directiveValidators["fastcgi_pass"] = &ConfigValidator::checkFastcgiPassDirective;
+  directiveValidators["cgi_workers"] = &ConfigValidator::checkCgiWorkersDirective;
+  directiveValidators["cgi_max_concurrency"] = &ConfigValidator::checkCgiMaxConcurrencyDirective;
+  directiveValidators["proxy_pass"] = &ConfigValidator::checkProxyPassDirective;
+  directiveValidators["proxy_connect_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["proxy_read_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["proxy_send_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["least_conn"] = &ConfigValidator::checkLeastConnDirective;
+  directiveValidators["hash"] = &ConfigValidator::checkHashDirective;
+  directiveValidators["cache_path"] = &ConfigValidator::checkCachePathDirective;
+  directiveValidators["cache"] = &ConfigValidator::checkCacheDirective;
+  directiveValidators["cache_valid"] = &ConfigValidator::checkCacheValidDirective;
+  directiveValidators["microcache"] = &ConfigValidator::checkMicrocacheDirective;
+  directiveValidators["capture"] = &ConfigValidator::checkCaptureDirective;
+  directiveValidators["status"] = &ConfigValidator::checkStatusDirective;
+  directiveValidators["trace"] = &ConfigValidator::checkTraceDirective;
+  directiveValidators["worker_connections"] = &ConfigValidator::checkHttpCountDirective;
+  directiveValidators["epoll_events"] = &ConfigValidator::checkHttpCountDirective;
+  directiveValidators["epoll_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["client_header_buffer_size"] = &ConfigValidator::checkHttpSizeDirective;
+  directiveValidators["large_client_header_buffers"] = &ConfigValidator::checkLargeClientHeaderBuffersDirective;
+  directiveValidators["send_chunk_size"] = &ConfigValidator::checkHttpSizeDirective;
+  directiveValidators["keepalive_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["client_header_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["client_body_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["send_timeout"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["max_pending_requests"] = &ConfigValidator::checkHttpCountDirective;
+  directiveValidators["overload_lag"] = &ConfigValidator::checkTimeDirective;
+  directiveValidators["limit_conn"] = &ConfigValidator::checkHttpCountDirective;
+  directiveValidators["limit_req"] = &ConfigValidator::checkLimitReqDirective;
 }
 
 const Directive *ConfigValidator::getDirective(const std::vector<Directive> &directives, const std::string &key)
@@ -53,21 +84,78 @@ void ConfigValidator::validate(Config &config)
   usedServerNameLocationPairs.clear();
   hostnamesOnPort.clear();
   portToWildcardSpan.clear();
+  upstreamNames.clear();
+  accessLogSettings.clear();
+  validateHttpConfig(config.getHttpDirectives());
+  // Upstreams first: proxy_pass may name them
+  for (size_t i = 0; i < config.getUpstreams().size(); i++)
+    validateUpstreamConfig(config.getUpstreams()[i]);
   for (size_t i = 0; i < config.getServers().size(); i++)
   {
     validateServerConfig(config.getServers()[i]);
   }
 }
 
+// Directives that hand a location's requests to something other than files
+static bool isLocationOnly(const std::string &key)
+{
+  return key == "fastcgi_pass" || key == "cgi_workers" || key == "cgi_max_concurrency" ||
+         key == "proxy_pass" || key == "proxy_connect_timeout" || key == "proxy_read_timeout" ||
+         key == "proxy_send_timeout" || key == "cache" || key == "cache_valid" || key == "microcache" ||
+         key == "status";
+}
+
+// Process-wide tuning, read into RuntimeConfig
+static bool isHttpOnly(const std::string &key)
+{
+  return key == "worker_connections" || key == "epoll_events" || key == "epoll_timeout" ||
+         key == "client_header_buffer_size" || key == "large_client_header_buffers" || key == "send_chunk_size" ||
+         key == "keepalive_timeout" || key == "client_header_timeout" || key == "client_body_timeout" ||
+         key == "send_timeout" || key == "max_pending_requests" || key == "overload_lag" ||
+         key == "limit_conn";
+}
+
+// Balancing methods; `server` lines are checked by validateUpstreamConfig
+static bool isUpstreamOnly(const std::string &key)
+{
+  return key == "least_conn" || key == "hash";
+}
+
 void ConfigValidator::validateDirective(const Directive &directive, Context context)
 {
   const std::string &key = directive.getKey();
   
-  if (context == LOCATION_CONTEXT && (key == "listen" || key == "server_name"))
+  if (context == GLOBAL_CONTEXT && !isHttpOnly(key))
+  {
+    reportInvalidDirective(directive, "The '" + key + "' directive is not allowed in http context");
+    return;
+  }
+  if (context != GLOBAL_CONTEXT && isHttpOnly(key))
+  {
+    reportInvalidDirective(directive, "The '" + key + "' directive is only allowed in http context");
+    return;
+  }
+  if (context == LOCATION_CONTEXT && (key == "listen" || key == "server_name" || key == "cache_path" ||
+                                     key == "capture" || key == "trace"))
   {
     reportInvalidDirective(directive, "The '" + key + "' directive is only allowed in server context");
     return;
   }
+  if (context == SERVER_CONTEXT && isLocationOnly(key))
+  {
+    reportInvalidDirective(directive, "The '" + key + "' directive is only allowed in location context");
+    return;
+  }
+  if (context != UPSTREAM_CONTEXT && isUpstreamOnly(key))
+  {
+    reportInvalidDirective(directive, "The '" + key + "' directive is only allowed in upstream context");
+    return;
+  }
+  if (context == UPSTREAM_CONTEXT && !isUpstreamOnly(key))
+  {
+    reportInvalidDirective(directive, "The '" + key + "' directive is not allowed in upstream context");
+    return;
+  }
 
   std::map<std::string, ValidatorFunc>::iterator it = directiveValidators.find(key);
   if (it != directiveValidators.end())
@@ -90,8 +178,19 @@ void ConfigValidator::validateServerConfig(const ServerConfig &serverConfig)
   for (size_t i = 0; i < serverConfig.getDirectives().size(); i++)
     validateDirective(serverConfig.getDirectives()[i], SERVER_CONTEXT);
 
+  // `cache on` stores into the server's cache_path
+  bool hasCachePath = isDirectivePresent(serverConfig.getDirectives(), "cache_path");
   for (size_t i = 0; i < serverConfig.getLocations().size(); i++)
-    validateLocationConfig(serverConfig.getLocations()[i]);
+  {
+    const LocationConfig &location = serverConfig.getLocations()[i];
+    validateLocationConfig(location);
+    const Directive *cache = getDirective(location.getDirectives(), "cache");
+    if (cache && !hasCachePath && !cache->getValues().empty() && cache->getValues()[0] == "on")
+      reportInvalidDirective(*cache, "cache on requires a cache_path in the server");
+    const Directive *microcache = getDirective(location.getDirectives(), "microcache");
+    if (cache && microcache && !cache->getValues().empty() && cache->getValues()[0] == "on")
+      reportInvalidDirective(*microcache, "microcache cannot be combined with cache on");
+  }
 
   if (errorReporter.hasErrors())
     return;
@@ -103,3 +202,53 @@ void ConfigValidator::validateLocationConfig(const LocationConfig &locationConfi
   for (size_t i = 0; i < locationConfig.getDirectives().size(); i++)
     validateDirective(locationConfig.getDirectives()[i], LOCATION_CONTEXT);
 }
+
+void ConfigValidator::validateHttpConfig(const std::vector<Directive> &directives)
+{
+  std::set<std::string> seen;
+  for (size_t i = 0; i < directives.size(); i++)
+  {
+    const Directive &directive = directives[i];
+    if (!seen.insert(directive.getKey()).second)
+      reportError(directive.getSpan(), "Duplicate directive '" + directive.getKey() + "'");
+    validateDirective(directive, GLOBAL_CONTEXT);
+  }
+}
+
+void ConfigValidator::validateUpstreamConfig(const UpstreamConfig &upstreamConfig)
+{
+  const std::string &name = upstreamConfig.getName();
+  if (name.find_first_of(":/") != std::string::npos)
+    reportError(upstreamConfig.getSpan(), "Invalid upstream name: '" + name + "'");
+  std::map<std::string, Span>::iterator previous = upstreamNames.find(name);
+  if (previous != upstreamNames.end())
+  {
+    reportError(upstreamConfig.getSpan(), "Duplicate upstream '" + name + "'");
+    reportError(previous->second, "Previous declaration of this upstream");
+  }
+  else
+    upstreamNames[name] = upstreamConfig.getSpan();
+
+  const std::vector<Directive> &directives = upstreamConfig.getDirectives();
+  size_t servers = 0;
+  const Directive *method = NULL;
+  for (size_t i = 0; i < directives.size(); i++)
+  {
+    const Directive &directive = directives[i];
+    if (directive.getKey() == "server")
+    {
+      servers++;
+      checkUpstreamServerDirective(directive);
+      continue;
+    }
+    if (isUpstreamOnly(directive.getKey()))
+    {
+      if (method)
+        reportInvalidDirective(directive, "Upstream '" + name + "' already has a balancing method");
+      method = &directive;
+    }
+    validateDirective(directive, UPSTREAM_CONTEXT);
+  }
+  if (servers == 0)
+    reportError(upstreamConfig.getSpan(), "Upstream '" + name + "' has no servers");
+}
@@ -1,5 +1,12 @@
 #include "config/ConfigValidator.hpp"
+#include "utils/Constants.hpp"
 #include "utils/File.hpp"
+#include "utils/Number.hpp"
+#include "core/AccessLog.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "core/RequestLimiter.hpp"
+#include "core/UpstreamGroup.hpp"
 #include <sstream>
 #include <climits>
 
@@ -143,10 +150,9 @@ bool ConfigValidator::checkClientMaxBodySizeDirective(const Directive &directive
     return false;
   }
 
-  long long finalSize = size * multiplier;
-  if (finalSize > 2147483647LL)
+  if (numericPart.size() > 10)
   {
-    reportInvalidDirective(directive, "client_max_body_size is too large (maximum 2GB)");
+    reportInvalidDirective(directive, "client_max_body_size is too large (at most 10 digits)");
     return false;
   }
 
@@ -345,11 +351,661 @@ bool ConfigValidator::checkMethodsDirective(const Directive &directive)
   for (size_t i = 0; i < values.size(); i++)
   {
     const std::string &method = values[i];
-    if (method != "GET" && method != "POST" && method != "DELETE")
+    if (method != "GET" && method != "POST" && method != "PUT" && method != "DELETE")
     {
-      reportInvalidDirective(directive, "Invalid HTTP method: '" + method + "'. Allowed methods are GET, POST, DELETE");
+      reportInvalidDirective(directive, "Invalid HTTP method: '" + method + "'. Allowed methods are GET, POST, PUT, DELETE");
       return false;
     }
   }
   return true;
-}
\ No newline at end of file
+}
+
+bool ConfigValidator::checkAccessLogDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty())
+  {
+    reportInvalidDirective(directive, "access_log directive requires a path or 'off'");
+    return false;
+  }
+  if (values[0] == "off")
+  {
+    if (values.size() != 1)
+    {
+      reportInvalidDirective(directive, "access_log off takes no other values");
+      return false;
+    }
+    return true;
+  }
+
+  const std::string &path = values[0];
+  if (!isValidRootPath(path))
+  {
+    reportInvalidDirective(directive, "access_log path must be an absolute path: '" + path + "'");
+    return false;
+  }
+  std::string parent = path.substr(0, path.rfind('/') + 1);
+  if (!File::isDirectory(parent))
+  {
+    reportInvalidDirective(directive, "access_log directory does not exist: '" + parent + "'");
+    return false;
+  }
+  if (File::isDirectory(path))
+  {
+    reportInvalidDirective(directive, "access_log path cannot be a directory: '" + path + "'");
+    return false;
+  }
+
+  std::string format = "main";
+  size_t bufferSize = AccessLog::DefaultBufferSize;
+  long flushIntervalMs = AccessLog::DefaultFlushIntervalMs;
+  size_t ringSize = 0;
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    const std::string &value = values[i];
+    size_t eq = value.find('=');
+    if (eq == std::string::npos)
+    {
+      AccessLogFormat parsed;
+      if (i != 1 || !AccessLog::parseFormat(value, &parsed))
+      {
+        reportInvalidDirective(directive, "Unknown access_log format: '" + value + "'. Expected 'main' or 'json'");
+        return false;
+      }
+      format = value;
+      continue;
+    }
+
+    std::string key = value.substr(0, eq);
+    std::string arg = value.substr(eq + 1);
+    bool ok = false;
+    if (key == "buffer")
+      bufferSize = Number::parseSize(arg, &ok);
+    else if (key == "flush")
+    {
+      flushIntervalMs = Number::parseDuration(arg, &ok);
+      if (flushIntervalMs <= 0)
+        ok = false;
+    }
+    else if (key == "ring")
+    {
+      ringSize = Number::parseSize(arg, &ok);
+      if (ok && ringSize < AccessLog::MinRingSize)
+      {
+        reportInvalidDirective(directive, "access_log ring size must be at least 64k: '" + arg + "'");
+        return false;
+      }
+    }
+    else
+    {
+      reportInvalidDirective(directive, "Unknown access_log parameter: '" + key + "'");
+      return false;
+    }
+    if (!ok)
+    {
+      reportInvalidDirective(directive, "Invalid access_log " + key + " value: '" + arg + "'");
+      return false;
+    }
+  }
+
+  // One log per path: every use of a path must agree on how it is written
+  std::string settings = format + " buffer=" + Number::toString(bufferSize) + " flush=" +
+                         Number::toString(flushIntervalMs) + " ring=" + Number::toString(ringSize);
+  std::map<std::string, std::pair<std::string, Span> >::iterator previous = accessLogSettings.find(path);
+  if (previous == accessLogSettings.end())
+    accessLogSettings[path] = std::make_pair(settings, directive.getSpan());
+  else if (previous->second.first != settings)
+  {
+    reportInvalidDirective(directive, "access_log '" + path + "' is already used with other settings");
+    reportError(previous->second.second, "Previous use of this access_log path");
+    return false;
+  }
+  return true;
+}
+
+bool ConfigValidator::checkFastcgiPassDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, "fastcgi_pass directive requires exactly one value: unix:<path> or <host>:<port>");
+    return false;
+  }
+
+  struct sockaddr_storage addr;
+  socklen_t length;
+  if (!FastCgiUpstream::parseAddress(values[0], &addr, &length))
+  {
+    reportInvalidDirective(directive, "Invalid fastcgi_pass address: '" + values[0] + "'");
+    return false;
+  }
+
+  return true;
+}
+
+bool ConfigValidator::checkCgiWorkersDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 3)
+  {
+    reportInvalidDirective(directive, "cgi_workers directive requires: <max> [min=n] [idle=time]");
+    return false;
+  }
+
+  bool ok = false;
+  int max = Number::toInt(values[0], &ok);
+  if (!ok || !Number::isDigits(values[0]) || max < 1 || max > static_cast<int>(Constants::Cgi::MaxWorkers))
+  {
+    reportInvalidDirective(directive, "cgi_workers max must be between 1 and 256: '" + values[0] + "'");
+    return false;
+  }
+
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    const std::string &value = values[i];
+    size_t eq = value.find('=');
+    std::string key = eq == std::string::npos ? value : value.substr(0, eq);
+    std::string arg = eq == std::string::npos ? "" : value.substr(eq + 1);
+    if (key == "min")
+    {
+      int min = Number::toInt(arg, &ok);
+      ok = ok && Number::isDigits(arg) && min <= max;
+    }
+    else if (key == "idle")
+    {
+      if (Number::parseDuration(arg, &ok) <= 0)
+        ok = false;
+    }
+    else
+    {
+      reportInvalidDirective(directive, "Unknown cgi_workers parameter: '" + key + "'");
+      return false;
+    }
+    if (!ok)
+    {
+      reportInvalidDirective(directive, "Invalid cgi_workers " + key + " value: '" + arg + "'");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ConfigValidator::checkCgiMaxConcurrencyDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 2)
+  {
+    reportInvalidDirective(directive, "cgi_max_concurrency directive requires: <n> [queue=n]");
+    return false;
+  }
+
+  bool ok = false;
+  int max = Number::toInt(values[0], &ok);
+  if (!ok || !Number::isDigits(values[0]) || max < 1)
+  {
+    reportInvalidDirective(directive, "cgi_max_concurrency must be a positive number: '" + values[0] + "'");
+    return false;
+  }
+
+  if (values.size() == 2)
+  {
+    const std::string &value = values[1];
+    if (value.compare(0, 6, "queue=") != 0)
+    {
+      reportInvalidDirective(directive, "Unknown cgi_max_concurrency parameter: '" + value + "'");
+      return false;
+    }
+    std::string arg = value.substr(6);
+    Number::toInt(arg, &ok);
+    if (!ok || !Number::isDigits(arg))
+    {
+      reportInvalidDirective(directive, "Invalid cgi_max_concurrency queue value: '" + arg + "'");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ConfigValidator::checkProxyPassDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, "proxy_pass directive requires exactly one value: http://<host>[:<port>][/uri]");
+    return false;
+  }
+
+  // An upstream block of that name, or a server address
+  std::string host;
+  std::string uri;
+  if (UpstreamGroup::splitUrl(values[0], &host, &uri) && upstreamNames.count(host))
+    return true;
+  std::string address;
+  if (!ProxyUpstream::parseUrl(values[0], &address, &uri))
+  {
+    reportInvalidDirective(directive, "Invalid proxy_pass address: '" + values[0] + "'");
+    return false;
+  }
+
+  return true;
+}
+
+// A single positive <time>: proxy_*_timeout, epoll_timeout and the client
+// timeouts
+bool ConfigValidator::checkTimeDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, directive.getKey() + " directive requires exactly one time value");
+    return false;
+  }
+
+  bool ok = false;
+  if (Number::parseDuration(values[0], &ok) <= 0 || !ok)
+  {
+    reportInvalidDirective(directive, "Invalid " + directive.getKey() + " value: '" + values[0] + "'");
+    return false;
+  }
+
+  return true;
+}
+
+// server <host>[:<port>] [weight=n] [max_fails=n] [fail_timeout=time]
+bool ConfigValidator::checkUpstreamServerDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 4)
+  {
+    reportInvalidDirective(directive, "server directive requires: <host>[:<port>] [weight=n] [max_fails=n] [fail_timeout=time]");
+    return false;
+  }
+
+  std::string address;
+  if (!ProxyUpstream::parseAddress(values[0], &address))
+  {
+    reportInvalidDirective(directive, "Invalid upstream server address: '" + values[0] + "'");
+    return false;
+  }
+
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    const std::string &value = values[i];
+    size_t eq = value.find('=');
+    std::string key = eq == std::string::npos ? value : value.substr(0, eq);
+    std::string arg = eq == std::string::npos ? "" : value.substr(eq + 1);
+    bool ok = false;
+    if (key == "weight")
+    {
+      int weight = Number::toInt(arg, &ok);
+      ok = ok && Number::isDigits(arg) && weight >= 1 && weight <= static_cast<int>(Constants::Upstream::MaxWeight);
+    }
+    else if (key == "max_fails")
+    {
+      Number::toInt(arg, &ok);
+      ok = ok && Number::isDigits(arg);
+    }
+    else if (key == "fail_timeout")
+    {
+      if (Number::parseDuration(arg, &ok) <= 0)
+        ok = false;
+    }
+    else
+    {
+      reportInvalidDirective(directive, "Unknown server parameter: '" + key + "'");
+      return false;
+    }
+    if (!ok)
+    {
+      reportInvalidDirective(directive, "Invalid server " + key + " value: '" + arg + "'");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ConfigValidator::checkLeastConnDirective(const Directive &directive)
+{
+  if (!directive.getValues().empty())
+  {
+    reportInvalidDirective(directive, "least_conn directive takes no value");
+    return false;
+  }
+  return true;
+}
+
+// hash <$request_uri|$uri|$remote_addr|$host>
+bool ConfigValidator::checkHashDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  UpstreamHashKey key;
+  if (values.size() != 1 || !UpstreamGroup::parseHashKey(values[0], &key))
+  {
+    reportInvalidDirective(directive, "hash directive requires one key: $request_uri, $uri, $remote_addr or $host");
+    return false;
+  }
+  return true;
+}
+
+// cache_path <dir> [max_size=size]
+bool ConfigValidator::checkCachePathDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 2)
+  {
+    reportInvalidDirective(directive, "cache_path directive requires: <dir> [max_size=size]");
+    return false;
+  }
+
+  const std::string &path = values[0];
+  if (!isValidRootPath(path))
+  {
+    reportInvalidDirective(directive, "cache_path must be an absolute path: '" + path + "'");
+    return false;
+  }
+  std::string parent = path.substr(0, path.find_last_not_of('/') + 1);
+  parent = parent.substr(0, parent.rfind('/') + 1);
+  if (!File::isDirectory(path) && !File::isDirectory(parent))
+  {
+    reportInvalidDirective(directive, "cache_path directory does not exist: '" + parent + "'");
+    return false;
+  }
+
+  if (values.size() == 2)
+  {
+    const std::string &value = values[1];
+    if (value.compare(0, 9, "max_size=") != 0)
+    {
+      reportInvalidDirective(directive, "Unknown cache_path parameter: '" + value + "'");
+      return false;
+    }
+    bool ok = false;
+    if (Number::parseSize(value.substr(9), &ok) == 0 || !ok)
+    {
+      reportInvalidDirective(directive, "Invalid cache_path max_size: '" + value.substr(9) + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ConfigValidator::checkCacheDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1 || (values[0] != "on" && values[0] != "off"))
+  {
+    reportInvalidDirective(directive, "cache directive requires 'on' or 'off'");
+    return false;
+  }
+  return true;
+}
+
+// cache_valid [code ...|any] <time>
+bool ConfigValidator::checkCacheValidDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty())
+  {
+    reportInvalidDirective(directive, "cache_valid directive requires: [code ...|any] <time>");
+    return false;
+  }
+
+  bool ok = false;
+  const std::string &time = values[values.size() - 1];
+  if (Number::parseDuration(time, &ok) <= 0 || !ok)
+  {
+    reportInvalidDirective(directive, "Invalid cache_valid time: '" + time + "'");
+    return false;
+  }
+  for (size_t i = 0; i + 1 < values.size(); i++)
+  {
+    if (values[i] == "any")
+      continue;
+    int code = Number::toInt(values[i], &ok);
+    if (!ok || !Number::isDigits(values[i]) || code < 200 || code > 599)
+    {
+      reportInvalidDirective(directive, "Invalid cache_valid status code: '" + values[i] + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+// microcache <time> [stale=time] [max_size=size]
+bool ConfigValidator::checkMicrocacheDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 3)
+  {
+    reportInvalidDirective(directive, "microcache directive requires: <time> [stale=time] [max_size=size]");
+    return false;
+  }
+
+  bool ok = false;
+  if (Number::parseDuration(values[0], &ok) <= 0 || !ok)
+  {
+    reportInvalidDirective(directive, "Invalid microcache time: '" + values[0] + "'");
+    return false;
+  }
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    const std::string &value = values[i];
+    size_t eq = value.find('=');
+    std::string key = value.substr(0, eq);
+    std::string arg = eq == std::string::npos ? "" : value.substr(eq + 1);
+    if (key == "stale")
+      Number::parseDuration(arg, &ok);
+    else if (key == "max_size")
+      ok = Number::parseSize(arg, &ok) > 0 && ok;
+    else
+    {
+      reportInvalidDirective(directive, "Unknown microcache parameter: '" + value + "'");
+      return false;
+    }
+    if (!ok)
+    {
+      reportInvalidDirective(directive, "Invalid microcache " + key + ": '" + arg + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+// capture <file> [max_size=size]
+bool ConfigValidator::checkCaptureDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 2)
+  {
+    reportInvalidDirective(directive, "capture directive requires: <file> [max_size=size]");
+    return false;
+  }
+
+  const std::string &path = values[0];
+  if (!isValidRootPath(path))
+  {
+    reportInvalidDirective(directive, "capture path must be an absolute path: '" + path + "'");
+    return false;
+  }
+  std::string parent = path.substr(0, path.rfind('/') + 1);
+  if (!File::isDirectory(parent))
+  {
+    reportInvalidDirective(directive, "capture directory does not exist: '" + parent + "'");
+    return false;
+  }
+  if (File::isDirectory(path))
+  {
+    reportInvalidDirective(directive, "capture path cannot be a directory: '" + path + "'");
+    return false;
+  }
+
+  if (values.size() == 2)
+  {
+    const std::string &value = values[1];
+    if (value.compare(0, 9, "max_size=") != 0)
+    {
+      reportInvalidDirective(directive, "Unknown capture parameter: '" + value + "'");
+      return false;
+    }
+    bool ok = false;
+    if (Number::parseSize(value.substr(9), &ok) == 0 || !ok)
+    {
+      reportInvalidDirective(directive, "Invalid capture max_size: '" + value.substr(9) + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ConfigValidator::checkStatusDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, "status directive requires exactly one value");
+    return false;
+  }
+  if (values[0] != "on" && values[0] != "off")
+  {
+    reportInvalidDirective(directive, "status value must be 'on' or 'off': '" + values[0] + "'");
+    return false;
+  }
+  return true;
+}
+
+// trace on|off [sample=n]
+bool ConfigValidator::checkTraceDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.empty() || values.size() > 2)
+  {
+    reportInvalidDirective(directive, "trace directive requires: on|off [sample=n]");
+    return false;
+  }
+  if (values[0] != "on" && values[0] != "off")
+  {
+    reportInvalidDirective(directive, "trace value must be 'on' or 'off': '" + values[0] + "'");
+    return false;
+  }
+  if (values.size() == 2)
+  {
+    const std::string &value = values[1];
+    if (values[0] == "off" || value.compare(0, 7, "sample=") != 0)
+    {
+      reportInvalidDirective(directive, "Unknown trace parameter: '" + value + "'");
+      return false;
+    }
+    bool ok = false;
+    if (Number::toInt(value.substr(7), &ok) <= 0 || !ok)
+    {
+      reportInvalidDirective(directive, "Invalid trace sample: '" + value.substr(7) + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+// limit_req rate=<n>r/s|<n>r/m [burst=<n>] | off
+bool ConfigValidator::checkLimitReqDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() == 1 && values[0] == "off")
+    return true;
+  if (values.empty() || values.size() > 2 || values[0].compare(0, 5, "rate=") != 0)
+  {
+    reportInvalidDirective(directive, "limit_req directive requires: rate=<n>r/s|<n>r/m [burst=n] | off");
+    return false;
+  }
+  long rate;
+  bool perMinute;
+  if (!RequestLimiter::parseRate(values[0].substr(5), &rate, &perMinute))
+  {
+    reportInvalidDirective(directive, "Invalid limit_req rate: '" + values[0].substr(5) + "'");
+    return false;
+  }
+  if (values.size() == 2)
+  {
+    if (values[1].compare(0, 6, "burst=") != 0)
+    {
+      reportInvalidDirective(directive, "Unknown limit_req parameter: '" + values[1] + "'");
+      return false;
+    }
+    bool ok = false;
+    int burst = Number::toInt(values[1].substr(6), &ok);
+    if (!ok || burst < 0 || burst > Constants::Limit::MaxBurst)
+    {
+      reportInvalidDirective(directive, "Invalid limit_req burst: '" + values[1].substr(6) + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+// worker_connections <n>, epoll_events <n>
+bool ConfigValidator::checkHttpCountDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, directive.getKey() + " directive requires exactly one number");
+    return false;
+  }
+  bool ok = false;
+  int count = Number::toInt(values[0], &ok);
+  if (!ok || !Number::isDigits(values[0]) || count < 1 || count > 1048576)
+  {
+    reportInvalidDirective(directive, directive.getKey() + " must be between 1 and 1048576: '" + values[0] + "'");
+    return false;
+  }
+  return true;
+}
+
+// client_header_buffer_size <size>, send_chunk_size <size>
+bool ConfigValidator::checkHttpSizeDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 1)
+  {
+    reportInvalidDirective(directive, directive.getKey() + " directive requires exactly one size");
+    return false;
+  }
+  bool ok = false;
+  size_t size = Number::parseSize(values[0], &ok);
+  if (!ok || size < 1024 || size > 16777216)
+  {
+    reportInvalidDirective(directive, directive.getKey() + " must be between 1k and 16m: '" + values[0] + "'");
+    return false;
+  }
+  return true;
+}
+
+// large_client_header_buffers <number> <size>: the request line must fit
+// one buffer, the whole header block all of them
+bool ConfigValidator::checkLargeClientHeaderBuffersDirective(const Directive &directive)
+{
+  const std::vector<std::string> &values = directive.getValues();
+  if (values.size() != 2)
+  {
+    reportInvalidDirective(directive, "large_client_header_buffers directive requires: <number> <size>");
+    return false;
+  }
+  bool ok = false;
+  int number = Number::toInt(values[0], &ok);
+  if (!ok || !Number::isDigits(values[0]) || number < 1 || number > 1024)
+  {
+    reportInvalidDirective(directive, "large_client_header_buffers number must be between 1 and 1024: '" +
+                                          values[0] + "'");
+    return false;
+  }
+  size_t size = Number::parseSize(values[1], &ok);
+  if (!ok || size < 1024 || size > 1048576)
+  {
+    reportInvalidDirective(directive, "large_client_header_buffers size must be between 1k and 1m: '" +
+                                          values[1] + "'");
+    return false;
+  }
+  return true;
+}
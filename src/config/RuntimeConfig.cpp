@@ -0,0 +1,19 @@
+#include "config/RuntimeConfig.hpp"
+#include "utils/Constants.hpp"
+
+RuntimeConfig RuntimeConfig::current;
+
+RuntimeConfig::RuntimeConfig()
+    : workerConnections(Constants::Network::WorkerConnections), epollMaxEvents(Constants::Network::EpollMaxEvents),
+      epollWaitTimeout(Constants::Network::EpollWaitTimeout), readBufferSize(Constants::Buffer::ReadBufferSize),
+      maxRequestLine(Constants::Http::MaxRequestLine), maxHeaderSize(Constants::Http::MaxHeaderSize),
+      writeChunkSize(Constants::Buffer::WriteChunkSize),
+      clientHeaderTimeout(Constants::Timeout::ClientHeader * 1000L),
+      clientBodyTimeout(Constants::Timeout::ClientBody * 1000L), sendTimeout(Constants::Timeout::Send * 1000L),
+      keepaliveTimeout(Constants::Timeout::Keepalive * 1000L),
+      maxPendingRequests(Constants::Network::MaxPendingRequests), overloadLag(Constants::Network::OverloadLag),
+      limitConn(Constants::Network::LimitConn)
+{
+}
+
+void RuntimeConfig::set(const RuntimeConfig &config) { current = config; }
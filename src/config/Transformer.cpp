@@ -1,10 +1,30 @@
 #include "config/Transformer.hpp"
+#include "config/RuntimeConfig.hpp"
 #include "utils/NetworkResolver.hpp"
+#include "utils/Constants.hpp"
 #include "utils/Number.hpp"
+#include "core/AccessLog.hpp"
+#include "core/CgiPool.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/LatencyStats.hpp"
+#include "core/RequestLimiter.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "core/MicroCache.hpp"
+#include "core/ResponseCache.hpp"
+#include "core/TrafficCapture.hpp"
+#include "core/UpstreamGroup.hpp"
 
 Transformer::Transformer(Config &config) : config(config) {}
 
 void Transformer::transform() {
+  // Tuning first: it sizes what the rest allocates
+  transformHttp(config.getHttpDirectives());
+
+  // Upstream groups first: proxy_pass refers to them by name
+  const std::vector<UpstreamConfig> &upstreamConfigs = config.getUpstreams();
+  for (size_t i = 0; i < upstreamConfigs.size(); i++)
+    transformUpstream(upstreamConfigs[i]);
+
   const std::vector<ServerConfig> &serverConfigs = config.getServers();
   for (size_t i = 0; i < serverConfigs.size(); i++) {
     const ServerConfig &serverConfig = serverConfigs[i];
@@ -13,6 +33,44 @@ void Transformer::transform() {
   }
 }
 
+void Transformer::transformHttp(const std::vector<Directive> &directives) {
+  RuntimeConfig tuning;
+  for (size_t i = 0; i < directives.size(); i++) {
+    const std::string &key = directives[i].getKey();
+    const std::vector<std::string> &vals = directives[i].getValues();
+
+    if (key == "worker_connections") {
+      tuning.workerConnections = Number::toInt(vals[0]);
+    } else if (key == "epoll_events") {
+      tuning.epollMaxEvents = Number::toInt(vals[0]);
+    } else if (key == "epoll_timeout") {
+      tuning.epollWaitTimeout = static_cast<int>(Number::parseDuration(vals[0]));
+    } else if (key == "client_header_buffer_size") {
+      tuning.readBufferSize = Number::parseSize(vals[0]);
+    } else if (key == "large_client_header_buffers") {
+      tuning.maxRequestLine = Number::parseSize(vals[1]);
+      tuning.maxHeaderSize = Number::toInt(vals[0]) * tuning.maxRequestLine;
+    } else if (key == "send_chunk_size") {
+      tuning.writeChunkSize = Number::parseSize(vals[0]);
+    } else if (key == "client_header_timeout") {
+      tuning.clientHeaderTimeout = Number::parseDuration(vals[0]);
+    } else if (key == "client_body_timeout") {
+      tuning.clientBodyTimeout = Number::parseDuration(vals[0]);
+    } else if (key == "send_timeout") {
+      tuning.sendTimeout = Number::parseDuration(vals[0]);
+    } else if (key == "keepalive_timeout") {
+      tuning.keepaliveTimeout = Number::parseDuration(vals[0]);
+    } else if (key == "max_pending_requests") {
+      tuning.maxPendingRequests = Number::toInt(vals[0]);
+    } else if (key == "overload_lag") {
+      tuning.overloadLag = Number::parseDuration(vals[0]);
+    } else if (key == "limit_conn") {
+      tuning.limitConn = Number::toInt(vals[0]);
+    }
+  }
+  RuntimeConfig::set(tuning);
+}
+
 static std::string getFirstValue(
     std::map<std::string, std::vector<Directive> > &directivesMap,
     const std::string &key) {
@@ -23,6 +81,184 @@ static std::string getFirstValue(
   return "";
 }
 
+static CgiPool *cgiPoolOf(Location *location) {
+  if (!location->getCgiPool())
+    location->setCgiPool(CgiPool::create());
+  return location->getCgiPool();
+}
+
+// cgi_workers <max> [min=n] [idle=time]
+static void setCgiWorkers(CgiPool *pool, const std::vector<std::string> &vals) {
+  size_t max = Number::toInt(vals[0]);
+  size_t min = 1;
+  long idleMs = Constants::Timeout::CgiWorkerIdle * 1000L;
+  for (size_t i = 1; i < vals.size(); i++) {
+    size_t eq = vals[i].find('=');
+    std::string key = vals[i].substr(0, eq);
+    std::string arg = vals[i].substr(eq + 1);
+    if (key == "min")
+      min = Number::toInt(arg);
+    else if (key == "idle")
+      idleMs = Number::parseDuration(arg);
+  }
+  pool->setWorkers(max, min, idleMs);
+}
+
+// cgi_max_concurrency <n> [queue=n]
+static void setCgiConcurrency(CgiPool *pool, const std::vector<std::string> &vals) {
+  size_t queue = 0;
+  if (vals.size() == 2)
+    queue = Number::toInt(vals[1].substr(vals[1].find('=') + 1));
+  pool->setConcurrency(Number::toInt(vals[0]), queue);
+}
+
+// proxy_connect_timeout / proxy_read_timeout / proxy_send_timeout <time>
+static void setProxyTimeout(Location *location, const std::string &key, const std::string &value) {
+  ProxyTimeouts timeouts = location->getProxyTimeouts();
+  long ms = Number::parseDuration(value);
+  if (key == "proxy_connect_timeout")
+    timeouts.connectMs = ms;
+  else if (key == "proxy_read_timeout")
+    timeouts.readMs = ms;
+  else
+    timeouts.sendMs = ms;
+  location->setProxyTimeouts(timeouts);
+}
+
+// limit_req rate=<n>r/s|<n>r/m [burst=<n>] | off
+static RequestLimiter *createRequestLimiter(const std::vector<std::string> &vals) {
+  if (vals[0] == "off")
+    return NULL;
+  long rate = 0;
+  bool perMinute = false;
+  RequestLimiter::parseRate(vals[0].substr(5), &rate, &perMinute);
+  unsigned burst = vals.size() == 2 ? Number::toInt(vals[1].substr(6)) : 0;
+  return RequestLimiter::create(rate, perMinute, burst);
+}
+
+// access_log <path> [format] [buffer=size] [flush=time] [ring=size] | off
+static AccessLog *openAccessLog(const std::vector<std::string> &vals) {
+  if (vals.empty() || vals[0] == "off")
+    return NULL;
+  AccessLogFormat format = ACCESS_LOG_MAIN;
+  size_t bufferSize = AccessLog::DefaultBufferSize;
+  long flushIntervalMs = AccessLog::DefaultFlushIntervalMs;
+  size_t ringSize = 0;
+  for (size_t i = 1; i < vals.size(); i++) {
+    size_t eq = vals[i].find('=');
+    if (eq == std::string::npos) {
+      AccessLog::parseFormat(vals[i], &format);
+      continue;
+    }
+    std::string key = vals[i].substr(0, eq);
+    std::string arg = vals[i].substr(eq + 1);
+    if (key == "buffer")
+      bufferSize = Number::parseSize(arg);
+    else if (key == "flush")
+      flushIntervalMs = Number::parseDuration(arg);
+    else if (key == "ring")
+      ringSize = Number::parseSize(arg);
+  }
+  return AccessLog::open(vals[0], format, bufferSize, flushIntervalMs,
+                         ringSize);
+}
+
+// cache_path <dir> [max_size=size]
+static ResponseCache *openCache(const std::vector<std::string> &vals) {
+  size_t maxSize = Constants::Cache::DefaultMaxSize;
+  if (vals.size() == 2)
+    maxSize = Number::parseSize(vals[1].substr(vals[1].find('=') + 1));
+  return ResponseCache::open(vals[0], maxSize);
+}
+
+// capture <file> [max_size=size]
+static TrafficCapture *openCapture(const std::vector<std::string> &vals) {
+  size_t maxSize = Constants::Capture::DefaultMaxSize;
+  if (vals.size() == 2)
+    maxSize = Number::parseSize(vals[1].substr(vals[1].find('=') + 1));
+  return TrafficCapture::open(vals[0], maxSize);
+}
+
+// cache_valid [code ...|any] <time>; without codes: 200 301 302
+static void addCacheValidity(Location *location, const std::vector<std::string> &vals) {
+  long ms = Number::parseDuration(vals[vals.size() - 1]);
+  if (vals.size() == 1) {
+    location->addCacheValidity(Constants::HttpStatus::OK, ms);
+    location->addCacheValidity(Constants::HttpStatus::MovedPermanently, ms);
+    location->addCacheValidity(Constants::HttpStatus::Found, ms);
+    return;
+  }
+  for (size_t i = 0; i + 1 < vals.size(); i++)
+    location->addCacheValidity(vals[i] == "any" ? 0 : Number::toInt(vals[i]), ms);
+}
+
+// microcache <time> [stale=time] [max_size=size]
+static MicroCache *createMicroCache(const std::vector<std::string> &vals) {
+  long staleMs = Constants::MicroCache::DefaultStaleMs;
+  size_t maxSize = Constants::MicroCache::DefaultMaxSize;
+  for (size_t i = 1; i < vals.size(); i++) {
+    size_t eq = vals[i].find('=');
+    std::string key = vals[i].substr(0, eq);
+    std::string arg = vals[i].substr(eq + 1);
+    if (key == "stale")
+      staleMs = Number::parseDuration(arg);
+    else if (key == "max_size")
+      maxSize = Number::parseSize(arg);
+  }
+  return MicroCache::create(Number::parseDuration(vals[0]), staleMs, maxSize);
+}
+
+// Names a server's latency stats "host:port" after its (alphabetically)
+// first server_name and its first listen
+static std::string latencyLabel(const Server *server) {
+  std::string label = server->getHostnames().empty()
+                          ? "*"
+                          : *server->getHostnames().begin();
+  if (!server->getListenInterfaces().empty())
+    label += ":" + Number::toString(server->getListenInterfaces()[0].second);
+  return label;
+}
+
+// server <address> [weight=n] [max_fails=n] [fail_timeout=time]
+static void addUpstreamServer(UpstreamGroup *group, const std::vector<std::string> &vals) {
+  std::string address;
+  ProxyUpstream::parseAddress(vals[0], &address);
+  unsigned weight = 1;
+  unsigned maxFails = Constants::Upstream::DefaultMaxFails;
+  long failTimeoutMs = Constants::Upstream::DefaultFailTimeout * 1000L;
+  for (size_t i = 1; i < vals.size(); i++) {
+    size_t eq = vals[i].find('=');
+    std::string key = vals[i].substr(0, eq);
+    std::string arg = vals[i].substr(eq + 1);
+    if (key == "weight")
+      weight = Number::toInt(arg);
+    else if (key == "max_fails")
+      maxFails = Number::toInt(arg);
+    else if (key == "fail_timeout")
+      failTimeoutMs = Number::parseDuration(arg);
+  }
+  group->addPeer(ProxyUpstream::open(address), weight, maxFails, failTimeoutMs);
+}
+
+void Transformer::transformUpstream(const UpstreamConfig &upstreamConfig) {
+  UpstreamGroup *group = UpstreamGroup::define(upstreamConfig.getName());
+  const std::vector<Directive> &directives = upstreamConfig.getDirectives();
+  for (size_t i = 0; i < directives.size(); i++) {
+    const std::string &key = directives[i].getKey();
+    const std::vector<std::string> &vals = directives[i].getValues();
+    if (key == "server") {
+      addUpstreamServer(group, vals);
+    } else if (key == "least_conn") {
+      group->setMethod(UPSTREAM_LEAST_CONN, HASH_REQUEST_URI);
+    } else if (key == "hash") {
+      UpstreamHashKey hashKey = HASH_REQUEST_URI;
+      UpstreamGroup::parseHashKey(vals[0], &hashKey);
+      group->setMethod(UPSTREAM_HASH, hashKey);
+    }
+  }
+  group->build();
+}
+
 Server *Transformer::transformServer(const ServerConfig &serverConfig) {
   std::map<std::string, std::vector<Directive> > directivesMap =
       serverConfig.getDirectivesMap();
@@ -67,7 +303,7 @@ Server *Transformer::transformServer(const ServerConfig &serverConfig) {
   // client_max_body_size
   std::string maxBody = getFirstValue(directivesMap, "client_max_body_size");
   if (!maxBody.empty())
-    server->setMaxClientBodySize(Number::toInt(maxBody));
+    server->setMaxClientBodySize(Number::parseSize(maxBody));
 
   // methods
   if (directivesMap.count("methods") && !directivesMap["methods"].empty()) {
@@ -113,11 +349,41 @@ Server *Transformer::transformServer(const ServerConfig &serverConfig) {
     }
   }
 
+  // access_log
+  if (directivesMap.count("access_log") && !directivesMap["access_log"].empty())
+    server->setAccessLog(
+        openAccessLog(directivesMap["access_log"].at(0).getValues()));
+
+  // cache_path
+  if (directivesMap.count("cache_path") && !directivesMap["cache_path"].empty())
+    server->setCache(openCache(directivesMap["cache_path"].at(0).getValues()));
+
+  // capture
+  if (directivesMap.count("capture") && !directivesMap["capture"].empty())
+    server->setCapture(openCapture(directivesMap["capture"].at(0).getValues()));
+
+  // trace on|off [sample=n]
+  if (directivesMap.count("trace") && !directivesMap["trace"].empty()) {
+    const std::vector<std::string> &vals = directivesMap["trace"].at(0).getValues();
+    if (vals[0] == "on")
+      server->setTraceSample(vals.size() == 2 ? Number::toInt(vals[1].substr(7)) : 1);
+  }
+
+  // limit_req
+  if (directivesMap.count("limit_req") && !directivesMap["limit_req"].empty())
+    server->setRequestLimiter(createRequestLimiter(directivesMap["limit_req"].at(0).getValues()));
+
+  // Latency stats, one set per location
+  std::string label = latencyLabel(server);
+  server->setLatencyStats(LatencyStats::create(label, ""));
+
   // Locations
   const std::vector<LocationConfig> &locationConfigs =
       serverConfig.getLocations();
   for (size_t i = 0; i < locationConfigs.size(); i++) {
-    server->addLocation(transformLocation(locationConfigs[i], server));
+    Location *location = transformLocation(locationConfigs[i], server);
+    location->setLatencyStats(LatencyStats::create(label, location->getPath()));
+    server->addLocation(location);
   }
 
   return server;
@@ -141,7 +407,7 @@ Location *Transformer::transformLocation(const LocationConfig &locationConfig,
     } else if (key == "autoindex") {
       location->setAutoindex(vals[0] == "on");
     } else if (key == "client_max_body_size") {
-      location->setMaxClientBodySize(Number::toInt(vals[0]));
+      location->setMaxClientBodySize(Number::parseSize(vals[0]));
     } else if (key == "methods") {
       location->setMethods(vals);
     } else if (key == "error_page" && vals.size() >= 2) {
@@ -158,8 +424,47 @@ Location *Transformer::transformLocation(const LocationConfig &locationConfig,
       location->setUploadStore(vals[0]);
     } else if (key == "cgi_extension" && vals.size() == 2) {
       location->addCgiExtension(vals[0], vals[1]);
+    } else if (key == "access_log") {
+      location->setAccessLog(openAccessLog(vals));
+    } else if (key == "limit_req") {
+      location->setRequestLimiter(createRequestLimiter(vals));
+    } else if (key == "fastcgi_pass") {
+      location->setFastCgiPass(FastCgiUpstream::open(vals[0]));
+    } else if (key == "cgi_workers") {
+      setCgiWorkers(cgiPoolOf(location), vals);
+    } else if (key == "cgi_max_concurrency") {
+      setCgiConcurrency(cgiPoolOf(location), vals);
+    } else if (key == "proxy_pass") {
+      std::string host;
+      std::string uri;
+      UpstreamGroup::splitUrl(vals[0], &host, &uri);
+      UpstreamGroup *group = UpstreamGroup::find(host);
+      if (!group) {
+        std::string address;
+        ProxyUpstream::parseUrl(vals[0], &address, &uri);
+        group = UpstreamGroup::forAddress(address);
+      }
+      location->setProxyPass(group, uri);
+    } else if (key == "proxy_connect_timeout" || key == "proxy_read_timeout" ||
+               key == "proxy_send_timeout") {
+      setProxyTimeout(location, key, vals[0]);
+    } else if (key == "cache") {
+      location->setCache(vals[0] == "on" ? server->getCache() : NULL);
+    } else if (key == "cache_valid") {
+      addCacheValidity(location, vals);
+    } else if (key == "microcache") {
+      location->setMicroCache(createMicroCache(vals));
+    } else if (key == "status") {
+      location->setStatusPage(vals[0] == "on");
     }
   }
+
+  // Workers are per interpreter, including ones inherited from the server
+  if (location->getCgiPool()) {
+    const std::map<std::string, std::string> &extensions = location->getCgiExtensions();
+    for (std::map<std::string, std::string>::const_iterator it = extensions.begin(); it != extensions.end(); ++it)
+      location->getCgiPool()->addInterpreter(it->second);
+  }
   return location;
 }
 
@@ -0,0 +1,389 @@
+#include "core/AccessLog.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Number.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+std::map<std::string, AccessLog *> AccessLog::registry;
+
+// Header at the start of a ring file; entries follow it and wrap around.
+// writeOffset only grows, so readers can tell how much was overwritten.
+struct AccessLogRingHeader
+{
+  char magic[8];
+  uint64_t writeOffset;
+  uint64_t dataSize;
+};
+
+static const size_t RingHeaderSize = 64;
+static const char RingMagic[8] = {'W', 'S', 'A', 'L', 'R', 'N', 'G', '1'};
+static const size_t MaxEntrySize = 4096;
+
+AccessLogEntry::AccessLogEntry()
+    : clientIp("-"), host(NULL), method(NULL), path(NULL), version(NULL),
+      status(0), bytesSent(0), requestTimeUs(0), upstreamTimeUs(-1)
+{
+}
+
+// Bounded appender used to build one log line without allocating
+struct LineWriter
+{
+  char *out;
+  size_t capacity;
+  size_t length;
+
+  LineWriter(char *out, size_t capacity) : out(out), capacity(capacity), length(0) {}
+
+  void put(const char *data, size_t n)
+  {
+    if (n > capacity - length)
+      n = capacity - length;
+    memcpy(out + length, data, n);
+    length += n;
+  }
+
+  void put(const char *s) { put(s, strlen(s)); }
+
+  void put(char c) { put(&c, 1); }
+
+  void putUnsigned(unsigned long n)
+  {
+    char digits[Number::MaxDigits];
+    put(digits, Number::format(digits, n));
+  }
+
+  // Microseconds as seconds with millisecond precision: "0.004"
+  void putSeconds(long us)
+  {
+    if (us < 0)
+      us = 0;
+    long ms = (us + 500) / 1000;
+    putUnsigned(ms / 1000);
+    char frac[4] = {'.', char('0' + (ms / 100) % 10), char('0' + (ms / 10) % 10), char('0' + ms % 10)};
+    put(frac, sizeof(frac));
+  }
+
+  // Quotes, backslashes and control bytes are written as \xHH (or \u00HH
+  // in JSON)
+  void putEscaped(const std::string *value, bool json = false)
+  {
+    if (!value || value->empty())
+    {
+      put('-');
+      return;
+    }
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < value->size(); i++)
+    {
+      unsigned char c = (*value)[i];
+      if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f)
+      {
+        if (json)
+          put("\\u00", 4);
+        else
+          put("\\x", 2);
+        put(hex[c >> 4]);
+        put(hex[c & 0xf]);
+      }
+      else
+        put(char(c));
+    }
+  }
+};
+
+static time_t cachedSecond = 0;
+static char cachedLocal[32];
+static char cachedIso[32];
+
+static void refreshTime()
+{
+  time_t now = time(NULL);
+  if (now == cachedSecond)
+    return;
+  struct tm tm;
+  localtime_r(&now, &tm);
+  strftime(cachedLocal, sizeof(cachedLocal), "%d/%b/%Y:%H:%M:%S %z", &tm);
+  strftime(cachedIso, sizeof(cachedIso), "%Y-%m-%dT%H:%M:%S%z", &tm);
+  cachedSecond = now;
+}
+
+AccessLog::AccessLog(const std::string &path, AccessLogFormat format, size_t bufferSize,
+                     long flushIntervalMs, size_t ringSize)
+    : path(path), format(format), fd(-1), buffer(NULL), capacity(bufferSize), used(0),
+      flushIntervalMs(flushIntervalMs), oldestPendingMs(0), failing(false), ring(NULL), ringSize(0)
+{
+  if (ringSize > 0)
+  {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+      throw AccessLogOpenException();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != ringSize && ftruncate(fd, ringSize) != 0))
+    {
+      ::close(fd);
+      throw AccessLogOpenException();
+    }
+    void *mapped = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+      ::close(fd);
+      throw AccessLogOpenException();
+    }
+    ring = static_cast<char *>(mapped);
+    this->ringSize = ringSize;
+    AccessLogRingHeader *header = reinterpret_cast<AccessLogRingHeader *>(ring);
+    if (memcmp(header->magic, RingMagic, sizeof(RingMagic)) != 0 ||
+        header->dataSize != ringSize - RingHeaderSize)
+    {
+      memset(ring, 0, ringSize);
+      memcpy(header->magic, RingMagic, sizeof(RingMagic));
+      header->dataSize = ringSize - RingHeaderSize;
+    }
+    return;
+  }
+
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1)
+    throw AccessLogOpenException();
+  if (capacity > 0)
+    buffer = new char[capacity];
+}
+
+AccessLog::~AccessLog()
+{
+  if (ring)
+    munmap(ring, ringSize);
+  else
+    flush();
+  delete[] buffer;
+  if (fd != -1)
+    ::close(fd);
+}
+
+AccessLog *AccessLog::open(const std::string &path, AccessLogFormat format,
+                           size_t bufferSize, long flushIntervalMs, size_t ringSize)
+{
+  std::map<std::string, AccessLog *>::iterator it = registry.find(path);
+  if (it != registry.end())
+    return it->second;
+  AccessLog *log = new AccessLog(path, format, bufferSize, flushIntervalMs, ringSize);
+  registry[path] = log;
+  return log;
+}
+
+bool AccessLog::parseFormat(const std::string &name, AccessLogFormat *format)
+{
+  if (name == "main")
+    *format = ACCESS_LOG_MAIN;
+  else if (name == "json")
+    *format = ACCESS_LOG_JSON;
+  else
+    return false;
+  return true;
+}
+
+void AccessLog::flushDue(long long nowMs)
+{
+  for (std::map<std::string, AccessLog *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    AccessLog *log = it->second;
+    if (log->used > 0 && nowMs - log->oldestPendingMs >= log->flushIntervalMs)
+      log->flush();
+  }
+}
+
+// Milliseconds until the next buffered log must be flushed, -1 if none
+int AccessLog::nextFlushDelay(long long nowMs)
+{
+  long long best = -1;
+  for (std::map<std::string, AccessLog *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    AccessLog *log = it->second;
+    if (log->used == 0)
+      continue;
+    long long delay = log->oldestPendingMs + log->flushIntervalMs - nowMs;
+    if (delay < 0)
+      delay = 0;
+    if (best == -1 || delay < best)
+      best = delay;
+  }
+  return static_cast<int>(best);
+}
+
+void AccessLog::closeAll()
+{
+  for (std::map<std::string, AccessLog *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
+
+const std::string &AccessLog::getPath() const { return path; }
+
+void AccessLog::flush() { writeOut(NULL, 0); }
+
+// Writes the buffer and then `line`, retrying short writes. What could
+// not be written stays buffered for the next flush, as far as the buffer
+// holds it; the rest is dropped.
+void AccessLog::writeOut(const char *line, size_t length)
+{
+  size_t total = used + length;
+  size_t done = 0;
+  while (done < total)
+  {
+    struct iovec iov[2];
+    int count = 0;
+    if (done < used)
+    {
+      iov[count].iov_base = buffer + done;
+      iov[count].iov_len = used - done;
+      count++;
+    }
+    size_t lineDone = done > used ? done - used : 0;
+    if (lineDone < length)
+    {
+      iov[count].iov_base = const_cast<char *>(line) + lineDone;
+      iov[count].iov_len = length - lineDone;
+      count++;
+    }
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  if (done == total)
+  {
+    used = 0;
+    failing = false;
+    return;
+  }
+
+  if (!failing)
+    LOG_WARN("access log write failed path=" << path << " error=\"" << strerror(errno) << "\"");
+  failing = true;
+  if (done < used)
+  {
+    memmove(buffer, buffer + done, used - done);
+    used -= done;
+  }
+  else
+  {
+    line += done - used;
+    length -= done - used;
+    used = 0;
+  }
+  if (length > 0 && length <= capacity - used)
+  {
+    memcpy(buffer + used, line, length);
+    used += length;
+  }
+  if (used > 0)
+    oldestPendingMs = Timer::monotonicMs();
+}
+
+void AccessLog::write(const AccessLogEntry &entry)
+{
+  char line[MaxEntrySize];
+  size_t length = formatEntry(entry, line, sizeof(line));
+
+  if (ring)
+  {
+    appendRing(line, length);
+    return;
+  }
+
+  if (used + length <= capacity)
+  {
+    if (used == 0)
+      oldestPendingMs = Timer::monotonicMs();
+    memcpy(buffer + used, line, length);
+    used += length;
+    return;
+  }
+
+  // Buffer full (or unbuffered): hand everything to the kernel at once
+  writeOut(line, length);
+}
+
+void AccessLog::appendRing(const char *data, size_t length)
+{
+  AccessLogRingHeader *header = reinterpret_cast<AccessLogRingHeader *>(ring);
+  char *area = ring + RingHeaderSize;
+  size_t size = header->dataSize;
+  size_t offset = header->writeOffset % size;
+  size_t first = length < size - offset ? length : size - offset;
+  memcpy(area + offset, data, first);
+  memcpy(area, data + first, length - first);
+  header->writeOffset += length;
+}
+
+size_t AccessLog::formatEntry(const AccessLogEntry &entry, char *out, size_t capacity) const
+{
+  refreshTime();
+  LineWriter w(out, capacity - 1);
+
+  if (format == ACCESS_LOG_JSON)
+  {
+    w.put("{\"time\":\"");
+    w.put(cachedIso);
+    w.put("\",\"remote_addr\":\"");
+    w.put(entry.clientIp);
+    w.put("\",\"host\":\"");
+    w.putEscaped(entry.host, true);
+    w.put("\",\"method\":\"");
+    w.putEscaped(entry.method, true);
+    w.put("\",\"uri\":\"");
+    w.putEscaped(entry.path, true);
+    w.put("\",\"protocol\":\"");
+    w.putEscaped(entry.version, true);
+    w.put("\",\"status\":");
+    w.putUnsigned(entry.status);
+    w.put(",\"bytes_sent\":");
+    w.putUnsigned(entry.bytesSent);
+    w.put(",\"request_time\":");
+    w.putSeconds(entry.requestTimeUs);
+    w.put(",\"upstream_time\":");
+    if (entry.upstreamTimeUs < 0)
+      w.put("null");
+    else
+      w.putSeconds(entry.upstreamTimeUs);
+    w.put('}');
+  }
+  else
+  {
+    // main: addr host [time] "request" status bytes request_time upstream_time
+    w.put(entry.clientIp);
+    w.put(' ');
+    w.putEscaped(entry.host);
+    w.put(" [");
+    w.put(cachedLocal);
+    w.put("] \"");
+    w.putEscaped(entry.method);
+    w.put(' ');
+    w.putEscaped(entry.path);
+    w.put(' ');
+    w.putEscaped(entry.version);
+    w.put("\" ");
+    w.putUnsigned(entry.status);
+    w.put(' ');
+    w.putUnsigned(entry.bytesSent);
+    w.put(' ');
+    w.putSeconds(entry.requestTimeUs);
+    w.put(' ');
+    if (entry.upstreamTimeUs < 0)
+      w.put('-');
+    else
+      w.putSeconds(entry.upstreamTimeUs);
+  }
+  out[w.length] = '\n';
+  return w.length + 1;
+}
@@ -0,0 +1,50 @@
+#include "core/CgiEnvironment.hpp"
+#include "core/HttpRequest.hpp"
+#include "utils/Number.hpp"
+#include <cctype>
+
+static void addHeaderVariable(std::vector<std::string> &env, const HeaderField &field)
+{
+  std::string name = "HTTP_";
+  for (size_t i = 0; i < field.name.size(); i++)
+  {
+    char c = field.name[i];
+    name += (c == '-') ? '_' : static_cast<char>(toupper(c));
+  }
+  env.push_back(name + "=" + field.value);
+}
+
+void CgiEnvironment::build(std::vector<std::string> &env, const HttpRequest &request,
+                           const std::string &script, const char *clientIp, int port)
+{
+  const std::string &host = request.getHeader("host");
+  std::string uri = request.getPath();
+  if (!request.getQuery().empty())
+    uri += "?" + request.getQuery();
+
+  env.push_back("GATEWAY_INTERFACE=CGI/1.1");
+  env.push_back("SERVER_SOFTWARE=webserv");
+  env.push_back("SERVER_PROTOCOL=" + request.getVersion());
+  env.push_back("SERVER_NAME=" + host.substr(0, host.find(':')));
+  env.push_back("SERVER_PORT=" + Number::toString(port));
+  env.push_back("REQUEST_METHOD=" + request.getMethod());
+  env.push_back("REQUEST_URI=" + uri);
+  env.push_back("SCRIPT_NAME=" + request.getPath());
+  env.push_back("SCRIPT_FILENAME=" + script);
+  env.push_back("PATH_INFO=" + request.getPath());
+  env.push_back("QUERY_STRING=" + request.getQuery());
+  env.push_back("REMOTE_ADDR=" + std::string(clientIp));
+  env.push_back("REDIRECT_STATUS=200");
+  if (!request.getHeader("content-length").empty())
+    env.push_back("CONTENT_LENGTH=" + request.getHeader("content-length"));
+  if (!request.getHeader("content-type").empty())
+    env.push_back("CONTENT_TYPE=" + request.getHeader("content-type"));
+  // Proxy: would become HTTP_PROXY, which many HTTP client libraries
+  // take as their proxy setting (httpoxy)
+  for (size_t i = 0; i < request.getHeaderCount(); i++)
+  {
+    const HeaderField &field = request.getHeaderField(i);
+    if (field.name != "content-length" && field.name != "content-type" && field.name != "proxy")
+      addHeaderVariable(env, field);
+  }
+}
@@ -0,0 +1,127 @@
+#include "core/CgiOutput.hpp"
+#include "core/HttpResponse.hpp"
+#include "utils/Constants.hpp"
+#include "utils/String.hpp"
+#include <cstdlib>
+
+CgiOutput::CgiOutput(HttpResponse &response, bool keepAlive)
+    : response(response), headDone(false), failed(false), keepAlive(keepAlive)
+{
+}
+
+void CgiOutput::feed(const char *data, size_t length)
+{
+  if (failed)
+    return;
+  if (headDone)
+  {
+    response.appendStream(data, length);
+    return;
+  }
+  head.append(data, length);
+  parseHead();
+}
+
+// The script is done; a response that never got its head is a failure
+void CgiOutput::end()
+{
+  if (headDone)
+    response.endStream();
+  else
+    failed = true;
+}
+
+// Builds the response head once the header block is complete. Returns
+// false while incomplete or if it is malformed (failed is set).
+bool CgiOutput::parseHead()
+{
+  size_t end = head.find("\r\n\r\n");
+  size_t separator = 4;
+  size_t bareEnd = head.find("\n\n");
+  if (bareEnd != std::string::npos && bareEnd < end)
+  {
+    end = bareEnd;
+    separator = 2;
+  }
+  if (end == std::string::npos)
+  {
+    if (head.size() > Constants::Http::MaxHeaderSize)
+      failed = true;
+    return false;
+  }
+
+  int status = Constants::HttpStatus::OK;
+  bool hasLength = false;
+  bool hasLocation = false;
+  size_t lineStart = 0;
+  while (lineStart < end)
+  {
+    size_t lineEnd = head.find('\n', lineStart);
+    if (lineEnd == std::string::npos || lineEnd > end)
+      lineEnd = end;
+    size_t colon = head.find(':', lineStart);
+    if (colon != std::string::npos && colon < lineEnd)
+    {
+      std::string name = head.substr(lineStart, colon - lineStart);
+      if (String::equalsIgnoreCase(name, "status"))
+      {
+        status = std::atoi(head.c_str() + colon + 1);
+        if (status < 100 || status > 599)
+        {
+          failed = true;
+          return false;
+        }
+      }
+      hasLength = hasLength || String::equalsIgnoreCase(name, "content-length");
+      hasLocation = hasLocation || String::equalsIgnoreCase(name, "location");
+    }
+    lineStart = lineEnd + 1;
+  }
+  if (hasLocation && status == Constants::HttpStatus::OK)
+    status = Constants::HttpStatus::Found;
+
+  // Without a length the body ends when the script exits
+  if (!hasLength)
+    keepAlive = false;
+
+  HeaderBuilder builder = response.beginStream(status);
+  lineStart = 0;
+  while (lineStart < end)
+  {
+    size_t lineEnd = head.find('\n', lineStart);
+    if (lineEnd == std::string::npos || lineEnd > end)
+      lineEnd = end;
+    size_t colon = head.find(':', lineStart);
+    if (colon != std::string::npos && colon < lineEnd)
+    {
+      size_t valueStart = colon + 1;
+      size_t valueEnd = lineEnd;
+      while (valueStart < valueEnd && (head[valueStart] == ' ' || head[valueStart] == '\t'))
+        valueStart++;
+      while (valueEnd > valueStart && (head[valueEnd - 1] == '\r' || head[valueEnd - 1] == ' '))
+        valueEnd--;
+      std::string name = head.substr(lineStart, colon - lineStart);
+      // Status became the status line; framing headers are ours to set
+      if (!String::equalsIgnoreCase(name, "status") && !String::equalsIgnoreCase(name, "connection") &&
+          !String::equalsIgnoreCase(name, "transfer-encoding"))
+        builder.add(name.data(), name.size(), head.data() + valueStart, valueEnd - valueStart);
+    }
+    lineStart = lineEnd + 1;
+  }
+  builder.add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close").finish();
+
+  headDone = true;
+  if (head.size() > end + separator)
+    response.appendStream(head.data() + end + separator, head.size() - end - separator);
+  head.clear();
+  return true;
+}
+
+bool CgiOutput::isHeadDone() const { return headDone; }
+bool CgiOutput::hasFailed() const { return failed; }
+bool CgiOutput::getKeepAlive() const { return keepAlive; }
+
+bool CgiOutput::hasRoom() const
+{
+  return !headDone || response.getStreamBuffered() < Constants::Cgi::MaxBufferedOutput;
+}
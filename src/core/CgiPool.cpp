@@ -0,0 +1,354 @@
+#include "core/CgiPool.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Number.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <errno.h>
+#include <iostream>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+std::vector<CgiPool *> CgiPool::pools;
+
+CgiPool::CgiPool(unsigned id)
+    : id(id), maxConcurrency(0), queueLimit(0), maxWorkers(0), minWorkers(0),
+      idleMs(Constants::Timeout::CgiWorkerIdle * 1000L), running(0)
+{
+}
+
+CgiPool::~CgiPool()
+{
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    CgiWorker *worker = workers[i];
+    if (worker->pid > 0)
+    {
+      kill(worker->pid, SIGKILL);
+      waitpid(worker->pid, NULL, 0);
+    }
+    unlink(worker->socketPath.c_str());
+    delete worker;
+  }
+  for (size_t i = 0; i < exiting.size(); i++)
+  {
+    kill(exiting[i], SIGKILL);
+    waitpid(exiting[i], NULL, 0);
+  }
+}
+
+CgiPool *CgiPool::create()
+{
+  CgiPool *pool = new CgiPool(pools.size());
+  pools.push_back(pool);
+  return pool;
+}
+
+void CgiPool::setConcurrency(size_t max, size_t queue)
+{
+  maxConcurrency = max;
+  queueLimit = queue;
+}
+
+void CgiPool::setWorkers(size_t max, size_t min, long idleMs)
+{
+  maxWorkers = max;
+  minWorkers = min;
+  this->idleMs = idleMs;
+}
+
+bool CgiPool::hasWorkers() const { return maxWorkers > 0; }
+
+// Creates the worker slots for an interpreter; sockets are named after
+// the server pid, pool and slot so restarts reuse the same upstream
+void CgiPool::addInterpreter(const std::string &interpreter)
+{
+  if (maxWorkers == 0)
+    return;
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    if (workers[i]->interpreter == interpreter)
+      return;
+  }
+  for (size_t i = 0; i < maxWorkers; i++)
+  {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char digits[Number::MaxDigits];
+    std::string name = "/tmp/webserv-cgi-";
+    name.append(digits, Number::format(digits, getpid()));
+    name += '-';
+    name.append(digits, Number::format(digits, id));
+    name += '-';
+    name.append(digits, Number::format(digits, workers.size()));
+    name += ".sock";
+    if (name.size() >= sizeof(path))
+      continue;
+
+    CgiWorker *worker = new CgiWorker();
+    worker->interpreter = interpreter;
+    worker->socketPath = name;
+    worker->upstream = FastCgiUpstream::open("unix:" + name);
+    worker->pid = -1;
+    worker->busy = false;
+    worker->idleSinceMs = 0;
+    worker->spawnedMs = 0;
+    workers.push_back(worker);
+  }
+}
+
+// Concurrency cap: the configured one, and never more than one request
+// per worker
+size_t CgiPool::getLimit() const
+{
+  if (maxWorkers > 0 && (maxConcurrency == 0 || maxConcurrency > maxWorkers))
+    return maxWorkers;
+  return maxConcurrency;
+}
+
+CgiAdmission CgiPool::admit(Connection *connection)
+{
+  size_t limit = getLimit();
+  if (limit == 0 || running < limit)
+  {
+    running++;
+    return CGI_ADMITTED;
+  }
+  if (waiting.size() < queueLimit)
+  {
+    waiting.push_back(std::make_pair(connection, Timer::monotonicMs()));
+    return CGI_QUEUED;
+  }
+  return CGI_REJECTED;
+}
+
+// A running request finished; its slot goes to the longest waiter
+void CgiPool::release(EventLoop &loop)
+{
+  if (running > 0)
+    running--;
+  promote(loop);
+}
+
+void CgiPool::promote(EventLoop &loop)
+{
+  size_t limit = getLimit();
+  while (!waiting.empty() && (limit == 0 || running < limit))
+  {
+    Connection *next = waiting.front().first;
+    waiting.pop_front();
+    running++;
+    next->onCgiSlotGranted();
+    loop.markDirty(next);
+  }
+}
+
+void CgiPool::cancel(Connection *connection)
+{
+  for (std::deque<std::pair<Connection *, long long> >::iterator it = waiting.begin(); it != waiting.end(); ++it)
+  {
+    if (it->first == connection)
+    {
+      waiting.erase(it);
+      return;
+    }
+  }
+}
+
+// Prefers the most recently used idle worker so the others stay idle
+// long enough to be reaped
+CgiWorker *CgiPool::acquireWorker(const std::string &interpreter)
+{
+  CgiWorker *best = NULL;
+  CgiWorker *empty = NULL;
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    CgiWorker *worker = workers[i];
+    if (worker->interpreter != interpreter || worker->busy)
+      continue;
+    if (worker->pid > 0)
+    {
+      if (!best || worker->idleSinceMs > best->idleSinceMs)
+        best = worker;
+    }
+    else if (!empty)
+      empty = worker;
+  }
+  if (!best && empty && spawn(*empty))
+    best = empty;
+  if (!best)
+    throw CgiWorkerUnavailableException();
+  best->busy = true;
+  return best;
+}
+
+void CgiPool::releaseWorker(CgiWorker *worker)
+{
+  worker->busy = false;
+  worker->idleSinceMs = Timer::monotonicMs();
+}
+
+bool CgiPool::spawn(CgiWorker &worker)
+{
+  // Built before fork: only async-signal-safe calls in the child
+  char pathEnv[] = "PATH=/usr/local/bin:/usr/bin:/bin";
+  char *envp[] = {pathEnv, NULL};
+  char *argv[] = {const_cast<char *>(worker.interpreter.c_str()), NULL};
+
+  unlink(worker.socketPath.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return false;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, worker.socketPath.c_str(), worker.socketPath.size() + 1);
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 || listen(fd, 16) == -1)
+  {
+    LOG_ERROR("cgi worker socket failed path=" << worker.socketPath << " error=\"" << strerror(errno) << "\"");
+    close(fd);
+    return false;
+  }
+
+  worker.spawnedMs = Timer::monotonicMs();
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid == -1)
+  {
+    close(fd);
+    return false;
+  }
+  if (pid == 0)
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGPIPE, &action, NULL);
+    // Workers must not outlive a server that was killed outright
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent)
+      _exit(0);
+    if (dup2(fd, STDIN_FILENO) != -1)
+      execve(argv[0], argv, envp);
+    _exit(127);
+  }
+
+  // The worker holds the only listening copy: once it is gone, connects
+  // fail at once instead of hanging in the backlog
+  close(fd);
+  worker.pid = pid;
+  worker.idleSinceMs = worker.spawnedMs;
+  LOG_INFO("cgi worker started pid=" << pid << " interpreter=" << worker.interpreter);
+  return true;
+}
+
+void CgiPool::stop(CgiWorker &worker)
+{
+  kill(worker.pid, SIGTERM);
+  exiting.push_back(worker.pid);
+  worker.pid = -1;
+  worker.upstream->closeIdle();
+  unlink(worker.socketPath.c_str());
+}
+
+// Times out waiters, notices workers that died, retires idle ones above
+// the minimum and keeps the minimum running
+void CgiPool::maintain(EventLoop &loop, long long nowMs)
+{
+  while (!waiting.empty() && nowMs - waiting.front().second >= Constants::Timeout::CgiQueue * 1000LL)
+  {
+    Connection *connection = waiting.front().first;
+    waiting.pop_front();
+    connection->onCgiQueueTimeout();
+    loop.markDirty(connection);
+  }
+
+  for (size_t i = 0; i < exiting.size();)
+  {
+    if (waitpid(exiting[i], NULL, WNOHANG) != 0)
+    {
+      exiting[i] = exiting.back();
+      exiting.pop_back();
+    }
+    else
+      i++;
+  }
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    CgiWorker *worker = workers[i];
+    if (worker->pid > 0 && waitpid(worker->pid, NULL, WNOHANG) != 0)
+    {
+      LOG_WARN("cgi worker exited pid=" << worker->pid << " interpreter=" << worker->interpreter);
+      worker->pid = -1;
+      worker->upstream->closeIdle();
+    }
+  }
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    const std::string &interpreter = workers[i]->interpreter;
+    if (i > 0 && workers[i - 1]->interpreter == interpreter)
+      continue;
+    size_t live = 0;
+    for (size_t j = i; j < workers.size() && workers[j]->interpreter == interpreter; j++)
+      live += workers[j]->pid > 0;
+    for (size_t j = i; j < workers.size() && workers[j]->interpreter == interpreter; j++)
+    {
+      CgiWorker *worker = workers[j];
+      if (worker->pid > 0 && !worker->busy && live > minWorkers && nowMs - worker->idleSinceMs >= idleMs)
+      {
+        LOG_INFO("cgi worker idle pid=" << worker->pid << " interpreter=" << interpreter);
+        stop(*worker);
+        live--;
+      }
+      else if (worker->pid <= 0 && live < minWorkers &&
+               nowMs - worker->spawnedMs >= Constants::Cgi::WorkerRespawnDelayMs && spawn(*worker))
+        live++;
+    }
+  }
+}
+
+void CgiPool::startAll()
+{
+  for (size_t i = 0; i < pools.size(); i++)
+  {
+    CgiPool *pool = pools[i];
+    for (size_t j = 0; j < pool->workers.size(); j++)
+    {
+      CgiWorker *worker = pool->workers[j];
+      size_t started = 0;
+      for (size_t k = 0; k < j; k++)
+        started += pool->workers[k]->interpreter == worker->interpreter && pool->workers[k]->pid > 0;
+      if (started < pool->minWorkers)
+        pool->spawn(*worker);
+    }
+  }
+}
+
+void CgiPool::collect(EventLoop &loop, long long nowMs)
+{
+  for (size_t i = 0; i < pools.size(); i++)
+    pools[i]->maintain(loop, nowMs);
+}
+
+void CgiPool::closeAll()
+{
+  for (size_t i = 0; i < pools.size(); i++)
+    delete pools[i];
+  pools.clear();
+}
+
+void CgiPool::print() const
+{
+  if (maxConcurrency > 0)
+    std::cout << "      CGI max concurrency: " << maxConcurrency << " (queue " << queueLimit << ")" << std::endl;
+  if (maxWorkers > 0)
+    std::cout << "      CGI workers: " << minWorkers << "-" << maxWorkers << " (idle " << idleMs << "ms)" << std::endl;
+}
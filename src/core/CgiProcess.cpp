@@ -0,0 +1,270 @@
+#include "core/CgiProcess.hpp"
+#include "core/CgiEnvironment.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/HttpRequest.hpp"
+#include "core/HttpResponse.hpp"
+#include "core/Socket.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+std::vector<pid_t> CgiProcess::orphans;
+
+CgiPipe::CgiPipe(CgiProcess &process) : process(process), fd(-1), interest(0), watched(false) {}
+
+int CgiPipe::getFd() const { return fd; }
+
+ConnectionType CgiPipe::getType() const { return CGI_PIPE; }
+
+CgiProcess &CgiPipe::getProcess() { return process; }
+
+CgiProcess::CgiProcess(EventLoop &loop, Connection &owner, bool keepAlive)
+    : loop(loop), owner(owner), request(owner.getRequest()), response(owner.getResponse()),
+      input(*this), output(*this), reply(response, keepAlive), pid(-1), deadlineMs(0), closed(false)
+{
+}
+
+CgiProcess::~CgiProcess()
+{
+  abort();
+}
+
+CgiProcess *CgiProcess::start(EventLoop &loop, Connection &owner, const std::string &interpreter,
+                              const std::string &script, const char *clientIp, int port,
+                              bool keepAlive)
+{
+  CgiProcess *cgi = new CgiProcess(loop, owner, keepAlive);
+  try
+  {
+    cgi->spawn(interpreter, script, clientIp, port);
+    cgi->onInputReady();
+  }
+  catch (...)
+  {
+    delete cgi;
+    throw;
+  }
+  return cgi;
+}
+
+void CgiProcess::spawn(const std::string &interpreter, const std::string &script,
+                       const char *clientIp, int port)
+{
+  // Everything the child needs is built before fork: in between fork and
+  // exec only async-signal-safe calls are allowed
+  std::vector<std::string> env;
+  CgiEnvironment::build(env, request, script, clientIp, port);
+  env.push_back("PATH=/usr/local/bin:/usr/bin:/bin");
+  std::vector<char *> envp;
+  for (size_t i = 0; i < env.size(); i++)
+    envp.push_back(const_cast<char *>(env[i].c_str()));
+  envp.push_back(NULL);
+  char *argv[3] = {const_cast<char *>(interpreter.c_str()), const_cast<char *>(script.c_str()), NULL};
+  std::string directory = script.substr(0, script.rfind('/') + 1);
+
+  int in[2];
+  int out[2];
+  if (pipe2(in, O_CLOEXEC) == -1)
+    throw CgiStartException();
+  if (pipe2(out, O_CLOEXEC) == -1)
+  {
+    close(in[0]);
+    close(in[1]);
+    throw CgiStartException();
+  }
+
+  pid = fork();
+  if (pid == -1)
+  {
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    throw CgiStartException();
+  }
+  if (pid == 0)
+  {
+    // The server ignores SIGPIPE; scripts expect the default
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGPIPE, &action, NULL);
+    if (dup2(in[0], STDIN_FILENO) != -1 && dup2(out[1], STDOUT_FILENO) != -1 &&
+        chdir(directory.c_str()) == 0)
+      execve(argv[0], argv, &envp[0]);
+    _exit(127);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  input.fd = in[1];
+  output.fd = out[0];
+  try
+  {
+    Socket::setNonBlocking(input.fd);
+    Socket::setNonBlocking(output.fd);
+  }
+  catch (...)
+  {
+    abort();
+    throw CgiStartException();
+  }
+  deadlineMs = Timer::monotonicMs() + Constants::Timeout::CgiExecution * 1000LL;
+}
+
+void CgiProcess::onEvent(CgiPipe &pipe)
+{
+  if (&pipe == &input)
+    onInputReady();
+  else
+    onOutputReady();
+}
+
+// Feeds buffered request body to the script; closes its stdin at the end
+void CgiProcess::onInputReady()
+{
+  const char *data;
+  size_t length = request.getBufferedBody(&data);
+  while (length > 0 && input.fd != -1)
+  {
+    ssize_t written = write(input.fd, data, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0 && errno == EAGAIN)
+      break;
+    if (written <= 0)
+    {
+      // The script stopped reading; the rest of the body is discarded
+      closePipe(input);
+      break;
+    }
+    request.consumeBody(written);
+    length = request.getBufferedBody(&data);
+  }
+  if (input.fd == -1)
+    request.consumeBody(length);
+  else if (request.getBodyLeft() == 0)
+    closePipe(input);
+  updateInterest();
+}
+
+void CgiProcess::onOutputReady()
+{
+  char chunk[Constants::Cgi::ReadChunkSize];
+  while (output.fd != -1 && reply.hasRoom())
+  {
+    ssize_t n = read(output.fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    if (n > 0)
+    {
+      reply.feed(chunk, n);
+      if (reply.hasFailed())
+      {
+        abort();
+        return;
+      }
+      continue;
+    }
+
+    // EOF (or a read error): the script is finished
+    reply.end();
+    abort();
+    return;
+  }
+  updateInterest();
+}
+
+void CgiProcess::setInterest(CgiPipe &pipe, uint32_t events)
+{
+  if (pipe.fd == -1)
+    return;
+  // An idle pipe is removed rather than parked with no events: epoll
+  // reports hangups regardless of the mask, which would spin the loop
+  if (events == 0)
+  {
+    if (pipe.watched)
+      loop.unwatch(&pipe);
+    pipe.watched = false;
+  }
+  else if (!pipe.watched)
+  {
+    loop.watch(&pipe, events);
+    pipe.watched = true;
+  }
+  else if (pipe.interest != events)
+    loop.modify(&pipe, events);
+  pipe.interest = events;
+}
+
+// Write while body bytes are waiting; read while the client keeps up
+void CgiProcess::updateInterest()
+{
+  if (closed)
+    return;
+  const char *data;
+  setInterest(input, request.getBufferedBody(&data) > 0 ? uint32_t(EPOLLOUT) : 0);
+  setInterest(output, reply.hasRoom() ? uint32_t(EPOLLIN) : 0);
+}
+
+void CgiProcess::closePipe(CgiPipe &pipe)
+{
+  if (pipe.fd == -1)
+    return;
+  if (pipe.watched)
+    loop.unwatch(&pipe);
+  close(pipe.fd);
+  pipe.fd = -1;
+  pipe.watched = false;
+}
+
+// Closes both pipes and makes sure the child goes away; it is reaped
+// later if it has not exited yet
+void CgiProcess::abort()
+{
+  closePipe(input);
+  closePipe(output);
+  if (pid > 0)
+  {
+    if (waitpid(pid, NULL, WNOHANG) == 0)
+    {
+      kill(pid, SIGKILL);
+      orphans.push_back(pid);
+    }
+    pid = -1;
+  }
+  closed = true;
+}
+
+void CgiProcess::reapOrphans()
+{
+  for (size_t i = 0; i < orphans.size();)
+  {
+    if (waitpid(orphans[i], NULL, WNOHANG) != 0)
+    {
+      orphans[i] = orphans.back();
+      orphans.pop_back();
+    }
+    else
+      i++;
+  }
+}
+
+Connection &CgiProcess::getOwner() { return owner; }
+bool CgiProcess::isClosed() const { return closed; }
+bool CgiProcess::hasFailed() const { return reply.hasFailed(); }
+bool CgiProcess::getKeepAlive() const { return reply.getKeepAlive(); }
+
+bool CgiProcess::isExpired(long long nowMs) const
+{
+  return !closed && nowMs >= deadlineMs;
+}
@@ -0,0 +1,31 @@
+#include "core/ClientTable.hpp"
+#include <cstring>
+
+ClientTable::ClientTable(size_t size) : slots(NULL), mask(0), shift(32)
+{
+  size_t capacity = 1;
+  while (capacity < size || capacity < Window)
+  {
+    capacity <<= 1;
+    shift--;
+  }
+  slots = new ClientSlot[capacity];
+  memset(slots, 0, capacity * sizeof(ClientSlot));
+  mask = capacity - 1;
+}
+
+ClientTable::~ClientTable() { delete[] slots; }
+
+ClientSlot *ClientTable::find(uint32_t addr)
+{
+  size_t start = home(addr);
+  for (size_t i = 0; i < Window; i++)
+  {
+    ClientSlot *slot = &slots[(start + i) & mask];
+    if (slot->addr == addr)
+      return slot;
+    if (slot->addr == 0)
+      break;
+  }
+  return NULL;
+}
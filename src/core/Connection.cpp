@@ -1,35 +1,158 @@
 #include "core/Connection.hpp"
+#include "config/RuntimeConfig.hpp"
+#include "core/AccessLog.hpp"
+#include "core/CgiPool.hpp"
+#include "core/CgiProcess.hpp"
+#include "core/FastCgiRequest.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/FileIOPool.hpp"
+#include "core/LatencyStats.hpp"
 #include "core/Location.hpp"
+#include "core/Metrics.hpp"
+#include "core/MicroCache.hpp"
+#include "core/ProxyRequest.hpp"
+#include "core/ResponseCache.hpp"
 #include "core/RequestContext.hpp"
+#include "core/RequestLimiter.hpp"
 #include "core/ServerManager.hpp"
 #include "core/Socket.hpp"
+#include "core/Trace.hpp"
+#include "core/TrafficCapture.hpp"
+#include "core/UploadRequest.hpp"
+#include "utils/AllocStats.hpp"
 #include "utils/File.hpp"
 #include "utils/Number.hpp"
 #include "utils/String.hpp"
 #include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
 #include <errno.h>
-#include <iostream>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+Connection *Connection::freeList = NULL;
+size_t Connection::freeCount = 0;
+
 Connection::Connection(int fd, int port, ConnectionType type,
                        ServerManager &serverManager)
-    : fd(fd), port(port), type(type), timer(Constants::Timeout::ConnectionIdle), shouldCleanup(false),
-      serverManager(serverManager), keepAlive(false), context(NULL) {
-  buffer = new char[Constants::Buffer::ReadBufferSize];
+    : fd(fd), port(port), type(type), shouldCleanup(false),
+      serverManager(serverManager), keepAlive(false), context(NULL),
+      fileChunk(NULL), chunkLength(0), chunkSent(0), pendingFileJob(0), dispatched(false), admitted(false),
+      watchedEvents(0), cgiInterpreter(NULL), backend(NULL), upstreamStartUs(0), upload(NULL), cgiPool(NULL), cgiWorker(NULL), cgiQueued(false), cacheWait(NULL), microWait(NULL), clientAddr(0), connLimited(false), requestStartUs(0), firstByteUs(0), activityMs(Timer::monotonicMs()), headerStartMs(activityMs), backendWaitMs(Constants::Timeout::ConnectionIdle * 1000L), servedOne(false), upstreamTimeUs(-1), allocsAtStart(0), traceId(0), traceStart(0), traceFileStart(0), capture(NULL), captureId(0), detached(false), nextFree(NULL), inPool(false) {
+  buffer = new char[RuntimeConfig::get().readBufferSize];
+  strcpy(clientIp, "-");
 }
 
 Connection::~Connection() {
+  cancelCacheWait();
+  delete backend;
   delete[] buffer;
-  delete context;
+  delete[] fileChunk;
+}
+
+// Returns a released connection to its just-constructed state, keeping
+// its buffers
+void Connection::reset(int fd, int port) {
+  this->fd = fd;
+  this->port = port;
+  activityMs = headerStartMs = Timer::monotonicMs();
+  backendWaitMs = Constants::Timeout::ConnectionIdle * 1000L;
+  servedOne = false;
+  request.clear();
+  response.clear();
+  server = NULL;
+  shouldCleanup = false;
+  keepAlive = false;
+  context = NULL;
+  chunkLength = chunkSent = 0;
+  pendingFileJob = 0;
+  dispatched = false;
+  admitted = false;
+  watchedEvents = 0;
+  cgiInterpreter = NULL;
+  upload = NULL;
+  cgiPool = NULL;
+  cgiWorker = NULL;
+  cgiQueued = false;
+  strcpy(clientIp, "-");
+  clientAddr = 0;
+  connLimited = false;
+  requestStartUs = 0;
+  firstByteUs = 0;
+  upstreamTimeUs = -1;
+  traceId = 0;
+  capture = NULL;
+  captureId = 0;
+  detached = false;
+  nextFree = NULL;
+  inPool = false;
+}
+
+// The first byte of a request: its timing, header deadline and trace
+void Connection::startRequest() {
+  if (requestStartUs != 0)
+    return;
+  requestStartUs = Timer::monotonicUs();
+  if (servedOne)
+    headerStartMs = requestStartUs / 1000;
+  allocsAtStart = AllocStats::threadCount();
+  traceId = Trace::sample(serverManager.getTraceSample(port));
+  traceStart = Trace::start(traceId);
 }
 
 void Connection::readData() {
+  startRequest();
+  size_t uploaded = 0;
   while (true) {
-    ssize_t bytesRead = recv(fd, buffer, Constants::Buffer::ReadBufferSize, 0);
-    std::cout << "Read " << bytesRead << " bytes from fd " << fd << std::endl;
+    // A streamed body is only read as fast as the script takes it
+    if (dispatched && !canBufferBody())
+      break;
+    // An upload never runs dry on a fast client; let others have a turn
+    if (upload && uploaded >= Constants::Upload::MaxReadPerEvent)
+      break;
+    // A raw upload body goes from the socket to its file without a copy,
+    // unless it is being captured and has to pass through memory
+    if (upload && upload->isSplicing() && !capture) {
+      uint64_t recvStart = Trace::start(traceId);
+      ssize_t moved = upload->receive(fd);
+      Trace::record(traceId, fd, TRACE_RECV, recvStart, moved);
+      LOG_DEBUG("splice fd=" << fd << " bytes=" << moved);
+      if (moved > 0) {
+        uploaded += moved;
+        updateActivity();
+        Metrics::count(METRIC_BYTES_IN, moved);
+        continue;
+      }
+      if (moved == 0)
+        throw ConnectionClosedException();
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      throw ReadDataException();
+    }
+    char *into = buffer;
+    size_t size = RuntimeConfig::get().readBufferSize;
+    if (upload && upload->getReadBuffer()) {
+      into = upload->getReadBuffer();
+      size = Constants::Upload::ReadBufferSize;
+    }
+    uint64_t recvStart = Trace::start(traceId);
+    ssize_t bytesRead = recv(fd, into, size, 0);
+    Trace::record(traceId, fd, TRACE_RECV, recvStart, bytesRead);
+    LOG_DEBUG("recv fd=" << fd << " bytes=" << bytesRead);
     if (bytesRead > 0) {
-      request.appendData(buffer, bytesRead);
+      updateActivity();
+      Metrics::count(METRIC_BYTES_IN, bytesRead);
+      if (capture)
+        capture->record(CAPTURE_DATA, captureId, port, into, bytesRead);
+      request.appendData(into, bytesRead);
+      if (upload) {
+        uploaded += bytesRead;
+        upload->onInputReady();
+      }
     } else if (bytesRead == 0) {
       throw ConnectionClosedException();
     } else {
@@ -38,31 +161,59 @@ void Connection::readData() {
       throw ReadDataException();
     }
   }
+  parseInput();
+}
 
+  // Parses what has been received and starts answering the request once
+  // it is complete
+  void Connection::parseInput() {
+    uint64_t parseStart = Trace::start(traceId);
     request.parse();
+    Trace::record(traceId, fd, TRACE_PARSE, parseStart);
     if (request.getState() == PARSE_PROCESS_HEADERS) {
       processHeaders();
       if (request.getState() != PARSE_ERROR) {
         request.setState(PARSE_BODY);
+        parseStart = Trace::start(traceId);
         request.parse();
+        Trace::record(traceId, fd, TRACE_PARSE, parseStart);
       }
     }
   
+    // An error answered while resolving the headers (413 before a large
+    // upload) still goes out; the connection closes after it
     if (request.getState() == PARSE_ERROR) {
-      shouldCleanup = true;
+      if (response.getState() == RESPONSE_IDLE)
+        shouldCleanup = true;
+      keepAlive = false;
     }
 
-    if (request.getState() == PARSE_SUCCESS) {
-      prepareResponse();
+    if (request.getState() == PARSE_SUCCESS && !dispatched) {
+      dispatched = true;
+      admitted = serverManager.getEventLoop().admitRequest();
+      if (admitted) {
+        prepareResponse();
+      } else {
+        response.prepareOverloaded();
+        keepAlive = false;
+      }
     }
+
+    if (backend)
+      backend->onInputReady();
   }
   
   void Connection::writeData() {
     if (response.getState() == RESPONSE_SENDING_HEADERS) {
       const std::string &headers = response.getHeadersBuffer();
       size_t sent = response.getHeadersSent();
+      uint64_t sendStart = Trace::start(traceId);
       ssize_t bytes = send(fd, headers.c_str() + sent, headers.size() - sent, 0);
+      Trace::record(traceId, fd, TRACE_SEND, sendStart, bytes);
       if (bytes > 0) {
+        updateActivity();
+        if (sent == 0)
+          firstByteUs = Timer::monotonicUs();
         response.updateHeadersSent(bytes);
       } else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
         shouldCleanup = true;
@@ -70,31 +221,59 @@ void Connection::readData() {
     }
 
     if (response.getState() == RESPONSE_SENDING_BODY) {
-      if (response.getFileFd() != -1) {
-        // Stream from file
-        char chunk[Constants::Buffer::WriteChunkSize];
-        ssize_t bytesRead = read(response.getFileFd(), chunk, sizeof(chunk));
-        
-        if (bytesRead > 0) {
-          ssize_t bytesSent = send(fd, chunk, bytesRead, 0);
+      if (response.isStreaming()) {
+        // CGI output; may be empty while the script is still working
+        const std::string &body = response.getStringBody();
+        size_t offset = response.getStreamOffset();
+        if (offset < body.size()) {
+          uint64_t sendStart = Trace::start(traceId);
+          ssize_t bytes = send(fd, body.data() + offset, body.size() - offset, 0);
+          Trace::record(traceId, fd, TRACE_SEND, sendStart, bytes);
+          if (bytes > 0) {
+            updateActivity();
+            response.updateBodySent(bytes);
+            if (backend)
+              backend->updateInterest();
+          } else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            shouldCleanup = true;
+          }
+        }
+      } else if (response.usesSendfile()) {
+        // Cached entry: the kernel copies straight from its file
+        size_t remaining = response.getFileSize() - response.getBodySent();
+        off_t offset = response.getFileOffset() + response.getBodySent();
+        uint64_t sendStart = Trace::start(traceId);
+        ssize_t bytesSent = remaining > 0 ? sendfile(fd, response.getFileFd(), &offset, remaining) : 0;
+        Trace::record(traceId, fd, TRACE_SEND, sendStart, bytesSent);
+        if (bytesSent > 0 || remaining == 0) {
+          updateActivity();
+          response.updateBodySent(bytesSent);
+        } else if (bytesSent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+          shouldCleanup = true; // the entry's file was truncated under us
+        }
+      } else if (response.getFileFd() != -1) {
+        // Stream from file, one staged chunk at a time
+        if (chunkSent < chunkLength || fillFileChunk()) {
+          uint64_t sendStart = Trace::start(traceId);
+          ssize_t bytesSent = send(fd, fileChunk + chunkSent, chunkLength - chunkSent, 0);
+          Trace::record(traceId, fd, TRACE_SEND, sendStart, bytesSent);
           if (bytesSent > 0) {
+            updateActivity();
+            chunkSent += bytesSent;
             response.updateBodySent(bytesSent);
-            // If we didn't send everything we read, we need to seek back
-            if (bytesSent < bytesRead) {
-              lseek(response.getFileFd(), bytesSent - bytesRead, SEEK_CUR);
-            }
           } else if (bytesSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             shouldCleanup = true;
           }
-        } else {
-          response.updateBodySent(0); // Mark as finished if nothing to read
         }
       } else {
         // Stream from string
         const std::string &body = response.getStringBody();
         size_t sent = response.getBodySent();
+        uint64_t sendStart = Trace::start(traceId);
         ssize_t bytes = send(fd, body.c_str() + sent, body.size() - sent, 0);
+        Trace::record(traceId, fd, TRACE_SEND, sendStart, bytes);
         if (bytes > 0) {
+          updateActivity();
           response.updateBodySent(bytes);
         } else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
           shouldCleanup = true;
@@ -103,20 +282,61 @@ void Connection::readData() {
     }
 
     if (response.getState() == RESPONSE_FINISHED) {
+      logAccess();
       if (!keepAlive) {
         shouldCleanup = true;
       } else {
         // Reset for next request if keep-alive
-        request.clear();
+        request.next();
         response.clear();
-        // We need to tell the event loop to switch back to EPOLLIN
-        // This is usually done by the event loop itself or by returning a status
-        // In this architecture, we might need a way to trigger EPOLL_CTL_MOD
+        chunkLength = chunkSent = 0;
+        dispatched = false;
+        finishRequest();
+        cgiInterpreter = NULL;
+        backendWaitMs = Constants::Timeout::ConnectionIdle * 1000L;
+        servedOne = true;
+        // A pipelined request already read has no recv event to wait for
+        if (request.hasPendingData()) {
+          startRequest();
+          parseInput();
+        }
       }
     }
   }
 
+  void Connection::logAccess() {
+    Metrics::countResponse(response.getStatusCode());
+    Metrics::count(METRIC_BYTES_OUT, response.getHeadersSent() + response.getBodySent());
+    long long nowUs = Timer::monotonicUs();
+    LatencyStats *latency = context ? context->getLatencyStats() : NULL;
+    if (latency && requestStartUs != 0)
+      latency->record((firstByteUs ? firstByteUs : nowUs) - requestStartUs, nowUs - requestStartUs);
+    AccessLog *log = context ? context->getAccessLog() : NULL;
+    if (log) {
+      AccessLogEntry entry;
+      entry.clientIp = clientIp;
+      entry.host = &request.getHeader("host");
+      entry.method = &request.getMethod();
+      entry.path = &request.getPath();
+      entry.version = &request.getVersion();
+      entry.status = response.getStatusCode();
+      entry.bytesSent = response.getHeadersSent() + response.getBodySent();
+      entry.requestTimeUs = nowUs - requestStartUs;
+      entry.upstreamTimeUs = upstreamTimeUs;
+      log->write(entry);
+    }
+    if (AllocStats::enabled())
+      LOG_INFO("request allocs fd=" << fd << " status=" << response.getStatusCode()
+               << " count=" << (AllocStats::threadCount() - allocsAtStart));
+    Trace::record(traceId, fd, TRACE_REQUEST, traceStart, response.getStatusCode());
+    traceId = 0;
+    requestStartUs = 0;
+    firstByteUs = 0;
+    upstreamTimeUs = -1;
+  }
+
   void Connection::prepareResponse() {
+    TraceScope span(traceId, fd, TRACE_PREPARE);
     if (!context) {
       response.prepareFromError(Constants::HttpStatus::InternalServerError, "Request Context Missing");
       return;
@@ -127,30 +347,293 @@ void Connection::readData() {
       return;
     }
 
-    std::string root = context->getRoot();
-    std::string path = request.getPath();
-    std::string fullPath = root + path;
+    if (context->hasStatusPage()) {
+      serveStatus();
+      return;
+    }
+
+    if (context->getMicroCache() && serveFromMicroCache())
+      return;
+    if (context->getCache() && serveFromCache())
+      return;
+    dispatchRequest();
+  }
+
+  // status on: the server's counters and latencies, as text or, with
+  // ?format=prometheus, in the Prometheus exposition format; with
+  // ?format=trace, the sampled request traces as Chrome trace-event JSON
+  void Connection::serveStatus() {
+    if (request.getMethod() != "GET") {
+      response.prepareFromError(Constants::HttpStatus::MethodNotAllowed);
+      keepAlive = false;
+      return;
+    }
+    const EventLoop &loop = serverManager.getEventLoop();
+    ConnectionCounts connections = loop.countConnections();
+    std::string body;
+    std::string query = "&" + request.getQuery() + "&";
+    if (query.find("&format=trace&") != std::string::npos) {
+      Trace::renderChrome(body);
+      response.prepareFromString(Constants::HttpStatus::OK, "application/json", body, keepAlive);
+    } else if (query.find("&format=prometheus&") != std::string::npos) {
+      Metrics::renderPrometheus(body, connections, loop.getLoopLag());
+      LatencyStats::renderPrometheus(body);
+      response.prepareFromString(Constants::HttpStatus::OK, "text/plain; version=0.0.4", body, keepAlive);
+    } else {
+      Metrics::renderText(body, connections, loop.getLoopLag());
+      LatencyStats::renderText(body);
+      response.prepareFromString(Constants::HttpStatus::OK, "text/plain", body, keepAlive);
+    }
+  }
+
+  // Hands the request to its backend, or resolves the file it names
+  void Connection::dispatchRequest() {
+    if (context->getFastCgiPass()) {
+      startFastCgi();
+      return;
+    }
+
+    if (context->getProxyPass()) {
+      startProxy();
+      return;
+    }
 
-    if (File::isDirectory(fullPath)) {
-      if (!fullPath.empty() && fullPath[fullPath.size() - 1] != '/') {
-        // Handle directory redirect for missing trailing slash
-        response.prepareRedirect(Constants::HttpStatus::MovedPermanently, path + "/");
+    if (isUpload()) {
+      if (!allowsMethod()) {
+        response.prepareFromError(Constants::HttpStatus::MethodNotAllowed);
+        keepAlive = false;
         return;
       }
-      fullPath += context->getIndex();
+      startUpload();
+      return;
     }
 
-    if (!File::exists(fullPath)) {
-      response.prepareFromError(Constants::HttpStatus::NotFound);
-    } else if (!File::isFile(fullPath)) {
-      response.prepareFromError(Constants::HttpStatus::Forbidden, "Not a regular file");
+    // Nothing else takes a PUT but a script
+    if (request.getMethod() == "PUT" && !cgiInterpreter) {
+      response.prepareFromError(Constants::HttpStatus::MethodNotAllowed);
+      keepAlive = false;
+      return;
+    }
+
+    // stat/open can stall on a cold cache; resolve on the file I/O pool
+    FileIOPool &pool = serverManager.getEventLoop().getFileIO();
+    FileJob *job = pool.acquire();
+    job->type = FILE_JOB_OPEN;
+    job->ownerFd = fd;
+    job->path.assign(context->getRoot());
+    job->path.append(request.getPath());
+    job->index.assign(context->getIndex());
+    pendingFileJob = job->id;
+    traceFileStart = Trace::start(traceId);
+    pool.submit(job);
+  }
+
+  // What a cache may answer: a plain GET for a backend
+  bool Connection::isCacheable() const {
+    bool backed = context->getFastCgiPass() || context->getProxyPass() || cgiInterpreter;
+    return backed && request.getMethod() == "GET" && request.getHeader("authorization").empty() &&
+           request.getHeader("range").empty();
+  }
+
+  // Whose response it is: servers naming the same cache_path share one
+  // cache, so the key starts with the server (its first listen and name)
+  // and the backend it came from
+  std::string Connection::cacheScope() const {
+    const Server *owner = context->getServer();
+    std::string scope;
+    const std::vector<std::pair<std::string, int> > &listens = owner->getListenInterfaces();
+    if (!listens.empty())
+      scope = listens[0].first + ":" + Number::toString(listens[0].second);
+    if (!owner->getHostnames().empty())
+      scope += " " + *owner->getHostnames().begin();
+    if (context->getProxyPass())
+      scope += " proxy " + context->getProxyPass()->getName() + context->getProxyUri();
+    else if (context->getFastCgiPass())
+      scope += " fastcgi " + context->getFastCgiPass()->getAddress() + " " + context->getRoot();
+    else
+      scope += " cgi " + context->getRoot();
+    return scope;
+  }
+
+  // The host, lowercased as names are, then the path and query
+  std::string Connection::cacheUri() const {
+    std::string uri = String::toLower(request.getHeader("host")) + request.getPath();
+    if (!request.getQuery().empty())
+      uri += "?" + request.getQuery();
+    return uri;
+  }
+
+  // cache on: a fresh entry answers the request; a miss waits for the
+  // fill of the same key already running, or becomes it. True when the
+  // request is answered or parked.
+  bool Connection::serveFromCache() {
+    if (!isCacheable())
+      return false;
+    ResponseCache *cache = context->getCache();
+    std::string key = cacheScope() + " " + cacheUri();
+    if (cache->serve(key, response, keepAlive)) {
+      Metrics::count(METRIC_CACHE_HITS);
+      return true;
+    }
+    if (cache->wait(key, this)) {
+      cacheWait = cache;
+      cacheKey = key;
+      return true;
+    }
+    Metrics::count(METRIC_CACHE_MISSES);
+    response.setCacheFill(cache->startFill(serverManager.getEventLoop(), key, context->getCacheValidity()));
+    return false;
+  }
+
+  // microcache: the same, in memory and keyed by method as well; each
+  // location has its own, so the server and backend are implied. A stale
+  // entry the request cannot be answered from makes it the refresh.
+  bool Connection::serveFromMicroCache() {
+    if (!isCacheable())
+      return false;
+    MicroCache *cache = context->getMicroCache();
+    std::string key = request.getMethod() + " " + cacheUri();
+    if (cache->serve(key, response, keepAlive)) {
+      Metrics::count(METRIC_CACHE_HITS);
+      return true;
+    }
+    if (cache->wait(key, this)) {
+      microWait = cache;
+      cacheKey = key;
+      return true;
+    }
+    Metrics::count(METRIC_CACHE_MISSES);
+    response.setCacheFill(cache->startFill(serverManager.getEventLoop(), key));
+    return false;
+  }
+
+  // The fill this request waited for is over; if it was not stored (or
+  // the wait timed out) the request goes to the backend uncached
+  void Connection::onCacheFilled(bool stored) {
+    ResponseCache *cache = cacheWait;
+    cacheWait = NULL;
+    if (stored && cache->serve(cacheKey, response, keepAlive)) {
+      Metrics::count(METRIC_CACHE_HITS);
     } else {
-      response.prepareFromFile(fullPath, Constants::HttpStatus::OK);
+      Metrics::count(METRIC_CACHE_MISSES);
+      dispatchRequest();
+    }
+    cacheKey.clear();
+  }
+
+  void Connection::onMicroCacheFilled(bool stored) {
+    MicroCache *cache = microWait;
+    microWait = NULL;
+    if (stored && cache->serve(cacheKey, response, keepAlive)) {
+      Metrics::count(METRIC_CACHE_HITS);
+    } else {
+      Metrics::count(METRIC_CACHE_MISSES);
+      dispatchRequest();
+    }
+    cacheKey.clear();
+  }
+
+  void Connection::cancelCacheWait() {
+    if (cacheWait)
+      cacheWait->cancel(cacheKey, this);
+    if (microWait)
+      microWait->cancel(cacheKey, this);
+    cacheWait = NULL;
+    microWait = NULL;
+    cacheKey.clear();
+  }
+
+  // Refills fileChunk from the response file. Cached data is read inline;
+  // otherwise the read goes to the pool and the connection parks.
+  bool Connection::fillFileChunk() {
+    if (!fileChunk)
+      fileChunk = new char[RuntimeConfig::get().writeChunkSize];
+    off_t offset = response.getBodySent();
+    size_t wanted = std::min(RuntimeConfig::get().writeChunkSize,
+                             response.getFileSize() - response.getBodySent());
+    uint64_t readStart = Trace::start(traceId);
+    ssize_t bytesRead = File::readCached(response.getFileFd(), fileChunk, wanted, offset);
+    Trace::record(traceId, fd, TRACE_FILE_READ, readStart, bytesRead);
+    if (bytesRead > 0) {
+      chunkLength = bytesRead;
+      chunkSent = 0;
+      return true;
+    }
+    if (bytesRead == 0) {
+      response.updateBodySent(response.getFileSize()); // truncated under us
+      return false;
+    }
+    if (errno != EAGAIN) {
+      shouldCleanup = true;
+      return false;
+    }
+
+    int readFd = dup(response.getFileFd());
+    if (readFd == -1) {
+      shouldCleanup = true;
+      return false;
+    }
+    FileIOPool &pool = serverManager.getEventLoop().getFileIO();
+    FileJob *job = pool.acquire();
+    job->type = FILE_JOB_READ;
+    job->ownerFd = fd;
+    job->fd = readFd;
+    job->offset = offset;
+    job->length = wanted;
+    pendingFileJob = job->id;
+    traceFileStart = Trace::start(traceId);
+    pool.submit(job);
+    return false;
+  }
+
+  void Connection::onFileJobDone(FileJob &job) {
+    pendingFileJob = 0;
+    if (job.type == FILE_JOB_READ)
+      Trace::record(traceId, fd, TRACE_FILE_READ, traceFileStart, job.bytes);
+    else
+      Trace::record(traceId, fd, TRACE_FILE_OPEN, traceFileStart);
+    if (job.type == FILE_JOB_READ) {
+      if (job.bytes <= 0) {
+        if (job.bytes < 0)
+          shouldCleanup = true;
+        else
+          response.updateBodySent(response.getFileSize());
+        return;
+      }
+      memcpy(fileChunk, job.data, job.bytes);
+      chunkLength = job.bytes;
+      chunkSent = 0;
+      return;
+    }
+
+    switch (job.status) {
+    case FILE_OK:
+      if (cgiInterpreter) {
+        close(job.fd);
+        job.fd = -1;
+        startCgi(job.path);
+        break;
+      }
+      response.prepareFromFd(job.fd, job.size, job.path, Constants::HttpStatus::OK);
+      job.fd = -1;
+      break;
+    case FILE_IS_DIRECTORY:
+      // Handle directory redirect for missing trailing slash
+      response.prepareRedirect(Constants::HttpStatus::MovedPermanently, request.getPath() + "/");
+      break;
+    case FILE_NOT_REGULAR:
+      response.prepareFromError(Constants::HttpStatus::Forbidden, "Not a regular file");
+      break;
+    default:
+      response.prepareFromError(Constants::HttpStatus::NotFound);
+      break;
     }
   }
   
   void Connection::processHeaders() {
+    TraceScope span(traceId, fd, TRACE_PROCESS_HEADERS);
     resolveConnectionHeaders();
+    uint64_t resolveStart = Trace::start(traceId);
     Server *server = serverManager.resolveServerForRequest(request, port);
   
     if (server == NULL) {
@@ -163,48 +646,407 @@ void Connection::readData() {
     // match the path
     Location *location = server->matchPath(request.getPath());
     if (location != NULL) {
-      std::cout << "Matched location: " << location->getPath() << std::endl;
+      LOG_DEBUG("location matched fd=" << fd << " location=" << location->getPath());
     } else {
-      std::cout << "No matching location found for path: " << request.getPath()
-                << std::endl;
+      LOG_DEBUG("location none fd=" << fd << " path=" << request.getPath());
+    }
+    requestContext = RequestContext(server, location, &request);
+    context = &requestContext;
+    Trace::record(traceId, fd, TRACE_RESOLVE, resolveStart);
+
+    // limit_req: a client over its rate costs one table lookup, timed by
+    // the request's first byte
+    RequestLimiter *limiter = context->getRequestLimiter();
+    if (limiter && !limiter->allow(clientAddr, requestStartUs)) {
+      Metrics::count(METRIC_LIMITED_REQUESTS);
+      request.setErrorCode(Constants::HttpStatus::TooManyRequests);
+      response.prepareRateLimited();
+      return;
+    }
+
+    // Only Content-Length delimits a body here: a chunked one would reach
+    // a backend empty and its chunks be read as the next request
+    if (!request.getHeader("transfer-encoding").empty()) {
+      request.setErrorCode(Constants::HttpStatus::LengthRequired);
+      response.prepareFromError(Constants::HttpStatus::LengthRequired);
+      return;
     }
-    delete context;
-    context = new RequestContext(server, location, &request);
 
     // Enforce max body size
-    std::string clHeader = request.getHeader("content-length");
+    const std::string &clHeader = request.getHeader("content-length");
     if (!clHeader.empty()) {
-      size_t contentLength = Number::toInt(clHeader);
+      bool valid;
+      size_t contentLength = Number::toSize(clHeader, &valid);
+      if (!valid) {
+        request.setErrorCode(Constants::HttpStatus::BadRequest);
+        response.prepareFromError(Constants::HttpStatus::BadRequest, "Invalid Content-Length");
+        return;
+      }
       if (contentLength > context->getMaxClientBodySize()) {
         request.setErrorCode(Constants::HttpStatus::PayloadTooLarge);
         response.prepareFromError(Constants::HttpStatus::PayloadTooLarge);
         return;
       }
     }
+
+    // Backend bodies go to the script as they arrive instead of being buffered
+    bool passed = context->getFastCgiPass() || context->getProxyPass();
+    cgiInterpreter = passed ? NULL : findCgiInterpreter();
+
+    // upload_store only writes for the methods the location lists;
+    // refused before any of the body is read
+    if (isUpload() && !allowsMethod()) {
+      request.setErrorCode(Constants::HttpStatus::MethodNotAllowed);
+      response.prepareFromError(Constants::HttpStatus::MethodNotAllowed);
+      return;
+    }
+    if (cgiInterpreter || passed || isUpload())
+      request.setBodyStreaming(true);
+
+    // A client holding its body back for the interim reply would otherwise
+    // wait out its own timeout; the reply is tiny, a short send is let go
+    if (String::equalsIgnoreCase(request.getHeader("expect"), "100-continue") && !clHeader.empty() &&
+        request.getVersion() == "HTTP/1.1") {
+      static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      send(fd, interim, sizeof(interim) - 1, MSG_NOSIGNAL);
+    }
+  }
+
+  // A POST or PUT to an upload_store location that no script or backend
+  // answers
+  bool Connection::isUpload() const {
+    const std::string &method = request.getMethod();
+    return (method == "POST" || method == "PUT") && !context->getUploadStore().empty() && !cgiInterpreter &&
+           !context->getFastCgiPass() && !context->getProxyPass();
+  }
+
+  // Whether the location's methods directive lists the request's method
+  bool Connection::allowsMethod() const {
+    const std::vector<std::string> &methods = context->getMethods();
+    return std::find(methods.begin(), methods.end(), request.getMethod()) != methods.end();
+  }
+
+  // A multipart POST is split into its files; any other body is the file
+  // named by the last component of the path
+  void Connection::startUpload() {
+    std::string boundary;
+    std::string fileName;
+    bool multipart = request.getMethod() == "POST" &&
+                     MultipartParser::parseBoundary(request.getHeader("content-type"), &boundary);
+    if (!multipart) {
+      const std::string &path = request.getPath();
+      fileName = UploadRequest::safeFileName(path.substr(path.rfind('/') + 1));
+      if (fileName.empty()) {
+        response.prepareFromError(request.getMethod() == "POST" ? Constants::HttpStatus::UnsupportedMediaType
+                                                                : Constants::HttpStatus::BadRequest,
+                                  "Expected multipart/form-data or a file name in the path");
+        keepAlive = false;
+        return;
+      }
+    }
+    try {
+      upstreamStartUs = Timer::monotonicUs();
+      EventLoop &loop = serverManager.getEventLoop();
+      if (multipart)
+        upload = UploadRequest::start(loop, *this, context->getUploadStore(), boundary, keepAlive);
+      else
+        upload = UploadRequest::startRaw(loop, *this, context->getUploadStore(), fileName, keepAlive);
+      backend = upload;
+    } catch (const std::exception &e) {
+      LOG_ERROR("upload start failed fd=" << fd << " store=" << context->getUploadStore() << " error=\""
+                << e.what() << "\"");
+      response.prepareFromError(Constants::HttpStatus::InternalServerError);
+      keepAlive = false;
+    }
+  }
+
+  // Interpreter configured for the extension of the request path, if any
+  const std::string *Connection::findCgiInterpreter() const {
+    const std::map<std::string, std::string> &extensions = context->getCgiExtensions();
+    if (extensions.empty())
+      return NULL;
+    const std::string &path = request.getPath();
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+      return NULL;
+    std::map<std::string, std::string>::const_iterator it = extensions.find(path.substr(dot));
+    return it == extensions.end() ? NULL : &it->second;
+  }
+
+  // A location with CGI limits admits the script, queues it until a slot
+  // frees up, or refuses it with a 503
+  void Connection::startCgi(const std::string &script) {
+    CgiPool *pool = context->getCgiPool();
+    if (pool) {
+      CgiAdmission admission = pool->admit(this);
+      if (admission == CGI_REJECTED) {
+        LOG_WARN("cgi at capacity fd=" << fd << " script=" << script);
+        response.prepareFromError(Constants::HttpStatus::ServiceUnavailable);
+        keepAlive = false;
+        return;
+      }
+      cgiPool = pool;
+      if (admission == CGI_QUEUED) {
+        cgiQueued = true;
+        cgiScript = script;
+        return;
+      }
+    }
+    launchCgi(script);
+  }
+
+  void Connection::launchCgi(const std::string &script) {
+    try {
+      upstreamStartUs = Timer::monotonicUs();
+      if (cgiPool && cgiPool->hasWorkers()) {
+        cgiWorker = cgiPool->acquireWorker(*cgiInterpreter);
+        backend = FastCgiRequest::start(serverManager.getEventLoop(), *cgiWorker->upstream, *this, script,
+                                        clientIp, port, keepAlive);
+      } else {
+        backend = CgiProcess::start(serverManager.getEventLoop(), *this, *cgiInterpreter, script,
+                                    clientIp, port, keepAlive);
+      }
+      LOG_DEBUG("cgi start fd=" << fd << " script=" << script);
+    } catch (const std::exception &e) {
+      LOG_ERROR("cgi start failed fd=" << fd << " script=" << script << " error=\"" << e.what() << "\"");
+      response.prepareFromError(Constants::HttpStatus::InternalServerError);
+      keepAlive = false;
+      releaseCgiSlot();
+    }
+  }
+
+  void Connection::onCgiSlotGranted() {
+    cgiQueued = false;
+    launchCgi(cgiScript);
+    cgiScript.clear();
+  }
+
+  // The pool already dropped this request from its queue
+  void Connection::onCgiQueueTimeout() {
+    LOG_WARN("cgi queue timeout fd=" << fd << " script=" << cgiScript);
+    Metrics::count(METRIC_TIMEOUTS);
+    cgiPool = NULL;
+    cgiQueued = false;
+    cgiScript.clear();
+    response.prepareFromError(Constants::HttpStatus::ServiceUnavailable);
+    keepAlive = false;
+  }
+
+  // Gives back the worker and the concurrency slot (or the queue place);
+  // the slot may go straight to a waiting connection
+  void Connection::releaseCgiSlot() {
+    if (!cgiPool)
+      return;
+    CgiPool *pool = cgiPool;
+    cgiPool = NULL;
+    if (cgiQueued) {
+      cgiQueued = false;
+      cgiScript.clear();
+      pool->cancel(this);
+      return;
+    }
+    if (cgiWorker)
+      pool->releaseWorker(cgiWorker);
+    cgiWorker = NULL;
+    pool->release(serverManager.getEventLoop());
+  }
+
+  // Gives back the event loop's pending slot, if the request took one
+  void Connection::finishRequest() {
+    if (!admitted)
+      return;
+    admitted = false;
+    serverManager.getEventLoop().finishRequest();
+  }
+
+  void Connection::startFastCgi() {
+    std::string script = context->getRoot() + request.getPath();
+    try {
+      upstreamStartUs = Timer::monotonicUs();
+      backend = FastCgiRequest::start(serverManager.getEventLoop(), *context->getFastCgiPass(), *this,
+                                      script, clientIp, port, keepAlive);
+    } catch (const std::exception &e) {
+      LOG_ERROR("fastcgi start failed fd=" << fd << " upstream=" << context->getFastCgiPass()->getAddress()
+                << " error=\"" << e.what() << "\"");
+      response.prepareFromError(Constants::HttpStatus::BadGateway);
+      keepAlive = false;
+    }
+  }
+
+  // proxy_pass http://host/uri replaces the matched location prefix with
+  // uri; without a uri the path goes upstream unchanged
+  void Connection::startProxy() {
+    std::string uri = request.getPath();
+    const std::string &prefix = context->getLocation()->getPath();
+    if (!context->getProxyUri().empty() && uri.compare(0, prefix.size(), prefix) == 0)
+      uri = context->getProxyUri() + uri.substr(prefix.size());
+
+    // The upstream timeouts, not the client idle limit, bound the wait
+    const ProxyTimeouts &timeouts = context->getProxyTimeouts();
+    long longestMs = std::max(timeouts.connectMs, std::max(timeouts.readMs, timeouts.sendMs));
+    setBackendWait(std::max(backendWaitMs, longestMs + 1000));
+    try {
+      upstreamStartUs = Timer::monotonicUs();
+      backend = ProxyRequest::start(serverManager.getEventLoop(), *context->getProxyPass(), *this, uri,
+                                    clientIp, keepAlive, timeouts);
+    } catch (const std::exception &e) {
+      LOG_ERROR("proxy start failed fd=" << fd << " upstream=" << context->getProxyPass()->getName()
+                << " error=\"" << e.what() << "\"");
+      response.prepareFromError(Constants::HttpStatus::BadGateway);
+      keepAlive = false;
+    }
+  }
+
+  // Called after the backend made progress. Once it is closed it is
+  // detached; a failure before the head went out becomes a 502, after
+  // it the connection can only be dropped.
+  void Connection::onBackendProgress() {
+    if (!backend || !backend->isClosed())
+      return;
+    bool failed = backend->hasFailed();
+    finishBackend();
+    if (!failed)
+      return;
+    LOG_WARN("backend produced no valid response fd=" << fd << " path=" << request.getPath());
+    if (response.getState() == RESPONSE_IDLE) {
+      response.prepareFromError(Constants::HttpStatus::BadGateway);
+      keepAlive = false;
+    } else {
+      shouldCleanup = true;
+    }
+  }
+
+  // Kills a script that overran its time limit. Before the head went out
+  // the client gets a 504; after, the connection can only be dropped.
+  bool Connection::checkBackendTimeout(long long nowMs) {
+    if (!backend || !backend->isExpired(nowMs))
+      return false;
+    LOG_WARN("backend timeout fd=" << fd << " path=" << request.getPath());
+    Metrics::count(METRIC_TIMEOUTS);
+    finishBackend();
+    if (response.getState() == RESPONSE_IDLE) {
+      response.prepareFromError(Constants::HttpStatus::GatewayTimeout);
+      keepAlive = false;
+    } else {
+      shouldCleanup = true;
+    }
+    return true;
+  }
+
+  // Detaches the backend; the EventLoop frees it once the current batch
+  // of events no longer refers to it
+  void Connection::finishBackend() {
+    backend->abort();
+    keepAlive = keepAlive && backend->getKeepAlive() && request.getBodyLeft() == 0;
+    upstreamTimeUs = Timer::monotonicUs() - upstreamStartUs;
+    serverManager.getEventLoop().retireBackend(backend);
+    backend = NULL;
+    upload = NULL;
+    releaseCgiSlot();
   }
 
+  bool Connection::canBufferBody() const {
+    const char *data;
+    size_t buffered = request.getBufferedBody(&data);
+    return request.isBodyStreaming() && buffered < request.getBodyLeft() &&
+           buffered < Constants::Cgi::MaxBufferedInput;
+  }
+
+  // Parked on disk: nothing. CGI: read while the body is still arriving
+  // and write while there is output. Otherwise one direction at a time.
+  uint32_t Connection::getInterest() const {
+    if (pendingFileJob)
+      return 0;
+    if (backend || cgiQueued || cacheWait || microWait || response.isStreaming()) {
+      // RDHUP notices a client giving up while the backend is quiet
+      uint32_t events = backend || cgiQueued || cacheWait || microWait ? uint32_t(EPOLLRDHUP) : 0;
+      if (canBufferBody())
+        events |= EPOLLIN;
+      ResponseState state = response.getState();
+      if (state == RESPONSE_SENDING_HEADERS || state == RESPONSE_FINISHED ||
+          (state == RESPONSE_SENDING_BODY && response.getStreamBuffered() > 0))
+        events |= EPOLLOUT;
+      return events;
+    }
+    if (response.getState() != RESPONSE_IDLE)
+      return EPOLLOUT;
+    return EPOLLIN;
+  }
+
+  uint32_t Connection::getWatchedEvents() const { return watchedEvents; }
+
+  void Connection::setWatchedEvents(uint32_t events) { watchedEvents = events; }
+
 void Connection::resolveConnectionHeaders() {
-  std::string connectionHeader = request.getHeader("connection");
-  if (String::toLower(connectionHeader) == "keep-alive") {
+  if (String::equalsIgnoreCase(request.getHeader("connection"), "keep-alive")) {
     keepAlive = true;
   }
 }
 
+void Connection::setClientAddress(const struct sockaddr_in &addr) {
+  clientAddr = addr.sin_addr.s_addr;
+  if (!inet_ntop(AF_INET, &addr.sin_addr, clientIp, sizeof(clientIp)))
+    strcpy(clientIp, "-");
+}
+
+// Starts recording this client if its port has a capture; call once the
+// client address is known
+void Connection::startCapture() {
+  capture = serverManager.getCapture(port);
+  if (capture)
+    captureId = capture->openConnection(port, clientIp);
+}
+
+void Connection::endCapture() {
+  if (!capture)
+    return;
+  capture->record(CAPTURE_CLOSE, captureId, port, NULL, 0);
+  capture = NULL;
+}
+
 int Connection::getFd() const { return fd; }
 
 int Connection::getPort() const { return port; }
 
 ConnectionType Connection::getType() const { return type; }
 
-void Connection::updateActivity() { timer.update(); }
+void Connection::updateActivity() { activityMs = Timer::monotonicMs(); }
 
-bool Connection::isTimedOut() const {
+// Waits on the client are bounded per phase, so a peer trickling bytes
+// cannot hold a slot: the headers have one deadline as a whole, while the
+// body and the response only need to keep moving
+ClientWait Connection::clientWait() const {
+  HttpParseState parsing = request.getState();
+  if (!dispatched && (parsing == PARSE_REQUEST_LINE || parsing == PARSE_HEADERS))
+    return requestStartUs == 0 && servedOne ? WAIT_KEEPALIVE : WAIT_HEADER;
+  ResponseState sending = response.getState();
+  if (sending == RESPONSE_SENDING_HEADERS ||
+      (sending == RESPONSE_SENDING_BODY && (!response.isStreaming() || response.getStreamBuffered() > 0)))
+    return WAIT_SEND;
+  if ((!dispatched && parsing == PARSE_BODY) || canBufferBody())
+    return WAIT_BODY;
+  return WAIT_BACKEND;
+}
+
+bool Connection::isTimedOut(long long nowMs) const {
   if (type == LISTENER)
     return false;
-  return timer.isExpired();
+  const RuntimeConfig &limits = RuntimeConfig::get();
+  switch (clientWait()) {
+  case WAIT_KEEPALIVE:
+    return nowMs - activityMs >= limits.keepaliveTimeout;
+  case WAIT_HEADER:
+    return nowMs - headerStartMs >= limits.clientHeaderTimeout;
+  case WAIT_BODY:
+    return nowMs - activityMs >= limits.clientBodyTimeout;
+  case WAIT_SEND:
+    return nowMs - activityMs >= limits.sendTimeout;
+  default:
+    return nowMs - activityMs >= backendWaitMs;
+  }
 }
 
-void Connection::setTimeout(int seconds) { timer.setLimit(seconds); }
+void Connection::setBackendWait(long ms) { backendWaitMs = ms; }
 
 HttpRequest &Connection::getRequest() { return request; }
 
@@ -215,13 +1057,78 @@ Connection *Connection::createListener(int fd, ServerManager &serverManager,
 
 Connection *Connection::createClient(int fd, ServerManager &serverManager,
                                      int port) {
+  Connection *connection = freeList;
+  if (connection && &connection->serverManager == &serverManager) {
+    freeList = connection->nextFree;
+    freeCount--;
+    connection->reset(fd, port);
+    return connection;
+  }
   return new Connection(fd, port, CLIENT, serverManager);
 }
 
+// The caller has already closed the fd
+void Connection::release(Connection *connection) {
+  if (connection->inPool) {
+    LOG_ERROR("connection released twice, ignored");
+    return;
+  }
+  connection->detach();
+  if (connection->type != CLIENT || freeCount >= Constants::Pool::MaxIdleConnections) {
+    delete connection;
+    return;
+  }
+  connection->response.clear(); // drop any open file now
+  connection->context = NULL;
+  connection->nextFree = freeList;
+  connection->inPool = true;
+  freeList = connection;
+  freeCount++;
+}
+
+void Connection::detach() {
+  finishRequest();
+  if (backend)
+    finishBackend();
+  releaseCgiSlot();
+  cancelCacheWait();
+  endCapture();
+  fd = -1;
+  detached = true;
+}
+
+bool Connection::isDetached() const { return detached; }
+
+void Connection::drainPool() {
+  while (freeList) {
+    Connection *next = freeList->nextFree;
+    delete freeList;
+    freeList = next;
+  }
+  freeCount = 0;
+}
+
 HttpResponse &Connection::getResponse() { return response; }
 
 bool Connection::getShouldCleanup() const { return shouldCleanup; }
 
+// Kept alive with no request begun
+bool Connection::isIdle() const { return requestStartUs == 0 && !dispatched; }
+
+bool Connection::isDispatched() const { return dispatched; }
+
+const char *Connection::getClientIp() const { return clientIp; }
+
+uint32_t Connection::getClientAddr() const { return clientAddr; }
+
+bool Connection::isConnLimited() const { return connLimited; }
+
+void Connection::setConnLimited(bool counted) { connLimited = counted; }
+
+bool Connection::isWaitingOnDisk() const { return pendingFileJob != 0; }
+
+unsigned long Connection::getPendingFileJob() const { return pendingFileJob; }
+
 ServerManager &Connection::getServerManager() { return serverManager; }
 
 bool Connection::getKeepAlive() const { return keepAlive; }
\ No newline at end of file
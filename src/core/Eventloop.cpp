@@ -1,22 +1,45 @@
 #include <sys/epoll.h>
+#include <algorithm>
+#include <cstring>
 #include <errno.h>
+#include <sys/socket.h>
 #include <unistd.h>
-#include <iostream>
 #include "core/Socket.hpp"
 
 #include "core/EventLoop.hpp"
+#include "core/AccessLog.hpp"
+#include "core/LatencyStats.hpp"
+#include "core/CgiPool.hpp"
+#include "core/ClientTable.hpp"
+#include "core/CgiProcess.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/MicroCache.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "core/ResponseCache.hpp"
+#include "core/TrafficCapture.hpp"
 #include "core/ConnectionType.hpp"
 #include "core/Connection.hpp"
+#include "config/RuntimeConfig.hpp"
 #include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
 
-EventLoop::EventLoop() : running(true)
+EventLoop::EventLoop() : running(true), fileIO(Constants::FileIO::WorkerThreads), clientCount(0),
+      pendingRequests(0), recentLagUs(0), acceptPausedUntilMs(0), connLimits(NULL)
 {
-  epollFd = epoll_create1(0);
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
   if (epollFd == -1)
   {
     throw EpollCreationException();
   }
-  events = new epoll_event[Constants::Network::EpollMaxEvents];
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = (void *)static_cast<IOHandler *>(&fileIO);
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fileIO.getFd(), &event) == -1)
+  {
+    close(epollFd);
+    throw EpollAddConnectionException();
+  }
+  events = new epoll_event[RuntimeConfig::get().epollMaxEvents];
 }
 
 void EventLoop::stop()
@@ -24,6 +47,8 @@ void EventLoop::stop()
   running = false;
 }
 
+FileIOPool &EventLoop::getFileIO() { return fileIO; }
+
 void EventLoop::addConnection(Connection *connection)
 {
   if (connections.find(connection->getFd()) != connections.end())
@@ -32,28 +57,501 @@ void EventLoop::addConnection(Connection *connection)
   }
   struct epoll_event event;
   event.events = EPOLLIN;
-  event.data.ptr = (void *)connection;
+  event.data.ptr = (void *)static_cast<IOHandler *>(connection);
   if (epoll_ctl(epollFd, EPOLL_CTL_ADD, connection->getFd(), &event) == -1)
   {
     throw EventLoop::EpollAddConnectionException();
   }
+  connection->setWatchedEvents(EPOLLIN);
   connections[connection->getFd()] = connection;
+  if (connection->getType() == CLIENT)
+    clientCount++;
+}
+
+void EventLoop::watch(IOHandler *handler, uint32_t events)
+{
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = (void *)handler;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, handler->getFd(), &event) == -1)
+    throw EventLoop::EpollAddConnectionException();
+}
+
+void EventLoop::modify(IOHandler *handler, uint32_t events)
+{
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = (void *)handler;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, handler->getFd(), &event);
+}
+
+void EventLoop::unwatch(IOHandler *handler)
+{
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, handler->getFd(), NULL);
+}
+
+// Later events in the same batch may still point at the backend's
+// descriptors, so it is only freed once the batch is done
+void EventLoop::retireBackend(Backend *backend)
+{
+  retired.push_back(backend);
+}
+
+// A FastCGI socket serves several client connections; the ones it made
+// progress for are settled once it is done with the event. Connections
+// removed meanwhile are skipped: they are only released after the batch.
+void EventLoop::markDirty(Connection *connection)
+{
+  if (connection->isDetached())
+    return;
+  if (std::find(dirty.begin(), dirty.end(), connection) == dirty.end())
+    dirty.push_back(connection);
+}
+
+void EventLoop::flushDirty()
+{
+  while (!dirty.empty())
+  {
+    std::vector<Connection *> batch;
+    batch.swap(dirty);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      Connection *connection = batch[i];
+      if (connection->isDetached())
+        continue;
+      try
+      {
+        connection->onBackendProgress();
+      }
+      catch (const std::exception &e)
+      {
+        LOG_ERROR("fastcgi error fd=" << connection->getFd() << " error=\"" << e.what() << "\"");
+        removeConnection(connection);
+        continue;
+      }
+      if (connection->getShouldCleanup())
+        removeConnection(connection);
+      else
+        updateInterest(connection);
+    }
+  }
+}
+
+// Connections removed during a batch may still have events later in it,
+// so they go back to the pool only once the batch is done
+void EventLoop::freeRetired()
+{
+  for (size_t i = 0; i < removed.size(); i++)
+    Connection::release(removed[i]);
+  removed.clear();
+  for (size_t i = 0; i < retired.size(); i++)
+    delete retired[i];
+  retired.clear();
+}
+
+ConnectionCounts EventLoop::countConnections() const
+{
+  ConnectionCounts counts = {0, 0, 0};
+  for (std::map<int, Connection *>::const_iterator it = connections.begin(); it != connections.end(); ++it)
+  {
+    const Connection *connection = it->second;
+    if (connection->getType() != CLIENT)
+      continue;
+    if (connection->isDispatched())
+      counts.writing++;
+    else if (connection->isIdle())
+      counts.idle++;
+    else
+      counts.reading++;
+  }
+  return counts;
 }
 
+// Once per connection: a second call would close whatever now owns the
+// fd and count the client out twice
 void EventLoop::removeConnection(Connection *connection)
 {
+  if (connection->isDetached())
+    return;
   int fd = connection->getFd();
+  std::vector<Connection *>::iterator pending = std::find(dirty.begin(), dirty.end(), connection);
+  if (pending != dirty.end())
+    dirty.erase(pending);
   epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
   connections.erase(fd);
+  if (connection->getType() == CLIENT)
+    clientCount--;
+  if (connection->isConnLimited())
+  {
+    ClientSlot *slot = connLimits->find(connection->getClientAddr());
+    if (slot && slot->connections > 0)
+      slot->connections--;
+  }
+  close(fd);
+  connection->detach();
+  removed.push_back(connection);
+}
+
+// Only touches epoll when the connection's interest actually changed
+void EventLoop::updateInterest(Connection *connection)
+{
+  uint32_t events = connection->getInterest();
+  if (events == connection->getWatchedEvents())
+    return;
+  modify(connection, events);
+  connection->setWatchedEvents(events);
+}
+
+void EventLoop::handleCgiEvent(CgiPipe *pipe)
+{
+  CgiProcess &cgi = pipe->getProcess();
+  if (cgi.isClosed())
+    return; // torn down earlier in this batch
+  // Removing the owner here defers its release like any other removal,
+  // so a hangup on its socket later in the batch finds it detached
+  Connection *connection = &cgi.getOwner();
+  if (connection->isDetached())
+    return;
+  connection->updateActivity();
+  try
+  {
+    cgi.onEvent(*pipe);
+    connection->onBackendProgress();
+  }
+  catch (const std::exception &e)
+  {
+    LOG_ERROR("cgi error fd=" << connection->getFd() << " error=\"" << e.what() << "\"");
+    removeConnection(connection);
+    return;
+  }
+  if (connection->getShouldCleanup())
+    removeConnection(connection);
+  else
+    updateInterest(connection);
+}
+
+void EventLoop::handleFastCgiEvent(FastCgiConnection *connection, uint32_t events)
+{
+  connection->onEvent(events);
+  flushDirty();
+}
+
+void EventLoop::handleProxyEvent(ProxyConnection *connection, uint32_t events)
+{
+  connection->onEvent(events);
+  flushDirty();
+}
+
+void EventLoop::handleClientEvent(Connection *connection, uint32_t events)
+{
+  try
+  {
+    if (!(events & (EPOLLIN | EPOLLOUT)))
+    {
+      // Error/hangup while parked
+      removeConnection(connection);
+      return;
+    }
+    if (events & EPOLLIN)
+    {
+      connection->readData();
+      if (connection->getShouldCleanup())
+      {
+        removeConnection(connection);
+        return;
+      }
+    }
+    // A CGI connection may be reading and writing at once
+    if (events & EPOLLOUT)
+    {
+      connection->writeData();
+      if (connection->getShouldCleanup())
+      {
+        removeConnection(connection);
+        return;
+      }
+    }
+    updateInterest(connection);
+  }
+  catch (const Connection::ConnectionClosedException &e)
+  {
+    LOG_DEBUG("peer closed fd=" << connection->getFd());
+    removeConnection(connection);
+  }
+  catch (const std::exception &e)
+  {
+    LOG_ERROR("connection error fd=" << connection->getFd() << " error=\"" << e.what() << "\"");
+    removeConnection(connection);
+  }
+}
+
+void EventLoop::handleFileCompletions()
+{
+  FileJob *job = fileIO.takeCompleted();
+  while (job)
+  {
+    FileJob *next = job->next;
+    std::map<int, Connection *>::iterator it = connections.find(job->ownerFd);
+    if (it != connections.end() && it->second->getPendingFileJob() == job->id)
+    {
+      Connection *connection = it->second;
+      connection->onFileJobDone(*job);
+      if (connection->getShouldCleanup())
+        removeConnection(connection);
+      else
+        updateInterest(connection);
+    }
+    // Owner went away (or the fd was reused) while the job was in flight
+    if (job->fd != -1)
+      close(job->fd);
+    fileIO.release(job);
+    job = next;
+  }
+}
+
+void EventLoop::dispatchEvent(IOHandler *handler, uint32_t events)
+{
+  if (handler->getType() == FILE_IO)
+  {
+    handleFileCompletions();
+    return;
+  }
+  if (handler->getType() == CGI_PIPE)
+  {
+    handleCgiEvent(static_cast<CgiPipe *>(handler));
+    return;
+  }
+  if (handler->getType() == FASTCGI)
+  {
+    handleFastCgiEvent(static_cast<FastCgiConnection *>(handler), events);
+    return;
+  }
+  if (handler->getType() == PROXY)
+  {
+    handleProxyEvent(static_cast<ProxyConnection *>(handler), events);
+    return;
+  }
+  Connection *connection = static_cast<Connection *>(handler);
+  if (connection->getType() == LISTENER)
+  {
+    acceptClient(connection);
+  }
+  else if (connection->getType() == CLIENT && !connection->isDetached())
+  {
+    handleClientEvent(connection, events);
+  }
+}
+
+void EventLoop::acceptClient(Connection *listener)
+{
+  struct sockaddr_in peer;
+  int clientFd = Socket::acceptConnection(listener->getFd(), &peer);
+  if (clientFd == -1)
+  {
+    // Out of descriptors: the pending connection stays ready, so keep
+    // the listeners out of epoll for a while rather than spin on it
+    if (errno == EMFILE || errno == ENFILE)
+      pauseAccepting(Timer::monotonicMs());
+    return;
+  }
+  if (clientCount >= RuntimeConfig::get().workerConnections)
+  {
+    shedConnection(clientFd, METRIC_SHED, "worker_connections are not enough");
+    return;
+  }
+  if (isLagging())
+  {
+    shedConnection(clientFd, METRIC_SHED, "event loop lag over overload_lag");
+    return;
+  }
+  // limit_conn: a client whose slot was taken by others' open connections
+  // is let through uncounted rather than refused
+  size_t limitConn = RuntimeConfig::get().limitConn;
+  ClientSlot *slot = NULL;
+  if (limitConn > 0)
+  {
+    if (!connLimits)
+      connLimits = new ClientTable(Constants::Limit::ClientSlots);
+    slot = connLimits->lookup(peer.sin_addr.s_addr, Timer::monotonicUs());
+    if (slot && slot->connections >= limitConn)
+    {
+      shedConnection(clientFd, METRIC_LIMITED_CONNECTIONS, "limit_conn exceeded");
+      return;
+    }
+  }
+  Connection *clientConn = Connection::createClient(clientFd, listener->getServerManager(), listener->getPort());
+  clientConn->setClientAddress(peer);
+  try
+  {
+    addConnection(clientConn);
+    if (slot)
+    {
+      slot->connections++;
+      clientConn->setConnLimited(true);
+    }
+    Metrics::count(METRIC_ACCEPTS);
+    clientConn->startCapture();
+    LOG_DEBUG("accept fd=" << clientFd << " port=" << listener->getPort());
+  }
+  catch (...)
+  {
+    close(clientFd);
+    Connection::release(clientConn);
+  }
+}
+
+// The prebuilt 503 goes out in one non-blocking send and the socket is
+// closed; whatever the client already sent is read first so the close
+// does not reset the connection under the answer. Logged at most once a
+// second.
+void EventLoop::shedConnection(int fd, MetricCounter counter, const char *reason)
+{
+  static long long lastWarnMs = 0;
+  char discard[512];
+
+  Metrics::count(counter);
+  send(fd, HttpResponse::Overloaded, HttpResponse::OverloadedLength, MSG_NOSIGNAL | MSG_DONTWAIT);
+  shutdown(fd, SHUT_WR);
+  while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+    ;
   close(fd);
-  delete connection;
+  long long nowMs = Timer::monotonicMs();
+  if (nowMs - lastWarnMs >= 1000)
+  {
+    LOG_WARN(reason << ": " << clientCount << " open, " << pendingRequests << " pending, shedding fd=" << fd);
+    lastWarnMs = nowMs;
+  }
 }
 
+void EventLoop::pauseAccepting(long long nowMs)
+{
+  if (acceptPausedUntilMs == 0)
+  {
+    LOG_WARN("accept failed: " << strerror(errno) << ", pausing listeners for "
+             << Constants::Network::AcceptPause << "ms");
+    for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end(); ++it)
+    {
+      if (it->second->getType() != LISTENER)
+        continue;
+      modify(it->second, 0);
+      it->second->setWatchedEvents(0);
+    }
+  }
+  acceptPausedUntilMs = nowMs + Constants::Network::AcceptPause;
+}
+
+void EventLoop::resumeAccepting()
+{
+  acceptPausedUntilMs = 0;
+  for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end(); ++it)
+  {
+    if (it->second->getType() != LISTENER)
+      continue;
+    modify(it->second, EPOLLIN);
+    it->second->setWatchedEvents(EPOLLIN);
+  }
+}
+
+bool EventLoop::isLagging() const
+{
+  long lag = RuntimeConfig::get().overloadLag;
+  return lag > 0 && recentLagUs >= lag * 1000;
+}
+
+bool EventLoop::admitRequest()
+{
+  size_t limit = RuntimeConfig::get().maxPendingRequests;
+  if ((limit > 0 && pendingRequests >= limit) || isLagging())
+  {
+    Metrics::count(METRIC_SHED);
+    return false;
+  }
+  pendingRequests++;
+  return true;
+}
+
+void EventLoop::finishRequest() { pendingRequests--; }
+
+static const char *typeName(ConnectionType type)
+{
+  switch (type)
+  {
+  case LISTENER:
+    return "listener";
+  case CLIENT:
+    return "client";
+  case FILE_IO:
+    return "file_io";
+  case CGI_PIPE:
+    return "cgi";
+  case FASTCGI:
+    return "fastcgi";
+  case PROXY:
+    return "proxy";
+  }
+  return "unknown";
+}
+
+static const char *waitName(ClientWait wait)
+{
+  switch (wait)
+  {
+  case WAIT_KEEPALIVE:
+    return "keepalive";
+  case WAIT_HEADER:
+    return "header";
+  case WAIT_BODY:
+    return "body";
+  case WAIT_SEND:
+    return "send";
+  case WAIT_BACKEND:
+    return "backend";
+  }
+  return "unknown";
+}
+
+// A handler held the loop past the stall threshold. A client still open
+// is described by its request and where that request was; the others
+// only by their descriptor.
+void EventLoop::reportStall(ConnectionType type, int fd, uint32_t events, long long elapsedUs)
+{
+  Metrics::count(METRIC_LOOP_STALLS);
+  std::map<int, Connection *>::iterator it = connections.find(fd);
+  if (type != CLIENT || it == connections.end())
+  {
+    LOG_WARN("slow handler type=" << typeName(type) << " fd=" << fd << " us=" << elapsedUs);
+    return;
+  }
+  Connection *connection = it->second;
+  const char *phase = connection->isDispatched() ? "writing" : connection->isIdle() ? "idle" : "reading";
+  LOG_WARN("slow handler type=client fd=" << fd << " client=" << connection->getClientIp() << " events="
+           << ((events & EPOLLIN) ? "in" : "") << ((events & EPOLLOUT) ? "out" : "") << " phase=" << phase
+           << " request=\"" << connection->getRequest().getMethod() << " " << connection->getRequest().getPath()
+           << "\" us=" << elapsedUs);
+}
+
+const Histogram &EventLoop::getLoopLag() const { return loopLag; }
+
 void EventLoop::run()
 {
   while (running)
   {
-    int nfds = epoll_wait(epollFd, events, Constants::Network::EpollMaxEvents, Constants::Network::EpollWaitTimeout);
+    // SIGUSR2 interrupts epoll_wait, so the dump happens right away
+    LatencyStats::dumpIfRequested();
+
+    // Wake in time for buffered access logs and captures to meet their
+    // flush interval
+    int timeout = RuntimeConfig::get().epollWaitTimeout;
+    long long nowMs = Timer::monotonicMs();
+    int flushDelay = AccessLog::nextFlushDelay(nowMs);
+    if (flushDelay >= 0 && flushDelay < timeout)
+      timeout = flushDelay;
+    flushDelay = TrafficCapture::nextFlushDelay(nowMs);
+    if (flushDelay >= 0 && flushDelay < timeout)
+      timeout = flushDelay;
+    if (acceptPausedUntilMs != 0 && acceptPausedUntilMs - nowMs < timeout)
+      timeout = acceptPausedUntilMs > nowMs ? static_cast<int>(acceptPausedUntilMs - nowMs) : 0;
+    int nfds = epoll_wait(epollFd, events, RuntimeConfig::get().epollMaxEvents, timeout);
     if (nfds == -1)
     {
       if (errno == EINTR)
@@ -62,96 +560,73 @@ void EventLoop::run()
       }
       throw EventLoop::EpollWaitException();
     }
+    // Loop lag: how long a ready event may wait for this pass to end.
+    // One clock read per handler times each of them as well.
+    long long wokeUs = Timer::monotonicUs();
+    long long handlerStartUs = wokeUs;
+    bool stalled = false;
     for (int i = 0; nfds > 0 && i < nfds; i++)
     {
-      Connection *connection = (Connection *)events[i].data.ptr;
-      if (connection->getType() == LISTENER)
-      {
-        int clientFd = Socket::acceptConnection(connection->getFd());
-        if (clientFd != -1)
-        {
-          Connection *clientConn = Connection::createClient(clientFd, connection->getServerManager(), connection->getPort());
-          try
-          {
-            addConnection(clientConn);
-            std::cout << "Accepted new connection on fd " << clientFd << std::endl;
-          }
-          catch (...)
-          {
-            delete clientConn;
-            close(clientFd);
-          }
-        }
-      }
-      else if (connection->getType() == CLIENT)
+      IOHandler *handler = (IOHandler *)events[i].data.ptr;
+      ConnectionType type = handler->getType();
+      int fd = handler->getFd();
+      dispatchEvent(handler, events[i].events);
+      long long handlerEndUs = Timer::monotonicUs();
+      if (handlerEndUs - handlerStartUs >= Constants::Network::StallThresholdUs)
       {
-        connection->updateActivity();
-        try
-        {
-          if (events[i].events & EPOLLIN)
-          {
-            connection->readData();
-            if (connection->getShouldCleanup())
-            {
-              removeConnection(connection);
-              continue;
-            }
-            if (connection->getRequest().getState() == PARSE_SUCCESS)
-            {
-              struct epoll_event ev;
-              ev.events = EPOLLOUT;
-              ev.data.ptr = (void *)connection;
-              epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->getFd(), &ev);
-            }
-          }
-          else if (events[i].events & EPOLLOUT)
-          {
-            connection->writeData();
-            if (connection->getShouldCleanup())
-            {
-              removeConnection(connection);
-              continue;
-            }
-            if (connection->getResponse().getState() == RESPONSE_IDLE)
-            {
-              struct epoll_event ev;
-              ev.events = EPOLLIN;
-              ev.data.ptr = (void *)connection;
-              epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->getFd(), &ev);
-            }
-          }
-        }
-        catch (const Connection::ConnectionClosedException &e)
-        {
-          std::cout << "Connection closed by peer on fd " << connection->getFd() << std::endl;
-          removeConnection(connection);
-        }
-        catch (const std::exception &e)
-        {
-          std::cerr << "Error handling connection on fd " << connection->getFd() << ": " << e.what() << std::endl;
-          removeConnection(connection);
-        }
+        reportStall(type, fd, events[i].events, handlerEndUs - handlerStartUs);
+        stalled = true;
       }
+      handlerStartUs = handlerEndUs;
     }
+    flushDirty();
+    freeRetired();
+    CgiProcess::reapOrphans();
+
+    nowMs = Timer::monotonicMs();
+    AccessLog::flushDue(nowMs);
+    TrafficCapture::flushDue(nowMs);
 
     // Check for timeouts
     for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end();)
     {
       Connection *conn = it->second;
-      if (conn->isTimedOut())
+      ++it;
+      if (conn->checkBackendTimeout(nowMs))
       {
-        std::cout << "Closing timed out connection on fd " << conn->getFd() << std::endl;
-        int fd = conn->getFd();
-        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
-        close(fd);
-        delete conn;
-        connections.erase(it++);
+        if (conn->getShouldCleanup())
+          removeConnection(conn);
+        else
+          updateInterest(conn);
       }
-      else
+      else if (conn->isTimedOut(nowMs))
       {
-        ++it;
+        LOG_INFO("timeout fd=" << conn->getFd() << " wait=" << waitName(conn->clientWait()));
+        // An idle keep-alive connection running out is not a failure
+        if (!conn->isIdle())
+          Metrics::count(METRIC_TIMEOUTS);
+        removeConnection(conn);
       }
     }
+    freeRetired();
+    FastCgiUpstream::collect(nowMs);
+    ProxyUpstream::collect(nowMs);
+    CgiPool::collect(*this, nowMs);
+    ResponseCache::collect(nowMs);
+    MicroCache::collect(nowMs);
+    flushDirty();
+
+    long long busyUs = Timer::monotonicUs() - wokeUs;
+    loopLag.record(static_cast<uint64_t>(busyUs));
+    recentLagUs += (busyUs - recentLagUs) / 8;
+    if (acceptPausedUntilMs != 0 && nowMs >= acceptPausedUntilMs)
+      resumeAccepting();
+    if (busyUs >= Constants::Network::StallThresholdUs && !stalled)
+    {
+      Metrics::count(METRIC_LOOP_STALLS);
+      LOG_WARN("event loop stall events=" << nfds << " busy_us=" << busyUs << " handlers_us="
+               << (handlerStartUs - wokeUs));
+    }
   }
 }
 
@@ -159,9 +634,14 @@ EventLoop::~EventLoop()
 {
   close(epollFd);
   delete[] events;
+  delete connLimits;
+  ResponseCache::forgetWaiters();
+  MicroCache::forgetWaiters();
   for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end(); ++it)
   {
     close(it->first);
     delete it->second;
   }
+  freeRetired();
+  Connection::drainPool();
 }
\ No newline at end of file
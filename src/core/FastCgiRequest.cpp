@@ -0,0 +1,172 @@
+#include "core/FastCgiRequest.hpp"
+#include "core/CgiEnvironment.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/HttpRequest.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <vector>
+
+static const unsigned char FCGI_RESPONDER = 1;
+static const unsigned char FCGI_KEEP_CONN = 1;
+
+FastCgiRequest::FastCgiRequest(EventLoop &loop, FastCgiUpstream &upstream, Connection &owner, bool keepAlive)
+    : loop(loop), upstream(upstream), owner(owner), request(owner.getRequest()), connection(NULL), id(0),
+      reply(owner.getResponse(), keepAlive), deadlineMs(0), bodySent(false), stdinDone(false),
+      received(false), retried(false), closed(false), failed(false)
+{
+}
+
+FastCgiRequest::~FastCgiRequest()
+{
+  abort();
+}
+
+FastCgiRequest *FastCgiRequest::start(EventLoop &loop, FastCgiUpstream &upstream, Connection &owner,
+                                      const std::string &script, const char *clientIp, int port,
+                                      bool keepAlive)
+{
+  FastCgiRequest *fcgi = new FastCgiRequest(loop, upstream, owner, keepAlive);
+  try
+  {
+    std::vector<std::string> env;
+    CgiEnvironment::build(env, fcgi->request, script, clientIp, port);
+    for (size_t i = 0; i < env.size(); i++)
+    {
+      size_t equals = env[i].find('=');
+      FastCgiConnection::appendPair(fcgi->params, env[i].data(), equals,
+                                    env[i].data() + equals + 1, env[i].size() - equals - 1);
+    }
+    fcgi->deadlineMs = Timer::monotonicMs() + Constants::Timeout::CgiExecution * 1000LL;
+    fcgi->dispatch();
+  }
+  catch (...)
+  {
+    delete fcgi;
+    throw;
+  }
+  return fcgi;
+}
+
+// Sends the request head (BEGIN_REQUEST and the params stream) on a
+// pooled socket, then whatever body is already buffered
+void FastCgiRequest::dispatch()
+{
+  FastCgiConnection *target = upstream.acquire(loop);
+  connection = target;
+  id = target->attach(this);
+  // A socket failing under send() re-dispatches (or fails) the request
+  // from onConnectionLost; this attempt is then over
+  char begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+  target->send(FCGI_BEGIN_REQUEST, id, begin, sizeof(begin));
+  if (connection == target)
+    target->send(FCGI_PARAMS, id, params.data(), params.size());
+  if (connection == target)
+    target->send(FCGI_PARAMS, id, NULL, 0);
+  if (connection == target)
+    onInputReady();
+}
+
+// Forwards buffered body as FCGI_STDIN, holding back once the socket has
+// a window's worth queued; the empty record ends the stream
+void FastCgiRequest::onInputReady()
+{
+  if (!connection || stdinDone)
+    return;
+  const char *data;
+  size_t length = request.getBufferedBody(&data);
+  while (length > 0 && connection && connection->getPendingOutput() < Constants::FastCgi::MaxPendingOutput)
+  {
+    connection->send(FCGI_STDIN, id, data, length);
+    bodySent = true;
+    request.consumeBody(length);
+    length = request.getBufferedBody(&data);
+  }
+  if (connection && length == 0 && request.getBodyLeft() == 0)
+  {
+    connection->send(FCGI_STDIN, id, NULL, 0);
+    stdinDone = true;
+  }
+}
+
+void FastCgiRequest::onWritable()
+{
+  onInputReady();
+  loop.markDirty(&owner);
+}
+
+void FastCgiRequest::onStdout(const char *data, size_t length)
+{
+  received = true;
+  reply.feed(data, length);
+  if (reply.hasFailed())
+    abort();
+  loop.markDirty(&owner);
+}
+
+void FastCgiRequest::onEnd(unsigned char protocolStatus)
+{
+  connection = NULL;
+  if (protocolStatus != 0)
+    LOG_WARN("fastcgi request rejected upstream=" << upstream.getAddress() << " status=" << int(protocolStatus));
+  reply.end();
+  closed = true;
+  loop.markDirty(&owner);
+}
+
+// A pooled socket the application had already closed fails on first use;
+// if nothing was exchanged yet the request goes out again on a new one
+void FastCgiRequest::onConnectionLost()
+{
+  connection = NULL;
+  if (closed)
+    return;
+  if (!received && !bodySent && !retried)
+  {
+    retried = true;
+    try
+    {
+      dispatch();
+      return;
+    }
+    catch (const std::exception &e)
+    {
+      connection = NULL;
+      LOG_WARN("fastcgi retry failed upstream=" << upstream.getAddress() << " error=\"" << e.what() << "\"");
+    }
+  }
+  closed = true;
+  failed = true;
+  loop.markDirty(&owner);
+}
+
+// Resumes reading once the client drained some output
+void FastCgiRequest::updateInterest()
+{
+  if (connection)
+    connection->updateInterest();
+}
+
+void FastCgiRequest::abort()
+{
+  if (connection)
+  {
+    FastCgiConnection *current = connection;
+    connection = NULL;
+    current->cancel(id);
+  }
+  closed = true;
+}
+
+bool FastCgiRequest::hasRoom() const { return closed || reply.hasRoom(); }
+bool FastCgiRequest::isClosed() const { return closed; }
+bool FastCgiRequest::hasFailed() const { return failed || reply.hasFailed(); }
+bool FastCgiRequest::getKeepAlive() const { return reply.getKeepAlive(); }
+
+bool FastCgiRequest::isExpired(long long nowMs) const
+{
+  return !closed && nowMs >= deadlineMs;
+}
@@ -0,0 +1,575 @@
+#include "core/FastCgiUpstream.hpp"
+#include "core/EventLoop.hpp"
+#include "core/FastCgiRequest.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/NetworkResolver.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+std::map<std::string, FastCgiUpstream *> FastCgiUpstream::registry;
+
+static const size_t HeaderSize = 8;
+static const size_t MaxRecordContent = 65528; // largest multiple of 8 below 64k
+static const size_t MaxControlSize = 1024;
+static const unsigned char RequestComplete = 0;
+
+FastCgiConnection::FastCgiConnection(FastCgiUpstream &upstream, EventLoop &loop, int fd, bool connecting)
+    : upstream(upstream), loop(loop), fd(fd), connecting(connecting), dead(false), hangup(false),
+      multiplexed(false), maxRequests(1), watched(false), interest(0),
+      lastActivityMs(Timer::monotonicMs()), outSent(0), nextId(1), headerRead(0), recordType(0),
+      recordId(0), contentLeft(0), paddingLeft(0)
+{
+  // Ask whether requests may share this socket; until the answer arrives
+  // it carries one at a time
+  std::string query;
+  appendPair(query, "FCGI_MPXS_CONNS", 15, "", 0);
+  appendPair(query, "FCGI_MAX_REQS", 13, "", 0);
+  send(FCGI_GET_VALUES, 0, query.data(), query.size());
+}
+
+// Only closes the socket: the EventLoop may already be gone at shutdown
+FastCgiConnection::~FastCgiConnection()
+{
+  if (fd != -1)
+    ::close(fd);
+}
+
+int FastCgiConnection::getFd() const { return fd; }
+
+ConnectionType FastCgiConnection::getType() const { return FASTCGI; }
+
+bool FastCgiConnection::isDead() const { return dead; }
+
+bool FastCgiConnection::isIdle() const { return active.empty(); }
+
+long long FastCgiConnection::getLastActivity() const { return lastActivityMs; }
+
+size_t FastCgiConnection::getPendingOutput() const { return out.size() - outSent; }
+
+bool FastCgiConnection::hasLiveRequests() const
+{
+  for (std::map<unsigned short, FastCgiRequest *>::const_iterator it = active.begin(); it != active.end(); ++it)
+  {
+    if (it->second)
+      return true;
+  }
+  return false;
+}
+
+bool FastCgiConnection::canAccept() const
+{
+  if (dead || hangup)
+    return false;
+  return active.empty() || (multiplexed && active.size() < maxRequests);
+}
+
+// Reading stops while any request's client has fallen behind; the
+// application then blocks on its own writes
+bool FastCgiConnection::canRead() const
+{
+  for (std::map<unsigned short, FastCgiRequest *>::const_iterator it = active.begin(); it != active.end(); ++it)
+  {
+    if (it->second && !it->second->hasRoom())
+      return false;
+  }
+  return true;
+}
+
+void FastCgiConnection::appendPair(std::string &out, const char *name, size_t nameLength,
+                                   const char *value, size_t valueLength)
+{
+  size_t lengths[2] = {nameLength, valueLength};
+  for (int i = 0; i < 2; i++)
+  {
+    if (lengths[i] < 128)
+      out += static_cast<char>(lengths[i]);
+    else
+    {
+      out += static_cast<char>(((lengths[i] >> 24) & 0x7f) | 0x80);
+      out += static_cast<char>((lengths[i] >> 16) & 0xff);
+      out += static_cast<char>((lengths[i] >> 8) & 0xff);
+      out += static_cast<char>(lengths[i] & 0xff);
+    }
+  }
+  out.append(name, nameLength);
+  out.append(value, valueLength);
+}
+
+unsigned short FastCgiConnection::attach(FastCgiRequest *request)
+{
+  unsigned short id;
+  do
+  {
+    id = nextId++;
+    if (nextId == 0)
+      nextId = 1;
+  } while (active.count(id));
+  active[id] = request;
+  lastActivityMs = Timer::monotonicMs();
+  return id;
+}
+
+// The application still answers an aborted request; its records are
+// dropped until FCGI_END_REQUEST frees the id
+void FastCgiConnection::cancel(unsigned short id)
+{
+  std::map<unsigned short, FastCgiRequest *>::iterator it = active.find(id);
+  if (it == active.end() || !it->second)
+    return;
+  it->second = NULL;
+  send(FCGI_ABORT_REQUEST, id, NULL, 0);
+}
+
+// Queues one stream's worth of records and writes what the socket takes
+void FastCgiConnection::send(unsigned char type, unsigned short id, const char *data, size_t length)
+{
+  if (dead)
+    return;
+  static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  size_t offset = 0;
+  do
+  {
+    size_t chunk = std::min(length - offset, MaxRecordContent);
+    size_t pad = (8 - chunk % 8) % 8;
+    char record[HeaderSize] = {1, static_cast<char>(type), static_cast<char>(id >> 8), static_cast<char>(id & 0xff),
+                               static_cast<char>(chunk >> 8), static_cast<char>(chunk & 0xff), static_cast<char>(pad), 0};
+    out.append(record, HeaderSize);
+    if (chunk > 0)
+      out.append(data + offset, chunk);
+    out.append(padding, pad);
+    offset += chunk;
+  } while (offset < length);
+
+  // Errors surface as socket events; the event path handles them
+  if (!connecting && !hangup)
+    writeOut();
+  updateInterest();
+}
+
+bool FastCgiConnection::writeOut()
+{
+  while (outSent < out.size())
+  {
+    ssize_t n = ::send(fd, out.data() + outSent, out.size() - outSent, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      outSent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  out.clear();
+  outSent = 0;
+  return true;
+}
+
+// Writes queued records; once the queue drains, requests waiting to send
+// more body get their turn
+void FastCgiConnection::flush()
+{
+  bool hadOutput = outSent < out.size();
+  if (!writeOut())
+  {
+    fail();
+    return;
+  }
+  if (!hadOutput || !out.empty())
+    return;
+  for (std::map<unsigned short, FastCgiRequest *>::iterator it = active.begin(); it != active.end(); ++it)
+  {
+    if (it->second)
+      it->second->onWritable();
+  }
+}
+
+void FastCgiConnection::onEvent(uint32_t events)
+{
+  if (dead)
+    return;
+  if (events & EPOLLERR)
+  {
+    fail();
+    return;
+  }
+  if (connecting)
+  {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+    {
+      LOG_WARN("fastcgi connect failed upstream=" << upstream.getAddress() << " error=\"" << strerror(error) << "\"");
+      fail();
+      return;
+    }
+    connecting = false;
+  }
+  if (events & EPOLLHUP)
+    hangup = true;
+
+  if (events & (EPOLLIN | EPOLLHUP))
+  {
+    char chunk[Constants::Cgi::ReadChunkSize];
+    while (!dead && canRead())
+    {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n > 0)
+      {
+        lastActivityMs = Timer::monotonicMs();
+        consume(chunk, n);
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      fail();
+      return;
+    }
+  }
+  if (!dead && !hangup && (events & EPOLLOUT))
+    flush();
+  updateInterest();
+}
+
+void FastCgiConnection::updateInterest()
+{
+  if (dead)
+    return;
+  uint32_t events = 0;
+  if (connecting || (!hangup && outSent < out.size()))
+    events |= EPOLLOUT;
+  if (!connecting && canRead())
+    events |= EPOLLIN;
+
+  // A hung-up socket keeps reporting EPOLLHUP; step out of epoll until
+  // there is room to read the rest of it
+  if (events == 0 && hangup)
+  {
+    if (watched)
+      loop.unwatch(this);
+    watched = false;
+    interest = 0;
+    return;
+  }
+  if (!watched)
+  {
+    try
+    {
+      loop.watch(this, events);
+    }
+    catch (const std::exception &e)
+    {
+      LOG_ERROR("fastcgi watch failed upstream=" << upstream.getAddress() << " error=\"" << e.what() << "\"");
+      fail();
+      return;
+    }
+    watched = true;
+  }
+  else if (events != interest)
+    loop.modify(this, events);
+  interest = events;
+}
+
+// Record parser: headers are assembled across reads, STDOUT content is
+// passed on as it comes and only small control records are buffered
+void FastCgiConnection::consume(const char *data, size_t length)
+{
+  while (length > 0 && !dead)
+  {
+    if (headerRead < HeaderSize)
+    {
+      size_t n = std::min(HeaderSize - headerRead, length);
+      memcpy(header + headerRead, data, n);
+      headerRead += n;
+      data += n;
+      length -= n;
+      if (headerRead < HeaderSize)
+        break;
+      if (header[0] != 1)
+      {
+        LOG_WARN("fastcgi bad record version upstream=" << upstream.getAddress());
+        fail();
+        return;
+      }
+      recordType = header[1];
+      recordId = static_cast<unsigned short>((header[2] << 8) | header[3]);
+      contentLeft = (header[4] << 8) | header[5];
+      paddingLeft = header[6];
+      control.clear();
+      if (contentLeft == 0)
+        finishRecord();
+    }
+    else if (contentLeft > 0)
+    {
+      size_t n = std::min(contentLeft, length);
+      deliver(data, n);
+      contentLeft -= n;
+      data += n;
+      length -= n;
+      if (contentLeft == 0)
+        finishRecord();
+    }
+    else
+    {
+      size_t n = std::min(paddingLeft, length);
+      paddingLeft -= n;
+      data += n;
+      length -= n;
+    }
+    if (headerRead == HeaderSize && contentLeft == 0 && paddingLeft == 0)
+      headerRead = 0;
+  }
+}
+
+void FastCgiConnection::deliver(const char *data, size_t length)
+{
+  if (recordType == FCGI_STDOUT)
+  {
+    std::map<unsigned short, FastCgiRequest *>::iterator it = active.find(recordId);
+    if (it != active.end() && it->second)
+      it->second->onStdout(data, length);
+  }
+  else if (recordType == FCGI_STDERR)
+  {
+    while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r'))
+      length--;
+    LOG_WARN("fastcgi stderr upstream=" << upstream.getAddress() << " message=\"" << std::string(data, length) << "\"");
+  }
+  else if (recordType == FCGI_END_REQUEST || recordType == FCGI_GET_VALUES_RESULT)
+  {
+    if (control.size() + length <= MaxControlSize)
+      control.append(data, length);
+  }
+}
+
+void FastCgiConnection::finishRecord()
+{
+  if (recordType == FCGI_GET_VALUES_RESULT)
+  {
+    readValues();
+    return;
+  }
+  if (recordType != FCGI_END_REQUEST)
+    return;
+  std::map<unsigned short, FastCgiRequest *>::iterator it = active.find(recordId);
+  if (it == active.end())
+    return;
+  FastCgiRequest *request = it->second;
+  active.erase(it);
+  unsigned char protocolStatus = control.size() >= 5 ? control[4] : RequestComplete;
+  if (request)
+    request->onEnd(protocolStatus);
+}
+
+static bool readLength(const std::string &data, size_t &pos, size_t &length)
+{
+  if (pos >= data.size())
+    return false;
+  unsigned char first = data[pos];
+  if (first < 128)
+  {
+    length = first;
+    pos++;
+    return true;
+  }
+  if (pos + 4 > data.size())
+    return false;
+  length = ((first & 0x7f) << 24) | (static_cast<unsigned char>(data[pos + 1]) << 16) |
+           (static_cast<unsigned char>(data[pos + 2]) << 8) | static_cast<unsigned char>(data[pos + 3]);
+  pos += 4;
+  return true;
+}
+
+void FastCgiConnection::readValues()
+{
+  size_t pos = 0;
+  size_t nameLength;
+  size_t valueLength;
+  while (readLength(control, pos, nameLength) && readLength(control, pos, valueLength) &&
+         pos + nameLength + valueLength <= control.size())
+  {
+    std::string name = control.substr(pos, nameLength);
+    std::string value = control.substr(pos + nameLength, valueLength);
+    pos += nameLength + valueLength;
+    if (name == "FCGI_MPXS_CONNS")
+      multiplexed = (value == "1");
+    else if (name == "FCGI_MAX_REQS")
+    {
+      long max = std::atol(value.c_str());
+      if (max > 0)
+        maxRequests = std::min(static_cast<size_t>(max), Constants::FastCgi::MaxMultiplexed);
+    }
+  }
+  if (multiplexed)
+    LOG_DEBUG("fastcgi multiplexing upstream=" << upstream.getAddress() << " max=" << maxRequests);
+}
+
+// The socket is unusable: close it and let every request on it decide
+// between a retry and a 502
+void FastCgiConnection::fail()
+{
+  if (dead)
+    return;
+  dead = true;
+  if (watched)
+    loop.unwatch(this);
+  watched = false;
+  ::close(fd);
+  fd = -1;
+  std::map<unsigned short, FastCgiRequest *> lost;
+  lost.swap(active);
+  for (std::map<unsigned short, FastCgiRequest *>::iterator it = lost.begin(); it != lost.end(); ++it)
+  {
+    if (it->second)
+      it->second->onConnectionLost();
+  }
+}
+
+void FastCgiConnection::close()
+{
+  fail();
+}
+
+// FastCgiUpstream
+
+FastCgiUpstream::FastCgiUpstream(const std::string &address) : address(address), addrLength(0)
+{
+  if (!parseAddress(address, &addr, &addrLength))
+    throw FastCgiAddressException();
+}
+
+FastCgiUpstream::~FastCgiUpstream()
+{
+  for (size_t i = 0; i < connections.size(); i++)
+    delete connections[i];
+}
+
+FastCgiUpstream *FastCgiUpstream::open(const std::string &address)
+{
+  std::map<std::string, FastCgiUpstream *>::iterator it = registry.find(address);
+  if (it != registry.end())
+    return it->second;
+  FastCgiUpstream *upstream = new FastCgiUpstream(address);
+  registry[address] = upstream;
+  return upstream;
+}
+
+bool FastCgiUpstream::parseAddress(const std::string &address, struct sockaddr_storage *addr,
+                                   socklen_t *length)
+{
+  return NetworkResolver::resolveAddress(address, addr, length);
+}
+
+const std::string &FastCgiUpstream::getAddress() const { return address; }
+
+// Prefers the most recently used idle socket, then a multiplexed one with
+// room, and only then opens a new one
+FastCgiConnection *FastCgiUpstream::acquire(EventLoop &loop)
+{
+  FastCgiConnection *shared = NULL;
+  for (size_t i = connections.size(); i-- > 0;)
+  {
+    FastCgiConnection *connection = connections[i];
+    if (!connection->canAccept())
+      continue;
+    if (connection->isIdle())
+      return connection;
+    if (!shared)
+      shared = connection;
+  }
+  if (shared)
+    return shared;
+  return connect(loop);
+}
+
+// The application behind the address went away; pooled sockets to it
+// are useless
+void FastCgiUpstream::closeIdle()
+{
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    if (connections[i]->isIdle())
+      connections[i]->close();
+  }
+}
+
+FastCgiConnection *FastCgiUpstream::connect(EventLoop &loop)
+{
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    throw FastCgiConnectException();
+  bool connecting = false;
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), addrLength) == -1)
+  {
+    if (errno != EINPROGRESS)
+    {
+      ::close(fd);
+      throw FastCgiConnectException();
+    }
+    connecting = true;
+  }
+  if (addr.ss_family == AF_INET)
+  {
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  }
+
+  FastCgiConnection *connection = new FastCgiConnection(*this, loop, fd, connecting);
+  if (connection->isDead())
+  {
+    delete connection;
+    throw FastCgiConnectException();
+  }
+  connections.push_back(connection);
+  return connection;
+}
+
+// Frees dead sockets and closes idle ones that are surplus or stale, and
+// ones only serving aborted requests the application never finished
+void FastCgiUpstream::sweep(long long nowMs)
+{
+  size_t idle = 0;
+  for (size_t i = connections.size(); i-- > 0;)
+  {
+    FastCgiConnection *connection = connections[i];
+    long long quietMs = nowMs - connection->getLastActivity();
+    if (connection->isDead())
+      ;
+    else if (connection->isIdle())
+    {
+      if (++idle > Constants::FastCgi::MaxIdleConnections || quietMs > Constants::Timeout::FastCgiIdle * 1000LL)
+        connection->close();
+    }
+    else if (!connection->hasLiveRequests() && quietMs > Constants::Timeout::CgiExecution * 1000LL)
+      connection->close();
+
+    if (connection->isDead())
+    {
+      delete connection;
+      connections.erase(connections.begin() + i);
+    }
+  }
+}
+
+void FastCgiUpstream::collect(long long nowMs)
+{
+  for (std::map<std::string, FastCgiUpstream *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    it->second->sweep(nowMs);
+}
+
+void FastCgiUpstream::closeAll()
+{
+  for (std::map<std::string, FastCgiUpstream *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
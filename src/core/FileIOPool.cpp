@@ -0,0 +1,250 @@
+#include "core/FileIOPool.hpp"
+#include "config/RuntimeConfig.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+
+FileJob::FileJob()
+    : type(FILE_JOB_OPEN), id(0), ownerFd(-1), size(0), offset(0), length(0),
+      fd(-1), status(FILE_OK), bytes(0), error(0), next(NULL)
+{
+  data = new char[RuntimeConfig::get().writeChunkSize];
+}
+
+FileJob::~FileJob()
+{
+  delete[] data;
+}
+
+FileIOPool::FileIOPool(int workers)
+    : stopping(false), pendingHead(NULL), pendingTail(NULL),
+      completedHead(NULL), completedTail(NULL), freeList(NULL), nextId(0)
+{
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd == -1)
+    throw PoolCreationException();
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+
+  // Workers must never take SIGINT meant for the main thread
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &previous);
+  for (int i = 0; i < workers; i++)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &FileIOPool::workerMain, this) != 0)
+      break;
+    threads.push_back(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (threads.empty() && workers > 0)
+  {
+    shutdown();
+    throw PoolCreationException();
+  }
+}
+
+FileIOPool::~FileIOPool()
+{
+  shutdown();
+}
+
+void FileIOPool::shutdown()
+{
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  for (size_t i = 0; i < threads.size(); i++)
+    pthread_join(threads[i], NULL);
+  threads.clear();
+
+  FileJob *lists[3] = {pendingHead, completedHead, freeList};
+  for (int i = 0; i < 3; i++)
+  {
+    while (lists[i])
+    {
+      FileJob *job = lists[i];
+      lists[i] = job->next;
+      if (job->fd != -1)
+        close(job->fd);
+      delete job;
+    }
+  }
+  pendingHead = pendingTail = completedHead = completedTail = freeList = NULL;
+
+  if (eventFd != -1)
+  {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+    close(eventFd);
+    eventFd = -1;
+  }
+}
+
+int FileIOPool::getFd() const { return eventFd; }
+
+ConnectionType FileIOPool::getType() const { return FILE_IO; }
+
+FileJob *FileIOPool::acquire()
+{
+  FileJob *job = freeList;
+  if (job)
+    freeList = job->next;
+  else
+    job = new FileJob();
+  job->id = ++nextId;
+  job->fd = -1;
+  job->status = FILE_OK;
+  job->bytes = 0;
+  job->error = 0;
+  job->size = 0;
+  job->next = NULL;
+  return job;
+}
+
+void FileIOPool::release(FileJob *job)
+{
+  // The caller has either adopted or closed any fd the job produced
+  job->fd = -1;
+  job->next = freeList;
+  freeList = job;
+}
+
+void FileIOPool::submit(FileJob *job)
+{
+  job->next = NULL;
+  if (threads.empty())
+  {
+    // No workers: degrade to doing the work inline
+    process(*job);
+    pthread_mutex_lock(&mutex);
+    if (completedTail)
+      completedTail->next = job;
+    else
+      completedHead = job;
+    completedTail = job;
+    pthread_mutex_unlock(&mutex);
+    uint64_t one = 1;
+    ssize_t ignored = write(eventFd, &one, sizeof(one));
+    (void)ignored;
+    return;
+  }
+  pthread_mutex_lock(&mutex);
+  if (pendingTail)
+    pendingTail->next = job;
+  else
+    pendingHead = job;
+  pendingTail = job;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+FileJob *FileIOPool::takeCompleted()
+{
+  uint64_t count;
+  while (read(eventFd, &count, sizeof(count)) > 0)
+    ;
+  pthread_mutex_lock(&mutex);
+  FileJob *list = completedHead;
+  completedHead = completedTail = NULL;
+  pthread_mutex_unlock(&mutex);
+  return list;
+}
+
+void *FileIOPool::workerMain(void *arg)
+{
+  static_cast<FileIOPool *>(arg)->workerLoop();
+  return NULL;
+}
+
+void FileIOPool::workerLoop()
+{
+  while (true)
+  {
+    pthread_mutex_lock(&mutex);
+    while (!pendingHead && !stopping)
+      pthread_cond_wait(&cond, &mutex);
+    if (stopping)
+    {
+      pthread_mutex_unlock(&mutex);
+      return;
+    }
+    FileJob *job = pendingHead;
+    pendingHead = job->next;
+    if (!pendingHead)
+      pendingTail = NULL;
+    pthread_mutex_unlock(&mutex);
+
+    job->next = NULL;
+    process(*job);
+
+    pthread_mutex_lock(&mutex);
+    if (completedTail)
+      completedTail->next = job;
+    else
+      completedHead = job;
+    completedTail = job;
+    pthread_mutex_unlock(&mutex);
+
+    uint64_t one = 1;
+    ssize_t ignored = write(eventFd, &one, sizeof(one));
+    (void)ignored;
+  }
+}
+
+void FileIOPool::process(FileJob &job)
+{
+  if (job.type == FILE_JOB_READ)
+  {
+    job.bytes = pread(job.fd, job.data, job.length, job.offset);
+    job.error = job.bytes < 0 ? errno : 0;
+    // The reader works on its own dup so the connection may close freely
+    close(job.fd);
+    job.fd = -1;
+    return;
+  }
+
+  struct stat st;
+  if (stat(job.path.c_str(), &st) != 0)
+  {
+    job.status = FILE_NOT_FOUND;
+    return;
+  }
+  if (S_ISDIR(st.st_mode))
+  {
+    if (job.path.empty() || job.path[job.path.size() - 1] != '/')
+    {
+      job.status = FILE_IS_DIRECTORY;
+      return;
+    }
+    job.path += job.index;
+    if (stat(job.path.c_str(), &st) != 0)
+    {
+      job.status = FILE_NOT_FOUND;
+      return;
+    }
+  }
+  if (!S_ISREG(st.st_mode))
+  {
+    job.status = FILE_NOT_REGULAR;
+    return;
+  }
+  job.fd = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (job.fd == -1 || fstat(job.fd, &st) != 0)
+  {
+    if (job.fd != -1)
+      close(job.fd);
+    job.fd = -1;
+    job.status = FILE_NOT_FOUND;
+    return;
+  }
+  job.size = st.st_size;
+  job.status = FILE_OK;
+}
@@ -0,0 +1,132 @@
+#include "core/HeaderBuilder.hpp"
+#include "utils/Number.hpp"
+#include <algorithm>
+#include <cstring>
+
+struct StatusLine
+{
+  int code;
+  const char *message;
+  const char *line;
+  size_t length;
+};
+
+#define STATUS_LINE(code, message) \
+  {code, message, "HTTP/1.1 " #code " " message "\r\n", sizeof("HTTP/1.1 " #code " " message "\r\n") - 1}
+
+static const StatusLine statusLines[] = {
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(201, "Created"),
+    STATUS_LINE(301, "Moved Permanently"),
+    STATUS_LINE(302, "Found"),
+    STATUS_LINE(303, "See Other"),
+    STATUS_LINE(307, "Temporary Redirect"),
+    STATUS_LINE(308, "Permanent Redirect"),
+    STATUS_LINE(400, "Bad Request"),
+    STATUS_LINE(401, "Unauthorized"),
+    STATUS_LINE(403, "Forbidden"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(405, "Method Not Allowed"),
+    STATUS_LINE(411, "Length Required"),
+    STATUS_LINE(413, "Payload Too Large"),
+    STATUS_LINE(414, "URI Too Long"),
+    STATUS_LINE(415, "Unsupported Media Type"),
+    STATUS_LINE(429, "Too Many Requests"),
+    STATUS_LINE(431, "Request Header Fields Too Large"),
+    STATUS_LINE(500, "Internal Server Error"),
+    STATUS_LINE(501, "Not Implemented"),
+    STATUS_LINE(502, "Bad Gateway"),
+    STATUS_LINE(503, "Service Unavailable"),
+    STATUS_LINE(504, "Gateway Timeout"),
+};
+
+#undef STATUS_LINE
+
+static const size_t StatusLineCount = sizeof(statusLines) / sizeof(statusLines[0]);
+static const size_t ReservedHeadSize = 512;
+
+static const StatusLine *findStatusLine(int status)
+{
+  for (size_t i = 0; i < StatusLineCount; i++)
+  {
+    if (statusLines[i].code == status)
+      return &statusLines[i];
+  }
+  return NULL;
+}
+
+HeaderBuilder::HeaderBuilder(std::string &out, int status) : out(out)
+{
+  out.clear();
+  out.reserve(ReservedHeadSize);
+  const StatusLine *known = findStatusLine(status);
+  if (known)
+  {
+    out.append(known->line, known->length);
+    return;
+  }
+  char digits[Number::MaxDigits];
+  out.append("HTTP/1.1 ", 9);
+  out.append(digits, Number::format(digits, status));
+  out.append(" Unknown\r\n", 10);
+}
+
+HeaderBuilder::HeaderBuilder(std::string &out, int status, const char *reason, size_t reasonLength) : out(out)
+{
+  out.clear();
+  out.reserve(ReservedHeadSize);
+  char digits[Number::MaxDigits];
+  out.append("HTTP/1.1 ", 9);
+  out.append(digits, Number::format(digits, status));
+  out.append(" ", 1);
+  out.append(reason, reasonLength);
+  out.append("\r\n", 2);
+}
+
+HeaderBuilder::HeaderBuilder(std::string &out, const std::string &head) : out(out)
+{
+  out.clear();
+  out.reserve(std::max(ReservedHeadSize, head.size() + 128));
+  out.append(head);
+}
+
+HeaderBuilder &HeaderBuilder::add(const char *name, const char *value, size_t length)
+{
+  return add(name, strlen(name), value, length);
+}
+
+HeaderBuilder &HeaderBuilder::add(const char *name, size_t nameLength, const char *value, size_t valueLength)
+{
+  out.append(name, nameLength);
+  out.append(": ", 2);
+  out.append(value, valueLength);
+  out.append("\r\n", 2);
+  return *this;
+}
+
+HeaderBuilder &HeaderBuilder::add(const char *name, const char *value)
+{
+  return add(name, value, strlen(value));
+}
+
+HeaderBuilder &HeaderBuilder::add(const char *name, const std::string &value)
+{
+  return add(name, value.data(), value.size());
+}
+
+HeaderBuilder &HeaderBuilder::add(const char *name, unsigned long long value)
+{
+  char digits[Number::MaxDigits];
+  return add(name, digits, Number::format(digits, value));
+}
+
+void HeaderBuilder::finish()
+{
+  out.append("\r\n", 2);
+}
+
+const char *HeaderBuilder::statusMessage(int status)
+{
+  const StatusLine *known = findStatusLine(status);
+  return known ? known->message : "Unknown";
+}
@@ -1,14 +1,14 @@
 #include "core/HttpRequest.hpp"
 #include "utils/Number.hpp"
 #include "utils/String.hpp"
+#include "config/RuntimeConfig.hpp"
 #include "utils/Constants.hpp"
+#include <algorithm>
 #include <iostream>
 
-HttpRequest::HttpRequest() : state(PARSE_REQUEST_LINE), errorCode(0), buffer("") {
-  allowedMethods.insert("GET");
-  allowedMethods.insert("POST");
-  allowedMethods.insert("DELETE");
-}
+HttpRequest::HttpRequest()
+    : state(PARSE_REQUEST_LINE), errorCode(0), buffer(""), parsed(0), headerStart(0), headerCount(0),
+      streamBody(false), bodyLeft(0) {}
 
 HttpRequest::~HttpRequest() {}
 
@@ -41,26 +41,33 @@ void HttpRequest::parse() {
     parseBody();
   }
 }
+
 void HttpRequest::parseRequestLine() {
-  std::size_t pos = buffer.find("\r\n");
+  std::size_t pos = buffer.find("\r\n", parsed);
   if (pos == std::string::npos) {
-    if (buffer.size() > Constants::Http::MaxRequestLine) {
+    if (buffer.size() - parsed > RuntimeConfig::get().maxRequestLine) {
       state = PARSE_ERROR;
       errorCode = 414; // URI Too Long
       return;
     }
     return;
   }
-  std::string requestLine = buffer.substr(0, pos);
-  buffer.erase(0, pos + 2);
+  if (pos - parsed > RuntimeConfig::get().maxRequestLine) {
+    state = PARSE_ERROR;
+    errorCode = 414;
+    return;
+  }
+  std::size_t lineStart = parsed;
+  parsed = pos + 2;
+  headerStart = parsed;
 
-  std::size_t methodEnd = requestLine.find(' ');
-  if (methodEnd == std::string::npos) {
+  std::size_t methodEnd = buffer.find(' ', lineStart);
+  if (methodEnd == std::string::npos || methodEnd > pos) {
     state = PARSE_ERROR;
     errorCode = 400; // Bad Request
     return;
   }
-  method = requestLine.substr(0, methodEnd);
+  method.assign(buffer, lineStart, methodEnd - lineStart);
 
   if (!isMethodAllowed(method)) {
     state = PARSE_ERROR;
@@ -68,72 +75,90 @@ void HttpRequest::parseRequestLine() {
     return;
   }
 
-  std::size_t uriEnd = requestLine.find(' ', methodEnd + 1);
-  if (uriEnd == std::string::npos) {
+  std::size_t uriEnd = buffer.find(' ', methodEnd + 1);
+  if (uriEnd == std::string::npos || uriEnd > pos) {
     state = PARSE_ERROR;
     errorCode = 400;
     return;
   }
-  std::string uri = requestLine.substr(methodEnd + 1, uriEnd - methodEnd - 1);
-  parseUri(uri);
-  version = requestLine.substr(uriEnd + 1);
+  parseUri(methodEnd + 1, uriEnd);
+  version.assign(buffer, uriEnd + 1, pos - uriEnd - 1);
   state = PARSE_HEADERS;
 }
 
-void HttpRequest::parseUri(std::string uri) {
-  std::size_t queryPos = uri.find('?');
-  if (queryPos == std::string::npos) {
-    path = uri;
+// Splits buffer[start, end) into path and query string
+void HttpRequest::parseUri(size_t start, size_t end) {
+  std::size_t queryPos = buffer.find('?', start);
+  if (queryPos == std::string::npos || queryPos >= end) {
+    path.assign(buffer, start, end - start);
     return;
   }
-  path = uri.substr(0, queryPos);
-  std::string queryString = uri.substr(queryPos + 1);
-  std::size_t pos = 0;
-  while ((pos = queryString.find('&')) != std::string::npos) {
-    std::string param = queryString.substr(0, pos);
-    queryString.erase(0, pos + 1);
-    std::size_t equalPos = param.find('=');
-    if (equalPos != std::string::npos) {
-      std::string name = param.substr(0, equalPos);
-      std::string value = param.substr(equalPos + 1);
-      queryParams[name] = value;
-    }
-  }
-  if (!queryString.empty()) {
-    std::size_t equalPos = queryString.find('=');
-    if (equalPos != std::string::npos) {
-      std::string name = queryString.substr(0, equalPos);
-      std::string value = queryString.substr(equalPos + 1);
-      queryParams[name] = value;
+  path.assign(buffer, start, queryPos - start);
+  query.assign(buffer, queryPos + 1, end - queryPos - 1);
+
+  std::size_t paramStart = 0;
+  while (paramStart < query.size()) {
+    std::size_t paramEnd = query.find('&', paramStart);
+    if (paramEnd == std::string::npos)
+      paramEnd = query.size();
+    std::size_t equalPos = query.find('=', paramStart);
+    if (equalPos != std::string::npos && equalPos < paramEnd) {
+      queryParams[query.substr(paramStart, equalPos - paramStart)] =
+          query.substr(equalPos + 1, paramEnd - equalPos - 1);
     }
+    paramStart = paramEnd + 1;
   }
 }
 
 void HttpRequest::parseHeaders() {
   std::size_t pos;
-  while ((pos = buffer.find("\r\n")) != std::string::npos) {
-    std::string line = buffer.substr(0, pos);
-    buffer.erase(0, pos + 2);
+  while ((pos = buffer.find("\r\n", parsed)) != std::string::npos) {
+    std::size_t lineStart = parsed;
+    parsed = pos + 2;
+    if (parsed - headerStart > RuntimeConfig::get().maxHeaderSize)
+      break;
 
-    if (line.empty()) {
+    if (pos == lineStart) {
       state = PARSE_PROCESS_HEADERS;
       return;
     }
 
-    std::size_t colonPos = line.find(':');
-    if (colonPos == std::string::npos) {
+    std::size_t colonPos = buffer.find(':', lineStart);
+    if (colonPos == std::string::npos || colonPos > pos) {
       state = PARSE_ERROR;
       errorCode = 400;
       return;
     }
 
-    std::string name = String::toLower(line.substr(0, colonPos));
-    std::string value = line.substr(colonPos + 1);
-    value = String::trim(value);
-    headers[name] = value;
+    std::size_t valueStart = colonPos + 1;
+    std::size_t valueEnd = pos;
+    while (valueStart < valueEnd && (buffer[valueStart] == ' ' || buffer[valueStart] == '\t'))
+      valueStart++;
+    while (valueEnd > valueStart && (buffer[valueEnd - 1] == ' ' || buffer[valueEnd - 1] == '\t'))
+      valueEnd--;
+
+    // Reuse an existing slot, or the first slot for a repeated name
+    std::size_t nameLength = colonPos - lineStart;
+    HeaderField *field = NULL;
+    for (size_t i = 0; i < headerCount; i++) {
+      if (headers[i].name.size() == nameLength &&
+          String::equalsIgnoreCase(headers[i].name, buffer.data() + lineStart, nameLength)) {
+        field = &headers[i];
+        break;
+      }
+    }
+    if (!field) {
+      if (headerCount == headers.size())
+        headers.push_back(HeaderField());
+      field = &headers[headerCount++];
+      field->name.assign(buffer, lineStart, nameLength);
+      String::toLowerInPlace(field->name);
+    }
+    field->value.assign(buffer, valueStart, valueEnd - valueStart);
   }
 
-  if (buffer.size() > Constants::Http::MaxHeaderSize) {
+  // The whole header block counts, not just the part still unparsed
+  if (buffer.size() - headerStart > RuntimeConfig::get().maxHeaderSize) {
     state = PARSE_ERROR;
     errorCode = 431; // Request Header Fields Too Large
     return;
@@ -141,22 +166,53 @@ void HttpRequest::parseHeaders() {
 }
 
 void HttpRequest::parseBody() {
-  if (headers.find("content-length") == headers.end()) {
+  const std::string &contentLengthHeader = getHeader("content-length");
+  if (contentLengthHeader.empty()) {
     state = PARSE_SUCCESS;
     return;
   }
 
-  std::size_t contentLength = Number::toInt(headers["content-length"]);
-  if (buffer.size() < contentLength) {
+  std::size_t contentLength = Number::toSize(contentLengthHeader);
+  if (streamBody) {
+    bodyLeft = contentLength;
+    state = PARSE_SUCCESS;
     return;
   }
-  body = buffer.substr(0, contentLength);
-  buffer.erase(0, contentLength);
+  if (buffer.size() - parsed < contentLength) {
+    return;
+  }
+  body.assign(buffer, parsed, contentLength);
+  parsed += contentLength;
   state = PARSE_SUCCESS;
 }
 
-bool HttpRequest::isMethodAllowed(const std::string &method) const {
-  return allowedMethods.count(method) > 0;
+void HttpRequest::setBodyStreaming(bool enabled) { streamBody = enabled; }
+
+// Body bytes received but not yet consumed
+size_t HttpRequest::getBufferedBody(const char **data) const {
+  size_t available = std::min(buffer.size() - parsed, bodyLeft);
+  *data = buffer.data() + parsed;
+  return available;
+}
+
+void HttpRequest::consumeBody(size_t length) {
+  parsed += length;
+  bodyLeft -= length;
+  if (parsed == buffer.size()) {
+    buffer.clear();
+    parsed = 0;
+  } else if (parsed >= Constants::Cgi::MaxBufferedInput) {
+    // A reader that never quite catches up must not grow the buffer
+    buffer.erase(0, parsed);
+    parsed = 0;
+  }
+}
+
+// Body bytes that never entered the buffer (spliced from the socket)
+void HttpRequest::skipBody(size_t length) { bodyLeft -= length; }
+
+bool HttpRequest::isMethodAllowed(const std::string &method) {
+  return method == "GET" || method == "POST" || method == "PUT" || method == "DELETE";
 }
 
 void HttpRequest::setState(HttpParseState newState) { state = newState; }
@@ -168,23 +224,49 @@ void HttpRequest::setErrorCode(int code) {
   state = PARSE_ERROR;
 }
 
-std::string HttpRequest::getHeader(const std::string &name) const {
-  std::map<std::string, std::string>::const_iterator it = headers.find(name);
-  if (it != headers.end())
-    return it->second;
-  return "";
+const std::string &HttpRequest::getHeader(const char *name) const {
+  static const std::string empty;
+  for (size_t i = 0; i < headerCount; i++) {
+    if (headers[i].name == name)
+      return headers[i].value;
+  }
+  return empty;
 }
 
 void HttpRequest::clear() {
+  // Keep the buffers for the next request unless a large body grew them
+  if (buffer.capacity() > Constants::Buffer::MaxRetainedRequest)
+    std::string().swap(buffer);
+  buffer.clear();
+  resetFields();
+}
+
+// A body not read to its end leaves nothing that can be parsed as a request
+void HttpRequest::next() {
+  if (bodyLeft > 0 || parsed >= buffer.size()) {
+    clear();
+    return;
+  }
+  buffer.erase(0, parsed);
+  resetFields();
+}
+
+void HttpRequest::resetFields() {
   state = PARSE_REQUEST_LINE;
   errorCode = 0;
-  buffer.clear();
+  if (body.capacity() > Constants::Buffer::MaxRetainedRequest)
+    std::string().swap(body);
+  parsed = 0;
+  headerStart = 0;
   method.clear();
   path.clear();
+  query.clear();
   version.clear();
   queryParams.clear();
-  headers.clear();
+  headerCount = 0;
   body.clear();
+  streamBody = false;
+  bodyLeft = 0;
 }
 
 void HttpRequest::print() const {
@@ -199,9 +281,8 @@ void HttpRequest::print() const {
   }
   std::cout << "Version: [" << version << "]" << std::endl;
   std::cout << "Headers:" << std::endl;
-  for (std::map<std::string, std::string>::const_iterator it = headers.begin();
-       it != headers.end(); ++it) {
-    std::cout << "  " << it->first << ": " << it->second << std::endl;
+  for (size_t i = 0; i < headerCount; i++) {
+    std::cout << "  " << headers[i].name << ": " << headers[i].value << std::endl;
   }
   if (!body.empty()) {
     std::cout << "Body (" << body.size() << " bytes):" << std::endl;
@@ -2,12 +2,34 @@
 #include "utils/MimeTypes.hpp"
 #include "utils/Number.hpp"
 #include "utils/Constants.hpp"
+#include "core/HeaderBuilder.hpp"
+#include "core/MicroCache.hpp"
+#include "core/ResponseTee.hpp"
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <sstream>
 
-HttpResponse::HttpResponse() : state(RESPONSE_IDLE), statusCode(Constants::HttpStatus::OK), headersSent(0), fileFd(-1), fileSize(0), bodySent(0) {}
+const char HttpResponse::Overloaded[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                        "Content-Type: text/plain\r\n"
+                                        "Content-Length: 20\r\n"
+                                        "Retry-After: 1\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n"
+                                        "Service Unavailable\n";
+const size_t HttpResponse::OverloadedLength = sizeof(HttpResponse::Overloaded) - 1;
+
+const char HttpResponse::RateLimited[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                                         "Content-Type: text/plain\r\n"
+                                         "Content-Length: 18\r\n"
+                                         "Retry-After: 1\r\n"
+                                         "Connection: close\r\n"
+                                         "\r\n"
+                                         "Too Many Requests\n";
+const size_t HttpResponse::RateLimitedLength = sizeof(HttpResponse::RateLimited) - 1;
+
+HttpResponse::HttpResponse()
+    : state(RESPONSE_IDLE), statusCode(Constants::HttpStatus::OK), headersSent(0), fileFd(-1), fileOffset(0), fileSize(0),
+      sendfileBody(false), bodySent(0), sharedBody(NULL), streaming(false), streamEnded(false), streamOffset(0), cacheFill(NULL) {}
 
 HttpResponse::~HttpResponse()
 {
@@ -21,35 +43,51 @@ void HttpResponse::clear()
     close(fileFd);
     fileFd = -1;
   }
+  // A response dropped before its end is not stored
+  delete cacheFill;
+  cacheFill = NULL;
+  MicroCacheBody::release(sharedBody);
+  sharedBody = NULL;
   stringBody.clear();
   headersBuffer.clear();
-  headers.clear();
   headersSent = 0;
   bodySent = 0;
+  fileOffset = 0;
   fileSize = 0;
+  sendfileBody = false;
+  streaming = false;
+  streamEnded = false;
+  streamOffset = 0;
   state = RESPONSE_IDLE;
 }
 
 void HttpResponse::prepareFromFile(const std::string &path, int status)
 {
-  clear();
-  statusCode = status;
-  fileFd = open(path.c_str(), O_RDONLY);
-  if (fileFd == -1)
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
   {
     prepareFromError(Constants::HttpStatus::NotFound);
     return;
   }
 
   struct stat st;
-  fstat(fileFd, &st);
-  fileSize = st.st_size;
+  fstat(fd, &st);
+  prepareFromFd(fd, st.st_size, path, status);
+}
 
-  setHeader("Content-Type", MimeTypes::getMimeType(path));
-  setHeader("Content-Length", Number::toString(fileSize));
-  setHeader("Connection", "keep-alive");
+// Takes ownership of an already opened and stat'ed file
+void HttpResponse::prepareFromFd(int fd, size_t size, const std::string &path, int status)
+{
+  clear();
+  statusCode = status;
+  fileFd = fd;
+  fileSize = size;
 
-  generateHeaders();
+  HeaderBuilder(headersBuffer, statusCode)
+      .add(Constants::Header::ContentType, MimeTypes::getMimeType(path))
+      .add(Constants::Header::ContentLength, fileSize)
+      .add(Constants::Header::Connection, "keep-alive")
+      .finish();
   state = RESPONSE_SENDING_HEADERS;
 }
 
@@ -57,14 +95,42 @@ void HttpResponse::prepareFromError(int status, const std::string &message)
 {
   clear();
   statusCode = status;
-  std::string msg = message.empty() ? getStatusMessage(status) : message;
-  stringBody = "<html><body><h1>" + Number::toString(status) + " " + getStatusMessage(status) + "</h1><p>" + msg + "</p></body></html>";
+  const char *reason = HeaderBuilder::statusMessage(status);
+  char code[Number::MaxDigits];
+  size_t codeLength = Number::format(code, status);
+  stringBody.append("<html><body><h1>");
+  stringBody.append(code, codeLength);
+  stringBody.append(" ");
+  stringBody.append(reason);
+  stringBody.append("</h1><p>");
+  if (message.empty())
+    stringBody.append(reason);
+  else
+    stringBody.append(message);
+  stringBody.append("</p></body></html>");
+
+  HeaderBuilder(headersBuffer, statusCode)
+      .add(Constants::Header::ContentType, "text/html")
+      .add(Constants::Header::ContentLength, stringBody.size())
+      .add(Constants::Header::Connection, "close")
+      .finish();
+  state = RESPONSE_SENDING_HEADERS;
+}
 
-  setHeader("Content-Type", "text/html");
-  setHeader("Content-Length", Number::toString(stringBody.size()));
-  setHeader("Connection", "close");
+// Head and body go out together as the head
+void HttpResponse::prepareOverloaded()
+{
+  clear();
+  statusCode = Constants::HttpStatus::ServiceUnavailable;
+  headersBuffer.assign(Overloaded, OverloadedLength);
+  state = RESPONSE_SENDING_HEADERS;
+}
 
-  generateHeaders();
+void HttpResponse::prepareRateLimited()
+{
+  clear();
+  statusCode = Constants::HttpStatus::TooManyRequests;
+  headersBuffer.assign(RateLimited, RateLimitedLength);
   state = RESPONSE_SENDING_HEADERS;
 }
 
@@ -72,71 +138,141 @@ void HttpResponse::prepareRedirect(int status, const std::string &urlOrBody)
 {
   clear();
   statusCode = status;
-  
+  HeaderBuilder headers(headersBuffer, statusCode);
+
   // If it's a redirect status code, use Location header
   if (status >= 300 && status < 400)
   {
-    setHeader("Location", urlOrBody);
-    setHeader("Content-Length", "0");
+    headers.add(Constants::Header::Location, urlOrBody)
+        .add(Constants::Header::ContentLength, "0");
   }
   else
   {
     // Otherwise, treat the second argument as the response body
     stringBody = urlOrBody;
-    setHeader("Content-Type", "text/plain");
-    setHeader("Content-Length", Number::toString(stringBody.size()));
+    headers.add(Constants::Header::ContentType, "text/plain")
+        .add(Constants::Header::ContentLength, stringBody.size());
   }
-  
-  setHeader("Connection", "close");
-  generateHeaders();
+
+  headers.add(Constants::Header::Connection, "close").finish();
   state = RESPONSE_SENDING_HEADERS;
 }
 
-void HttpResponse::setHeader(const std::string &key, const std::string &value)
+// A body generated in memory, such as the status page
+void HttpResponse::prepareFromString(int status, const char *contentType, const std::string &body, bool keepAlive)
 {
-  headers[key] = value;
+  clear();
+  statusCode = status;
+  stringBody = body;
+  HeaderBuilder(headersBuffer, statusCode)
+      .add(Constants::Header::ContentType, contentType)
+      .add(Constants::Header::ContentLength, stringBody.size())
+      .add("Cache-Control", "no-store")
+      .add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close")
+      .finish();
+  state = RESPONSE_SENDING_HEADERS;
 }
 
-void HttpResponse::generateHeaders()
+// A cached response: the stored head, fresh framing, and the body sent
+// straight from the entry's file
+void HttpResponse::prepareFromCache(int fd, int status, const std::string &head, size_t offset, size_t size,
+                                    unsigned long age, bool keepAlive)
 {
-  std::stringstream ss;
-  ss << "HTTP/1.1 " << statusCode << " " << getStatusMessage(statusCode) << "\r\n";
-  for (std::map<std::string, std::string>::iterator it = headers.begin(); it != headers.end(); ++it)
-  {
-    ss << it->first << ": " << it->second << "\r\n";
-  }
-  ss << "\r\n";
-  headersBuffer = ss.str();
+  clear();
+  statusCode = status;
+  fileFd = fd;
+  fileOffset = offset;
+  fileSize = size;
+  sendfileBody = true;
+
+  HeaderBuilder(headersBuffer, head)
+      .add(Constants::Header::ContentLength, fileSize)
+      .add("Age", age)
+      .add("X-Cache", "HIT")
+      .add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close")
+      .finish();
+  state = RESPONSE_SENDING_HEADERS;
 }
 
-std::string HttpResponse::getStatusMessage(int code) const
+// A microcache entry: its head and body as stored, with fresh framing
+void HttpResponse::prepareFromMemory(int status, const std::string &head, MicroCacheBody *body, unsigned long age,
+                                     bool stale, bool keepAlive)
 {
-  switch (code)
+  clear();
+  statusCode = status;
+  sharedBody = MicroCacheBody::retain(body);
+
+  HeaderBuilder(headersBuffer, head)
+      .add(Constants::Header::ContentLength, body->data.size())
+      .add("Age", age)
+      .add("X-Cache", stale ? "STALE" : "HIT")
+      .add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close")
+      .finish();
+  state = RESPONSE_SENDING_HEADERS;
+}
+
+HeaderBuilder HttpResponse::beginStream(int status)
+{
+  ResponseTee *fill = cacheFill;
+  cacheFill = NULL;
+  clear();
+  cacheFill = fill;
+  statusCode = status;
+  streaming = true;
+  state = RESPONSE_SENDING_HEADERS;
+  return HeaderBuilder(headersBuffer, statusCode);
+}
+
+HeaderBuilder HttpResponse::beginStream(int status, const char *reason, size_t reasonLength)
+{
+  ResponseTee *fill = cacheFill;
+  cacheFill = NULL;
+  clear();
+  cacheFill = fill;
+  statusCode = status;
+  streaming = true;
+  state = RESPONSE_SENDING_HEADERS;
+  return HeaderBuilder(headersBuffer, statusCode, reason, reasonLength);
+}
+
+void HttpResponse::appendStream(const char *data, size_t length)
+{
+  if (cacheFill)
+    cacheFill->write(headersBuffer, data, length);
+  stringBody.append(data, length);
+}
+
+void HttpResponse::appendFraming(const char *data, size_t length)
+{
+  stringBody.append(data, length);
+}
+
+void HttpResponse::endStream()
+{
+  if (cacheFill)
   {
-  case Constants::HttpStatus::OK: return "OK";
-  case Constants::HttpStatus::MovedPermanently: return "Moved Permanently";
-  case Constants::HttpStatus::Found: return "Found";
-  case Constants::HttpStatus::SeeOther: return "See Other";
-  case Constants::HttpStatus::TemporaryRedirect: return "Temporary Redirect";
-  case Constants::HttpStatus::PermanentRedirect: return "Permanent Redirect";
-  case Constants::HttpStatus::BadRequest: return "Bad Request";
-  case Constants::HttpStatus::Unauthorized: return "Unauthorized";
-  case Constants::HttpStatus::Forbidden: return "Forbidden";
-  case Constants::HttpStatus::NotFound: return "Not Found";
-  case Constants::HttpStatus::MethodNotAllowed: return "Method Not Allowed";
-  case Constants::HttpStatus::PayloadTooLarge: return "Payload Too Large";
-  case Constants::HttpStatus::UriTooLong: return "URI Too Long";
-  case Constants::HttpStatus::RequestHeaderFieldsTooLarge: return "Request Header Fields Too Large";
-  case Constants::HttpStatus::InternalServerError: return "Internal Server Error";
-  case Constants::HttpStatus::NotImplemented: return "Not Implemented";
-  case Constants::HttpStatus::BadGateway: return "Bad Gateway";
-  case Constants::HttpStatus::ServiceUnavailable: return "Service Unavailable";
-  case Constants::HttpStatus::GatewayTimeout: return "Gateway Timeout";
-  default: return "Unknown";
+    cacheFill->finish(headersBuffer);
+    delete cacheFill;
+    cacheFill = NULL;
   }
+  streamEnded = true;
+  if (state == RESPONSE_SENDING_BODY && streamOffset == stringBody.size())
+    state = RESPONSE_FINISHED;
 }
 
+// Set before the backend starts; the fill follows the stream it begins
+void HttpResponse::setCacheFill(ResponseTee *fill)
+{
+  delete cacheFill;
+  cacheFill = fill;
+}
+
+bool HttpResponse::isStreaming() const { return streaming; }
+size_t HttpResponse::getStreamOffset() const { return streamOffset; }
+size_t HttpResponse::getStreamBuffered() const { return stringBody.size() - streamOffset; }
+
 ResponseState HttpResponse::getState() const { return state; }
+int HttpResponse::getStatusCode() const { return statusCode; }
 const std::string &HttpResponse::getHeadersBuffer() const { return headersBuffer; }
 size_t HttpResponse::getHeadersSent() const { return headersSent; }
 void HttpResponse::updateHeadersSent(size_t bytes)
@@ -144,21 +280,42 @@ void HttpResponse::updateHeadersSent(size_t bytes)
   headersSent += bytes;
   if (headersSent >= headersBuffer.size())
   {
-    state = (fileFd != -1 || !stringBody.empty()) ? RESPONSE_SENDING_BODY : RESPONSE_FINISHED;
+    if (streaming)
+      state = (streamEnded && stringBody.empty()) ? RESPONSE_FINISHED : RESPONSE_SENDING_BODY;
+    else
+      state = (fileFd != -1 || !getStringBody().empty()) ? RESPONSE_SENDING_BODY : RESPONSE_FINISHED;
   }
 }
 
 int HttpResponse::getFileFd() const { return fileFd; }
+size_t HttpResponse::getFileOffset() const { return fileOffset; }
+bool HttpResponse::usesSendfile() const { return sendfileBody; }
 size_t HttpResponse::getBodySent() const { return bodySent; }
 size_t HttpResponse::getFileSize() const { return fileSize; }
 void HttpResponse::updateBodySent(size_t bytes)
 {
   bodySent += bytes;
-  size_t total = (fileFd != -1) ? fileSize : stringBody.size();
+  if (streaming)
+  {
+    // Drop what has been sent once the buffer drains so it never grows
+    streamOffset += bytes;
+    if (streamOffset == stringBody.size())
+    {
+      stringBody.clear();
+      streamOffset = 0;
+      if (streamEnded)
+        state = RESPONSE_FINISHED;
+    }
+    return;
+  }
+  size_t total = (fileFd != -1) ? fileSize : getStringBody().size();
   if (bodySent >= total)
   {
     state = RESPONSE_FINISHED;
   }
 }
 
-const std::string &HttpResponse::getStringBody() const { return stringBody; }
\ No newline at end of file
+const std::string &HttpResponse::getStringBody() const
+{
+  return sharedBody ? sharedBody->data : stringBody;
+}
\ No newline at end of file
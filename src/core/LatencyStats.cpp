@@ -0,0 +1,141 @@
+#include "core/LatencyStats.hpp"
+#include "utils/Logger.hpp"
+#include <cstdio>
+
+std::vector<LatencyStats *> LatencyStats::registry;
+volatile sig_atomic_t LatencyStats::dumpRequested = 0;
+
+// Prometheus bucket bounds: microseconds and the `le` label in seconds
+static const uint64_t BucketUs[] = {100,    250,    500,     1000,    2500,    5000,    10000,   25000,
+                                    50000,  100000, 250000,  500000,  1000000, 2500000, 5000000, 10000000};
+static const char *const BucketLabels[] = {"0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005",
+                                           "0.01",   "0.025",   "0.05",   "0.1",   "0.25",   "0.5",
+                                           "1",      "2.5",     "5",      "10"};
+static const size_t BucketCount = sizeof(BucketUs) / sizeof(BucketUs[0]);
+
+LatencyStats::LatencyStats(const std::string &server, const std::string &location)
+    : server(server), location(location), ttfb(NULL), total(NULL)
+{
+}
+
+LatencyStats::~LatencyStats()
+{
+  delete ttfb;
+  delete total;
+}
+
+void LatencyStats::allocate()
+{
+  ttfb = new Histogram();
+  total = new Histogram();
+}
+
+LatencyStats *LatencyStats::create(const std::string &server, const std::string &location)
+{
+  LatencyStats *stats = new LatencyStats(server, location);
+  registry.push_back(stats);
+  return stats;
+}
+
+void LatencyStats::closeAll()
+{
+  for (size_t i = 0; i < registry.size(); i++)
+    delete registry[i];
+  registry.clear();
+}
+
+void LatencyStats::requestDump() { dumpRequested = 1; }
+
+// One log line per location that has answered anything
+void LatencyStats::dumpIfRequested()
+{
+  if (!dumpRequested)
+    return;
+  dumpRequested = 0;
+  for (size_t i = 0; i < registry.size(); i++)
+  {
+    const LatencyStats *stats = registry[i];
+    if (!stats->ttfb)
+      continue;
+    LOG_INFO("latency server=" << stats->server << " location=" << (stats->location.empty() ? "-" : stats->location)
+             << " requests=" << static_cast<unsigned long>(stats->total->getCount())
+             << " ttfb_p50_us=" << static_cast<unsigned long>(stats->ttfb->valueAtPercentile(50))
+             << " ttfb_p99_us=" << static_cast<unsigned long>(stats->ttfb->valueAtPercentile(99))
+             << " total_p50_us=" << static_cast<unsigned long>(stats->total->valueAtPercentile(50))
+             << " total_p99_us=" << static_cast<unsigned long>(stats->total->valueAtPercentile(99))
+             << " total_max_us=" << static_cast<unsigned long>(stats->total->getMax()));
+  }
+}
+
+void LatencyStats::renderText(std::string &out)
+{
+  char line[256];
+  bool header = false;
+  for (size_t i = 0; i < registry.size(); i++)
+  {
+    const LatencyStats *stats = registry[i];
+    if (!stats->ttfb)
+      continue;
+    if (!header)
+    {
+      snprintf(line, sizeof(line), "\nLatency (ms)%28s %9s %9s %9s %9s %9s\n", "requests", "ttfb p50", "ttfb p99",
+               "total p50", "total p99", "total max");
+      out.append(line);
+      header = true;
+    }
+    std::string name = stats->server + " " + (stats->location.empty() ? "-" : stats->location);
+    snprintf(line, sizeof(line), "%-31s %8lu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name.c_str(),
+             static_cast<unsigned long>(stats->total->getCount()), stats->ttfb->valueAtPercentile(50) / 1000.0,
+             stats->ttfb->valueAtPercentile(99) / 1000.0, stats->total->valueAtPercentile(50) / 1000.0,
+             stats->total->valueAtPercentile(99) / 1000.0, stats->total->getMax() / 1000.0);
+    out.append(line);
+  }
+}
+
+static void appendLabelValue(std::string &out, const std::string &value)
+{
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    if (value[i] == '"' || value[i] == '\\')
+      out += '\\';
+    out += value[i];
+  }
+}
+
+static void appendHistogram(std::string &out, const std::string &labels, const Histogram &histogram)
+{
+  char number[64];
+  for (size_t i = 0; i < BucketCount; i++)
+  {
+    snprintf(number, sizeof(number), "%lu", static_cast<unsigned long>(histogram.countAtOrBelow(BucketUs[i])));
+    out.append("webserv_request_duration_seconds_bucket{").append(labels).append(",le=\"");
+    out.append(BucketLabels[i]).append("\"} ").append(number).append("\n");
+  }
+  snprintf(number, sizeof(number), "%lu", static_cast<unsigned long>(histogram.getCount()));
+  out.append("webserv_request_duration_seconds_bucket{").append(labels).append(",le=\"+Inf\"} ");
+  out.append(number).append("\n");
+  snprintf(number, sizeof(number), "%.6f", histogram.getSum() / 1e6);
+  out.append("webserv_request_duration_seconds_sum{").append(labels).append("} ").append(number).append("\n");
+  snprintf(number, sizeof(number), "%lu", static_cast<unsigned long>(histogram.getCount()));
+  out.append("webserv_request_duration_seconds_count{").append(labels).append("} ").append(number).append("\n");
+}
+
+void LatencyStats::renderPrometheus(std::string &out)
+{
+  out.append("# HELP webserv_request_duration_seconds Time from the first request byte to the first (ttfb) "
+             "and last (total) response byte.\n");
+  out.append("# TYPE webserv_request_duration_seconds histogram\n");
+  for (size_t i = 0; i < registry.size(); i++)
+  {
+    const LatencyStats *stats = registry[i];
+    if (!stats->ttfb)
+      continue;
+    std::string labels = "server=\"";
+    appendLabelValue(labels, stats->server);
+    labels.append("\",location=\"");
+    appendLabelValue(labels, stats->location);
+    labels.append("\",phase=\"");
+    appendHistogram(out, labels + "ttfb\"", *stats->ttfb);
+    appendHistogram(out, labels + "total\"", *stats->total);
+  }
+}
@@ -1,11 +1,18 @@
 #include "core/Location.hpp"
 #include "core/Server.hpp"
+#include "core/AccessLog.hpp"
+#include "core/CgiPool.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/MicroCache.hpp"
+#include "core/RequestLimiter.hpp"
 #include <iostream>
 
 Location::Location(const std::string &path)
     : path(path), server(NULL), autoindex(false), autoindexSet(false),
       maxClientBodySize(0), maxClientBodySizeSet(false),
-      methodsSet(false), returnCode(-1)
+      methodsSet(false), returnCode(-1), accessLog(NULL), accessLogSet(false),
+      fastCgiPass(NULL), cgiPool(NULL), proxyPass(NULL), cache(NULL), microCache(NULL),
+      statusPage(false), latency(NULL), requestLimiter(NULL), requestLimiterSet(false)
 {
 }
 
@@ -58,6 +65,64 @@ void Location::addCgiExtension(const std::string &ext, const std::string &binary
   cgiExtensions[ext] = binary;
 }
 
+void Location::setAccessLog(AccessLog *log)
+{
+  accessLog = log;
+  accessLogSet = true;
+}
+
+void Location::setFastCgiPass(FastCgiUpstream *upstream)
+{
+  fastCgiPass = upstream;
+}
+
+void Location::setCgiPool(CgiPool *pool)
+{
+  cgiPool = pool;
+}
+
+void Location::setProxyPass(UpstreamGroup *group, const std::string &uri)
+{
+  proxyPass = group;
+  proxyUri = uri;
+}
+
+void Location::setProxyTimeouts(const ProxyTimeouts &timeouts)
+{
+  proxyTimeouts = timeouts;
+}
+
+void Location::setCache(ResponseCache *cache)
+{
+  this->cache = cache;
+}
+
+void Location::addCacheValidity(int status, long ms)
+{
+  cacheValidity[status] = ms;
+}
+
+void Location::setMicroCache(MicroCache *cache)
+{
+  microCache = cache;
+}
+
+void Location::setStatusPage(bool enabled)
+{
+  statusPage = enabled;
+}
+
+void Location::setLatencyStats(LatencyStats *stats)
+{
+  latency = stats;
+}
+
+void Location::setRequestLimiter(RequestLimiter *limiter)
+{
+  requestLimiter = limiter;
+  requestLimiterSet = true;
+}
+
 // Resolving getters — fall back to server when not set locally
 
 const std::string &Location::getPath() const { return path; }
@@ -152,6 +217,42 @@ const std::map<std::string, std::string> &Location::getCgiExtensions() const
   return cgiExtensions;
 }
 
+AccessLog *Location::getAccessLog() const
+{
+  if (accessLogSet)
+    return accessLog;
+  if (server)
+    return server->getAccessLog();
+  return NULL;
+}
+
+FastCgiUpstream *Location::getFastCgiPass() const { return fastCgiPass; }
+
+CgiPool *Location::getCgiPool() const { return cgiPool; }
+
+UpstreamGroup *Location::getProxyPass() const { return proxyPass; }
+
+const std::string &Location::getProxyUri() const { return proxyUri; }
+
+const ProxyTimeouts &Location::getProxyTimeouts() const { return proxyTimeouts; }
+
+ResponseCache *Location::getCache() const { return cache; }
+
+const CacheValidity &Location::getCacheValidity() const { return cacheValidity; }
+MicroCache *Location::getMicroCache() const { return microCache; }
+bool Location::hasStatusPage() const { return statusPage; }
+
+LatencyStats *Location::getLatencyStats() const { return latency; }
+
+RequestLimiter *Location::getRequestLimiter() const
+{
+  if (requestLimiterSet)
+    return requestLimiter;
+  if (server)
+    return server->getRequestLimiter();
+  return NULL;
+}
+
 bool Location::hasReturn() const { return getReturnCode() != -1; }
 
 void Location::print() const
@@ -188,4 +289,38 @@ void Location::print() const
     for (std::map<std::string, std::string>::const_iterator it = cgiExtensions.begin(); it != cgiExtensions.end(); ++it)
       std::cout << "        " << it->first << " -> " << it->second << std::endl;
   }
+  if (accessLogSet)
+    std::cout << "      Access log: " << (accessLog ? accessLog->getPath() : "off") << std::endl;
+  if (requestLimiterSet)
+    std::cout << "      Request limit: " << (requestLimiter ? requestLimiter->describe() : "off") << std::endl;
+  if (fastCgiPass)
+    std::cout << "      FastCGI pass: " << fastCgiPass->getAddress() << std::endl;
+  if (cgiPool)
+    cgiPool->print();
+  if (proxyPass)
+  {
+    std::cout << "      Proxy pass: http://" << proxyPass->getName() << proxyUri << std::endl;
+    if (proxyPass->getPeerCount() > 1)
+      proxyPass->print();
+    std::cout << "      Proxy timeouts: connect " << proxyTimeouts.connectMs << "ms, read " << proxyTimeouts.readMs
+              << "ms, send " << proxyTimeouts.sendMs << "ms" << std::endl;
+  }
+  if (cache)
+  {
+    std::cout << "      Cache: " << cache->getDir() << std::endl;
+    for (CacheValidity::const_iterator it = cacheValidity.begin(); it != cacheValidity.end(); ++it)
+    {
+      std::cout << "        Valid: ";
+      if (it->first == 0)
+        std::cout << "any";
+      else
+        std::cout << it->first;
+      std::cout << " " << it->second << "ms" << std::endl;
+    }
+  }
+  if (microCache)
+    std::cout << "      Microcache: " << microCache->getTtl() << "ms, stale " << microCache->getStaleTime()
+              << "ms, max size " << microCache->getMaxSize() << std::endl;
+  if (statusPage)
+    std::cout << "      Status: on" << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "core/Metrics.hpp"
+#include "utils/Histogram.hpp"
+#include "utils/Number.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include <vector>
+
+__thread MetricSlot *Metrics::local = NULL;
+
+// Slots outlive their threads so that nothing counted is lost
+static pthread_mutex_t slotsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<MetricSlot *> slots;
+
+MetricSlot *Metrics::registerThread()
+{
+  void *memory = NULL;
+  if (posix_memalign(&memory, sizeof(MetricSlot), sizeof(MetricSlot)) != 0)
+    throw std::bad_alloc();
+  local = static_cast<MetricSlot *>(memory);
+  std::memset(local, 0, sizeof(MetricSlot));
+  pthread_mutex_lock(&slotsMutex);
+  slots.push_back(local);
+  pthread_mutex_unlock(&slotsMutex);
+  return local;
+}
+
+void Metrics::countResponse(int status)
+{
+  count(METRIC_REQUESTS);
+  if (status >= 100 && status < 600)
+    count(static_cast<MetricCounter>(METRIC_RESPONSES_1XX + status / 100 - 1));
+}
+
+void Metrics::snapshot(uint64_t *totals)
+{
+  for (int i = 0; i < METRIC_COUNTERS; i++)
+    totals[i] = 0;
+  pthread_mutex_lock(&slotsMutex);
+  for (size_t i = 0; i < slots.size(); i++)
+  {
+    for (int j = 0; j < METRIC_COUNTERS; j++)
+      totals[j] += __atomic_load_n(&slots[i]->values[j], __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&slotsMutex);
+}
+
+static void appendNumber(std::string &out, uint64_t value)
+{
+  char digits[Number::MaxDigits];
+  out.append(digits, Number::format(digits, value));
+}
+
+void Metrics::renderText(std::string &out, const ConnectionCounts &connections, const Histogram &loopLag)
+{
+  uint64_t totals[METRIC_COUNTERS];
+  snapshot(totals);
+  out.append("Active connections: ");
+  appendNumber(out, connections.reading + connections.writing + connections.idle);
+  out.append("\nReading: ");
+  appendNumber(out, connections.reading);
+  out.append(" Writing: ");
+  appendNumber(out, connections.writing);
+  out.append(" Idle: ");
+  appendNumber(out, connections.idle);
+  out.append("\nAccepts: ");
+  appendNumber(out, totals[METRIC_ACCEPTS]);
+  out.append("\nRequests: ");
+  appendNumber(out, totals[METRIC_REQUESTS]);
+  out.append("\nBytes: in ");
+  appendNumber(out, totals[METRIC_BYTES_IN]);
+  out.append(" out ");
+  appendNumber(out, totals[METRIC_BYTES_OUT]);
+  out.append("\nResponses:");
+  for (int i = 0; i < 5; i++)
+  {
+    char name[] = " 1xx ";
+    name[1] = static_cast<char>('1' + i);
+    out.append(name);
+    appendNumber(out, totals[METRIC_RESPONSES_1XX + i]);
+  }
+  out.append("\nCache: hits ");
+  appendNumber(out, totals[METRIC_CACHE_HITS]);
+  out.append(" misses ");
+  appendNumber(out, totals[METRIC_CACHE_MISSES]);
+  out.append("\nTimeouts: ");
+  appendNumber(out, totals[METRIC_TIMEOUTS]);
+  out.append("\nShed: ");
+  appendNumber(out, totals[METRIC_SHED]);
+  out.append("\nLimited: conn ");
+  appendNumber(out, totals[METRIC_LIMITED_CONNECTIONS]);
+  out.append(" req ");
+  appendNumber(out, totals[METRIC_LIMITED_REQUESTS]);
+  char lag[128];
+  snprintf(lag, sizeof(lag), "\nLoop lag (ms): p50 %.3f p99 %.3f max %.3f stalls ", loopLag.valueAtPercentile(50) / 1000.0,
+           loopLag.valueAtPercentile(99) / 1000.0, loopLag.getMax() / 1000.0);
+  out.append(lag);
+  appendNumber(out, totals[METRIC_LOOP_STALLS]);
+  out.append("\n");
+}
+
+static void appendFamily(std::string &out, const char *name, const char *type, const char *help)
+{
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+static void appendSample(std::string &out, const char *name, const char *labels, uint64_t value)
+{
+  out.append(name);
+  if (labels)
+    out.append("{").append(labels).append("}");
+  out.append(" ");
+  appendNumber(out, value);
+  out.append("\n");
+}
+
+// Prometheus text exposition format, version 0.0.4
+void Metrics::renderPrometheus(std::string &out, const ConnectionCounts &connections, const Histogram &loopLag)
+{
+  uint64_t totals[METRIC_COUNTERS];
+  snapshot(totals);
+  appendFamily(out, "webserv_connections", "gauge", "Open client connections by state.");
+  appendSample(out, "webserv_connections", "state=\"reading\"", connections.reading);
+  appendSample(out, "webserv_connections", "state=\"writing\"", connections.writing);
+  appendSample(out, "webserv_connections", "state=\"idle\"", connections.idle);
+  appendFamily(out, "webserv_accepts_total", "counter", "Client connections accepted.");
+  appendSample(out, "webserv_accepts_total", NULL, totals[METRIC_ACCEPTS]);
+  appendFamily(out, "webserv_requests_total", "counter", "Requests answered.");
+  appendSample(out, "webserv_requests_total", NULL, totals[METRIC_REQUESTS]);
+  appendFamily(out, "webserv_received_bytes_total", "counter", "Bytes read from clients.");
+  appendSample(out, "webserv_received_bytes_total", NULL, totals[METRIC_BYTES_IN]);
+  appendFamily(out, "webserv_sent_bytes_total", "counter", "Bytes of answered requests sent to clients.");
+  appendSample(out, "webserv_sent_bytes_total", NULL, totals[METRIC_BYTES_OUT]);
+  appendFamily(out, "webserv_responses_total", "counter", "Requests answered by status class.");
+  for (int i = 0; i < 5; i++)
+  {
+    char label[] = "code=\"1xx\"";
+    label[6] = static_cast<char>('1' + i);
+    appendSample(out, "webserv_responses_total", label, totals[METRIC_RESPONSES_1XX + i]);
+  }
+  appendFamily(out, "webserv_cache_requests_total", "counter", "Cache and microcache lookups by result.");
+  appendSample(out, "webserv_cache_requests_total", "result=\"hit\"", totals[METRIC_CACHE_HITS]);
+  appendSample(out, "webserv_cache_requests_total", "result=\"miss\"", totals[METRIC_CACHE_MISSES]);
+  appendFamily(out, "webserv_timeouts_total", "counter", "Connections and backend requests that timed out.");
+  appendSample(out, "webserv_timeouts_total", NULL, totals[METRIC_TIMEOUTS]);
+  appendFamily(out, "webserv_shed_total", "counter", "Connections and requests turned away with a 503 under overload.");
+  appendSample(out, "webserv_shed_total", NULL, totals[METRIC_SHED]);
+  appendFamily(out, "webserv_limited_total", "counter", "Connections (limit_conn) and requests (limit_req) over a per-client limit.");
+  appendSample(out, "webserv_limited_total", "limit=\"conn\"", totals[METRIC_LIMITED_CONNECTIONS]);
+  appendSample(out, "webserv_limited_total", "limit=\"req\"", totals[METRIC_LIMITED_REQUESTS]);
+  appendFamily(out, "webserv_loop_lag_seconds", "summary",
+               "Time the event loop took per pass over a batch of events; a ready event waits up to this.");
+  static const char *const quantiles[] = {"0.5", "0.9", "0.99"};
+  static const double percentiles[] = {50, 90, 99};
+  char value[64];
+  for (int i = 0; i < 3; i++)
+  {
+    snprintf(value, sizeof(value), "%.6f", loopLag.valueAtPercentile(percentiles[i]) / 1e6);
+    out.append("webserv_loop_lag_seconds{quantile=\"").append(quantiles[i]).append("\"} ").append(value).append("\n");
+  }
+  snprintf(value, sizeof(value), "%.6f", loopLag.getSum() / 1e6);
+  out.append("webserv_loop_lag_seconds_sum ").append(value).append("\n");
+  appendSample(out, "webserv_loop_lag_seconds_count", NULL, loopLag.getCount());
+  appendFamily(out, "webserv_loop_stalls_total", "counter", "Event handlers and loop passes over the stall threshold.");
+  appendSample(out, "webserv_loop_stalls_total", NULL, totals[METRIC_LOOP_STALLS]);
+}
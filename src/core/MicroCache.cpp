@@ -0,0 +1,289 @@
+#include "core/MicroCache.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/HttpResponse.hpp"
+#include "core/ResponseCache.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+
+std::vector<MicroCache *> MicroCache::registry;
+long long MicroCache::lastSweepMs = 0;
+
+// Statuses kept for the microcache lifetime when the response sets none
+static bool isMicroCacheable(int status)
+{
+  return status == 200 || status == 203 || status == 300 || status == 301 || status == 302 || status == 308 ||
+         status == 404 || status == 410;
+}
+
+MicroCacheBody *MicroCacheBody::retain(MicroCacheBody *body)
+{
+  body->refs++;
+  return body;
+}
+
+void MicroCacheBody::release(MicroCacheBody *body)
+{
+  if (body && --body->refs == 0)
+    delete body;
+}
+
+MicroCacheFill::MicroCacheFill(MicroCache &cache, EventLoop &loop, const std::string &key)
+    : cache(cache), loop(loop), key(key), pending(true), settled(false), status(0), ttlMs(0),
+      startedMs(Timer::monotonicMs())
+{
+}
+
+// A response that is dropped half way is not stored; waiters go to the
+// backend themselves
+MicroCacheFill::~MicroCacheFill()
+{
+  if (!settled)
+    settle(false);
+}
+
+// The same responses as for the disk cache qualify; their own lifetime
+// can only shorten the microcache one
+bool MicroCacheFill::start(const std::string &responseHead)
+{
+  long ownTtl;
+  if (!ResponseCache::parseHead(responseHead, &status, &head, &ownTtl) || !isMicroCacheable(status))
+    return false;
+  ttlMs = cache.ttlMs;
+  if (ownTtl >= 0 && ownTtl * 1000 < ttlMs)
+    ttlMs = ownTtl * 1000;
+  return ttlMs > 0;
+}
+
+void MicroCacheFill::write(const std::string &responseHead, const char *data, size_t length)
+{
+  if (settled)
+    return;
+  if (pending)
+  {
+    pending = false;
+    if (!start(responseHead))
+    {
+      settle(false);
+      return;
+    }
+  }
+  if (length == 0)
+    return;
+  if (body.size() + length > std::min(cache.maxSize, Constants::MicroCache::MaxEntrySize))
+  {
+    settle(false);
+    return;
+  }
+  body.append(data, length);
+}
+
+// The body is complete: the entry goes live
+void MicroCacheFill::finish(const std::string &responseHead)
+{
+  write(responseHead, NULL, 0);
+  if (settled)
+    return;
+  cache.store(*this);
+  settle(true);
+}
+
+void MicroCacheFill::settle(bool stored)
+{
+  settled = true;
+  std::string().swap(body);
+  cache.settle(*this, stored);
+}
+
+MicroCache::MicroCache(long ttlMs, long staleMs, size_t maxSize)
+    : ttlMs(ttlMs), staleMs(staleMs), maxSize(maxSize), usedSize(0)
+{
+}
+
+MicroCache::~MicroCache()
+{
+  for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    MicroCacheBody::release(it->second.body);
+}
+
+// One cache per location: keys are not shared across locations
+MicroCache *MicroCache::create(long ttlMs, long staleMs, size_t maxSize)
+{
+  MicroCache *cache = new MicroCache(ttlMs, staleMs, maxSize);
+  registry.push_back(cache);
+  return cache;
+}
+
+// Requests parked longer than the lock timeout stop waiting and go to
+// the backend, uncached; once a second entries past their stale window
+// are dropped
+void MicroCache::collect(long long nowMs)
+{
+  bool sweepDue = nowMs - lastSweepMs >= Constants::MicroCache::SweepIntervalMs;
+  if (sweepDue)
+    lastSweepMs = nowMs;
+  for (size_t i = 0; i < registry.size(); i++)
+  {
+    std::map<std::string, MicroCacheFill *> &filling = registry[i]->filling;
+    for (std::map<std::string, MicroCacheFill *>::iterator fill = filling.begin(); fill != filling.end(); ++fill)
+    {
+      MicroCacheFill &current = *fill->second;
+      if (current.waiters.empty() || nowMs - current.startedMs < Constants::Cache::LockTimeoutMs)
+        continue;
+      LOG_INFO("microcache lock timeout key=" << current.key << " waiters=" << current.waiters.size());
+      std::vector<Connection *> waiters;
+      waiters.swap(current.waiters);
+      for (size_t j = 0; j < waiters.size(); j++)
+      {
+        waiters[j]->onMicroCacheFilled(false);
+        current.loop.markDirty(waiters[j]);
+      }
+    }
+    if (sweepDue)
+      registry[i]->sweep(nowMs);
+  }
+}
+
+// Shutdown: the parked connections are about to be freed, so no fill
+// may wake them
+void MicroCache::forgetWaiters()
+{
+  for (size_t i = 0; i < registry.size(); i++)
+  {
+    std::map<std::string, MicroCacheFill *> &filling = registry[i]->filling;
+    for (std::map<std::string, MicroCacheFill *>::iterator fill = filling.begin(); fill != filling.end(); ++fill)
+      fill->second->waiters.clear();
+  }
+}
+
+void MicroCache::closeAll()
+{
+  for (size_t i = 0; i < registry.size(); i++)
+    delete registry[i];
+  registry.clear();
+}
+
+// Responses still being sent keep their body until they are done
+void MicroCache::remove(std::map<std::string, Entry>::iterator it)
+{
+  MicroCacheBody::release(it->second.body);
+  usedSize -= it->second.size;
+  recent.erase(it->second.recent);
+  entries.erase(it);
+}
+
+void MicroCache::sweep(long long nowMs)
+{
+  std::map<std::string, Entry>::iterator it = entries.begin();
+  while (it != entries.end())
+  {
+    std::map<std::string, Entry>::iterator current = it++;
+    if (nowMs >= current->second.staleUntilMs)
+      remove(current);
+  }
+}
+
+// A complete fill replaces any older copy of the key, then the least
+// recently used entries go until the cache fits max_size
+void MicroCache::store(MicroCacheFill &fill)
+{
+  std::map<std::string, Entry>::iterator old = entries.find(fill.key);
+  if (old != entries.end())
+    remove(old);
+  MicroCacheBody *body = new MicroCacheBody();
+  body->data.swap(fill.body);
+  body->refs = 1;
+
+  long long now = Timer::monotonicMs();
+  Entry &entry = entries[fill.key];
+  entry.head = fill.head;
+  entry.status = fill.status;
+  entry.body = body;
+  entry.size = fill.key.size() + fill.head.size() + body->data.size();
+  entry.storedMs = now;
+  entry.expiresMs = now + fill.ttlMs;
+  entry.staleUntilMs = entry.expiresMs + staleMs;
+  recent.push_front(fill.key);
+  entry.recent = recent.begin();
+  usedSize += entry.size;
+  while (usedSize > maxSize && recent.size() > 1)
+    remove(entries.find(recent.back()));
+}
+
+// The fill is over: the key is free for the next miss, and whoever waited
+// for it is served from the new entry or sent to the backend
+void MicroCache::settle(MicroCacheFill &fill, bool stored)
+{
+  std::map<std::string, MicroCacheFill *>::iterator it = filling.find(fill.key);
+  if (it != filling.end() && it->second == &fill)
+    filling.erase(it);
+  std::vector<Connection *> waiters;
+  waiters.swap(fill.waiters);
+  for (size_t i = 0; i < waiters.size(); i++)
+  {
+    waiters[i]->onMicroCacheFilled(stored);
+    fill.loop.markDirty(waiters[i]);
+  }
+}
+
+// A fresh entry for key becomes the response. An expired one still
+// within its stale window does too while another request refreshes it;
+// otherwise the caller is the one to refresh it.
+bool MicroCache::serve(const std::string &key, HttpResponse &response, bool keepAlive)
+{
+  std::map<std::string, Entry>::iterator it = entries.find(key);
+  if (it == entries.end())
+    return false;
+  Entry &entry = it->second;
+  long long now = Timer::monotonicMs();
+  bool stale = now >= entry.expiresMs;
+  if (stale && (now >= entry.staleUntilMs || !filling.count(key)))
+  {
+    if (now >= entry.staleUntilMs)
+      remove(it);
+    return false;
+  }
+  recent.splice(recent.begin(), recent, entry.recent);
+  response.prepareFromMemory(entry.status, entry.head, entry.body,
+                             static_cast<unsigned long>((now - entry.storedMs) / 1000), stale, keepAlive);
+  return true;
+}
+
+// Parks connection behind the fill in progress for key, if there is one
+// it may still wait for
+bool MicroCache::wait(const std::string &key, Connection *connection)
+{
+  std::map<std::string, MicroCacheFill *>::iterator it = filling.find(key);
+  if (it == filling.end() || Timer::monotonicMs() - it->second->startedMs >= Constants::Cache::LockTimeoutMs)
+    return false;
+  it->second->waiters.push_back(connection);
+  return true;
+}
+
+void MicroCache::cancel(const std::string &key, Connection *connection)
+{
+  std::map<std::string, MicroCacheFill *>::iterator it = filling.find(key);
+  if (it == filling.end())
+    return;
+  std::vector<Connection *> &waiters = it->second->waiters;
+  waiters.erase(std::remove(waiters.begin(), waiters.end(), connection), waiters.end());
+}
+
+// The caller's response becomes the only fill for key; NULL when one is
+// already running (past its lock timeout), so this request goes uncached
+MicroCacheFill *MicroCache::startFill(EventLoop &loop, const std::string &key)
+{
+  if (filling.count(key) || key.size() > Constants::Cache::MaxKeySize)
+    return NULL;
+  MicroCacheFill *fill = new MicroCacheFill(*this, loop, key);
+  filling[key] = fill;
+  return fill;
+}
+
+long MicroCache::getTtl() const { return ttlMs; }
+long MicroCache::getStaleTime() const { return staleMs; }
+size_t MicroCache::getMaxSize() const { return maxSize; }
+size_t MicroCache::getEntryCount() const { return entries.size(); }
+size_t MicroCache::getUsedSize() const { return usedSize; }
@@ -0,0 +1,216 @@
+#include "core/MultipartParser.hpp"
+#include "utils/Constants.hpp"
+#include "utils/String.hpp"
+#include <algorithm>
+#include <cstring>
+
+// The parameter key of a header value like `form-data; name="a"`. Only \"
+// and \\ are unescaped in quoted values: browsers send Windows paths as is.
+static bool headerParam(const std::string &value, const char *key, std::string *param)
+{
+  size_t pos = value.find(';');
+  while (pos != std::string::npos && pos < value.size())
+  {
+    size_t start = pos + 1;
+    size_t eq = start;
+    while (eq < value.size() && value[eq] != '=' && value[eq] != ';')
+      eq++;
+    bool match = String::equalsIgnoreCase(String::trim(value.substr(start, eq - start)), key);
+    pos = eq;
+    if (pos == value.size() || value[pos] == ';')
+      continue;
+    pos++;
+    while (pos < value.size() && (value[pos] == ' ' || value[pos] == '\t'))
+      pos++;
+    std::string text;
+    if (pos < value.size() && value[pos] == '"')
+    {
+      for (pos++; pos < value.size() && value[pos] != '"'; pos++)
+      {
+        if (value[pos] == '\\' && pos + 1 < value.size() && (value[pos + 1] == '"' || value[pos + 1] == '\\'))
+          pos++;
+        text += value[pos];
+      }
+      pos = value.find(';', pos);
+    }
+    else
+    {
+      size_t end = value.find(';', pos);
+      text = String::trim(value.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+      pos = end;
+    }
+    if (match)
+    {
+      *param = text;
+      return true;
+    }
+  }
+  return false;
+}
+
+MultipartParser::MultipartParser(MultipartSink &sink, const std::string &boundary)
+    : sink(sink), delimiter("\r\n--" + boundary), state(MULTIPART_PREAMBLE), pending("\r\n")
+{
+  // The body's first delimiter has no CRLF before it; pretend it had
+}
+
+// multipart/form-data; boundary=... with a boundary of 1 to 70 characters
+bool MultipartParser::parseBoundary(const std::string &contentType, std::string *boundary)
+{
+  size_t semi = contentType.find(';');
+  if (!String::equalsIgnoreCase(String::trim(contentType.substr(0, semi)), "multipart/form-data"))
+    return false;
+  return headerParam(contentType, "boundary", boundary) && !boundary->empty() &&
+         boundary->size() <= Constants::Upload::MaxBoundary;
+}
+
+bool MultipartParser::feed(const char *data, size_t length)
+{
+  size_t used = 0;
+  while (used < length && state != MULTIPART_ERROR && state != MULTIPART_EPILOGUE)
+  {
+    if (state == MULTIPART_PREAMBLE || state == MULTIPART_DATA)
+    {
+      bool found;
+      used += scan(data + used, length - used, &found);
+      if (!found || state == MULTIPART_ERROR)
+        continue;
+      if (state == MULTIPART_DATA && !sink.onPartEnd())
+        state = MULTIPART_ERROR;
+      else
+        state = MULTIPART_DELIMITER;
+    }
+    else if (state == MULTIPART_DELIMITER)
+    {
+      char c = data[used++];
+      if (pending.empty() && (c == ' ' || c == '\t'))
+        continue; // transport padding
+      pending += c;
+      if (pending == "--")
+        state = MULTIPART_EPILOGUE;
+      else if (pending == "\r\n")
+        state = MULTIPART_HEADERS;
+      else if (pending.size() == 2 || (c != '-' && c != '\r'))
+        state = MULTIPART_ERROR;
+      // The CRLF stays: the header block then always ends in CRLF CRLF
+      if (state != MULTIPART_DELIMITER && state != MULTIPART_HEADERS)
+        pending.clear();
+    }
+    else
+      used += readHeaders(data + used, length - used);
+  }
+  return state != MULTIPART_ERROR;
+}
+
+// Passes on data up to the next delimiter and consumes the delimiter.
+// A tail that could be the start of one is held back in pending, which
+// is always a proper prefix of the delimiter.
+size_t MultipartParser::scan(const char *data, size_t length, bool *found)
+{
+  *found = false;
+  size_t used = 0;
+  while (!pending.empty())
+  {
+    size_t need = std::min(delimiter.size() - pending.size(), length - used);
+    if (memcmp(delimiter.data() + pending.size(), data + used, need) == 0)
+    {
+      pending.append(data + used, need);
+      used += need;
+      if (pending.size() < delimiter.size())
+        return used;
+      pending.clear();
+      *found = true;
+      return used;
+    }
+    // Not a delimiter after all: give up bytes until what is left could be
+    do
+    {
+      if (!emit(pending.data(), 1))
+        return length;
+      pending.erase(0, 1);
+    } while (!pending.empty() && delimiter.compare(0, pending.size(), pending) != 0);
+  }
+
+  const char *start = data + used;
+  size_t rest = length - used;
+  const char *hit = static_cast<const char *>(memmem(start, rest, delimiter.data(), delimiter.size()));
+  if (hit)
+  {
+    if (!emit(start, hit - start))
+      return length;
+    *found = true;
+    return used + (hit - start) + delimiter.size();
+  }
+  size_t keep = 0;
+  for (size_t k = rest >= delimiter.size() ? rest - delimiter.size() + 1 : 0; k < rest; k++)
+  {
+    if (start[k] == '\r' && memcmp(start + k, delimiter.data(), rest - k) == 0)
+    {
+      keep = rest - k;
+      break;
+    }
+  }
+  if (!emit(start, rest - keep))
+    return length;
+  pending.assign(start + rest - keep, keep);
+  return length;
+}
+
+bool MultipartParser::emit(const char *data, size_t length)
+{
+  if (state != MULTIPART_DATA || length == 0)
+    return true;
+  if (sink.onPartData(data, length))
+    return true;
+  state = MULTIPART_ERROR;
+  return false;
+}
+
+// Collects a part's header block, CRLF CRLF included, and starts the part
+size_t MultipartParser::readHeaders(const char *data, size_t length)
+{
+  size_t before = pending.size();
+  pending.append(data, length);
+  size_t end = pending.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+  if (end == std::string::npos)
+  {
+    if (pending.size() > Constants::Upload::MaxPartHeaders)
+      state = MULTIPART_ERROR;
+    return length;
+  }
+  std::string headers = end > 2 ? pending.substr(2, end - 2) : std::string();
+  pending.clear();
+  state = startPart(headers) ? MULTIPART_DATA : MULTIPART_ERROR;
+  return end + 4 - before;
+}
+
+// Every part names its form field in Content-Disposition; files also
+// carry a filename
+bool MultipartParser::startPart(const std::string &headers)
+{
+  size_t lineStart = 0;
+  while (lineStart < headers.size())
+  {
+    size_t lineEnd = headers.find("\r\n", lineStart);
+    if (lineEnd == std::string::npos)
+      lineEnd = headers.size();
+    size_t colon = headers.find(':', lineStart);
+    if (colon < lineEnd &&
+        String::equalsIgnoreCase(String::trim(headers.substr(lineStart, colon - lineStart)), "content-disposition"))
+    {
+      std::string value = headers.substr(colon + 1, lineEnd - colon - 1);
+      std::string name;
+      std::string filename;
+      if (!headerParam(value, "name", &name))
+        return false;
+      headerParam(value, "filename", &filename);
+      return sink.onPartBegin(name, filename);
+    }
+    lineStart = lineEnd + 2;
+  }
+  return false;
+}
+
+bool MultipartParser::isComplete() const { return state == MULTIPART_EPILOGUE; }
+
+MultipartState MultipartParser::getState() const { return state; }
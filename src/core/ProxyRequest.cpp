@@ -0,0 +1,625 @@
+#include "core/ProxyRequest.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/HttpRequest.hpp"
+#include "core/HttpResponse.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/String.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+// Hop-by-hop headers (RFC 9110 7.6.1) belong to one connection and are
+// never forwarded; framing headers are rewritten for each side
+static bool isHopByHop(const std::string &name)
+{
+  static const char *const names[] = {"connection", "keep-alive", "proxy-connection", "te", "trailer",
+                                      "transfer-encoding", "upgrade"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if (String::equalsIgnoreCase(name, names[i]))
+      return true;
+  }
+  return false;
+}
+
+// Whether a comma-separated header value lists token (case-insensitive)
+static bool hasToken(const std::string &list, const char *token, size_t length)
+{
+  size_t start = 0;
+  while (start < list.size())
+  {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    size_t first = start;
+    size_t last = end;
+    while (first < last && (list[first] == ' ' || list[first] == '\t'))
+      first++;
+    while (last > first && (list[last - 1] == ' ' || list[last - 1] == '\t'))
+      last--;
+    if (last - first == length && strncasecmp(list.data() + first, token, length) == 0)
+      return true;
+    start = end + 1;
+  }
+  return false;
+}
+
+static void appendChunkSize(HttpResponse &response, size_t size)
+{
+  char hex[sizeof(size_t) * 2 + 2];
+  size_t pos = sizeof(hex);
+  hex[--pos] = '\n';
+  hex[--pos] = '\r';
+  do
+  {
+    hex[--pos] = "0123456789abcdef"[size & 0xf];
+    size >>= 4;
+  } while (size > 0);
+  response.appendFraming(hex + pos, sizeof(hex) - pos);
+}
+
+ProxyRequest::ProxyRequest(EventLoop &loop, UpstreamGroup &group, Connection &owner, bool keepAlive,
+                           const ProxyTimeouts &timeouts)
+    : loop(loop), group(group), peer(NULL), tried(group.getPeerCount(), false), owner(owner),
+      request(owner.getRequest()), response(owner.getResponse()), connection(NULL), timeouts(timeouts),
+      progressMs(0), keepAlive(keepAlive), clientChunked(request.getVersion() == "HTTP/1.1"), bodySent(false),
+      onReused(false), connected(false), received(false), retried(false), closed(false), failed(false),
+      expired(false), state(PROXY_HEAD), bodyLeft(0), chunkState(CHUNK_SIZE), chunkLeft(0), reusable(false)
+{
+}
+
+ProxyRequest::~ProxyRequest()
+{
+  abort();
+}
+
+ProxyRequest *ProxyRequest::start(EventLoop &loop, UpstreamGroup &group, Connection &owner,
+                                  const std::string &uri, const char *clientIp, bool keepAlive,
+                                  const ProxyTimeouts &timeouts)
+{
+  ProxyRequest *proxy = new ProxyRequest(loop, group, owner, keepAlive, timeouts);
+  try
+  {
+    proxy->buildHead(uri, clientIp);
+    if (group.getMethod() == UPSTREAM_HASH)
+      proxy->buildKey(clientIp);
+    proxy->dispatch();
+  }
+  catch (...)
+  {
+    delete proxy;
+    throw;
+  }
+  return proxy;
+}
+
+// The client's head minus hop-by-hop headers, with the client address
+// appended to X-Forwarded-For and the upstream connection kept alive
+void ProxyRequest::buildHead(const std::string &uri, const char *clientIp)
+{
+  const std::string &connectionHeader = request.getHeader("connection");
+  head.reserve(512);
+  head += request.getMethod();
+  head += ' ';
+  head += uri;
+  if (!request.getQuery().empty())
+  {
+    head += '?';
+    head += request.getQuery();
+  }
+  head += " HTTP/1.1\r\nHost: ";
+  const std::string &host = request.getHeader("host");
+  head += host.empty() ? group.getName() : host;
+  head += "\r\n";
+  for (size_t i = 0; i < request.getHeaderCount(); i++)
+  {
+    const HeaderField &field = request.getHeaderField(i);
+    if (isHopByHop(field.name) || field.name == "host" || field.name == "content-length" ||
+        field.name == "expect" || field.name == "x-forwarded-for" ||
+        hasToken(connectionHeader, field.name.data(), field.name.size()))
+      continue;
+    head += field.name;
+    head += ": ";
+    head += field.value;
+    head += "\r\n";
+  }
+  head += "X-Forwarded-For: ";
+  const std::string &forwarded = request.getHeader("x-forwarded-for");
+  if (!forwarded.empty())
+  {
+    head += forwarded;
+    head += ", ";
+  }
+  head += clientIp;
+  head += "\r\n";
+  const std::string &contentLength = request.getHeader("content-length");
+  if (!contentLength.empty())
+  {
+    head += "Content-Length: ";
+    head += contentLength;
+    head += "\r\n";
+  }
+  head += "Connection: keep-alive\r\n\r\n";
+}
+
+void ProxyRequest::buildKey(const char *clientIp)
+{
+  UpstreamHashKey hashKey = group.getHashKey();
+  if (hashKey == HASH_REMOTE_ADDR)
+    key = clientIp;
+  else if (hashKey == HASH_HOST)
+    key = request.getHeader("host");
+  else
+  {
+    key = request.getPath();
+    if (hashKey == HASH_REQUEST_URI && !request.getQuery().empty())
+    {
+      key += '?';
+      key += request.getQuery();
+    }
+  }
+}
+
+const std::string &ProxyRequest::upstreamName() const
+{
+  return peer ? peer->upstream->getAddress() : group.getName();
+}
+
+// Sends the head on a pooled (or new) socket of the current server, or of
+// the next one the group picks, then whatever body is already buffered.
+// A server refusing the connection outright is skipped.
+void ProxyRequest::dispatch()
+{
+  long long nowMs = Timer::monotonicMs();
+  while (!connection)
+  {
+    if (!peer)
+    {
+      peer = group.select(key, tried, nowMs);
+      if (!peer)
+        throw UpstreamGroup::NoLiveUpstreamException();
+      tried[peer->index] = true;
+      group.begin(peer);
+    }
+    try
+    {
+      connection = peer->upstream->acquire(loop);
+    }
+    catch (const ProxyUpstream::ProxyConnectException &)
+    {
+      leavePeer(true);
+    }
+  }
+  onReused = connection->isReused();
+  connected = !connection->isConnecting();
+  connection->attach(this);
+  progressMs = nowMs;
+  connection->send(head.data(), head.size());
+  onInputReady();
+}
+
+// Forwards buffered body, holding back once the socket has a window's
+// worth queued
+void ProxyRequest::onInputReady()
+{
+  if (!connection)
+    return;
+  const char *data;
+  size_t length = request.getBufferedBody(&data);
+  while (length > 0 && connection->getPendingOutput() < Constants::Proxy::MaxPendingOutput)
+  {
+    connection->send(data, length);
+    bodySent = true;
+    request.consumeBody(length);
+    length = request.getBufferedBody(&data);
+  }
+}
+
+void ProxyRequest::onConnected()
+{
+  connected = true;
+  progressMs = Timer::monotonicMs();
+  owner.updateActivity();
+}
+
+void ProxyRequest::onWritable()
+{
+  owner.updateActivity();
+  onInputReady();
+  loop.markDirty(&owner);
+}
+
+void ProxyRequest::onData(const char *data, size_t length)
+{
+  received = true;
+  owner.updateActivity();
+  while (length > 0 && !closed && state != PROXY_DONE)
+  {
+    size_t used = length;
+    if (state == PROXY_HEAD)
+      used = parseHead(data, length);
+    else if (state == PROXY_BODY_LENGTH)
+    {
+      used = std::min(bodyLeft, length);
+      response.appendStream(data, used);
+      bodyLeft -= used;
+      if (bodyLeft == 0)
+        state = PROXY_DONE;
+    }
+    else if (state == PROXY_BODY_CHUNKED)
+      used = parseChunked(data, length);
+    else
+      response.appendStream(data, length);
+    data += used;
+    length -= used;
+  }
+  // Bytes past the end of the response mean the server is out of step
+  if (!closed && state == PROXY_DONE)
+  {
+    if (length > 0)
+      reusable = false;
+    finish();
+  }
+  loop.markDirty(&owner);
+}
+
+// Collects the head up to the blank line; interim 1xx responses are
+// dropped
+size_t ProxyRequest::parseHead(const char *data, size_t length)
+{
+  size_t before = line.size();
+  line.append(data, length);
+  size_t end = line.find("\r\n\r\n", before < 3 ? 0 : before - 3);
+  if (end == std::string::npos)
+  {
+    if (line.size() > Constants::Http::MaxHeaderSize)
+    {
+      LOG_WARN("proxy response head too large upstream=" << upstreamName());
+      fail();
+    }
+    return length;
+  }
+  std::string block = line.substr(0, end + 2);
+  line.clear();
+  if (!startResponse(block))
+  {
+    LOG_WARN("proxy bad response head upstream=" << upstreamName());
+    fail();
+  }
+  else if (peer)
+    group.succeeded(peer);
+  return end + 4 - before;
+}
+
+// Parses the status line and headers, picks the body framing for both
+// sides and starts the client response
+bool ProxyRequest::startResponse(const std::string &block)
+{
+  size_t lineEnd = block.find("\r\n");
+  if (block.compare(0, 5, "HTTP/") != 0 || lineEnd < 12 || block[8] != ' ')
+    return false;
+  std::string version = block.substr(0, 8);
+  int status = std::atoi(block.c_str() + 9);
+  if (status < 100 || status > 599)
+    return false;
+  if (status < 200)
+    return status != 101; // 100 Continue and friends; the real head follows
+  size_t reasonStart = std::min(lineEnd, static_cast<size_t>(13));
+
+  // Framing and keep-alive first: they decide which headers go out
+  bool chunked = false;
+  bool hasLength = false;
+  bool hasEncoding = false;
+  size_t contentLength = 0;
+  std::string connectionHeader;
+  size_t pos = lineEnd + 2;
+  while (pos < block.size())
+  {
+    size_t end = block.find("\r\n", pos);
+    size_t colon = block.find(':', pos);
+    if (colon == std::string::npos || colon > end)
+      return false;
+    std::string name = block.substr(pos, colon - pos);
+    std::string value = String::trim(block.substr(colon + 1, end - colon - 1));
+    if (String::equalsIgnoreCase(name, "content-length"))
+    {
+      if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || value.size() > 15 ||
+          (hasLength && std::strtoul(value.c_str(), NULL, 10) != contentLength))
+        return false;
+      contentLength = std::strtoul(value.c_str(), NULL, 10);
+      hasLength = true;
+    }
+    else if (String::equalsIgnoreCase(name, "transfer-encoding"))
+    {
+      hasEncoding = true;
+      chunked = value.size() >= 7 && strncasecmp(value.c_str() + value.size() - 7, "chunked", 7) == 0;
+    }
+    else if (String::equalsIgnoreCase(name, "connection"))
+      connectionHeader = value;
+    pos = end + 2;
+  }
+
+  reusable = version == "HTTP/1.1" ? !hasToken(connectionHeader, "close", 5)
+                                   : hasToken(connectionHeader, "keep-alive", 10);
+  if (status == 204 || status == 304)
+    state = PROXY_DONE;
+  else if (hasEncoding)
+  {
+    // An encoding other than chunked is only delimited by the close
+    state = chunked ? PROXY_BODY_CHUNKED : PROXY_BODY_CLOSE;
+    hasLength = false;
+  }
+  else if (hasLength)
+  {
+    bodyLeft = contentLength;
+    state = contentLength > 0 ? PROXY_BODY_LENGTH : PROXY_DONE;
+  }
+  else
+    state = PROXY_BODY_CLOSE;
+  if (state == PROXY_BODY_CLOSE)
+    reusable = false;
+  // The client can only be kept if it learns where this body ends
+  if (state == PROXY_BODY_CLOSE || (state == PROXY_BODY_CHUNKED && !clientChunked))
+    keepAlive = false;
+
+  HeaderBuilder builder = response.beginStream(status, block.data() + reasonStart, lineEnd - reasonStart);
+  pos = lineEnd + 2;
+  while (pos < block.size())
+  {
+    size_t end = block.find("\r\n", pos);
+    size_t colon = block.find(':', pos);
+    std::string name = block.substr(pos, colon - pos);
+    size_t valueStart = colon + 1;
+    while (valueStart < end && (block[valueStart] == ' ' || block[valueStart] == '\t'))
+      valueStart++;
+    if (!isHopByHop(name) && !hasToken(connectionHeader, name.data(), name.size()) &&
+        (hasLength || !String::equalsIgnoreCase(name, "content-length")))
+      builder.add(name.data(), name.size(), block.data() + valueStart, end - valueStart);
+    pos = end + 2;
+  }
+  if (state == PROXY_BODY_CHUNKED && clientChunked)
+    builder.add("Transfer-Encoding", "chunked");
+  builder.add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close").finish();
+  return true;
+}
+
+// Reads one CRLF-terminated line into line; false while it is incomplete
+bool ProxyRequest::readLine(const char *data, size_t length, size_t *used)
+{
+  const char *newline = static_cast<const char *>(memchr(data, '\n', length));
+  size_t take = newline ? newline - data + 1 : length;
+  line.append(data, take);
+  *used = take;
+  if (line.size() > Constants::Proxy::MaxLineSize)
+  {
+    LOG_WARN("proxy chunk line too long upstream=" << upstreamName());
+    fail();
+    return false;
+  }
+  if (!newline)
+    return false;
+  line.erase(line.size() - 1);
+  if (!line.empty() && line[line.size() - 1] == '\r')
+    line.erase(line.size() - 1);
+  return true;
+}
+
+// Decodes the chunked body; for an HTTP/1.1 client the same chunks are
+// written back out, trailers dropped
+size_t ProxyRequest::parseChunked(const char *data, size_t length)
+{
+  size_t total = 0;
+  while (total < length && state == PROXY_BODY_CHUNKED && !closed)
+  {
+    if (chunkState == CHUNK_DATA)
+    {
+      size_t n = std::min(chunkLeft, length - total);
+      response.appendStream(data + total, n);
+      chunkLeft -= n;
+      total += n;
+      if (chunkLeft == 0)
+      {
+        chunkState = CHUNK_DATA_END;
+        if (clientChunked)
+          response.appendFraming("\r\n", 2);
+      }
+      continue;
+    }
+
+    size_t used;
+    bool complete = readLine(data + total, length - total, &used);
+    total += used;
+    if (!complete)
+      continue;
+    if (chunkState == CHUNK_SIZE)
+    {
+      char *end;
+      unsigned long size = std::strtoul(line.c_str(), &end, 16);
+      if (end == line.c_str() || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+      {
+        LOG_WARN("proxy bad chunk size upstream=" << upstreamName());
+        fail();
+        break;
+      }
+      chunkLeft = size;
+      chunkState = size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+      if (size > 0 && clientChunked)
+        appendChunkSize(response, size);
+    }
+    else if (chunkState == CHUNK_DATA_END)
+    {
+      if (!line.empty())
+      {
+        LOG_WARN("proxy bad chunk end upstream=" << upstreamName());
+        fail();
+        break;
+      }
+      chunkState = CHUNK_SIZE;
+    }
+    else if (line.empty())
+    {
+      if (clientChunked)
+        response.appendFraming("0\r\n\r\n", 5);
+      state = PROXY_DONE;
+    }
+    line.clear();
+  }
+  return total;
+}
+
+// The response is complete: the socket goes back to the pool if the
+// whole exchange was clean
+void ProxyRequest::finish()
+{
+  ProxyConnection *current = connection;
+  connection = NULL;
+  if (current)
+    current->release(reusable && request.getBodyLeft() == 0 && current->getPendingOutput() == 0);
+  leavePeer(false);
+  response.endStream();
+  closed = true;
+  loop.markDirty(&owner);
+}
+
+void ProxyRequest::fail()
+{
+  ProxyConnection *current = connection;
+  connection = NULL;
+  if (current)
+    current->release(false);
+  leavePeer(true);
+  closed = true;
+  failed = true;
+  loop.markDirty(&owner);
+}
+
+// The attempt is over for its server; failures count towards max_fails
+void ProxyRequest::leavePeer(bool failure)
+{
+  if (!peer)
+    return;
+  if (failure)
+    group.failed(peer, Timer::monotonicMs());
+  group.end(peer);
+  peer = NULL;
+}
+
+// The server closed the socket: the end of a close-delimited body, or a
+// response cut short
+void ProxyRequest::onEof()
+{
+  if (state == PROXY_BODY_CLOSE)
+  {
+    finish();
+    return;
+  }
+  ProxyConnection *current = connection;
+  connection = NULL;
+  if (current)
+    current->release(false);
+  retryOrFail();
+}
+
+void ProxyRequest::onConnectionLost()
+{
+  connection = NULL;
+  retryOrFail();
+}
+
+// A pooled socket the server closed just as it was reused fails on first
+// use; if nothing was exchanged yet the request goes out again on a new
+// one. Otherwise the server failed, and the request moves on to the next
+// server if it never reached this one or is safe to repeat.
+void ProxyRequest::retryOrFail()
+{
+  if (closed)
+    return;
+  bool untouched = !received && !bodySent;
+  if (untouched && onReused && !retried)
+  {
+    retried = true;
+    try
+    {
+      dispatch();
+      return;
+    }
+    catch (const std::exception &e)
+    {
+      connection = NULL;
+      LOG_WARN("proxy retry failed upstream=" << upstreamName() << " error=\"" << e.what() << "\"");
+    }
+  }
+  LOG_WARN("proxy upstream closed early upstream=" << upstreamName() << " received=" << received);
+  leavePeer(true);
+  if (untouched && (!connected || request.getMethod() != "POST"))
+  {
+    try
+    {
+      dispatch();
+      return;
+    }
+    catch (const std::exception &e)
+    {
+      connection = NULL;
+      leavePeer(false);
+      LOG_WARN("proxy no next upstream group=" << group.getName() << " error=\"" << e.what() << "\"");
+    }
+  }
+  closed = true;
+  failed = true;
+  loop.markDirty(&owner);
+}
+
+// Resumes reading once the client drained some output; time spent waiting
+// on the client does not count against the read timeout
+void ProxyRequest::updateInterest()
+{
+  if (!connection)
+    return;
+  progressMs = Timer::monotonicMs();
+  connection->updateInterest();
+}
+
+void ProxyRequest::abort()
+{
+  if (connection)
+  {
+    ProxyConnection *current = connection;
+    connection = NULL;
+    current->release(false);
+  }
+  leavePeer(expired);
+  closed = true;
+}
+
+bool ProxyRequest::hasRoom() const
+{
+  return closed || state == PROXY_HEAD || response.getStreamBuffered() < Constants::Proxy::MaxBufferedOutput;
+}
+
+bool ProxyRequest::isClosed() const { return closed; }
+bool ProxyRequest::hasFailed() const { return failed; }
+bool ProxyRequest::getKeepAlive() const { return keepAlive; }
+
+// Connect timeout until connected, send timeout while request bytes are
+// queued, read timeout while waiting on the server with the client
+// keeping up
+bool ProxyRequest::isExpired(long long nowMs) const
+{
+  if (closed || !connection)
+    return false;
+  long long idleMs = nowMs - std::max(progressMs, connection->getLastActivity());
+  if (connection->isConnecting())
+    expired = idleMs >= timeouts.connectMs;
+  else if (connection->getPendingOutput() > 0)
+    expired = idleMs >= timeouts.sendMs;
+  else if (request.getBodyLeft() > 0 || !hasRoom())
+    expired = false;
+  else
+    expired = idleMs >= timeouts.readMs;
+  return expired;
+}
@@ -0,0 +1,391 @@
+#include "core/ProxyUpstream.hpp"
+#include "core/EventLoop.hpp"
+#include "core/ProxyRequest.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/NetworkResolver.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+std::map<std::string, ProxyUpstream *> ProxyUpstream::registry;
+
+ProxyTimeouts::ProxyTimeouts()
+    : connectMs(Constants::Timeout::ProxyConnect * 1000L), readMs(Constants::Timeout::ProxyRead * 1000L),
+      sendMs(Constants::Timeout::ProxySend * 1000L)
+{
+}
+
+ProxyConnection::ProxyConnection(ProxyUpstream &upstream, EventLoop &loop, int fd, bool connecting)
+    : upstream(upstream), loop(loop), fd(fd), connecting(connecting), dead(false), hangup(false),
+      reused(false), watched(false), interest(0), lastActivityMs(Timer::monotonicMs()), outSent(0),
+      request(NULL)
+{
+}
+
+// Only closes the socket: the EventLoop may already be gone at shutdown
+ProxyConnection::~ProxyConnection()
+{
+  if (fd != -1)
+    ::close(fd);
+}
+
+int ProxyConnection::getFd() const { return fd; }
+
+ConnectionType ProxyConnection::getType() const { return PROXY; }
+
+bool ProxyConnection::isDead() const { return dead; }
+
+bool ProxyConnection::isIdle() const { return !request; }
+
+bool ProxyConnection::isConnecting() const { return connecting; }
+
+bool ProxyConnection::isReused() const { return reused; }
+
+long long ProxyConnection::getLastActivity() const { return lastActivityMs; }
+
+size_t ProxyConnection::getPendingOutput() const { return out.size() - outSent; }
+
+// A pooled socket the server has since closed (or written to out of turn)
+// must not carry the next request
+bool ProxyConnection::isStale()
+{
+  if (dead || hangup)
+    return true;
+  char byte;
+  ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+void ProxyConnection::attach(ProxyRequest *request)
+{
+  this->request = request;
+  lastActivityMs = Timer::monotonicMs();
+}
+
+// The request is done with the socket. It goes back to the pool only if
+// the exchange ended cleanly on both sides.
+void ProxyConnection::release(bool reusable)
+{
+  request = NULL;
+  if (!reusable || dead || hangup || outSent < out.size())
+  {
+    close();
+    return;
+  }
+  reused = true;
+  lastActivityMs = Timer::monotonicMs();
+  updateInterest();
+}
+
+// Queues request bytes and writes what the socket takes; errors surface
+// as socket events and are handled there
+void ProxyConnection::send(const char *data, size_t length)
+{
+  if (dead)
+    return;
+  out.append(data, length);
+  if (!connecting && !hangup)
+    writeOut();
+  updateInterest();
+}
+
+bool ProxyConnection::writeOut()
+{
+  while (outSent < out.size())
+  {
+    ssize_t n = ::send(fd, out.data() + outSent, out.size() - outSent, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      outSent += n;
+      lastActivityMs = Timer::monotonicMs();
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  out.clear();
+  outSent = 0;
+  return true;
+}
+
+void ProxyConnection::onEvent(uint32_t events)
+{
+  if (dead)
+    return;
+  if (connecting)
+  {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+    {
+      LOG_WARN("proxy connect failed upstream=" << upstream.getAddress() << " error=\"" << strerror(error) << "\"");
+      fail();
+      return;
+    }
+    connecting = false;
+    lastActivityMs = Timer::monotonicMs();
+    if (request)
+      request->onConnected();
+  }
+  if (events & EPOLLERR)
+  {
+    fail();
+    return;
+  }
+  // Pooled: the server closed it, or sent something it should not have
+  if (!request)
+  {
+    close();
+    return;
+  }
+  if (events & EPOLLHUP)
+    hangup = true;
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+    readResponse();
+  if (!dead && request && !hangup && (events & EPOLLOUT))
+  {
+    bool hadOutput = outSent < out.size();
+    if (!writeOut())
+    {
+      fail();
+      return;
+    }
+    if (hadOutput && out.empty())
+      request->onWritable();
+  }
+  updateInterest();
+}
+
+// Reads while the client keeps up; the response may complete (releasing
+// the socket) or fail part way through
+void ProxyConnection::readResponse()
+{
+  char chunk[Constants::Proxy::ReadChunkSize];
+  while (!dead && request && request->hasRoom())
+  {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n > 0)
+    {
+      lastActivityMs = Timer::monotonicMs();
+      request->onData(chunk, n);
+      continue;
+    }
+    if (n == 0)
+    {
+      hangup = true;
+      request->onEof();
+      return;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return;
+    fail();
+    return;
+  }
+}
+
+void ProxyConnection::updateInterest()
+{
+  if (dead)
+    return;
+  uint32_t events = 0;
+  if (connecting || (!hangup && outSent < out.size()))
+    events |= EPOLLOUT;
+  if (!connecting && (!request || request->hasRoom()))
+    events |= EPOLLIN | EPOLLRDHUP;
+
+  // A hung-up socket keeps reporting EPOLLHUP; step out of epoll until
+  // there is room to read the rest of it
+  if (events == 0 && hangup)
+  {
+    if (watched)
+      loop.unwatch(this);
+    watched = false;
+    interest = 0;
+    return;
+  }
+  if (!watched)
+  {
+    try
+    {
+      loop.watch(this, events);
+    }
+    catch (const std::exception &e)
+    {
+      LOG_ERROR("proxy watch failed upstream=" << upstream.getAddress() << " error=\"" << e.what() << "\"");
+      fail();
+      return;
+    }
+    watched = true;
+  }
+  else if (events != interest)
+    loop.modify(this, events);
+  interest = events;
+}
+
+// The socket is unusable: close it and let its request decide between a
+// retry and a 502
+void ProxyConnection::fail()
+{
+  if (dead)
+    return;
+  dead = true;
+  if (watched)
+    loop.unwatch(this);
+  watched = false;
+  ::close(fd);
+  fd = -1;
+  ProxyRequest *lost = request;
+  request = NULL;
+  if (lost)
+    lost->onConnectionLost();
+}
+
+void ProxyConnection::close()
+{
+  fail();
+}
+
+// ProxyUpstream
+
+ProxyUpstream::ProxyUpstream(const std::string &address) : address(address), addrLength(0)
+{
+  if (!NetworkResolver::resolveAddress(address, &addr, &addrLength))
+    throw ProxyAddressException();
+}
+
+ProxyUpstream::~ProxyUpstream()
+{
+  for (size_t i = 0; i < connections.size(); i++)
+    delete connections[i];
+}
+
+ProxyUpstream *ProxyUpstream::open(const std::string &address)
+{
+  std::map<std::string, ProxyUpstream *>::iterator it = registry.find(address);
+  if (it != registry.end())
+    return it->second;
+  ProxyUpstream *upstream = new ProxyUpstream(address);
+  registry[address] = upstream;
+  return upstream;
+}
+
+// http://host[:port][/uri]; the port defaults to 80 and the host must
+// resolve now
+bool ProxyUpstream::parseUrl(const std::string &url, std::string *address, std::string *uri)
+{
+  if (url.compare(0, 7, "http://") != 0)
+    return false;
+  size_t slash = url.find('/', 7);
+  if (!parseAddress(url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7), address))
+    return false;
+  *uri = slash == std::string::npos ? "" : url.substr(slash);
+  return true;
+}
+
+// host[:port] -> host:port, which must resolve now
+bool ProxyUpstream::parseAddress(const std::string &hostPort, std::string *address)
+{
+  if (hostPort.empty() || hostPort.compare(0, 5, "unix:") == 0)
+    return false;
+  std::string withPort = hostPort;
+  if (withPort.find(':') == std::string::npos)
+    withPort += ":80";
+
+  struct sockaddr_storage addr;
+  socklen_t length;
+  if (!NetworkResolver::resolveAddress(withPort, &addr, &length))
+    return false;
+  *address = withPort;
+  return true;
+}
+
+const std::string &ProxyUpstream::getAddress() const { return address; }
+
+// Hands out the most recently used idle socket that is still open, and
+// only then connects a new one
+ProxyConnection *ProxyUpstream::acquire(EventLoop &loop)
+{
+  for (size_t i = connections.size(); i-- > 0;)
+  {
+    ProxyConnection *connection = connections[i];
+    if (connection->isDead() || !connection->isIdle())
+      continue;
+    if (connection->isStale())
+    {
+      connection->close();
+      continue;
+    }
+    return connection;
+  }
+  return connect(loop);
+}
+
+ProxyConnection *ProxyUpstream::connect(EventLoop &loop)
+{
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    throw ProxyConnectException();
+  bool connecting = false;
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), addrLength) == -1)
+  {
+    if (errno != EINPROGRESS)
+    {
+      LOG_WARN("proxy connect failed upstream=" << address << " error=\"" << strerror(errno) << "\"");
+      ::close(fd);
+      throw ProxyConnectException();
+    }
+    connecting = true;
+  }
+  if (addr.ss_family == AF_INET)
+  {
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  }
+
+  ProxyConnection *connection = new ProxyConnection(*this, loop, fd, connecting);
+  connections.push_back(connection);
+  return connection;
+}
+
+// Frees dead sockets and closes idle ones that are surplus or stale
+void ProxyUpstream::sweep(long long nowMs)
+{
+  size_t idle = 0;
+  for (size_t i = connections.size(); i-- > 0;)
+  {
+    ProxyConnection *connection = connections[i];
+    if (!connection->isDead() && connection->isIdle())
+    {
+      if (++idle > Constants::Proxy::MaxIdleConnections ||
+          nowMs - connection->getLastActivity() > Constants::Timeout::ProxyIdle * 1000LL)
+        connection->close();
+    }
+    if (connection->isDead())
+    {
+      delete connection;
+      connections.erase(connections.begin() + i);
+    }
+  }
+}
+
+void ProxyUpstream::collect(long long nowMs)
+{
+  for (std::map<std::string, ProxyUpstream *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    it->second->sweep(nowMs);
+}
+
+void ProxyUpstream::closeAll()
+{
+  for (std::map<std::string, ProxyUpstream *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
@@ -4,6 +4,17 @@
 #include "core/HttpRequest.hpp"
 #include "utils/Constants.hpp"
 
+// Fallbacks for a context with neither server nor location
+static const std::string emptyString;
+static const std::string defaultIndex = "index.html";
+static const std::vector<std::string> defaultMethods(1, "GET");
+static const std::map<int, std::string> noErrorPages;
+static const std::map<std::string, std::string> noCgiExtensions;
+static const ProxyTimeouts defaultProxyTimeouts;
+static const CacheValidity noCacheValidity;
+
+RequestContext::RequestContext() : server(NULL), location(NULL), request(NULL) {}
+
 RequestContext::RequestContext(const Server *server, const Location *location, const HttpRequest *request)
     : server(server), location(location), request(request)
 {
@@ -11,22 +22,22 @@ RequestContext::RequestContext(const Server *server, const Location *location, c
 
 RequestContext::~RequestContext() {}
 
-std::string RequestContext::getRoot() const
+const std::string &RequestContext::getRoot() const
 {
   if (location)
     return location->getRoot();
   if (server)
     return server->getRoot();
-  return "";
+  return emptyString;
 }
 
-std::string RequestContext::getIndex() const
+const std::string &RequestContext::getIndex() const
 {
   if (location)
     return location->getIndex();
   if (server)
     return server->getIndex();
-  return "index.html";
+  return defaultIndex;
 }
 
 bool RequestContext::getAutoindex() const
@@ -47,24 +58,22 @@ size_t RequestContext::getMaxClientBodySize() const
   return Constants::Http::DefaultMaxBodySize;
 }
 
-std::vector<std::string> RequestContext::getMethods() const
+const std::vector<std::string> &RequestContext::getMethods() const
 {
   if (location)
     return location->getMethods();
   if (server)
     return server->getMethods();
-  std::vector<std::string> defaults;
-  defaults.push_back("GET");
-  return defaults;
+  return defaultMethods;
 }
 
-std::map<int, std::string> RequestContext::getErrorPages() const
+const std::map<int, std::string> &RequestContext::getErrorPages() const
 {
   if (location)
     return location->getErrorPages();
   if (server)
     return server->getErrorPages();
-  return std::map<int, std::string>();
+  return noErrorPages;
 }
 
 int RequestContext::getReturnCode() const
@@ -76,13 +85,13 @@ int RequestContext::getReturnCode() const
   return -1;
 }
 
-std::string RequestContext::getReturnUrl() const
+const std::string &RequestContext::getReturnUrl() const
 {
   if (location)
     return location->getReturnUrl();
   if (server)
     return server->getReturnUrl();
-  return "";
+  return emptyString;
 }
 
 bool RequestContext::hasReturn() const
@@ -90,22 +99,110 @@ bool RequestContext::hasReturn() const
   return getReturnCode() != -1;
 }
 
-std::string RequestContext::getUploadStore() const
+const std::string &RequestContext::getUploadStore() const
 {
   if (location)
     return location->getUploadStore();
   if (server)
     return server->getUploadStore();
-  return "";
+  return emptyString;
 }
 
-std::map<std::string, std::string> RequestContext::getCgiExtensions() const
+const std::map<std::string, std::string> &RequestContext::getCgiExtensions() const
 {
   if (location)
     return location->getCgiExtensions();
   if (server)
     return server->getCgiExtensions();
-  return std::map<std::string, std::string>();
+  return noCgiExtensions;
+}
+
+AccessLog *RequestContext::getAccessLog() const
+{
+  if (location)
+    return location->getAccessLog();
+  if (server)
+    return server->getAccessLog();
+  return NULL;
+}
+
+FastCgiUpstream *RequestContext::getFastCgiPass() const
+{
+  if (location)
+    return location->getFastCgiPass();
+  return NULL;
+}
+
+CgiPool *RequestContext::getCgiPool() const
+{
+  if (location)
+    return location->getCgiPool();
+  return NULL;
+}
+
+UpstreamGroup *RequestContext::getProxyPass() const
+{
+  if (location)
+    return location->getProxyPass();
+  return NULL;
+}
+
+const std::string &RequestContext::getProxyUri() const
+{
+  if (location)
+    return location->getProxyUri();
+  return emptyString;
+}
+
+const ProxyTimeouts &RequestContext::getProxyTimeouts() const
+{
+  if (location)
+    return location->getProxyTimeouts();
+  return defaultProxyTimeouts;
+}
+
+ResponseCache *RequestContext::getCache() const
+{
+  if (location)
+    return location->getCache();
+  return NULL;
+}
+
+const std::map<int, long> &RequestContext::getCacheValidity() const
+{
+  if (location)
+    return location->getCacheValidity();
+  return noCacheValidity;
+}
+
+MicroCache *RequestContext::getMicroCache() const
+{
+  if (location)
+    return location->getMicroCache();
+  return NULL;
+}
+
+bool RequestContext::hasStatusPage() const
+{
+  return location && location->hasStatusPage();
+}
+
+LatencyStats *RequestContext::getLatencyStats() const
+{
+  if (location)
+    return location->getLatencyStats();
+  if (server)
+    return server->getLatencyStats();
+  return NULL;
+}
+
+RequestLimiter *RequestContext::getRequestLimiter() const
+{
+  if (location)
+    return location->getRequestLimiter();
+  if (server)
+    return server->getRequestLimiter();
+  return NULL;
 }
 
 const Server *RequestContext::getServer() const { return server; }
@@ -0,0 +1,50 @@
+#include "core/RequestLimiter.hpp"
+#include "utils/Number.hpp"
+#include <sstream>
+
+std::vector<RequestLimiter *> RequestLimiter::registry;
+
+RequestLimiter::RequestLimiter(long rate, bool perMinute, unsigned burst)
+    : rate(rate), perMinute(perMinute), burst(burst), intervalUs((perMinute ? 60000000LL : 1000000LL) / rate),
+      toleranceUs(intervalUs * burst), table(NULL)
+{
+}
+
+RequestLimiter::~RequestLimiter() { delete table; }
+
+RequestLimiter *RequestLimiter::create(long rate, bool perMinute, unsigned burst)
+{
+  RequestLimiter *limiter = new RequestLimiter(rate, perMinute, burst);
+  registry.push_back(limiter);
+  return limiter;
+}
+
+void RequestLimiter::closeAll()
+{
+  for (size_t i = 0; i < registry.size(); i++)
+    delete registry[i];
+  registry.clear();
+}
+
+bool RequestLimiter::parseRate(const std::string &value, long *rate, bool *perMinute)
+{
+  if (value.size() < 4 || value.compare(value.size() - 3, 2, "r/") != 0)
+    return false;
+  char unit = value[value.size() - 1];
+  if (unit != 's' && unit != 'm')
+    return false;
+  bool ok = false;
+  long parsed = Number::toInt(value.substr(0, value.size() - 3), &ok);
+  if (!ok || parsed <= 0 || parsed > Constants::Limit::MaxRate)
+    return false;
+  *rate = parsed;
+  *perMinute = unit == 'm';
+  return true;
+}
+
+std::string RequestLimiter::describe() const
+{
+  std::ostringstream out;
+  out << rate << (perMinute ? "r/m" : "r/s") << " burst=" << burst;
+  return out.str();
+}
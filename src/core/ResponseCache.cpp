@@ -0,0 +1,580 @@
+#include "core/ResponseCache.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "core/HttpResponse.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/String.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::map<std::string, ResponseCache *> ResponseCache::registry;
+
+// Framing and per-hop headers are set again when the entry is served
+static bool isStoredHeader(const std::string &name)
+{
+  static const char *const dropped[] = {"connection", "keep-alive", "transfer-encoding", "content-length", "age",
+                                        "proxy-connection", "te", "trailer", "upgrade", "x-cache"};
+  for (size_t i = 0; i < sizeof(dropped) / sizeof(dropped[0]); i++)
+  {
+    if (String::equalsIgnoreCase(name, dropped[i]))
+      return false;
+  }
+  return true;
+}
+
+// Statuses a response may be stored with on the strength of its own
+// max-age or Expires (RFC 9110 15.1); others need a cache_valid line
+static bool isCacheableByDefault(int status)
+{
+  return status == 200 || status == 203 || status == 300 || status == 301 || status == 308 || status == 404 ||
+         status == 410;
+}
+
+// Reads the directives caching depends on; false if the response must
+// not be stored at all. Ages stay -1 when absent.
+static bool parseCacheControl(const std::string &value, long *maxAge, long *sharedMaxAge)
+{
+  size_t start = 0;
+  while (start <= value.size())
+  {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos)
+      end = value.size();
+    std::string item = String::toLower(String::trim(value.substr(start, end - start)));
+    std::string name = item.substr(0, item.find('='));
+    if (name == "no-store" || name == "no-cache" || name == "private")
+      return false;
+    if (name == "max-age" && name.size() < item.size())
+      *maxAge = std::max(0L, std::atol(item.c_str() + name.size() + 1));
+    else if (name == "s-maxage" && name.size() < item.size())
+      *sharedMaxAge = std::max(0L, std::atol(item.c_str() + name.size() + 1));
+    start = end + 1;
+  }
+  return true;
+}
+
+// An HTTP-date; anything else counts as already expired
+static time_t parseHttpDate(const std::string &value)
+{
+  struct tm tm;
+  std::memset(&tm, 0, sizeof(tm));
+  const char *end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (!end || *end != '\0')
+    return 0;
+  return timegm(&tm);
+}
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = ::write(fd, data, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+static bool makeDirectory(const std::string &path)
+{
+  return mkdir(path.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+CacheFill::CacheFill(ResponseCache &cache, EventLoop &loop, const std::string &key, const CacheValidity &validity)
+    : cache(cache), loop(loop), key(key), validity(validity), state(FILL_PENDING), fd(-1), status(0), expiresAt(0),
+      headerSize(0), bodySize(0), startedMs(Timer::monotonicMs())
+{
+}
+
+// A response that is dropped half way (client gone, backend failed) is
+// not stored; waiters go to the backend themselves
+CacheFill::~CacheFill()
+{
+  if (state != FILL_SETTLED)
+    settle(false);
+}
+
+// Decides from the head whether and for how long the response is kept,
+// and starts the file: a line with the lifetime and sizes, the key, then
+// the head as it will be served
+bool CacheFill::start(const std::string &responseHead)
+{
+  long ttl;
+  if (!ResponseCache::parseHead(responseHead, &status, &head, &ttl))
+    return false;
+
+  // The response's own lifetime wins over cache_valid
+  CacheValidity::const_iterator valid = validity.find(status);
+  if (valid == validity.end())
+    valid = validity.find(0);
+  if (ttl < 0 && valid != validity.end())
+    ttl = (valid->second + 999) / 1000;
+  else if (ttl >= 0 && valid == validity.end() && !isCacheableByDefault(status))
+    return false;
+  if (ttl <= 0)
+    return false;
+  time_t now = time(NULL);
+  expiresAt = now + ttl;
+
+  char line[Constants::Cache::MaxFileHeader];
+  int lineLength = snprintf(line, sizeof(line), "WSCACHE1 %ld %ld %d %lu %lu\n", static_cast<long>(expiresAt),
+                            static_cast<long>(now), status, static_cast<unsigned long>(head.size()),
+                            static_cast<unsigned long>(key.size()));
+  std::string header(line, lineLength);
+  header.append(key);
+  header.append("\n", 1);
+  header.append(head);
+  headerSize = header.size();
+  if (headerSize > cache.maxSize)
+    return false;
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%lu", ++cache.tempCounter);
+  tempPath = cache.dir + "/tmp/" + ResponseCache::fileName(key) + suffix;
+  fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_TRUNC, 0600);
+  if (fd == -1)
+  {
+    LOG_WARN("cache temp file failed path=" << tempPath << " error=\"" << strerror(errno) << "\"");
+    tempPath.clear();
+    return false;
+  }
+  return writeAll(fd, header.data(), header.size());
+}
+
+// Body bytes as the client gets them, minus any transfer framing. The
+// page cache absorbs these writes; they are not synced.
+void CacheFill::write(const std::string &responseHead, const char *data, size_t length)
+{
+  if (state == FILL_SETTLED)
+    return;
+  if (state == FILL_PENDING)
+  {
+    if (!start(responseHead))
+    {
+      settle(false);
+      return;
+    }
+    state = FILL_WRITING;
+  }
+  if (length == 0)
+    return;
+  if (headerSize + bodySize + length > cache.maxSize || !writeAll(fd, data, length))
+  {
+    settle(false);
+    return;
+  }
+  bodySize += length;
+}
+
+// The body is complete: the entry goes live
+void CacheFill::finish(const std::string &responseHead)
+{
+  write(responseHead, NULL, 0);
+  if (state == FILL_WRITING)
+    settle(cache.store(*this));
+}
+
+void CacheFill::settle(bool stored)
+{
+  state = FILL_SETTLED;
+  if (fd != -1)
+    close(fd);
+  fd = -1;
+  if (!tempPath.empty())
+    unlink(tempPath.c_str());
+  tempPath.clear();
+  cache.settle(*this, stored);
+}
+
+ResponseCache::ResponseCache(const std::string &dir, size_t maxSize)
+    : dir(dir), maxSize(maxSize), usedSize(0), tempCounter(0)
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+}
+
+// The status and end-to-end head of a response that may be shared at
+// all, with the lifetime in seconds it gives itself, -1 if none; false
+// for responses that must not be stored
+bool ResponseCache::parseHead(const std::string &responseHead, int *status, std::string *head, long *ownTtl)
+{
+  size_t lineEnd = responseHead.find("\r\n");
+  if (lineEnd == std::string::npos || lineEnd < 12)
+    return false;
+  *status = std::atoi(responseHead.c_str() + 9);
+  if (*status < 200 || *status == 204 || *status == 206 || *status == 304)
+    return false;
+
+  long maxAge = -1;
+  long sharedMaxAge = -1;
+  bool hasExpires = false;
+  time_t expires = 0;
+  head->assign(responseHead, 0, lineEnd + 2);
+  size_t pos = lineEnd + 2;
+  while (pos < responseHead.size())
+  {
+    size_t end = responseHead.find("\r\n", pos);
+    if (end == std::string::npos || end == pos)
+      break;
+    size_t colon = responseHead.find(':', pos);
+    if (colon != std::string::npos && colon < end)
+    {
+      std::string name = responseHead.substr(pos, colon - pos);
+      std::string value = String::trim(responseHead.substr(colon + 1, end - colon - 1));
+      // One stored copy cannot serve every variant or every user
+      if (String::equalsIgnoreCase(name, "set-cookie") || String::equalsIgnoreCase(name, "vary"))
+        return false;
+      if (String::equalsIgnoreCase(name, "cache-control") && !parseCacheControl(value, &maxAge, &sharedMaxAge))
+        return false;
+      if (String::equalsIgnoreCase(name, "expires"))
+      {
+        hasExpires = true;
+        expires = parseHttpDate(value);
+      }
+      if (isStoredHeader(name))
+        head->append(responseHead, pos, end + 2 - pos);
+    }
+    pos = end + 2;
+  }
+
+  time_t now = time(NULL);
+  *ownTtl = -1;
+  if (sharedMaxAge >= 0)
+    *ownTtl = sharedMaxAge;
+  else if (maxAge >= 0)
+    *ownTtl = maxAge;
+  else if (hasExpires)
+    *ownTtl = expires > now ? static_cast<long>(expires - now) : 0;
+  return true;
+}
+
+// One cache per directory; servers naming the same one share it
+ResponseCache *ResponseCache::open(const std::string &dir, size_t maxSize)
+{
+  std::map<std::string, ResponseCache *>::iterator it = registry.find(dir);
+  if (it != registry.end())
+    return it->second;
+  if (!makeDirectory(dir) || !makeDirectory(dir + "/tmp"))
+    throw CacheOpenException();
+  ResponseCache *cache = new ResponseCache(dir, maxSize);
+  cache->load();
+  registry[dir] = cache;
+  return cache;
+}
+
+// Requests parked longer than the lock timeout stop waiting and go to
+// the backend, uncached
+void ResponseCache::collect(long long nowMs)
+{
+  for (std::map<std::string, ResponseCache *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    std::map<std::string, CacheFill *> &filling = it->second->filling;
+    for (std::map<std::string, CacheFill *>::iterator fill = filling.begin(); fill != filling.end(); ++fill)
+    {
+      CacheFill &current = *fill->second;
+      if (current.waiters.empty() || nowMs - current.startedMs < Constants::Cache::LockTimeoutMs)
+        continue;
+      LOG_INFO("cache lock timeout key=" << current.key << " waiters=" << current.waiters.size());
+      std::vector<Connection *> waiters;
+      waiters.swap(current.waiters);
+      for (size_t i = 0; i < waiters.size(); i++)
+      {
+        waiters[i]->onCacheFilled(false);
+        current.loop.markDirty(waiters[i]);
+      }
+    }
+  }
+}
+
+// Shutdown: the parked connections are about to be freed, so no fill
+// may wake them
+void ResponseCache::forgetWaiters()
+{
+  for (std::map<std::string, ResponseCache *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    std::map<std::string, CacheFill *> &filling = it->second->filling;
+    for (std::map<std::string, CacheFill *>::iterator fill = filling.begin(); fill != filling.end(); ++fill)
+      fill->second->waiters.clear();
+  }
+}
+
+void ResponseCache::closeAll()
+{
+  for (std::map<std::string, ResponseCache *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
+
+// 64-bit FNV-1a of the key in hex; the key itself is kept in the file
+// and checked, so a collision is a miss rather than a wrong answer
+std::string ResponseCache::fileName(const std::string &key)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++)
+  {
+    h ^= static_cast<unsigned char>(key[i]);
+    h *= 1099511628211ULL;
+  }
+  char hex[17];
+  for (int i = 15; i >= 0; i--)
+  {
+    hex[i] = "0123456789abcdef"[h & 0xf];
+    h >>= 4;
+  }
+  hex[16] = '\0';
+  return std::string(hex, 16);
+}
+
+// levels=1:2: the last hex digit, then the two before it
+std::string ResponseCache::filePath(const std::string &name) const
+{
+  return dir + "/" + name.substr(15, 1) + "/" + name.substr(13, 2) + "/" + name;
+}
+
+// Rebuilds the index from the files a previous run left behind, oldest
+// first in the recency list; half-written temp files are dropped
+void ResponseCache::load()
+{
+  std::string tempDir = dir + "/tmp";
+  if (DIR *temp = opendir(tempDir.c_str()))
+  {
+    while (struct dirent *file = readdir(temp))
+    {
+      if (file->d_name[0] != '.')
+        unlink((tempDir + "/" + file->d_name).c_str());
+    }
+    closedir(temp);
+  }
+
+  DIR *top = opendir(dir.c_str());
+  if (!top)
+    return;
+  while (struct dirent *level1 = readdir(top))
+  {
+    if (std::strlen(level1->d_name) != 1 || level1->d_name[0] == '.')
+      continue;
+    std::string path1 = dir + "/" + level1->d_name;
+    DIR *middle = opendir(path1.c_str());
+    if (!middle)
+      continue;
+    while (struct dirent *level2 = readdir(middle))
+    {
+      if (std::strlen(level2->d_name) != 2 || level2->d_name[0] == '.')
+        continue;
+      std::string path2 = path1 + "/" + level2->d_name;
+      DIR *bottom = opendir(path2.c_str());
+      if (!bottom)
+        continue;
+      while (struct dirent *file = readdir(bottom))
+      {
+        if (std::strlen(file->d_name) == 16)
+          loadFile(path2 + "/" + file->d_name, file->d_name);
+      }
+      closedir(bottom);
+    }
+    closedir(middle);
+  }
+  closedir(top);
+
+  std::vector<std::pair<time_t, std::string> > byAge;
+  for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    byAge.push_back(std::make_pair(it->second.storedAt, it->first));
+  std::sort(byAge.begin(), byAge.end());
+  for (size_t i = 0; i < byAge.size(); i++)
+  {
+    recent.push_front(byAge[i].second);
+    entries[byAge[i].second].recent = recent.begin();
+  }
+  evict();
+}
+
+// Indexes one stored response; a file that is expired, truncated or not
+// where its key says it belongs is removed
+void ResponseCache::loadFile(const std::string &path, const std::string &name)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  struct stat st;
+  std::string buffer(Constants::Cache::MaxFileHeader + Constants::Cache::MaxKeySize + Constants::Http::MaxHeaderSize,
+                     '\0');
+  ssize_t n = fstat(fd, &st) == 0 ? pread(fd, &buffer[0], buffer.size(), 0) : -1;
+  close(fd);
+
+  Entry entry;
+  long expiresAt = 0;
+  long storedAt = 0;
+  unsigned long headSize = 0;
+  unsigned long keySize = 0;
+  int consumed = 0;
+  bool valid = n > 0;
+  if (valid)
+  {
+    buffer.resize(n);
+    valid = sscanf(buffer.c_str(), "WSCACHE1 %ld %ld %d %lu %lu\n%n", &expiresAt, &storedAt, &entry.status,
+                   &headSize, &keySize, &consumed) == 5 &&
+            consumed > 0 && consumed + keySize + 1 + headSize <= static_cast<size_t>(n);
+  }
+  if (valid)
+  {
+    entry.key = buffer.substr(consumed, keySize);
+    entry.head = buffer.substr(consumed + keySize + 1, headSize);
+    entry.bodyOffset = consumed + keySize + 1 + headSize;
+    entry.bodySize = st.st_size - entry.bodyOffset;
+    entry.fileSize = st.st_size;
+    entry.storedAt = storedAt;
+    entry.expiresAt = expiresAt;
+    valid = fileName(entry.key) == name && expiresAt > time(NULL);
+  }
+  if (!valid)
+  {
+    unlink(path.c_str());
+    return;
+  }
+  usedSize += entry.fileSize;
+  entries[name] = entry;
+}
+
+void ResponseCache::remove(std::map<std::string, Entry>::iterator it, bool unlinkFile)
+{
+  if (unlinkFile)
+    unlink(filePath(it->first).c_str());
+  usedSize -= it->second.fileSize;
+  recent.erase(it->second.recent);
+  entries.erase(it);
+}
+
+// Least recently used entries go until the cache fits max_size. A
+// client still sending one keeps its open file; only the name goes.
+void ResponseCache::evict()
+{
+  while (usedSize > maxSize && recent.size() > 1)
+    remove(entries.find(recent.back()), true);
+}
+
+// Moves a complete fill into place, replacing any older copy of the key
+bool ResponseCache::store(CacheFill &fill)
+{
+  close(fill.fd);
+  fill.fd = -1;
+  std::string name = fileName(fill.key);
+  std::string path = filePath(name);
+  if (!makeDirectory(path.substr(0, path.size() - 20)) || !makeDirectory(path.substr(0, path.size() - 17)) ||
+      rename(fill.tempPath.c_str(), path.c_str()) == -1)
+  {
+    LOG_WARN("cache store failed path=" << path << " error=\"" << strerror(errno) << "\"");
+    return false;
+  }
+  fill.tempPath.clear();
+
+  std::map<std::string, Entry>::iterator old = entries.find(name);
+  if (old != entries.end())
+    remove(old, false);
+  Entry &entry = entries[name];
+  entry.key = fill.key;
+  entry.head = fill.head;
+  entry.status = fill.status;
+  entry.bodyOffset = fill.headerSize;
+  entry.bodySize = fill.bodySize;
+  entry.fileSize = fill.headerSize + fill.bodySize;
+  entry.storedAt = time(NULL);
+  entry.expiresAt = fill.expiresAt;
+  recent.push_front(name);
+  entry.recent = recent.begin();
+  usedSize += entry.fileSize;
+  evict();
+  return true;
+}
+
+// The fill is over: the key is free for the next miss, and whoever waited
+// for it is served from the new entry or sent to the backend
+void ResponseCache::settle(CacheFill &fill, bool stored)
+{
+  std::map<std::string, CacheFill *>::iterator it = filling.find(fill.key);
+  if (it != filling.end() && it->second == &fill)
+    filling.erase(it);
+  std::vector<Connection *> waiters;
+  waiters.swap(fill.waiters);
+  for (size_t i = 0; i < waiters.size(); i++)
+  {
+    waiters[i]->onCacheFilled(stored);
+    fill.loop.markDirty(waiters[i]);
+  }
+}
+
+// A fresh entry for key becomes the response; expired ones are dropped
+bool ResponseCache::serve(const std::string &key, HttpResponse &response, bool keepAlive)
+{
+  std::map<std::string, Entry>::iterator it = entries.find(fileName(key));
+  if (it == entries.end() || it->second.key != key)
+    return false;
+  Entry &entry = it->second;
+  time_t now = time(NULL);
+  if (now >= entry.expiresAt)
+  {
+    remove(it, true);
+    return false;
+  }
+  int fd = ::open(filePath(it->first).c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    remove(it, false);
+    return false;
+  }
+  recent.splice(recent.begin(), recent, entry.recent);
+  response.prepareFromCache(fd, entry.status, entry.head, entry.bodyOffset, entry.bodySize,
+                            static_cast<unsigned long>(now - entry.storedAt), keepAlive);
+  return true;
+}
+
+// Parks connection behind the fill in progress for key, if there is one
+// it may still wait for
+bool ResponseCache::wait(const std::string &key, Connection *connection)
+{
+  std::map<std::string, CacheFill *>::iterator it = filling.find(key);
+  if (it == filling.end() || Timer::monotonicMs() - it->second->startedMs >= Constants::Cache::LockTimeoutMs)
+    return false;
+  it->second->waiters.push_back(connection);
+  return true;
+}
+
+void ResponseCache::cancel(const std::string &key, Connection *connection)
+{
+  std::map<std::string, CacheFill *>::iterator it = filling.find(key);
+  if (it == filling.end())
+    return;
+  std::vector<Connection *> &waiters = it->second->waiters;
+  waiters.erase(std::remove(waiters.begin(), waiters.end(), connection), waiters.end());
+}
+
+// The caller's response becomes the only fill for key; NULL when one is
+// already running (past its lock timeout), so this request goes uncached
+CacheFill *ResponseCache::startFill(EventLoop &loop, const std::string &key, const CacheValidity &validity)
+{
+  if (filling.count(key) || key.size() > Constants::Cache::MaxKeySize || key.find('\n') != std::string::npos)
+    return NULL;
+  CacheFill *fill = new CacheFill(*this, loop, key, validity);
+  filling[key] = fill;
+  return fill;
+}
+
+const std::string &ResponseCache::getDir() const { return dir; }
+size_t ResponseCache::getMaxSize() const { return maxSize; }
+size_t ResponseCache::getEntryCount() const { return entries.size(); }
+size_t ResponseCache::getUsedSize() const { return usedSize; }
@@ -1,9 +1,14 @@
 #include "core/Server.hpp"
 #include "core/Location.hpp"
+#include "core/AccessLog.hpp"
+#include "core/ResponseCache.hpp"
+#include "core/TrafficCapture.hpp"
+#include "core/RequestLimiter.hpp"
 #include <iostream>
 
 Server::Server()
-    : autoindex(false), maxClientBodySize(1048576), returnCode(-1)
+    : autoindex(false), maxClientBodySize(1048576), returnCode(-1), accessLog(NULL), cache(NULL), capture(NULL),
+      latency(NULL), traceSample(0), requestLimiter(NULL)
 {
   index = "index.html";
   methods.push_back("GET");
@@ -53,6 +58,18 @@ void Server::addCgiExtension(const std::string &ext, const std::string &binary)
   cgiExtensions[ext] = binary;
 }
 
+void Server::setAccessLog(AccessLog *log) { accessLog = log; }
+
+void Server::setCache(ResponseCache *cache) { this->cache = cache; }
+
+void Server::setCapture(TrafficCapture *capture) { this->capture = capture; }
+
+void Server::setLatencyStats(LatencyStats *stats) { latency = stats; }
+
+void Server::setTraceSample(unsigned oneIn) { traceSample = oneIn; }
+
+void Server::setRequestLimiter(RequestLimiter *limiter) { requestLimiter = limiter; }
+
 // Location management
 void Server::addLocation(Location *location)
 {
@@ -93,6 +110,15 @@ int Server::getReturnCode() const { return returnCode; }
 const std::string &Server::getReturnUrl() const { return returnUrl; }
 const std::string &Server::getUploadStore() const { return uploadStore; }
 const std::map<std::string, std::string> &Server::getCgiExtensions() const { return cgiExtensions; }
+AccessLog *Server::getAccessLog() const { return accessLog; }
+ResponseCache *Server::getCache() const { return cache; }
+TrafficCapture *Server::getCapture() const { return capture; }
+
+LatencyStats *Server::getLatencyStats() const { return latency; }
+
+unsigned Server::getTraceSample() const { return traceSample; }
+
+RequestLimiter *Server::getRequestLimiter() const { return requestLimiter; }
 const std::vector<Location *> &Server::getLocations() const { return locations; }
 bool Server::hasReturn() const { return returnCode != -1; }
 
@@ -143,6 +169,22 @@ void Server::print() const
       std::cout << "    " << it->first << " -> " << it->second << std::endl;
   }
 
+  if (accessLog)
+    std::cout << "  Access log: " << accessLog->getPath() << std::endl;
+
+  if (cache)
+    std::cout << "  Cache: " << cache->getDir() << " max_size=" << cache->getMaxSize() << " ("
+              << cache->getEntryCount() << " entries, " << cache->getUsedSize() << " bytes)" << std::endl;
+
+  if (capture)
+    std::cout << "  Capture: " << capture->getPath() << std::endl;
+
+  if (traceSample)
+    std::cout << "  Trace: 1 in " << traceSample << std::endl;
+
+  if (requestLimiter)
+    std::cout << "  Request limit: " << requestLimiter->describe() << std::endl;
+
   if (!locations.empty())
   {
     std::cout << "  Locations:" << std::endl;
@@ -1,5 +1,5 @@
 #include "core/ServerManager.hpp"
-#include <iostream>
+#include "utils/Logger.hpp"
 #include <map>
 #include <set>
 #include <sstream>
@@ -17,7 +17,7 @@ void ServerManager::initializeListener(const std::string &interface, int port) {
     int fd = Socket::createListener(interface, port);
     Connection *connection = Connection::createListener(fd, *this, port);
     eventloop.addConnection(connection);
-    std::cout << "Listening on " << interface << ":" << port << std::endl;
+    LOG_INFO("listening on " << interface << ":" << port);
   } catch (const std::exception &e) {
     std::ostringstream ss;
     ss << "Failed to listen on " << interface << ":" << port << ": "
@@ -36,6 +36,13 @@ void ServerManager::setup(const std::vector<Server *> &servers) {
         servers[i]->getListenInterfaces();
     for (size_t j = 0; j < interfaces.size(); j++) {
       portToInterfaces[interfaces[j].second].insert(interfaces[j].first);
+      // Bytes are captured before the Host header picks a server, so a
+      // capture applies per port; the first server that asks for one wins
+      if (servers[i]->getCapture() && !captures.count(interfaces[j].second))
+        captures[interfaces[j].second] = servers[i]->getCapture();
+      // Tracing starts at the first recv, likewise
+      if (servers[i]->getTraceSample() && !traceSamples.count(interfaces[j].second))
+        traceSamples[interfaces[j].second] = servers[i]->getTraceSample();
     }
   }
 
@@ -61,31 +68,37 @@ void ServerManager::run() { eventloop.run(); }
 
 void ServerManager::stop() { eventloop.stop(); }
 
+EventLoop &ServerManager::getEventLoop() { return eventloop; }
+
+TrafficCapture *ServerManager::getCapture(int port) const {
+  std::map<int, TrafficCapture *>::const_iterator it = captures.find(port);
+  return it == captures.end() ? NULL : it->second;
+}
+
+unsigned ServerManager::getTraceSample(int port) const {
+  std::map<int, unsigned>::const_iterator it = traceSamples.find(port);
+  return it == traceSamples.end() ? 0 : it->second;
+}
+
 Server *ServerManager::resolveServerForRequest(const HttpRequest &request,
                                                int port) {
-  std::string host = request.getHeader("host");
-  if (host.find(':') != std::string::npos) {
-    host = host.substr(0, host.find(':'));
-  }
-  std::vector<Server *> candidates;
+  const std::string &host = request.getHeader("host");
+  hostKey.assign(host, 0, host.find(':'));
+
+  // First server on the port whose server_name matches, else the default
+  Server *fallback = NULL;
   for (size_t i = 0; i < servers.size(); i++) {
     const std::vector<std::pair<std::string, int> > &interfaces =
         servers[i]->getListenInterfaces();
     for (size_t j = 0; j < interfaces.size(); j++) {
       if (interfaces[j].second == port) {
-        candidates.push_back(servers[i]);
+        if (servers[i]->getHostnames().count(hostKey) > 0)
+          return servers[i];
+        if (!fallback)
+          fallback = servers[i];
         break;
       }
     }
   }
-  // choise based on hostname
-  for (size_t i = 0; i < candidates.size(); i++) {
-    const std::set<std::string> &hostnames = candidates[i]->getHostnames();
-    if (hostnames.count(host) > 0) {
-      return candidates[i];
-    }
-  }
-  if (candidates.size() == 0)
-    return NULL;
-  return candidates[0];
+  return fallback;
 }
\ No newline at end of file
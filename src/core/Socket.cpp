@@ -1,6 +1,7 @@
 #include "core/Socket.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -22,7 +23,8 @@ void Socket::setNonBlocking(int fd)
 
 int Socket::createListener(const std::string &interface, int port)
 {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  // CGI children must not inherit listeners or client sockets
+  int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (sockfd == -1)
   {
     throw SocketCreationException();
@@ -63,14 +65,20 @@ int Socket::createListener(const std::string &interface, int port)
   return sockfd;
 }
 
-int Socket::acceptConnection(int fd)
+int Socket::acceptConnection(int fd, struct sockaddr_in *peer)
 {
   struct sockaddr_in clientAddr;
   socklen_t clientLen = sizeof(clientAddr);
-  int newsockfd = accept(fd, (struct sockaddr *)&clientAddr, &clientLen);
+  int newsockfd = accept4(fd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_CLOEXEC);
   
   if (newsockfd != -1)
   {
+    if (peer)
+      *peer = clientAddr;
+    // The head and body go out in separate sends; don't let Nagle hold the
+    // body back waiting for the client's delayed ACK
+    int nodelay = 1;
+    setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     try {
       setNonBlocking(newsockfd);
     } catch (...) {
@@ -0,0 +1,91 @@
+#include "core/Trace.hpp"
+#include "utils/Timer.hpp"
+#include <cstdio>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+__thread TraceRing *Trace::local = NULL;
+__thread unsigned Trace::sampleCount = 0;
+
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceRing *> rings;
+static uint32_t lastRequest = 0;
+
+// Ticks and microseconds at startup; the dump converts between them with
+// the rate measured since
+static const uint64_t anchorTicks = Trace::now();
+static const long long anchorUs = Timer::monotonicUs();
+
+static const char *const PhaseNames[TRACE_PHASES] = {"request", "recv",      "parse",     "processHeaders", "resolve",
+                                                     "prepare", "file_open", "file_read", "send"};
+
+TraceRing *Trace::registerThread()
+{
+  local = new TraceRing();
+  pthread_mutex_lock(&ringsMutex);
+  rings.push_back(local);
+  pthread_mutex_unlock(&ringsMutex);
+  return local;
+}
+
+uint32_t Trace::sample(unsigned oneIn)
+{
+  if (oneIn == 0 || ++sampleCount % oneIn != 0)
+    return 0;
+  uint32_t request = __atomic_add_fetch(&lastRequest, 1, __ATOMIC_RELAXED);
+  return request ? request : __atomic_add_fetch(&lastRequest, 1, __ATOMIC_RELAXED);
+}
+
+static const char *valueName(uint32_t phase)
+{
+  if (phase == TRACE_REQUEST)
+    return "status";
+  if (phase == TRACE_RECV || phase == TRACE_SEND || phase == TRACE_FILE_READ)
+    return "bytes";
+  return NULL;
+}
+
+// Complete ("X") events, one row per client socket
+void Trace::renderChrome(std::string &out)
+{
+  long long elapsedUs = Timer::monotonicUs() - anchorUs;
+  double ticksPerUs = elapsedUs > 0 ? static_cast<double>(now() - anchorTicks) / elapsedUs : 1.0;
+  if (ticksPerUs <= 0)
+    ticksPerUs = 1.0;
+  int pid = getpid();
+  char event[256];
+  bool first = true;
+
+  out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  pthread_mutex_lock(&ringsMutex);
+  for (size_t i = 0; i < rings.size(); i++)
+  {
+    const TraceRing *ring = rings[i];
+    uint64_t from = ring->head > TraceRing::Size ? ring->head - TraceRing::Size : 0;
+    for (uint64_t j = from; j < ring->head; j++)
+    {
+      const TraceSpan &span = ring->spans[j % TraceRing::Size];
+      double ts = (span.start - anchorTicks) / ticksPerUs;
+      double dur = span.end > span.start ? (span.end - span.start) / ticksPerUs : 0;
+      const char *name = span.phase < TRACE_PHASES ? PhaseNames[span.phase] : "unknown";
+      const char *value = valueName(span.phase);
+      int length;
+      if (value)
+        length = snprintf(event, sizeof(event),
+                          "%s\n{\"name\":\"%s\",\"cat\":\"webserv\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%u,\"%s\":%lld}}",
+                          first ? "" : ",", name, pid, span.fd, ts, dur, span.request, value,
+                          static_cast<long long>(span.value));
+      else
+        length = snprintf(event, sizeof(event),
+                          "%s\n{\"name\":\"%s\",\"cat\":\"webserv\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%u}}",
+                          first ? "" : ",", name, pid, span.fd, ts, dur, span.request);
+      out.append(event, length);
+      first = false;
+    }
+  }
+  pthread_mutex_unlock(&ringsMutex);
+  out.append("\n]}\n");
+}
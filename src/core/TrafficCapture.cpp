@@ -0,0 +1,174 @@
+#include "core/TrafficCapture.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Timer.hpp"
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+std::map<std::string, TrafficCapture *> TrafficCapture::registry;
+
+// Fields are stored little-endian, as the hosts this runs on are
+void CaptureRecord::encode(char *out) const
+{
+  memcpy(out, &timeUs, 8);
+  memcpy(out + 8, &connection, 4);
+  memcpy(out + 12, &length, 4);
+  memcpy(out + 16, &port, 2);
+  out[18] = static_cast<char>(type);
+  out[19] = 0;
+}
+
+void CaptureRecord::decode(const char *in)
+{
+  memcpy(&timeUs, in, 8);
+  memcpy(&connection, in + 8, 4);
+  memcpy(&length, in + 12, 4);
+  memcpy(&port, in + 16, 2);
+  type = static_cast<uint8_t>(in[18]);
+}
+
+TrafficCapture::TrafficCapture(const std::string &path, size_t maxSize)
+    : path(path), fd(-1), buffer(NULL), used(0), written(0), maxSize(maxSize), full(false),
+      startUs(Timer::monotonicUs()), oldestPendingMs(0), nextConnection(1)
+{
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    throw CaptureOpenException();
+  buffer = new char[BufferSize];
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  uint64_t wallUs = static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+  char header[CaptureFormat::FileHeaderSize];
+  memcpy(header, CaptureFormat::Magic, sizeof(CaptureFormat::Magic));
+  memcpy(header + 8, &wallUs, 8);
+  append(header, sizeof(header));
+}
+
+TrafficCapture::~TrafficCapture()
+{
+  flush();
+  delete[] buffer;
+  if (fd != -1)
+    ::close(fd);
+}
+
+TrafficCapture *TrafficCapture::open(const std::string &path, size_t maxSize)
+{
+  std::map<std::string, TrafficCapture *>::iterator it = registry.find(path);
+  if (it != registry.end())
+    return it->second;
+  TrafficCapture *capture = new TrafficCapture(path, maxSize);
+  registry[path] = capture;
+  return capture;
+}
+
+void TrafficCapture::flushDue(long long nowMs)
+{
+  for (std::map<std::string, TrafficCapture *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    TrafficCapture *capture = it->second;
+    if (capture->used > 0 && nowMs - capture->oldestPendingMs >= FlushIntervalMs)
+      capture->flush();
+  }
+}
+
+// Milliseconds until the next buffered capture must be flushed, -1 if none
+int TrafficCapture::nextFlushDelay(long long nowMs)
+{
+  long long best = -1;
+  for (std::map<std::string, TrafficCapture *>::iterator it = registry.begin(); it != registry.end(); ++it)
+  {
+    TrafficCapture *capture = it->second;
+    if (capture->used == 0)
+      continue;
+    long long delay = capture->oldestPendingMs + FlushIntervalMs - nowMs;
+    if (delay < 0)
+      delay = 0;
+    if (best == -1 || delay < best)
+      best = delay;
+  }
+  return static_cast<int>(best);
+}
+
+void TrafficCapture::closeAll()
+{
+  for (std::map<std::string, TrafficCapture *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
+
+uint32_t TrafficCapture::openConnection(int port, const char *clientIp)
+{
+  uint32_t connection = nextConnection++;
+  record(CAPTURE_OPEN, connection, port, clientIp, strlen(clientIp));
+  return connection;
+}
+
+void TrafficCapture::record(CaptureRecordType type, uint32_t connection, int port, const char *data, size_t length)
+{
+  if (full)
+    return;
+  if (maxSize > 0 && written + used + CaptureRecord::HeaderSize + length > maxSize)
+  {
+    LOG_WARN("capture full path=" << path << " bytes=" << static_cast<unsigned long>(written + used));
+    full = true;
+    return;
+  }
+  CaptureRecord record;
+  record.timeUs = Timer::monotonicUs() - startUs;
+  record.connection = connection;
+  record.length = static_cast<uint32_t>(length);
+  record.port = static_cast<uint16_t>(port);
+  record.type = static_cast<uint8_t>(type);
+  char header[CaptureRecord::HeaderSize];
+  record.encode(header);
+  append(header, sizeof(header));
+  append(data, length);
+}
+
+const std::string &TrafficCapture::getPath() const { return path; }
+
+void TrafficCapture::append(const char *data, size_t length)
+{
+  if (used + length > BufferSize)
+    flush();
+  if (length > BufferSize)
+  {
+    // Larger than the whole buffer: straight to the file
+    while (length > 0)
+    {
+      ssize_t n = ::write(fd, data, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return;
+      data += n;
+      length -= n;
+      written += n;
+    }
+    return;
+  }
+  if (used == 0)
+    oldestPendingMs = Timer::monotonicMs();
+  memcpy(buffer + used, data, length);
+  used += length;
+}
+
+void TrafficCapture::flush()
+{
+  size_t offset = 0;
+  while (offset < used)
+  {
+    ssize_t n = ::write(fd, buffer + offset, used - offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    offset += n;
+  }
+  written += offset;
+  used = 0;
+}
@@ -0,0 +1,290 @@
+#include "core/UploadRequest.hpp"
+#include "core/Connection.hpp"
+#include "core/EventLoop.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Number.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+
+unsigned long UploadRequest::tempCounter = 0;
+
+UploadRequest::UploadRequest(EventLoop &loop, Connection &owner, const std::string &store, bool keepAlive)
+    : loop(loop), owner(owner), request(owner.getRequest()), response(owner.getResponse()), store(store),
+      parser(NULL), readBuffer(NULL), pipeSize(0), fd(-1), fileSize(0), diskError(false), keepAlive(keepAlive),
+      closed(false)
+{
+  pipeFds[0] = pipeFds[1] = -1;
+}
+
+UploadRequest::~UploadRequest()
+{
+  discardPart();
+  if (pipeFds[0] != -1)
+  {
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+  }
+  delete parser;
+  delete[] readBuffer;
+}
+
+UploadRequest *UploadRequest::start(EventLoop &loop, Connection &owner, const std::string &store,
+                                    const std::string &boundary, bool keepAlive)
+{
+  UploadRequest *upload = new UploadRequest(loop, owner, store, keepAlive);
+  upload->parser = new MultipartParser(*upload, boundary);
+  upload->readBuffer = new char[Constants::Upload::ReadBufferSize];
+  return upload;
+}
+
+UploadRequest *UploadRequest::startRaw(EventLoop &loop, Connection &owner, const std::string &store,
+                                       const std::string &fileName, bool keepAlive)
+{
+  UploadRequest *upload = new UploadRequest(loop, owner, store, keepAlive);
+  if (!upload->onPartBegin("", fileName))
+  {
+    delete upload;
+    throw UploadOpenException();
+  }
+  upload->openPipe();
+  if (upload->pipeFds[0] == -1)
+    upload->readBuffer = new char[Constants::Upload::ReadBufferSize];
+  return upload;
+}
+
+// Without a pipe the raw body takes the recv-and-write path
+void UploadRequest::openPipe()
+{
+  if (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) == -1)
+  {
+    LOG_WARN("upload pipe failed error=\"" << strerror(errno) << "\"");
+    pipeFds[0] = pipeFds[1] = -1;
+    return;
+  }
+  int size = fcntl(pipeFds[1], F_SETPIPE_SZ, Constants::Upload::PipeSize);
+  if (size == -1)
+    size = fcntl(pipeFds[1], F_GETPIPE_SZ);
+  pipeSize = size > 0 ? size : 65536;
+}
+
+// The last path component of a client-supplied name, with control
+// characters and a leading dot replaced; empty if nothing usable is left
+std::string UploadRequest::safeFileName(const std::string &filename)
+{
+  size_t slash = filename.find_last_of("/\\");
+  std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+  if (name == "." || name == "..")
+    return "";
+  if (name.size() > 255)
+    name.erase(255);
+  for (size_t i = 0; i < name.size(); i++)
+  {
+    unsigned char c = name[i];
+    if (c < 0x20 || c == 0x7f || (i == 0 && c == '.'))
+      name[i] = '_';
+  }
+  return name;
+}
+
+char *UploadRequest::getReadBuffer() { return readBuffer; }
+
+// Parts without a filename are form fields: their data is dropped
+bool UploadRequest::onPartBegin(const std::string &name, const std::string &filename)
+{
+  (void)name;
+  fileName = safeFileName(filename);
+  if (fileName.empty())
+    return true;
+  std::ostringstream path;
+  path << store << "/.upload-" << getpid() << '-' << ++tempCounter;
+  tempPath = path.str();
+  fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    LOG_ERROR("upload open failed path=" << tempPath << " error=\"" << strerror(errno) << "\"");
+    tempPath.clear();
+    diskError = true;
+    return false;
+  }
+  fileSize = 0;
+  return true;
+}
+
+bool UploadRequest::onPartData(const char *data, size_t length)
+{
+  if (fd == -1)
+    return true;
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0)
+    {
+      LOG_ERROR("upload write failed path=" << tempPath << " error=\"" << strerror(errno) << "\"");
+      diskError = true;
+      return false;
+    }
+    data += written;
+    length -= written;
+    fileSize += written;
+  }
+  return true;
+}
+
+// A complete part replaces any file of the same name in one step
+bool UploadRequest::onPartEnd()
+{
+  if (fd == -1)
+    return true;
+  std::string path = store + "/" + fileName;
+  int closeResult = close(fd);
+  fd = -1;
+  if (closeResult == -1 || rename(tempPath.c_str(), path.c_str()) == -1)
+  {
+    LOG_ERROR("upload store failed path=" << path << " error=\"" << strerror(errno) << "\"");
+    diskError = true;
+    return false;
+  }
+  tempPath.clear();
+  LOG_DEBUG("upload stored fd=" << owner.getFd() << " path=" << path << " bytes=" << fileSize);
+  stored.push_back(std::make_pair(fileName, fileSize));
+  return true;
+}
+
+void UploadRequest::discardPart()
+{
+  if (fd != -1)
+    close(fd);
+  fd = -1;
+  if (!tempPath.empty())
+    unlink(tempPath.c_str());
+  tempPath.clear();
+}
+
+// Body bytes in the request buffer: the whole body for a multipart
+// upload, only what came with the head for a spliced one
+void UploadRequest::onInputReady()
+{
+  if (closed)
+    return;
+  const char *data;
+  size_t length = request.getBufferedBody(&data);
+  if (length > 0)
+  {
+    bool ok = parser ? parser->feed(data, length) : onPartData(data, length);
+    request.consumeBody(length);
+    if (!ok)
+    {
+      if (diskError)
+        fail(Constants::HttpStatus::InternalServerError, "Failed to store the upload");
+      else
+        fail(Constants::HttpStatus::BadRequest, "Malformed multipart body");
+      return;
+    }
+  }
+  if (request.getBodyLeft() == 0)
+    complete();
+}
+
+bool UploadRequest::isSplicing() const
+{
+  return pipeFds[0] != -1 && !closed;
+}
+
+// Moves one batch of the raw body from the socket into the file; returns
+// what recv() would: the byte count, 0 at EOF or -1 with errno set
+ssize_t UploadRequest::receive(int socket)
+{
+  size_t wanted = std::min(request.getBodyLeft(), pipeSize);
+  ssize_t moved = splice(socket, NULL, pipeFds[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (moved <= 0)
+    return moved;
+  size_t left = moved;
+  while (left > 0)
+  {
+    ssize_t written = splice(pipeFds[0], NULL, fd, NULL, left, SPLICE_F_MOVE);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0)
+    {
+      LOG_ERROR("upload splice failed path=" << tempPath << " error=\"" << strerror(errno) << "\"");
+      diskError = true;
+      fail(Constants::HttpStatus::InternalServerError, "Failed to store the upload");
+      return moved;
+    }
+    left -= written;
+  }
+  fileSize += moved;
+  request.skipBody(moved);
+  if (request.getBodyLeft() == 0)
+    complete();
+  return moved;
+}
+
+// The whole body is in: one "name size" line per stored file
+void UploadRequest::complete()
+{
+  if (parser ? !parser->isComplete() : !onPartEnd())
+  {
+    if (diskError)
+      fail(Constants::HttpStatus::InternalServerError, "Failed to store the upload");
+    else
+      fail(Constants::HttpStatus::BadRequest, "Incomplete multipart body");
+    return;
+  }
+  std::string body;
+  for (size_t i = 0; i < stored.size(); i++)
+  {
+    body += stored[i].first;
+    body += ' ';
+    body += Number::toString(stored[i].second);
+    body += '\n';
+  }
+  int status = stored.empty() ? Constants::HttpStatus::OK : Constants::HttpStatus::Created;
+  response.beginStream(status)
+      .add(Constants::Header::ContentType, "text/plain")
+      .add(Constants::Header::ContentLength, body.size())
+      .add(Constants::Header::Connection, keepAlive ? "keep-alive" : "close")
+      .finish();
+  response.appendStream(body.data(), body.size());
+  response.endStream();
+  closed = true;
+  loop.markDirty(&owner);
+}
+
+// The rest of the body is not read; the connection closes after the reply
+void UploadRequest::fail(int status, const char *reason)
+{
+  LOG_WARN("upload failed fd=" << owner.getFd() << " status=" << status << " reason=\"" << reason << "\"");
+  discardPart();
+  response.prepareFromError(status, reason);
+  keepAlive = false;
+  closed = true;
+  loop.markDirty(&owner);
+}
+
+void UploadRequest::updateInterest() {}
+
+void UploadRequest::abort()
+{
+  discardPart();
+  closed = true;
+}
+
+bool UploadRequest::isClosed() const { return closed; }
+bool UploadRequest::hasFailed() const { return false; }
+bool UploadRequest::getKeepAlive() const { return keepAlive; }
+
+// Paced by the client; its idle timeout covers a stalled upload
+bool UploadRequest::isExpired(long long nowMs) const
+{
+  (void)nowMs;
+  return false;
+}
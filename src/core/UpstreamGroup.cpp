@@ -0,0 +1,292 @@
+#include "core/UpstreamGroup.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "utils/Constants.hpp"
+#include "utils/Logger.hpp"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+std::map<std::string, UpstreamGroup *> UpstreamGroup::registry;
+
+// FNV-1a with a murmur3 finalizer: cheap, and spreads similar keys
+// (server addresses differing in one digit) across the ring
+static uint32_t hashKey32(const char *data, size_t length)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+  {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+bool UpstreamGroup::LoadOrder::operator()(const UpstreamPeer *a, const UpstreamPeer *b) const
+{
+  unsigned long long loadA = static_cast<unsigned long long>(a->active) * b->weight;
+  unsigned long long loadB = static_cast<unsigned long long>(b->active) * a->weight;
+  if (loadA != loadB)
+    return loadA < loadB;
+  if (a->picked != b->picked)
+    return a->picked < b->picked;
+  return a->index < b->index;
+}
+
+UpstreamGroup::UpstreamGroup(const std::string &name)
+    : name(name), method(UPSTREAM_ROUND_ROBIN), hashKey(HASH_REQUEST_URI), cursor(0), picks(0)
+{
+}
+
+UpstreamGroup *UpstreamGroup::define(const std::string &name)
+{
+  UpstreamGroup *group = new UpstreamGroup(name);
+  registry[name] = group;
+  return group;
+}
+
+UpstreamGroup *UpstreamGroup::find(const std::string &name)
+{
+  std::map<std::string, UpstreamGroup *>::iterator it = registry.find(name);
+  return it == registry.end() ? NULL : it->second;
+}
+
+// proxy_pass to a host:port: a group of one, shared by every location
+// naming the same address
+UpstreamGroup *UpstreamGroup::forAddress(const std::string &address)
+{
+  UpstreamGroup *group = find(address);
+  if (group)
+    return group;
+  group = define(address);
+  group->addPeer(ProxyUpstream::open(address), 1, Constants::Upstream::DefaultMaxFails,
+                 Constants::Upstream::DefaultFailTimeout * 1000L);
+  group->build();
+  return group;
+}
+
+// http://host[:port][/uri] -> host[:port], /uri
+bool UpstreamGroup::splitUrl(const std::string &url, std::string *host, std::string *uri)
+{
+  if (url.compare(0, 7, "http://") != 0)
+    return false;
+  size_t slash = url.find('/', 7);
+  *host = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+  *uri = slash == std::string::npos ? "" : url.substr(slash);
+  return !host->empty();
+}
+
+bool UpstreamGroup::parseHashKey(const std::string &value, UpstreamHashKey *key)
+{
+  if (value == "$request_uri")
+    *key = HASH_REQUEST_URI;
+  else if (value == "$uri")
+    *key = HASH_URI;
+  else if (value == "$remote_addr")
+    *key = HASH_REMOTE_ADDR;
+  else if (value == "$host")
+    *key = HASH_HOST;
+  else
+    return false;
+  return true;
+}
+
+void UpstreamGroup::closeAll()
+{
+  for (std::map<std::string, UpstreamGroup *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    delete it->second;
+  registry.clear();
+}
+
+void UpstreamGroup::addPeer(ProxyUpstream *upstream, unsigned weight, unsigned maxFails, long failTimeoutMs)
+{
+  UpstreamPeer peer;
+  peer.upstream = upstream;
+  peer.index = peers.size();
+  peer.weight = weight;
+  peer.maxFails = maxFails;
+  peer.failTimeoutMs = failTimeoutMs;
+  peer.fails = 0;
+  peer.failWindowStartMs = 0;
+  peer.downUntilMs = 0;
+  peer.active = 0;
+  peer.picked = 0;
+  peers.push_back(peer);
+}
+
+void UpstreamGroup::setMethod(UpstreamMethod method, UpstreamHashKey hashKey)
+{
+  this->method = method;
+  this->hashKey = hashKey;
+}
+
+// Precomputes what selection walks; peers are fixed from here on
+void UpstreamGroup::build()
+{
+  schedule.clear();
+  byLoad.clear();
+  ring.clear();
+  if (method == UPSTREAM_ROUND_ROBIN)
+  {
+    // One full cycle of smooth weighted round-robin: weights 5,1,1 give
+    // a a b a c a a rather than a a a a a b c
+    unsigned total = 0;
+    for (size_t i = 0; i < peers.size(); i++)
+      total += peers[i].weight;
+    std::vector<long> current(peers.size(), 0);
+    for (unsigned step = 0; step < total; step++)
+    {
+      size_t best = 0;
+      for (size_t i = 0; i < peers.size(); i++)
+      {
+        current[i] += peers[i].weight;
+        if (current[i] > current[best])
+          best = i;
+      }
+      current[best] -= total;
+      schedule.push_back(best);
+    }
+  }
+  else if (method == UPSTREAM_LEAST_CONN)
+  {
+    for (size_t i = 0; i < peers.size(); i++)
+      byLoad.insert(&peers[i]);
+  }
+  else
+  {
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+      const std::string &address = peers[i].upstream->getAddress();
+      for (unsigned point = 0; point < peers[i].weight * Constants::Upstream::RingPointsPerWeight; point++)
+      {
+        std::ostringstream label;
+        label << address << '-' << point;
+        std::string text = label.str();
+        ring.push_back(std::make_pair(hashKey32(text.data(), text.size()), i));
+      }
+    }
+    std::sort(ring.begin(), ring.end());
+  }
+}
+
+const std::string &UpstreamGroup::getName() const { return name; }
+
+UpstreamMethod UpstreamGroup::getMethod() const { return method; }
+
+UpstreamHashKey UpstreamGroup::getHashKey() const { return hashKey; }
+
+size_t UpstreamGroup::getPeerCount() const { return peers.size(); }
+
+void UpstreamGroup::print() const
+{
+  static const char *const methods[] = {"round-robin", "least_conn", "hash"};
+  std::cout << "        Balancing: " << methods[method] << std::endl;
+  for (size_t i = 0; i < peers.size(); i++)
+    std::cout << "        Server: " << peers[i].upstream->getAddress() << " weight=" << peers[i].weight
+              << " max_fails=" << peers[i].maxFails << " fail_timeout=" << peers[i].failTimeoutMs << "ms"
+              << std::endl;
+}
+
+bool UpstreamGroup::isUsable(const UpstreamPeer &peer, const std::vector<bool> &tried, long long nowMs) const
+{
+  if (!tried.empty() && tried[peer.index])
+    return false;
+  return peer.downUntilMs <= nowMs;
+}
+
+// Picks the peer for a request; tried (indexed by peer, may be empty)
+// holds the peers an earlier attempt of the same request already failed on
+UpstreamPeer *UpstreamGroup::select(const std::string &key, const std::vector<bool> &tried, long long nowMs)
+{
+  if (method == UPSTREAM_LEAST_CONN)
+    return selectLeastConn(tried, nowMs);
+  if (method == UPSTREAM_HASH)
+    return selectHash(key, tried, nowMs);
+  return selectRoundRobin(tried, nowMs);
+}
+
+UpstreamPeer *UpstreamGroup::selectRoundRobin(const std::vector<bool> &tried, long long nowMs)
+{
+  for (size_t n = 0; n < schedule.size(); n++)
+  {
+    UpstreamPeer &peer = peers[schedule[cursor]];
+    if (++cursor == schedule.size())
+      cursor = 0;
+    if (isUsable(peer, tried, nowMs))
+      return &peer;
+  }
+  return NULL;
+}
+
+UpstreamPeer *UpstreamGroup::selectLeastConn(const std::vector<bool> &tried, long long nowMs)
+{
+  for (std::set<UpstreamPeer *, LoadOrder>::iterator it = byLoad.begin(); it != byLoad.end(); ++it)
+  {
+    if (isUsable(**it, tried, nowMs))
+      return *it;
+  }
+  return NULL;
+}
+
+// The first point at or after the key's hash; a peer that is down hands
+// its keys to the next peer on the ring, the others keep theirs
+UpstreamPeer *UpstreamGroup::selectHash(const std::string &key, const std::vector<bool> &tried, long long nowMs)
+{
+  if (ring.empty())
+    return NULL;
+  std::pair<uint32_t, size_t> probe(hashKey32(key.data(), key.size()), 0);
+  size_t start = std::lower_bound(ring.begin(), ring.end(), probe) - ring.begin();
+  for (size_t n = 0; n < ring.size(); n++)
+  {
+    UpstreamPeer &peer = peers[ring[(start + n) % ring.size()].second];
+    if (isUsable(peer, tried, nowMs))
+      return &peer;
+  }
+  return NULL;
+}
+
+// A request starts on peer; least_conn reorders it by its new load
+void UpstreamGroup::begin(UpstreamPeer *peer)
+{
+  if (method == UPSTREAM_LEAST_CONN)
+    byLoad.erase(peer);
+  peer->active++;
+  peer->picked = ++picks;
+  if (method == UPSTREAM_LEAST_CONN)
+    byLoad.insert(peer);
+}
+
+void UpstreamGroup::end(UpstreamPeer *peer)
+{
+  if (method == UPSTREAM_LEAST_CONN)
+    byLoad.erase(peer);
+  peer->active--;
+  if (method == UPSTREAM_LEAST_CONN)
+    byLoad.insert(peer);
+}
+
+void UpstreamGroup::succeeded(UpstreamPeer *peer)
+{
+  peer->fails = 0;
+}
+
+// Counts a failure in the current fail_timeout window; at max_fails the
+// peer sits out the next fail_timeout. A group of one is never emptied.
+void UpstreamGroup::failed(UpstreamPeer *peer, long long nowMs)
+{
+  if (nowMs - peer->failWindowStartMs > peer->failTimeoutMs)
+  {
+    peer->fails = 0;
+    peer->failWindowStartMs = nowMs;
+  }
+  peer->fails++;
+  if (peer->maxFails == 0 || peer->fails < peer->maxFails || peers.size() < 2)
+    return;
+  peer->downUntilMs = nowMs + peer->failTimeoutMs;
+  LOG_WARN("upstream server down group=" << name << " server=" << peer->upstream->getAddress()
+           << " fails=" << peer->fails << " for=" << peer->failTimeoutMs << "ms");
+}
@@ -14,6 +14,17 @@
 #include "config/Transformer.hpp"
 #include "core/ServerManager.hpp"
 #include "core/Socket.hpp"
+#include "core/AccessLog.hpp"
+#include "core/CgiPool.hpp"
+#include "core/FastCgiUpstream.hpp"
+#include "core/LatencyStats.hpp"
+#include "core/RequestLimiter.hpp"
+#include "core/ProxyUpstream.hpp"
+#include "core/MicroCache.hpp"
+#include "core/ResponseCache.hpp"
+#include "core/TrafficCapture.hpp"
+#include "core/UpstreamGroup.hpp"
+#include "utils/Logger.hpp"
 
 ServerManager *g_manager = NULL;
 
@@ -27,6 +38,13 @@ void handle_sigint(int sig)
   }
 }
 
+// Logs every location's latency percentiles at the next loop iteration
+void handle_sigusr2(int sig)
+{
+  (void)sig;
+  LatencyStats::requestDump();
+}
+
 std::string readFile(const std::string &filename)
 {
   std::ifstream file(filename.c_str());
@@ -48,6 +66,9 @@ int main(int argc, char **argv)
   }
 
   signal(SIGINT, handle_sigint);
+  signal(SIGUSR2, handle_sigusr2);
+  // A client or CGI script going away mid-write is handled via EPIPE
+  signal(SIGPIPE, SIG_IGN);
 
   std::string filename = argv[1];
   std::string buffer = readFile(filename);
@@ -76,7 +97,25 @@ int main(int argc, char **argv)
   }
 
   Transformer transformer(config);
-  transformer.transform();
+  try
+  {
+    transformer.transform();
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    CgiPool::closeAll();
+    FastCgiUpstream::closeAll();
+    UpstreamGroup::closeAll();
+    ProxyUpstream::closeAll();
+    ResponseCache::closeAll();
+    MicroCache::closeAll();
+    AccessLog::closeAll();
+    TrafficCapture::closeAll();
+    LatencyStats::closeAll();
+    RequestLimiter::closeAll();
+    return 1;
+  }
 
   const std::vector<Server *> servers = transformer.releaseServers();
   for (size_t i = 0; i < servers.size(); i++)
@@ -86,20 +125,41 @@ int main(int argc, char **argv)
     std::cout << std::endl;
   }
 
-  ServerManager manager;
-  g_manager = &manager;
-  try
+#ifdef WEBSERV_DEBUG_LOG
+  Logger::start("", LEVEL_DEBUG);
+#else
+  Logger::start("", LEVEL_INFO);
+#endif
+  int status = 0;
   {
-    manager.setup(servers);
-    manager.run();
-  }
-  catch (const std::exception &e)
-  {
-    std::cerr << "Fatal Error: " << e.what() << std::endl;
+    // Connections may still hold FastCGI requests; they go before the
+    // upstreams they point into
+    ServerManager manager;
+    g_manager = &manager;
+    try
+    {
+      manager.setup(servers);
+      CgiPool::startAll();
+      manager.run();
+    }
+    catch (const std::exception &e)
+    {
+      LOG_ERROR("fatal: " << e.what());
+      status = 1;
+    }
     g_manager = NULL;
-    return 1;
   }
 
-  g_manager = NULL;
-  return 0;
+  CgiPool::closeAll();
+  FastCgiUpstream::closeAll();
+  UpstreamGroup::closeAll();
+  ProxyUpstream::closeAll();
+  ResponseCache::closeAll();
+  MicroCache::closeAll();
+  AccessLog::closeAll();
+  TrafficCapture::closeAll();
+  LatencyStats::closeAll();
+  RequestLimiter::closeAll();
+  Logger::stop();
+  return status;
 }
\ No newline at end of file
@@ -12,11 +12,25 @@ Config Parser::parse()
 Config Parser::parseConfig()
 {
   std::vector<ServerConfig> servers;
+  std::vector<UpstreamConfig> upstreams;
+  std::vector<Directive> httpDirectives;
+  bool httpSeen = false;
   while (tokenStream.hasNext())
   {
     try
     {
-      servers.push_back(parseServerConfig());
+      if (tokenStream.check(UPSTREAM))
+        upstreams.push_back(parseUpstreamConfig());
+      else if (tokenStream.check(HTTP))
+      {
+        // A second block is still parsed so its servers are checked too
+        if (httpSeen)
+          tokenStream.reportError("duplicate http block");
+        httpSeen = true;
+        parseHttpConfig(servers, upstreams, httpDirectives);
+      }
+      else
+        servers.push_back(parseServerConfig());
     }
     catch (const ParseError &e)
     {
@@ -26,7 +40,38 @@ Config Parser::parseConfig()
   }
   Span span = Span(servers.empty() ? Position() : servers.front().getSpan().start,
                    servers.empty() ? Position() : servers.back().getSpan().end);
-  return Config(servers, span);
+  return Config(servers, upstreams, httpDirectives, span);
+}
+
+// http { directives; server { ... } upstream { ... } }: the directives
+// apply to the whole process; the blocks inside are the same as at the
+// top level
+void Parser::parseHttpConfig(std::vector<ServerConfig> &servers, std::vector<UpstreamConfig> &upstreams,
+                             std::vector<Directive> &directives)
+{
+  tokenStream.consume(HTTP, "Expected 'http' keyword");
+  tokenStream.consume(LEFT_BRACE, "Expected '{' after 'http'");
+  while (!tokenStream.isAtEnd() && !tokenStream.check(RIGHT_BRACE))
+  {
+    try
+    {
+      if (tokenStream.check(HTTP))
+        tokenStream.throwError("http block cannot be nested");
+      if (tokenStream.check(LOCATION))
+        tokenStream.throwError("location block must be inside a server block");
+      if (tokenStream.check(SERVER))
+        servers.push_back(parseServerConfig());
+      else if (tokenStream.check(UPSTREAM))
+        upstreams.push_back(parseUpstreamConfig());
+      else
+        directives.push_back(parseDirective());
+    }
+    catch (const ParseError &e)
+    {
+      tokenStream.synchronize();
+    }
+  }
+  tokenStream.consume(RIGHT_BRACE, "Expected '}' after http block");
 }
 
 ServerConfig Parser::parseServerConfig()
@@ -91,6 +136,38 @@ LocationConfig Parser::parseLocationConfig()
   return LocationConfig(path, directives, Span(start.getSpan().start, end.getSpan().end));
 }
 
+// Entries are `server <address> [params];` lines and the balancing method;
+// `least_conn;` is the one directive that takes no value
+UpstreamConfig Parser::parseUpstreamConfig()
+{
+  std::vector<Directive> directives;
+
+  Token start = tokenStream.consume(UPSTREAM, "Expected 'upstream' keyword");
+  std::string name = tokenStream.consume(IDENTIFIER, "Expected upstream name").getValue();
+  tokenStream.consume(LEFT_BRACE, "Expected '{' after upstream name");
+  while (!tokenStream.isAtEnd() && !tokenStream.check(RIGHT_BRACE))
+  {
+    try
+    {
+      if (tokenStream.check(LOCATION) || tokenStream.check(UPSTREAM))
+        tokenStream.throwError("Blocks cannot be nested inside an upstream block");
+      Token keyToken = tokenStream.check(SERVER) ? tokenStream.advance() : tokenStream.consumeDirective();
+      std::vector<std::string> values;
+      while (!tokenStream.isAtEnd() && !tokenStream.check(SEMICOLON) && !tokenStream.check(RIGHT_BRACE))
+        values.push_back(tokenStream.consumeValue().getValue());
+      Token end = tokenStream.consume(SEMICOLON, "Expected ';' after directive");
+      directives.push_back(Directive(keyToken.getValue(), values, Span(keyToken.getSpan().start, end.getSpan().end)));
+    }
+    catch (const ParseError &e)
+    {
+      tokenStream.synchronize();
+    }
+  }
+  Token end = tokenStream.consume(RIGHT_BRACE, "Expected '}' after upstream block");
+
+  return UpstreamConfig(name, directives, Span(start.getSpan().start, end.getSpan().end));
+}
+
 Directive Parser::parseDirective()
 {
   std::vector<std::string> values;
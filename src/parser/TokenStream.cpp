@@ -15,6 +15,37 @@ TokenStream::TokenStream(const std::vector<Token> &tokens, ErrorReporter &errorR
     directives.insert(CGI_EXTENSION);
     directives.insert(UPLOAD_STORE);
     directives.insert(CLIENT_MAX_BODY_SIZE); 
+    directives.insert(ACCESS_LOG);
+    directives.insert(FASTCGI_PASS);
+    directives.insert(CGI_WORKERS);
+    directives.insert(CGI_MAX_CONCURRENCY);
+    directives.insert(PROXY_PASS);
+    directives.insert(PROXY_CONNECT_TIMEOUT);
+    directives.insert(PROXY_READ_TIMEOUT);
+    directives.insert(PROXY_SEND_TIMEOUT);
+    directives.insert(LEAST_CONN);
+    directives.insert(HASH);
+    directives.insert(CACHE_PATH);
+    directives.insert(CACHE);
+    directives.insert(CACHE_VALID);
+    directives.insert(MICROCACHE);
+    directives.insert(CAPTURE);
+    directives.insert(STATUS);
+    directives.insert(TRACE);
+    directives.insert(WORKER_CONNECTIONS);
+    directives.insert(EPOLL_EVENTS);
+    directives.insert(EPOLL_TIMEOUT);
+    directives.insert(CLIENT_HEADER_BUFFER_SIZE);
+    directives.insert(LARGE_CLIENT_HEADER_BUFFERS);
+    directives.insert(SEND_CHUNK_SIZE);
+    directives.insert(KEEPALIVE_TIMEOUT);
+    directives.insert(CLIENT_HEADER_TIMEOUT);
+    directives.insert(CLIENT_BODY_TIMEOUT);
+    directives.insert(SEND_TIMEOUT);
+    directives.insert(MAX_PENDING_REQUESTS);
+    directives.insert(OVERLOAD_LAG);
+    directives.insert(LIMIT_CONN);
+    directives.insert(LIMIT_REQ);
 }
 
 const Token &TokenStream::peek() const
@@ -124,7 +155,8 @@ Token TokenStream::consumeValue()
 
 bool TokenStream::isValue(TokenType type) const
 {
-    return directives.find(type) != directives.end() || type == IDENTIFIER || type == LOCATION || type == SERVER;
+    return directives.find(type) != directives.end() || type == IDENTIFIER || type == LOCATION || type == SERVER || type == UPSTREAM ||
+           type == HTTP;
 }
 
 bool TokenStream::isDirective(TokenType type) const
@@ -155,6 +187,10 @@ std::string TokenStream::tokenTypeString(TokenType type)
         return "LOCATION";
     case SERVER:
         return "SERVER";
+    case UPSTREAM:
+        return "UPSTREAM";
+    case HTTP:
+        return "HTTP";
     default:
         return "UNKNOWN";
     }
@@ -189,7 +225,7 @@ void TokenStream::synchronizeServer()
     advance();
     while (!isAtEnd())
     {
-        if (peek().getType() == SERVER)
+        if (peek().getType() == SERVER || peek().getType() == UPSTREAM || peek().getType() == HTTP)
             return;
         advance();
     }
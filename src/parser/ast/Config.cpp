@@ -1,10 +1,21 @@
 #include "parser/ast/Config.hpp"
 
-Config::Config(const std::vector<ServerConfig> &servers, const Span &span)
-    : Node(span), servers(servers)
+Config::Config(const std::vector<ServerConfig> &servers, const std::vector<UpstreamConfig> &upstreams,
+               const std::vector<Directive> &httpDirectives, const Span &span)
+    : Node(span), servers(servers), upstreams(upstreams), httpDirectives(httpDirectives)
 {
 }
 const std::vector<ServerConfig> &Config::getServers() const
 {
     return servers;
-}
\ No newline at end of file
+}
+
+const std::vector<UpstreamConfig> &Config::getUpstreams() const
+{
+    return upstreams;
+}
+
+const std::vector<Directive> &Config::getHttpDirectives() const
+{
+    return httpDirectives;
+}
@@ -0,0 +1,16 @@
+#include "parser/ast/UpstreamConfig.hpp"
+
+UpstreamConfig::UpstreamConfig(const std::string &name, const std::vector<Directive> &directives, const Span &span)
+    : Node(span), name(name), directives(directives)
+{
+}
+
+const std::string &UpstreamConfig::getName() const
+{
+    return name;
+}
+
+const std::vector<Directive> &UpstreamConfig::getDirectives() const
+{
+    return directives;
+}
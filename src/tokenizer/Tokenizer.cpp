@@ -16,6 +16,39 @@ Tokenizer::Tokenizer(const std::string &buffer, ErrorReporter &reporter) : buffe
   keywords["upload_store"] = UPLOAD_STORE;
   keywords["client_max_body_size"] = CLIENT_MAX_BODY_SIZE;
   keywords["return"] = RETURN;
+  keywords["access_log"] = ACCESS_LOG;
+  keywords["fastcgi_pass"] = FASTCGI_PASS;
+  keywords["cgi_workers"] = CGI_WORKERS;
+  keywords["cgi_max_concurrency"] = CGI_MAX_CONCURRENCY;
+  keywords["proxy_pass"] = PROXY_PASS;
+  keywords["proxy_connect_timeout"] = PROXY_CONNECT_TIMEOUT;
+  keywords["proxy_read_timeout"] = PROXY_READ_TIMEOUT;
+  keywords["proxy_send_timeout"] = PROXY_SEND_TIMEOUT;
+  keywords["upstream"] = UPSTREAM;
+  keywords["least_conn"] = LEAST_CONN;
+  keywords["hash"] = HASH;
+  keywords["cache_path"] = CACHE_PATH;
+  keywords["cache"] = CACHE;
+  keywords["cache_valid"] = CACHE_VALID;
+  keywords["microcache"] = MICROCACHE;
+  keywords["capture"] = CAPTURE;
+  keywords["status"] = STATUS;
+  keywords["trace"] = TRACE;
+  keywords["http"] = HTTP;
+  keywords["worker_connections"] = WORKER_CONNECTIONS;
+  keywords["epoll_events"] = EPOLL_EVENTS;
+  keywords["epoll_timeout"] = EPOLL_TIMEOUT;
+  keywords["client_header_buffer_size"] = CLIENT_HEADER_BUFFER_SIZE;
+  keywords["large_client_header_buffers"] = LARGE_CLIENT_HEADER_BUFFERS;
+  keywords["send_chunk_size"] = SEND_CHUNK_SIZE;
+  keywords["keepalive_timeout"] = KEEPALIVE_TIMEOUT;
+  keywords["client_header_timeout"] = CLIENT_HEADER_TIMEOUT;
+  keywords["client_body_timeout"] = CLIENT_BODY_TIMEOUT;
+  keywords["send_timeout"] = SEND_TIMEOUT;
+  keywords["max_pending_requests"] = MAX_PENDING_REQUESTS;
+  keywords["overload_lag"] = OVERLOAD_LAG;
+  keywords["limit_conn"] = LIMIT_CONN;
+  keywords["limit_req"] = LIMIT_REQ;
 }
 
 std::vector<Token> Tokenizer::tokenize()
@@ -109,7 +142,7 @@ void Tokenizer::skipComments()
 
 bool Tokenizer::isIdentifierChar(char c)
 {
-  return isalnum(c) || c == '/' || c == '_' || c == '.' || c == '-' || c == ':';
+  return isalnum(c) || c == '/' || c == '_' || c == '.' || c == '-' || c == ':' || c == '=' || c == '$';
 }
 
 bool Tokenizer::isWhitespace(char c)
@@ -0,0 +1,37 @@
+#include "utils/AllocStats.hpp"
+#include <cstdlib>
+#include <new>
+
+#ifdef WEBSERV_ALLOC_STATS
+
+static __thread unsigned long allocations = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) throw(std::bad_alloc)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) throw() { free(p); }
+
+void operator delete[](void *p) throw() { free(p); }
+
+bool AllocStats::enabled() { return true; }
+
+unsigned long AllocStats::threadCount() { return allocations; }
+
+#else
+
+bool AllocStats::enabled() { return false; }
+
+unsigned long AllocStats::threadCount() { return 0; }
+
+#endif
@@ -1,6 +1,8 @@
 #include "utils/File.hpp"
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <errno.h>
 
 bool File::exists(const std::string &path)
 {
@@ -27,4 +29,25 @@ bool File::isFile(const std::string &path)
 bool File::isExecutable(const std::string &path)
 {
   return (access(path.c_str(), X_OK) == 0);
-}
\ No newline at end of file
+}
+
+// Reads only if the data is already in the page cache; fails with EAGAIN
+// instead of blocking on the disk.
+ssize_t File::readCached(int fd, char *buf, size_t len, off_t offset)
+{
+#ifdef RWF_NOWAIT
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  ssize_t n = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+  if (n >= 0 || errno != EOPNOTSUPP)
+    return n;
+#else
+  (void)fd;
+  (void)buf;
+  (void)len;
+  (void)offset;
+#endif
+  errno = EAGAIN;
+  return -1;
+}
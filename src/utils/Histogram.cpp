@@ -0,0 +1,92 @@
+#include "utils/Histogram.hpp"
+#include <cstring>
+
+Histogram::Histogram()
+{
+  reset();
+}
+
+void Histogram::merge(const Histogram &other)
+{
+  for (int i = 0; i < CountsLength; i++)
+    counts[i] += other.counts[i];
+  total += other.total;
+  sum += other.sum;
+  if (other.minValue < minValue)
+    minValue = other.minValue;
+  if (other.maxValue > maxValue)
+    maxValue = other.maxValue;
+}
+
+void Histogram::reset()
+{
+  std::memset(counts, 0, sizeof(counts));
+  total = 0;
+  sum = 0;
+  minValue = ~static_cast<uint64_t>(0);
+  maxValue = 0;
+}
+
+uint64_t Histogram::getCount() const { return total; }
+uint64_t Histogram::getSum() const { return sum; }
+uint64_t Histogram::getMin() const { return total ? minValue : 0; }
+uint64_t Histogram::getMax() const { return maxValue; }
+
+double Histogram::getMean() const
+{
+  return total ? static_cast<double>(sum) / total : 0.0;
+}
+
+uint64_t Histogram::valueAtPercentile(double percentile) const
+{
+  if (total == 0)
+    return 0;
+  if (percentile > 100.0)
+    percentile = 100.0;
+  uint64_t target = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+  if (target == 0)
+    target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < CountsLength; i++)
+  {
+    seen += counts[i];
+    if (seen >= target)
+    {
+      uint64_t value = highestEquivalent(i);
+      return value < maxValue ? value : maxValue;
+    }
+  }
+  return maxValue;
+}
+
+uint64_t Histogram::countAtOrBelow(uint64_t value) const
+{
+  if (value >= maxValue)
+    return total;
+  uint64_t count = 0;
+  for (int i = 0, last = indexOf(value); i <= last; i++)
+    count += counts[i];
+  return count;
+}
+
+// The first step of bucket 0 covers 0..63 one by one; later buckets only
+// use their upper half, the lower half being the previous bucket
+uint64_t Histogram::lowestEquivalent(int index)
+{
+  int bucket = (index >> (SubBucketBits - 1)) - 1;
+  uint64_t sub = (index & (SubBucketHalf - 1)) + SubBucketHalf;
+  if (bucket < 0)
+  {
+    bucket = 0;
+    sub -= SubBucketHalf;
+  }
+  return sub << bucket;
+}
+
+uint64_t Histogram::highestEquivalent(int index)
+{
+  int bucket = (index >> (SubBucketBits - 1)) - 1;
+  if (bucket < 0)
+    bucket = 0;
+  return lowestEquivalent(index) + (1ULL << bucket) - 1;
+}
@@ -0,0 +1,314 @@
+#include "utils/Logger.hpp"
+#include "utils/Number.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+
+// Lines are published whole: the producer copies a complete line and only
+// then advances head, so the flusher never sees half a line.
+struct LogRing
+{
+  static const size_t Size = 1 << 16;
+  char data[Size];
+  size_t head; // written by the owning thread
+  size_t tail; // written by the flusher
+
+  LogRing() : head(0), tail(0) {}
+};
+
+LogLevel Logger::threshold = LEVEL_INFO;
+
+static const size_t FlushBufferSize = 1 << 18;
+static const long FlushIntervalMs = 50;
+
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<LogRing *> rings;
+static pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushCond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static bool running = false;
+static bool stopping = false;
+static int outputFd = STDERR_FILENO;
+static bool ownsOutput = false;
+static unsigned long dropped = 0;
+static __thread LogRing *localRing = NULL;
+
+static void writeAll(const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = ::write(outputFd, data, length);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+static void wakeFlusher()
+{
+  pthread_mutex_lock(&flushMutex);
+  pthread_cond_signal(&flushCond);
+  pthread_mutex_unlock(&flushMutex);
+}
+
+void Logger::start(const std::string &path, LogLevel level)
+{
+  if (running)
+    stop();
+  threshold = level;
+  if (!path.empty())
+  {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+      throw LoggerOpenException();
+    outputFd = fd;
+    ownsOutput = true;
+  }
+
+  stopping = false;
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &previous);
+  running = pthread_create(&flusher, NULL, &Logger::flusherMain, NULL) == 0;
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void Logger::stop()
+{
+  if (running)
+  {
+    pthread_mutex_lock(&flushMutex);
+    stopping = true;
+    pthread_cond_signal(&flushCond);
+    pthread_mutex_unlock(&flushMutex);
+    pthread_join(flusher, NULL);
+    running = false;
+  }
+
+  pthread_mutex_lock(&ringsMutex);
+  for (size_t i = 0; i < rings.size(); i++)
+    delete rings[i];
+  rings.clear();
+  localRing = NULL;
+  pthread_mutex_unlock(&ringsMutex);
+
+  if (ownsOutput)
+  {
+    close(outputFd);
+    outputFd = STDERR_FILENO;
+    ownsOutput = false;
+  }
+}
+
+void Logger::setLevel(LogLevel level) { threshold = level; }
+
+unsigned long Logger::getDropped() { return __atomic_load_n(&dropped, __ATOMIC_RELAXED); }
+
+LogRing *Logger::threadRing()
+{
+  if (!localRing)
+  {
+    localRing = new LogRing();
+    pthread_mutex_lock(&ringsMutex);
+    rings.push_back(localRing);
+    pthread_mutex_unlock(&ringsMutex);
+  }
+  return localRing;
+}
+
+void Logger::write(const char *data, size_t length)
+{
+  if (!running)
+  {
+    writeAll(data, length);
+    return;
+  }
+
+  LogRing *ring = threadRing();
+  size_t head = ring->head;
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  size_t used = head - tail;
+  if (length > LogRing::Size - used)
+  {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  size_t offset = head & (LogRing::Size - 1);
+  size_t first = std::min(length, LogRing::Size - offset);
+  memcpy(ring->data + offset, data, first);
+  memcpy(ring->data, data + first, length - first);
+  __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+
+  // Crossing half full is the only time a producer pays for a wakeup
+  if (used < LogRing::Size / 2 && used + length >= LogRing::Size / 2)
+    wakeFlusher();
+}
+
+size_t Logger::drain(char *out, size_t capacity)
+{
+  size_t total = 0;
+  size_t used = 0;
+  pthread_mutex_lock(&ringsMutex);
+  for (size_t i = 0; i < rings.size(); i++)
+  {
+    LogRing *ring = rings[i];
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = ring->tail;
+    size_t avail = head - tail;
+    if (avail == 0)
+      continue;
+    if (used + avail > capacity)
+    {
+      writeAll(out, used);
+      used = 0;
+    }
+    size_t offset = tail & (LogRing::Size - 1);
+    size_t first = std::min(avail, LogRing::Size - offset);
+    memcpy(out + used, ring->data + offset, first);
+    memcpy(out + used + first, ring->data, avail - first);
+    used += avail;
+    total += avail;
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&ringsMutex);
+  writeAll(out, used);
+  return total;
+}
+
+void *Logger::flusherMain(void *arg)
+{
+  (void)arg;
+  char *batch = new char[FlushBufferSize];
+  pthread_mutex_lock(&flushMutex);
+  while (!stopping)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FlushIntervalMs * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flushCond, &flushMutex, &deadline);
+    pthread_mutex_unlock(&flushMutex);
+    drain(batch, FlushBufferSize);
+    pthread_mutex_lock(&flushMutex);
+  }
+  pthread_mutex_unlock(&flushMutex);
+  drain(batch, FlushBufferSize);
+  delete[] batch;
+  return NULL;
+}
+
+// LogLine
+
+static const char *levelName(LogLevel level)
+{
+  switch (level)
+  {
+  case LEVEL_DEBUG: return "debug";
+  case LEVEL_INFO: return "info";
+  case LEVEL_WARN: return "warn";
+  case LEVEL_ERROR: return "error";
+  default: return "none";
+  }
+}
+
+static __thread time_t stampSecond = 0;
+static __thread char stamp[24];
+
+LogLine::LogLine(LogLevel level) : length(0)
+{
+  time_t now = time(NULL);
+  if (now != stampSecond)
+  {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y/%m/%d %H:%M:%S", &tm);
+    stampSecond = now;
+  }
+  append(stamp, strlen(stamp));
+  append(" [", 2);
+  const char *name = levelName(level);
+  append(name, strlen(name));
+  append("] ", 2);
+}
+
+LogLine::~LogLine()
+{
+  buffer[length++] = '\n';
+  Logger::write(buffer, length);
+}
+
+void LogLine::append(const char *data, size_t n)
+{
+  // Keep one byte for the newline
+  size_t room = Capacity - 1 - length;
+  if (n > room)
+    n = room;
+  memcpy(buffer + length, data, n);
+  length += n;
+}
+
+void LogLine::appendUnsigned(unsigned long long n)
+{
+  char digits[Number::MaxDigits];
+  append(digits, Number::format(digits, n));
+}
+
+LogLine &LogLine::operator<<(const char *s)
+{
+  append(s, strlen(s));
+  return *this;
+}
+
+LogLine &LogLine::operator<<(const std::string &s)
+{
+  append(s.data(), s.size());
+  return *this;
+}
+
+LogLine &LogLine::operator<<(char c)
+{
+  append(&c, 1);
+  return *this;
+}
+
+LogLine &LogLine::operator<<(int n) { return *this << static_cast<long long>(n); }
+
+LogLine &LogLine::operator<<(unsigned int n) { return *this << static_cast<unsigned long long>(n); }
+
+LogLine &LogLine::operator<<(long n) { return *this << static_cast<long long>(n); }
+
+LogLine &LogLine::operator<<(unsigned long n) { return *this << static_cast<unsigned long long>(n); }
+
+LogLine &LogLine::operator<<(long long n)
+{
+  if (n < 0)
+  {
+    append("-", 1);
+    appendUnsigned(0ULL - static_cast<unsigned long long>(n));
+  }
+  else
+    appendUnsigned(n);
+  return *this;
+}
+
+LogLine &LogLine::operator<<(unsigned long long n)
+{
+  appendUnsigned(n);
+  return *this;
+}
@@ -24,17 +24,18 @@ void MimeTypes::initialize()
   initialized = true;
 }
 
-std::string MimeTypes::getMimeType(const std::string &path)
+const std::string &MimeTypes::getMimeType(const std::string &path)
 {
+  static const std::string defaultType = "application/octet-stream";
   initialize();
   size_t dotPos = path.find_last_of('.');
   if (dotPos == std::string::npos)
-    return "application/octet-stream";
+    return defaultType;
 
   std::string ext = path.substr(dotPos);
   std::map<std::string, std::string>::iterator it = mimeMap.find(ext);
   if (it != mimeMap.end())
     return it->second;
 
-  return "application/octet-stream";
+  return defaultType;
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include "utils/NetworkResolver.hpp"
 #include "utils/Number.hpp"
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <sys/un.h>
 
 std::pair<std::string, int> NetworkResolver::resolveListen(const std::string &listenStr)
 {
@@ -39,4 +43,43 @@ std::pair<std::string, int> NetworkResolver::resolveListen(const std::string &li
   int port = portStr.empty() ? defaultPort : Number::toInt(portStr);
   
   return std::make_pair(interface, port);
-}
\ No newline at end of file
+}
+
+bool NetworkResolver::resolveAddress(const std::string &address, struct sockaddr_storage *addr,
+                                     socklen_t *length)
+{
+  memset(addr, 0, sizeof(*addr));
+  if (address.compare(0, 5, "unix:") == 0)
+  {
+    std::string path = address.substr(5);
+    struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un *>(addr);
+    if (path.empty() || path[0] != '/' || path.size() >= sizeof(un->sun_path))
+      return false;
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, path.c_str(), path.size() + 1);
+    *length = sizeof(struct sockaddr_un);
+    return true;
+  }
+
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+    return false;
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+  if (port.find_first_not_of("0123456789") != std::string::npos || port.size() > 5 ||
+      std::atoi(port.c_str()) < 1 || std::atoi(port.c_str()) > 65535)
+    return false;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  struct addrinfo *result = NULL;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+    return false;
+  memcpy(addr, result->ai_addr, result->ai_addrlen);
+  *length = result->ai_addrlen;
+  freeaddrinfo(result);
+  return true;
+}
@@ -1,5 +1,7 @@
 
 #include "utils/Number.hpp"
+#include <cctype>
+#include <cstring>
 #include <sstream>
 
 bool Number::isDigits(const std::string &str)
@@ -25,9 +27,110 @@ int Number::toInt(const std::string &str, bool *ok)
   return success ? num : 0;
 }
 
+// Plain decimal digits only, as in Content-Length; no sign, no overflow
+size_t Number::toSize(const std::string &str, bool *ok)
+{
+  bool success = !str.empty() && str.size() <= 18 && isDigits(str);
+  if (ok)
+    *ok = success;
+  if (!success)
+    return 0;
+  size_t value = 0;
+  for (size_t i = 0; i < str.size(); i++)
+    value = value * 10 + (str[i] - '0');
+  return value;
+}
+
 std::string Number::toString(long long n)
 {
-  std::stringstream ss;
-  ss << n;
-  return ss.str();
+  char digits[MaxDigits + 1];
+  if (n < 0)
+  {
+    digits[0] = '-';
+    return std::string(digits, 1 + format(digits + 1, 0ULL - static_cast<unsigned long long>(n)));
+  }
+  return std::string(digits, format(digits, n));
+}
+
+static const char DigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Two digits per division, written back to front
+size_t Number::format(char *out, unsigned long long n)
+{
+  char digits[MaxDigits];
+  size_t i = MaxDigits;
+  while (n >= 100)
+  {
+    unsigned pair = static_cast<unsigned>(n % 100) * 2;
+    n /= 100;
+    digits[--i] = DigitPairs[pair + 1];
+    digits[--i] = DigitPairs[pair];
+  }
+  if (n >= 10)
+  {
+    unsigned pair = static_cast<unsigned>(n) * 2;
+    digits[--i] = DigitPairs[pair + 1];
+    digits[--i] = DigitPairs[pair];
+  }
+  else
+    digits[--i] = static_cast<char>('0' + n);
+  size_t length = MaxDigits - i;
+  memcpy(out, digits + i, length);
+  return length;
+}
+
+// "512", "64k", "16M", "1g" -> bytes
+size_t Number::parseSize(const std::string &str, bool *ok)
+{
+  size_t multiplier = 1;
+  std::string digits = str;
+  if (!str.empty())
+  {
+    char unit = std::tolower(str[str.size() - 1]);
+    if (unit == 'k' || unit == 'm' || unit == 'g')
+    {
+      multiplier = unit == 'k' ? 1024 : unit == 'm' ? 1024 * 1024 : 1024 * 1024 * 1024;
+      digits = str.substr(0, str.size() - 1);
+    }
+  }
+  bool success = !digits.empty() && digits.size() <= 10 && isDigits(digits);
+  if (ok)
+    *ok = success;
+  if (!success)
+    return 0;
+  unsigned long long value = 0;
+  for (size_t i = 0; i < digits.size(); i++)
+    value = value * 10 + (digits[i] - '0');
+  return value * multiplier;
+}
+
+// "250ms", "30s", "5m", "1h", bare numbers are seconds -> milliseconds
+long Number::parseDuration(const std::string &str, bool *ok)
+{
+  size_t end = 0;
+  while (end < str.size() && isdigit(str[end]))
+    end++;
+  std::string digits = str.substr(0, end);
+  std::string unit = str.substr(end);
+  long multiplier = -1;
+  if (unit == "ms")
+    multiplier = 1;
+  else if (unit.empty() || unit == "s")
+    multiplier = 1000;
+  else if (unit == "m")
+    multiplier = 60 * 1000;
+  else if (unit == "h")
+    multiplier = 60 * 60 * 1000;
+  bool success = !digits.empty() && digits.size() <= 6 && multiplier > 0;
+  if (ok)
+    *ok = success;
+  if (!success)
+    return 0;
+  long value = 0;
+  for (size_t i = 0; i < digits.size(); i++)
+    value = value * 10 + (digits[i] - '0');
+  return value * multiplier;
 }
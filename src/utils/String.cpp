@@ -1,4 +1,6 @@
 #include "utils/String.hpp"
+#include <cstring>
+#include <strings.h>
 
 std::string String::toLower(const std::string &str)
 {
@@ -20,4 +22,25 @@ std::string String::trim(const std::string &str)
     return "";
   size_t last = str.find_last_not_of(" \t");
   return str.substr(first, (last - first + 1));
-}
\ No newline at end of file
+}
+
+void String::toLowerInPlace(std::string &str)
+{
+  for (size_t i = 0; i < str.size(); i++)
+  {
+    if (str[i] >= 'A' && str[i] <= 'Z')
+      str[i] = str[i] - 'A' + 'a';
+  }
+}
+
+bool String::equalsIgnoreCase(const std::string &str, const char *other, size_t length)
+{
+  if (str.size() != length)
+    return false;
+  return strncasecmp(str.data(), other, length) == 0;
+}
+
+bool String::equalsIgnoreCase(const std::string &str, const char *other)
+{
+  return equalsIgnoreCase(str, other, strlen(other));
+}
@@ -1,28 +1,13 @@
 #include "utils/Timer.hpp"
 
-Timer::Timer(int limitSeconds) : limit(limitSeconds)
+long long Timer::monotonicMs()
 {
-  update();
+  return monotonicUs() / 1000;
 }
 
-Timer::~Timer() {}
-
-void Timer::update()
-{
-  lastActivity = time(NULL);
-}
-
-bool Timer::isExpired() const
-{
-  return (time(NULL) - lastActivity) >= limit;
-}
-
-void Timer::setLimit(int seconds)
-{
-  limit = seconds;
-}
-
-int Timer::getLimit() const
+long long Timer::monotonicUs()
 {
-  return limit;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
\ No newline at end of file
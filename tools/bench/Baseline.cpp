@@ -0,0 +1,60 @@
+#include "Baseline.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+Baseline Baseline::load(const std::string &fileName)
+{
+  std::ifstream file(fileName.c_str());
+  if (!file.is_open())
+    throw BaselineFileException("cannot read " + fileName);
+  Baseline baseline;
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++)
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    std::string name;
+    Measurement measurement;
+    measurement.iterations = 0;
+    if (!(fields >> name >> measurement.nsPerOp >> measurement.allocsPerOp))
+    {
+      std::ostringstream ss;
+      ss << fileName << ":" << number << ": expected name, ns/op and allocs/op";
+      throw BaselineFileException(ss.str());
+    }
+    baseline.add(name, measurement);
+  }
+  return baseline;
+}
+
+void Baseline::add(const std::string &name, const Measurement &measurement)
+{
+  if (results.find(name) == results.end())
+    order.push_back(name);
+  results[name] = measurement;
+}
+
+const Measurement *Baseline::find(const std::string &name) const
+{
+  std::map<std::string, Measurement>::const_iterator it = results.find(name);
+  return it == results.end() ? NULL : &it->second;
+}
+
+void Baseline::save(const std::string &fileName) const
+{
+  std::ofstream file(fileName.c_str());
+  if (!file.is_open())
+    throw BaselineFileException("cannot write " + fileName);
+  file << "# name ns/op allocs/op\n";
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    const Measurement &measurement = results.find(order[i])->second;
+    char line[256];
+    snprintf(line, sizeof(line), "%s %.1f %.2f\n", order[i].c_str(), measurement.nsPerOp, measurement.allocsPerOp);
+    file << line;
+  }
+  if (!file)
+    throw BaselineFileException("cannot write " + fileName);
+}
@@ -0,0 +1,34 @@
+#ifndef BASELINE_HPP
+#define BASELINE_HPP
+
+#include "Benchmark.hpp"
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Saved results to compare a run against, one benchmark per line:
+//
+//   # name ns/op allocs/op
+//   parse/curl 412.3 0
+//
+class Baseline
+{
+  std::map<std::string, Measurement> results;
+  std::vector<std::string> order;
+
+public:
+  static Baseline load(const std::string &fileName);
+
+  void add(const std::string &name, const Measurement &measurement);
+  const Measurement *find(const std::string &name) const;
+  void save(const std::string &fileName) const;
+
+  class BaselineFileException : public std::runtime_error
+  {
+  public:
+    BaselineFileException(const std::string &msg) : std::runtime_error(msg) {}
+  };
+};
+
+#endif
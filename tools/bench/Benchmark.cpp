@@ -0,0 +1,56 @@
+#include "Benchmark.hpp"
+#include "utils/AllocStats.hpp"
+#include "utils/Timer.hpp"
+
+volatile size_t g_benchSink = 0;
+
+Benchmark::Benchmark(const std::string &name) : name(name) {}
+
+Benchmark::~Benchmark() {}
+
+const std::string &Benchmark::getName() const { return name; }
+
+static long long timeRun(Benchmark &benchmark, size_t iterations, unsigned long *allocations)
+{
+  unsigned long allocationsBefore = AllocStats::threadCount();
+  long long start = Timer::monotonicUs();
+  benchmark.run(iterations);
+  long long elapsed = Timer::monotonicUs() - start;
+  *allocations = AllocStats::threadCount() - allocationsBefore;
+  return elapsed;
+}
+
+Measurement measure(Benchmark &benchmark, long minTimeMs, int samples)
+{
+  long long sampleUs = minTimeMs * 1000LL / samples;
+  if (sampleUs < 1000)
+    sampleUs = 1000;
+
+  // Warms caches and lazily built tables, then sizes the samples
+  unsigned long allocations;
+  size_t iterations = 1;
+  long long elapsed = timeRun(benchmark, iterations, &allocations);
+  while (elapsed < sampleUs)
+  {
+    size_t next = elapsed > 0 ? static_cast<size_t>(iterations * 1.2 * sampleUs / elapsed) : iterations * 100;
+    if (next <= iterations)
+      next = iterations + 1;
+    if (next > iterations * 100)
+      next = iterations * 100;
+    iterations = next;
+    elapsed = timeRun(benchmark, iterations, &allocations);
+  }
+
+  Measurement result;
+  result.iterations = iterations;
+  result.nsPerOp = elapsed * 1000.0 / iterations;
+  result.allocsPerOp = static_cast<double>(allocations) / iterations;
+  for (int i = 1; i < samples; i++)
+  {
+    elapsed = timeRun(benchmark, iterations, &allocations);
+    double nsPerOp = elapsed * 1000.0 / iterations;
+    if (nsPerOp < result.nsPerOp)
+      result.nsPerOp = nsPerOp;
+  }
+  return result;
+}
@@ -0,0 +1,40 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+// One measured operation. Whatever it works on is built by the
+// constructor, outside the timing; run() repeats the operation
+// `iterations` times.
+class Benchmark
+{
+  std::string name;
+
+public:
+  Benchmark(const std::string &name);
+  virtual ~Benchmark();
+
+  const std::string &getName() const;
+  virtual void run(size_t iterations) = 0;
+};
+
+struct Measurement
+{
+  double nsPerOp;     // fastest of the samples
+  double allocsPerOp; // operator new calls; the same in every sample
+  size_t iterations;  // per sample
+};
+
+// Grows the iteration count until a sample takes minTimeMs / samples,
+// then keeps the fastest of `samples` runs
+Measurement measure(Benchmark &benchmark, long minTimeMs, int samples);
+
+// Every suite, in report order; the caller owns them
+std::vector<Benchmark *> createBenchmarks();
+
+// Written by benchmarks so results are not optimised away
+extern volatile size_t g_benchSink;
+
+#endif
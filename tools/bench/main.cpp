@@ -0,0 +1,150 @@
+#include "Baseline.hpp"
+#include "Benchmark.hpp"
+#include "utils/AllocStats.hpp"
+#include "utils/Logger.hpp"
+#include "utils/Number.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name << " [options]\n"
+            << "  -b, --baseline FILE   compare with saved results; fail on a regression\n"
+            << "  -s, --save FILE       save these results as a baseline\n"
+            << "  -t, --threshold PCT   slowdown in ns/op that counts as a regression (default 10)\n"
+            << "  -f, --filter TEXT     only benchmarks whose name contains TEXT\n"
+            << "  -m, --min-time TIME   measuring time per benchmark, e.g. 500ms (default 300ms)" << std::endl;
+}
+
+// Any extra allocation is a regression: unlike time, the count does not
+// vary from run to run
+static const double AllocSlack = 0.005;
+
+int main(int argc, char **argv)
+{
+  static const struct option longOptions[] = {
+      {"baseline", required_argument, NULL, 'b'}, {"save", required_argument, NULL, 's'},
+      {"threshold", required_argument, NULL, 't'}, {"filter", required_argument, NULL, 'f'},
+      {"min-time", required_argument, NULL, 'm'},  {NULL, 0, NULL, 0}};
+
+  std::string baselineFile, saveFile, filter;
+  double threshold = 10.0;
+  long minTimeMs = 300;
+  int option;
+  while ((option = getopt_long(argc, argv, "b:s:t:f:m:", longOptions, NULL)) != -1)
+  {
+    bool ok = true;
+    switch (option)
+    {
+    case 'b':
+      baselineFile = optarg;
+      break;
+    case 's':
+      saveFile = optarg;
+      break;
+    case 't':
+    {
+      char *end;
+      threshold = std::strtod(optarg, &end);
+      ok = *end == '\0' && end != optarg && threshold > 0;
+      break;
+    }
+    case 'f':
+      filter = optarg;
+      break;
+    case 'm':
+      minTimeMs = Number::parseDuration(optarg, &ok);
+      ok = ok && minTimeMs > 0;
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Baseline baseline;
+  try
+  {
+    if (!baselineFile.empty())
+      baseline = Baseline::load(baselineFile);
+  }
+  catch (const Baseline::BaselineFileException &e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  if (!AllocStats::enabled())
+    std::cerr << argv[0] << ": built without ALLOC_STATS, allocations read 0" << std::endl;
+  signal(SIGPIPE, SIG_IGN);
+  Logger::setLevel(LEVEL_WARN); // setup chatter would break up the table
+
+  std::vector<Benchmark *> benchmarks;
+  Baseline results;
+  int regressions = 0;
+  int status = 0;
+  try
+  {
+    benchmarks = createBenchmarks();
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %12s %10s", "benchmark", "ns/op", "allocs/op");
+    std::cout << line << (baselineFile.empty() ? "" : "     baseline     change") << std::endl;
+    for (size_t i = 0; i < benchmarks.size(); i++)
+    {
+      const std::string &name = benchmarks[i]->getName();
+      if (!filter.empty() && name.find(filter) == std::string::npos)
+        continue;
+      Measurement measurement = measure(*benchmarks[i], minTimeMs, 5);
+      results.add(name, measurement);
+      snprintf(line, sizeof(line), "%-24s %12.1f %10.2f", name.c_str(), measurement.nsPerOp,
+               measurement.allocsPerOp);
+      std::cout << line;
+      const Measurement *before = baselineFile.empty() ? NULL : baseline.find(name);
+      if (before)
+      {
+        double change = before->nsPerOp > 0 ? (measurement.nsPerOp / before->nsPerOp - 1.0) * 100.0 : 0.0;
+        bool slower = change > threshold;
+        bool allocates = measurement.allocsPerOp > before->allocsPerOp + AllocSlack;
+        snprintf(line, sizeof(line), " %12.1f %+9.1f%%%s%s", before->nsPerOp, change,
+                 slower ? "  REGRESSED" : "", allocates ? "  MORE ALLOCS" : "");
+        std::cout << line;
+        if (slower || allocates)
+          regressions++;
+      }
+      else if (!baselineFile.empty())
+        std::cout << "          new";
+      std::cout << std::endl;
+    }
+    if (!saveFile.empty())
+      results.save(saveFile);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    status = 1;
+  }
+  for (size_t i = 0; i < benchmarks.size(); i++)
+    delete benchmarks[i];
+
+  if (regressions > 0)
+  {
+    std::cout << regressions << " benchmark" << (regressions == 1 ? "" : "s") << " regressed past " << threshold
+              << "% or allocate more than " << baselineFile << std::endl;
+    status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Compares fork-per-request CGI with fastcgi_pass on a running web-serv.
+
+Both locations must answer the same kind of request; with the config
+below each request is a small echo handled by a Python program:
+
+    server {
+        listen 8081;
+        root /tmp/bench;
+        location /cgi/ { cgi_extension .py /usr/bin/python3; }
+        location /fcgi/ { fastcgi_pass unix:/tmp/fcgi.sock; }
+    }
+
+    mkdir -p /tmp/bench/cgi && cp tools/cgi_echo.py /tmp/bench/cgi/echo.py
+    python3 tools/fcgi_echo.py unix:/tmp/fcgi.sock &
+    ./web-serv bench.conf &
+    python3 tools/cgi_bench.py --port 8081 --threads 16 --seconds 10
+
+Each client thread keeps one keep-alive connection and sends requests
+back to back; throughput and latency percentiles are reported per mode.
+"""
+
+import argparse
+import http.client
+import threading
+import time
+
+
+def worker(host, port, path, body, deadline, latencies, errors, lock):
+    conn = None
+    local = []
+    failures = 0
+    while time.time() < deadline:
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(host, port, timeout=35)
+            start = time.perf_counter()
+            # web-serv only keeps connections open when asked to
+            headers = {"Connection": "keep-alive"}
+            if body:
+                conn.request("POST", path, body=body, headers=headers)
+            else:
+                conn.request("GET", path, headers=headers)
+            response = conn.getresponse()
+            response.read()
+            local.append(time.perf_counter() - start)
+            if response.status != 200:
+                failures += 1
+            if response.getheader("Connection", "").lower() == "close":
+                conn.close()
+                conn = None
+        except (OSError, http.client.HTTPException):
+            failures += 1
+            if conn is not None:
+                conn.close()
+            conn = None
+    if conn is not None:
+        conn.close()
+    with lock:
+        latencies.extend(local)
+        errors[0] += failures
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(len(sorted_values) * fraction))
+    return sorted_values[index]
+
+
+def run(name, args, path):
+    latencies = []
+    errors = [0]
+    lock = threading.Lock()
+    body = b"x" * args.body if args.body else None
+    deadline = time.time() + args.seconds
+    threads = [threading.Thread(target=worker, args=(args.host, args.port, path, body, deadline,
+                                                     latencies, errors, lock))
+               for _ in range(args.threads)]
+    started = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - started
+    latencies.sort()
+    print("%-8s %8d req %9.1f req/s  p50 %7.2f ms  p99 %7.2f ms  errors %d" % (
+        name, len(latencies), len(latencies) / elapsed, percentile(latencies, 0.5) * 1000,
+        percentile(latencies, 0.99) * 1000, errors[0]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8081)
+    parser.add_argument("--cgi", default="/cgi/echo.py", help="path served by cgi_extension")
+    parser.add_argument("--fastcgi", default="/fcgi/echo", help="path served by fastcgi_pass")
+    parser.add_argument("--threads", type=int, default=16)
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("--body", type=int, default=0, help="POST a body of this many bytes")
+    args = parser.parse_args()
+
+    run("cgi", args, args.cgi)
+    run("fastcgi", args, args.fastcgi)
+
+
+if __name__ == "__main__":
+    main()
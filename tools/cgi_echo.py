@@ -0,0 +1,14 @@
+#!/usr/bin/env python3
+"""CGI counterpart of fcgi_echo.py, used by cgi_bench.py."""
+
+import os
+import sys
+
+length = int(os.environ.get("CONTENT_LENGTH") or 0)
+data = sys.stdin.buffer.read(length) if length else b""
+body = ("method=%s\nuri=%s\nscript=%s\nlength=%d\n\n" % (
+    os.environ.get("REQUEST_METHOD", ""), os.environ.get("REQUEST_URI", ""),
+    os.environ.get("SCRIPT_FILENAME", ""), len(data))).encode() + data
+sys.stdout.buffer.write(b"Status: 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n"
+                        % len(body))
+sys.stdout.buffer.write(body)
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""Pre-warmed Python interpreter for cgi_workers.
+
+Use it as the interpreter for .py scripts:
+
+    location /cgi/ {
+        cgi_extension .py /path/to/tools/cgi_worker.py;
+        cgi_workers 8 min=2;
+    }
+
+Started by web-serv with a listening socket as fd 0 (FCGI_LISTENSOCK_FILENO)
+it answers FastCGI requests one at a time: each script runs in a fork of
+this already-initialised interpreter, with the CGI environment, stdin and
+stdout it would get as a separate process. The request body is collected
+before the script starts. Run with a script argument (no cgi_workers) it
+simply executes that script as plain CGI.
+"""
+
+import os
+import runpy
+import socket
+import stat
+import struct
+import sys
+import threading
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_KEEP_CONN = 1
+
+# Imported once here so scripts don't pay for them on every request
+PRELOAD = ("json", "email.parser", "urllib.parse", "http.cookies")
+
+
+def run_script(path):
+    sys.argv = [path]
+    os.chdir(os.path.dirname(path) or ".")
+    runpy.run_path(path, run_name="__main__")
+
+
+def read_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_length(data, pos):
+    if data[pos] < 128:
+        return data[pos], pos + 1
+    return struct.unpack("!I", data[pos:pos + 4])[0] & 0x7FFFFFFF, pos + 4
+
+
+def parse_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        name_len, pos = read_length(data, pos)
+        value_len, pos = read_length(data, pos)
+        name = data[pos:pos + name_len].decode("latin-1")
+        pos += name_len
+        pairs[name] = data[pos:pos + value_len].decode("latin-1")
+        pos += value_len
+    return pairs
+
+
+def encode_pairs(pairs):
+    out = b""
+    for name, value in pairs.items():
+        name, value = name.encode(), value.encode()
+        out += bytes([len(name), len(value)]) + name + value
+    return out
+
+
+def send(sock, rtype, rid, data):
+    pos = 0
+    while True:
+        chunk = data[pos:pos + 65535]
+        sock.sendall(struct.pack("!BBHHBx", 1, rtype, rid, len(chunk), 0) + chunk)
+        pos += len(chunk)
+        if pos >= len(data):
+            break
+
+
+def execute(sock, rid, params, body):
+    """Runs the script in a child and streams its stdout as FCGI_STDOUT."""
+    in_read, in_write = os.pipe()
+    out_read, out_write = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        try:
+            os.dup2(in_read, 0)
+            os.dup2(out_write, 1)
+            for fd in (in_read, in_write, out_read, out_write):
+                os.close(fd)
+            sock.close()
+            os.environ.clear()
+            os.environ.update(params)
+            os.environ.setdefault("PATH", "/usr/local/bin:/usr/bin:/bin")
+            sys.stdin = open(0, "r", closefd=False)
+            sys.stdout = open(1, "w", closefd=False)
+            run_script(params.get("SCRIPT_FILENAME", ""))
+            sys.stdout.flush()
+            os._exit(0)
+        except SystemExit as e:
+            sys.stdout.flush()
+            os._exit(e.code if isinstance(e.code, int) else 0)
+        except BaseException:
+            import traceback
+            traceback.print_exc()
+            os._exit(1)
+
+    os.close(in_read)
+    os.close(out_write)
+
+    def feed():
+        try:
+            view = memoryview(body)
+            while view:
+                view = view[os.write(in_write, view):]
+        except OSError:
+            pass  # the script stopped reading
+        finally:
+            os.close(in_write)
+
+    writer = threading.Thread(target=feed, daemon=True)
+    writer.start()
+    try:
+        while True:
+            chunk = os.read(out_read, 65536)
+            if not chunk:
+                break
+            send(sock, FCGI_STDOUT, rid, chunk)
+    finally:
+        os.close(out_read)
+        writer.join()
+        _, status = os.waitpid(pid, 0)
+    send(sock, FCGI_STDOUT, rid, b"")
+    send(sock, FCGI_END_REQUEST, rid, struct.pack("!IB3x", os.waitstatus_to_exitcode(status) & 0xFF, 0))
+
+
+def serve(sock):
+    """One connection: requests arrive one after another (no multiplexing)."""
+    requests = {}
+    while True:
+        header = read_exact(sock, 8)
+        if header is None:
+            return
+        _, rtype, rid, length, padding = struct.unpack("!BBHHBx", header)
+        content = read_exact(sock, length + padding)
+        if content is None:
+            return
+        content = content[:length]
+        if rtype == FCGI_GET_VALUES:
+            known = {"FCGI_MPXS_CONNS": "0", "FCGI_MAX_REQS": "1", "FCGI_MAX_CONNS": "1"}
+            names = parse_pairs(content)
+            send(sock, FCGI_GET_VALUES_RESULT, 0,
+                 encode_pairs(dict((n, known[n]) for n in names if n in known)))
+        elif rtype == FCGI_BEGIN_REQUEST:
+            requests[rid] = {"keep": bool(content[2] & FCGI_KEEP_CONN), "params": b"", "stdin": b""}
+        elif rtype == FCGI_PARAMS and rid in requests:
+            requests[rid]["params"] += content
+        elif rtype == FCGI_STDIN and rid in requests:
+            if content:
+                requests[rid]["stdin"] += content
+                continue
+            state = requests.pop(rid)
+            execute(sock, rid, parse_pairs(state["params"]), state["stdin"])
+            if not state["keep"]:
+                return
+        elif rtype == FCGI_ABORT_REQUEST and rid in requests:
+            requests.pop(rid)
+            send(sock, FCGI_END_REQUEST, rid, struct.pack("!IB3x", 0, 0))
+
+
+def main():
+    if len(sys.argv) > 1:
+        run_script(os.path.abspath(sys.argv[1]))
+        return
+    if not stat.S_ISSOCK(os.fstat(0).st_mode):
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+    for name in PRELOAD:
+        try:
+            __import__(name)
+        except ImportError:
+            pass
+    listener = socket.socket(fileno=0)
+    while True:
+        conn, _ = listener.accept()
+        try:
+            serve(conn)
+        except OSError:
+            pass
+        finally:
+            conn.close()
+
+
+if __name__ == "__main__":
+    main()
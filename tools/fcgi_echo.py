@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+"""Minimal FastCGI responder for testing fastcgi_pass.
+
+Answers every request with a text/plain body describing it (method, URI,
+script) followed by the request body it received. Connections are kept
+open when the server asks for FCGI_KEEP_CONN, and FCGI_GET_VALUES is
+answered so the server can multiplex requests over one socket.
+
+    python3 tools/fcgi_echo.py unix:/tmp/fcgi.sock
+    python3 tools/fcgi_echo.py 127.0.0.1:9000 --no-multiplex
+
+Query parameters understood by the echo:
+    sleep=<seconds>   wait before answering
+    size=<bytes>      append that many bytes of filler to the body
+"""
+
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+from urllib.parse import parse_qs
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_KEEP_CONN = 1
+FCGI_REQUEST_COMPLETE = 0
+
+MULTIPLEX = "--no-multiplex" not in sys.argv
+
+
+def read_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_length(data, pos):
+    if data[pos] < 128:
+        return data[pos], pos + 1
+    return struct.unpack("!I", data[pos:pos + 4])[0] & 0x7FFFFFFF, pos + 4
+
+
+def parse_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        name_len, pos = read_length(data, pos)
+        value_len, pos = read_length(data, pos)
+        name = data[pos:pos + name_len].decode("latin-1")
+        pos += name_len
+        pairs[name] = data[pos:pos + value_len].decode("latin-1")
+        pos += value_len
+    return pairs
+
+
+def encode_pairs(pairs):
+    out = b""
+    for name, value in pairs.items():
+        name, value = name.encode(), value.encode()
+        for length in (len(name), len(value)):
+            out += bytes([length]) if length < 128 else struct.pack("!I", length | 0x80000000)
+        out += name + value
+    return out
+
+
+class Connection:
+    def __init__(self, sock):
+        self.sock = sock
+        self.lock = threading.Lock()
+        self.requests = {}
+        self.closing = False
+
+    def send(self, rtype, rid, data):
+        # Split into records of at most 65535 bytes; an empty payload is
+        # sent as a single empty record (end of stream)
+        with self.lock:
+            pos = 0
+            while True:
+                chunk = data[pos:pos + 65535]
+                header = struct.pack("!BBHHBx", 1, rtype, rid, len(chunk), 0)
+                self.sock.sendall(header + chunk)
+                pos += len(chunk)
+                if pos >= len(data):
+                    break
+
+    def respond(self, rid, state):
+        params = state["params"]
+        query = parse_qs(params.get("QUERY_STRING", ""))
+        if "sleep" in query:
+            time.sleep(float(query["sleep"][0]))
+        body = ("method=%s\nuri=%s\nscript=%s\nlength=%d\n\n" % (
+            params.get("REQUEST_METHOD", ""), params.get("REQUEST_URI", ""),
+            params.get("SCRIPT_FILENAME", ""), len(state["stdin"]))).encode()
+        body += bytes(state["stdin"])
+        if "size" in query:
+            body += b"x" * int(query["size"][0])
+        head = ("Status: 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n"
+                % len(body)).encode()
+        try:
+            self.send(FCGI_STDOUT, rid, head + body)
+            self.send(FCGI_STDOUT, rid, b"")
+            self.finish(rid, state)
+        except OSError:
+            pass
+
+    def finish(self, rid, state):
+        self.send(FCGI_END_REQUEST, rid, struct.pack("!IB3x", 0, FCGI_REQUEST_COMPLETE))
+        if not state["keep"]:
+            self.closing = True
+            self.sock.shutdown(socket.SHUT_RDWR)
+
+    def serve(self):
+        try:
+            while not self.closing:
+                header = read_exact(self.sock, 8)
+                if header is None:
+                    break
+                _, rtype, rid, length, padding = struct.unpack("!BBHHBx", header)
+                content = read_exact(self.sock, length + padding)
+                if content is None:
+                    break
+                content = content[:length]
+                self.record(rtype, rid, content)
+        except OSError:
+            pass
+        finally:
+            self.sock.close()
+
+    def record(self, rtype, rid, content):
+        if rtype == FCGI_GET_VALUES:
+            names = parse_pairs(content)
+            known = {"FCGI_MPXS_CONNS": "1" if MULTIPLEX else "0", "FCGI_MAX_REQS": "64",
+                     "FCGI_MAX_CONNS": "64"}
+            self.send(FCGI_GET_VALUES_RESULT, 0,
+                      encode_pairs(dict((n, known[n]) for n in names if n in known)))
+        elif rtype == FCGI_BEGIN_REQUEST:
+            flags = content[2]
+            self.requests[rid] = {"keep": bool(flags & FCGI_KEEP_CONN), "params": b"",
+                                  "stdin": bytearray()}
+        elif rtype == FCGI_PARAMS and rid in self.requests:
+            state = self.requests[rid]
+            if content:
+                state["params"] += content
+            else:
+                state["params"] = parse_pairs(state["params"])
+        elif rtype == FCGI_STDIN and rid in self.requests:
+            state = self.requests[rid]
+            if content:
+                state["stdin"] += content
+            else:
+                del self.requests[rid]
+                if MULTIPLEX:
+                    threading.Thread(target=self.respond, args=(rid, state), daemon=True).start()
+                else:
+                    self.respond(rid, state)
+        elif rtype == FCGI_ABORT_REQUEST and rid in self.requests:
+            state = self.requests.pop(rid)
+            self.finish(rid, state)
+
+
+def listen(address):
+    if address.startswith("unix:"):
+        path = address[5:]
+        if os.path.exists(path):
+            os.unlink(path)
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.bind(path)
+    else:
+        host, port = address.rsplit(":", 1)
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind((host, int(port)))
+    sock.listen(128)
+    return sock
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith("--")]
+    if len(args) != 1:
+        print(__doc__)
+        sys.exit(1)
+    server = listen(args[0])
+    print("fcgi_echo listening on %s (multiplex %s)" % (args[0], "on" if MULTIPLEX else "off"))
+    while True:
+        client, _ = server.accept()
+        threading.Thread(target=Connection(client).serve, daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
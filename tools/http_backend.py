@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Stand-in HTTP/1.1 upstream for testing proxy_pass.
+
+Answers every request with a text/plain body describing it (method, URI,
+the headers it got and which TCP connection carried it) followed by the
+request body. Connections are kept alive unless the client asks
+otherwise, so upstream connection reuse shows in the conn= line.
+
+    python3 tools/http_backend.py 127.0.0.1:9100
+    python3 tools/http_backend.py 127.0.0.1:9100 --name b
+
+Query parameters understood by the echo:
+    sleep=<seconds>   wait before answering
+    size=<bytes>      append that many bytes of filler to the body
+    mode=chunked      send the body with Transfer-Encoding: chunked
+    mode=close        send the body without a length and close after it
+    status=<code>     answer with that status instead of 200
+    cache=<value>     send Cache-Control: <value> (e.g. cache=max-age=60)
+    cookie=<value>    send Set-Cookie: <value>
+
+Every response also carries the number of requests answered so far in
+req=, so a cached response shows up as a repeated req= value.
+"""
+
+import socket
+import sys
+import threading
+import time
+from urllib.parse import parse_qs, urlsplit
+
+NAME = "backend"
+connection_ids = iter(range(1, 1 << 62))
+request_ids = iter(range(1, 1 << 62))
+id_lock = threading.Lock()
+
+
+def read_head(sock, buffered):
+    while b"\r\n\r\n" not in buffered:
+        chunk = sock.recv(65536)
+        if not chunk:
+            return None, b""
+        buffered += chunk
+    head, rest = buffered.split(b"\r\n\r\n", 1)
+    return head.decode("latin-1"), rest
+
+
+def read_body(sock, rest, length):
+    while len(rest) < length:
+        chunk = sock.recv(min(65536, length - len(rest)))
+        if not chunk:
+            break
+        rest += chunk
+    return rest[:length], rest[length:]
+
+
+def respond(sock, conn_id, method, target, headers, body):
+    query = parse_qs(urlsplit(target).query)
+    param = lambda name, default: query.get(name, [default])[0]
+    time.sleep(float(param("sleep", "0")))
+    status = int(param("status", "200"))
+    mode = param("mode", "length")
+    with id_lock:
+        request_id = next(request_ids)
+
+    lines = ["backend=%s" % NAME, "conn=%d" % conn_id, "req=%d" % request_id, "method=%s" % method, "uri=%s" % target]
+    lines += ["%s: %s" % item for item in headers]
+    payload = ("\n".join(lines) + "\n\n").encode() + body + b"x" * int(param("size", "0"))
+
+    head = "HTTP/1.1 %d Test\r\nContent-Type: text/plain\r\nX-Backend: %s\r\n" % (status, NAME)
+    if "cache" in query:
+        head += "Cache-Control: %s\r\n" % param("cache", "")
+    if "cookie" in query:
+        head += "Set-Cookie: %s\r\n" % param("cookie", "")
+    if status in (204, 304):
+        sock.sendall((head + "\r\n").encode())
+        return True
+    if mode == "chunked":
+        sock.sendall((head + "Transfer-Encoding: chunked\r\n\r\n").encode())
+        for start in range(0, len(payload), 4000):
+            piece = payload[start:start + 4000]
+            sock.sendall(b"%x\r\n%s\r\n" % (len(piece), piece))
+        sock.sendall(b"0\r\nX-Trailer: done\r\n\r\n")
+        return True
+    if mode == "close":
+        sock.sendall((head + "Connection: close\r\n\r\n").encode() + payload)
+        return False
+    sock.sendall((head + "Content-Length: %d\r\n\r\n" % len(payload)).encode() + payload)
+    return True
+
+
+def serve(sock):
+    with id_lock:
+        conn_id = next(connection_ids)
+    buffered = b""
+    try:
+        while True:
+            head, buffered = read_head(sock, buffered)
+            if head is None:
+                return
+            request_line, *header_lines = head.split("\r\n")
+            method, target, version = request_line.split(" ", 2)
+            headers = [tuple(part.strip() for part in line.split(":", 1)) for line in header_lines]
+            fields = dict((name.lower(), value) for name, value in headers)
+            body, buffered = read_body(sock, buffered, int(fields.get("content-length", "0")))
+            keep = respond(sock, conn_id, method, target, headers, body)
+            if not keep or fields.get("connection", "").lower() == "close" or version == "HTTP/1.0":
+                return
+    except (OSError, ValueError):
+        pass
+    finally:
+        sock.close()
+
+
+def main():
+    global NAME
+    if len(sys.argv) < 2:
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+    if "--name" in sys.argv:
+        NAME = sys.argv[sys.argv.index("--name") + 1]
+    host, port = sys.argv[1].rsplit(":", 1)
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind((host, int(port)))
+    listener.listen(128)
+    while True:
+        sock, _ = listener.accept()
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        threading.Thread(target=serve, args=(sock,), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
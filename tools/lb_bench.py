@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Measures how a proxy_pass location spreads requests over an upstream.
+
+Start one tools/http_backend.py per server of the upstream block, each
+with its own --name; every response carries that name in X-Backend.
+
+    upstream pool {
+        server 127.0.0.1:9101;
+        server 127.0.0.1:9102;
+        server 127.0.0.1:9103;
+    }
+    server {
+        listen 8083;
+        root /tmp;
+        location /app/ { proxy_pass http://pool/; }
+    }
+
+    for n in 1 2 3; do python3 tools/http_backend.py 127.0.0.1:910$n --name b$n & done
+    ./web-serv lb.conf &
+    python3 tools/lb_bench.py --port 8083 --path /app/ --threads 16 --seconds 5
+
+Each client thread keeps one keep-alive connection. With --keys n the
+request paths cycle through n distinct URIs (for `hash $request_uri`),
+and the report also shows whether each URI always hit the same server.
+"""
+
+import argparse
+import http.client
+import threading
+import time
+from collections import Counter, defaultdict
+
+
+def worker(args, deadline, counts, owners, errors, lock, seed):
+    conn = None
+    local = Counter()
+    seen = defaultdict(set)
+    failed = 0
+    n = seed
+    while time.time() < deadline:
+        path = args.path
+        if args.keys:
+            path += "key-%d?sleep=%s" % (n % args.keys, args.sleep)
+            n += 7
+        else:
+            path += "?sleep=%s" % args.sleep
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+            conn.request("GET", path, headers={"Connection": "keep-alive"})
+            response = conn.getresponse()
+            response.read()
+            if response.status != 200:
+                failed += 1
+                continue
+            backend = response.getheader("X-Backend", "?")
+            local[backend] += 1
+            if args.keys:
+                seen[path.split("?")[0]].add(backend)
+            if response.getheader("Connection", "").lower() == "close":
+                conn.close()
+                conn = None
+        except (OSError, http.client.HTTPException):
+            failed += 1
+            if conn is not None:
+                conn.close()
+            conn = None
+    with lock:
+        counts.update(local)
+        for path, backends in seen.items():
+            owners[path].update(backends)
+        errors[0] += failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8083)
+    parser.add_argument("--path", default="/app/")
+    parser.add_argument("--threads", type=int, default=16)
+    parser.add_argument("--seconds", type=float, default=5)
+    parser.add_argument("--keys", type=int, default=0, help="distinct request URIs to cycle through")
+    parser.add_argument("--sleep", default="0", help="upstream think time per request, seconds")
+    args = parser.parse_args()
+
+    counts = Counter()
+    owners = defaultdict(set)
+    errors = [0]
+    lock = threading.Lock()
+    deadline = time.time() + args.seconds
+    threads = [threading.Thread(target=worker, args=(args, deadline, counts, owners, errors, lock, i))
+               for i in range(args.threads)]
+    start = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - start
+
+    total = sum(counts.values())
+    print("%d requests in %.1fs = %.0f req/s, %d errors" % (total, elapsed, total / elapsed, errors[0]))
+    for backend, count in sorted(counts.items()):
+        print("  %-10s %8d  %5.1f%%" % (backend, count, 100.0 * count / max(total, 1)))
+    if counts:
+        print("  max/min   %8.2f" % (max(counts.values()) / float(min(counts.values()))))
+    if args.keys:
+        split = sum(1 for backends in owners.values() if len(backends) > 1)
+        print("  %d keys, %d served by more than one server" % (len(owners), split))
+
+
+if __name__ == "__main__":
+    main()
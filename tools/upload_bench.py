@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Measures upload throughput into an upload_store location.
+
+    server {
+        listen 8085;
+        root /tmp;
+        client_max_body_size 8G;
+        location /up/ { upload_store /tmp/store; }
+    }
+
+    ./web-serv upload.conf &
+    python3 tools/upload_bench.py --port 8085 --size 1G --runs 3 --pid $(pgrep -x web-serv)
+
+Each run sends the same generated body twice: as a raw PUT (spliced from
+the socket into the file) and as a multipart/form-data POST (received and
+written out a read at a time). With --pid the server's CPU time for each
+upload is shown as well.
+"""
+
+import argparse
+import os
+import socket
+import time
+
+CHUNK = 1 << 20
+
+
+def parse_size(text):
+    units = {"k": 1 << 10, "m": 1 << 20, "g": 1 << 30}
+    if text[-1].lower() in units:
+        return int(text[:-1]) * units[text[-1].lower()]
+    return int(text)
+
+
+def cpu_seconds(pid):
+    if not pid:
+        return 0.0
+    with open("/proc/%d/stat" % pid) as stat:
+        fields = stat.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf("SC_CLK_TCK"))
+
+
+def upload(args, head, prefix, suffix):
+    block = b"\0" * CHUNK
+    sock = socket.create_connection((args.host, args.port))
+    sock.sendall(head + prefix)
+    left = args.size
+    while left > 0:
+        sent = sock.send(block[:min(left, CHUNK)])
+        left -= sent
+    sock.sendall(suffix)
+    reply = b""
+    while b"\r\n\r\n" not in reply:
+        data = sock.recv(4096)
+        if not data:
+            break
+        reply += data
+    sock.close()
+    return reply.split(b"\r\n", 1)[0].decode("latin1")
+
+
+def raw(args):
+    head = ("PUT %sbench-raw.bin HTTP/1.1\r\nHost: %s\r\nContent-Length: %d\r\n\r\n"
+            % (args.path, args.host, args.size)).encode()
+    return upload(args, head, b"", b"")
+
+
+def multipart(args):
+    boundary = "bench-boundary-7f3a"
+    prefix = ('--%s\r\nContent-Disposition: form-data; name="file"; filename="bench-multipart.bin"\r\n'
+              "Content-Type: application/octet-stream\r\n\r\n" % boundary).encode()
+    suffix = ("\r\n--%s--\r\n" % boundary).encode()
+    head = ("POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: multipart/form-data; boundary=%s\r\n"
+            "Content-Length: %d\r\n\r\n" % (args.path, args.host, boundary,
+                                            len(prefix) + args.size + len(suffix))).encode()
+    return upload(args, head, prefix, suffix)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8085)
+    parser.add_argument("--path", default="/up/")
+    parser.add_argument("--size", type=parse_size, default=parse_size("1G"))
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--pid", type=int, default=0, help="server pid, for its CPU time")
+    args = parser.parse_args()
+
+    results = {"raw PUT (splice)": [], "multipart POST": []}
+    for _ in range(args.runs):
+        for name, send in (("raw PUT (splice)", raw), ("multipart POST", multipart)):
+            cpu = cpu_seconds(args.pid)
+            start = time.time()
+            status = send(args)
+            elapsed = time.time() - start
+            results[name].append((elapsed, cpu_seconds(args.pid) - cpu))
+            if " 201 " not in status:
+                print("%s: unexpected reply %r" % (name, status))
+    mb = args.size / float(1 << 20)
+    for name, runs in results.items():
+        best = min(elapsed for elapsed, _ in runs)
+        cpu = sum(used for _, used in runs) / len(runs)
+        print("%-18s best %6.0f MB/s   server cpu %.2fs per upload" % (name, mb / best, cpu))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,136 @@
+#include "BenchResult.hpp"
+#include <cstdio>
+#include <cstring>
+
+static const double Percentiles[] = {50.0, 75.0, 90.0, 99.0, 99.9, 99.99};
+static const size_t PercentileCount = sizeof(Percentiles) / sizeof(Percentiles[0]);
+
+BenchResult::BenchResult() : responses(0), bytesRead(0), unanswered(0), connects(0), maxBacklog(0), elapsedUs(0)
+{
+  std::memset(errors, 0, sizeof(errors));
+}
+
+void BenchResult::merge(const BenchResult &other)
+{
+  latency.merge(other.latency);
+  responses += other.responses;
+  bytesRead += other.bytesRead;
+  for (std::map<int, uint64_t>::const_iterator it = other.statuses.begin(); it != other.statuses.end(); ++it)
+    statuses[it->first] += it->second;
+  for (int i = 0; i < ERROR_KINDS; i++)
+    errors[i] += other.errors[i];
+  unanswered += other.unanswered;
+  connects += other.connects;
+  if (other.maxBacklog > maxBacklog)
+    maxBacklog = other.maxBacklog;
+  if (other.elapsedUs > elapsedUs)
+    elapsedUs = other.elapsedUs;
+}
+
+uint64_t BenchResult::errorCount() const
+{
+  uint64_t total = 0;
+  for (int i = 0; i < ERROR_KINDS; i++)
+    total += errors[i];
+  return total;
+}
+
+const char *BenchResult::errorName(int kind)
+{
+  static const char *const names[] = {"connect", "read", "write", "timeout", "parse", "closed"};
+  return names[kind];
+}
+
+static std::string milliseconds(uint64_t us)
+{
+  char text[32];
+  snprintf(text, sizeof(text), "%.3fms", us / 1000.0);
+  return text;
+}
+
+static std::string percentileName(double percentile)
+{
+  char text[16];
+  snprintf(text, sizeof(text), "p%g", percentile);
+  return text;
+}
+
+static double perSecond(uint64_t count, long long elapsedUs)
+{
+  return elapsedUs > 0 ? count * 1e6 / elapsedUs : 0.0;
+}
+
+void printText(std::ostream &out, const BenchSummary &summary, const BenchResult &result)
+{
+  char line[256];
+  snprintf(line, sizeof(line), "%.2fs test @ %s", result.elapsedUs / 1e6, summary.url.c_str());
+  out << line << "\n";
+  snprintf(line, sizeof(line), "  %u thread%s, %u connections, pipeline %u, %s%s", summary.threads,
+           summary.threads == 1 ? "" : "s", summary.connections, summary.pipeline,
+           summary.keepAlive ? "keep-alive" : "no keep-alive", summary.mixSize > 1 ? ", mixed requests" : "");
+  out << line << "\n";
+  if (summary.rate > 0)
+  {
+    snprintf(line, sizeof(line), "  open loop at %.0f req/s; latency counts from each request's scheduled time",
+             summary.rate);
+    out << line << "\n";
+  }
+  else
+    out << "  closed loop\n";
+
+  const Histogram &latency = result.latency;
+  out << "  Latency    min " << milliseconds(latency.getMin()) << "  mean " << milliseconds(latency.getMean())
+      << "  max " << milliseconds(latency.getMax()) << "\n";
+  out << "            ";
+  for (size_t i = 0; i < PercentileCount; i++)
+    out << percentileName(Percentiles[i]) << " " << milliseconds(latency.valueAtPercentile(Percentiles[i]))
+        << (i + 1 < PercentileCount ? "  " : "\n");
+  snprintf(line, sizeof(line), "  Requests   %llu, %.1f/s", static_cast<unsigned long long>(result.responses),
+           perSecond(result.responses, result.elapsedUs));
+  out << line << "\n";
+  snprintf(line, sizeof(line), "  Transfer   %.2f MB read, %.2f MB/s", result.bytesRead / 1048576.0,
+           perSecond(result.bytesRead, result.elapsedUs) / 1048576.0);
+  out << line << "\n";
+  out << "  Status    ";
+  for (std::map<int, uint64_t>::const_iterator it = result.statuses.begin(); it != result.statuses.end(); ++it)
+    out << " " << it->first << " " << it->second;
+  out << "\n";
+  out << "  Errors    ";
+  for (int i = 0; i < ERROR_KINDS; i++)
+    out << " " << BenchResult::errorName(i) << " " << result.errors[i];
+  out << "\n";
+  out << "  Unanswered " << result.unanswered << " requests still waiting at the end\n";
+  if (summary.rate > 0)
+    out << "  Backlog    at most " << result.maxBacklog << " requests overdue\n";
+  out << "  Connections opened " << result.connects << "\n";
+}
+
+void printJson(std::ostream &out, const BenchSummary &summary, const BenchResult &result)
+{
+  char number[64];
+  const Histogram &latency = result.latency;
+  out << "{\"url\": \"" << summary.url << "\", \"threads\": " << summary.threads
+      << ", \"connections\": " << summary.connections << ", \"pipeline\": " << summary.pipeline
+      << ", \"keep_alive\": " << (summary.keepAlive ? "true" : "false") << ", \"mode\": \""
+      << (summary.rate > 0 ? "open" : "closed") << "\"";
+  snprintf(number, sizeof(number), "%.1f", summary.rate);
+  out << ", \"rate\": " << number;
+  snprintf(number, sizeof(number), "%.3f", result.elapsedUs / 1e6);
+  out << ", \"duration_s\": " << number << ", \"requests\": " << result.responses;
+  snprintf(number, sizeof(number), "%.1f", perSecond(result.responses, result.elapsedUs));
+  out << ", \"requests_per_s\": " << number << ", \"bytes_read\": " << result.bytesRead;
+  snprintf(number, sizeof(number), "%.1f", perSecond(result.bytesRead, result.elapsedUs));
+  out << ", \"bytes_per_s\": " << number;
+  snprintf(number, sizeof(number), "%.1f", latency.getMean());
+  out << ", \"latency_us\": {\"min\": " << latency.getMin() << ", \"mean\": " << number;
+  for (size_t i = 0; i < PercentileCount; i++)
+    out << ", \"" << percentileName(Percentiles[i]) << "\": " << latency.valueAtPercentile(Percentiles[i]);
+  out << ", \"max\": " << latency.getMax() << "}";
+  out << ", \"status\": {";
+  for (std::map<int, uint64_t>::const_iterator it = result.statuses.begin(); it != result.statuses.end(); ++it)
+    out << (it == result.statuses.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+  out << "}, \"errors\": {";
+  for (int i = 0; i < ERROR_KINDS; i++)
+    out << (i ? ", " : "") << "\"" << BenchResult::errorName(i) << "\": " << result.errors[i];
+  out << "}, \"unanswered\": " << result.unanswered << ", \"connects\": " << result.connects << ", \"max_backlog\": " << result.maxBacklog << "}\n";
+}
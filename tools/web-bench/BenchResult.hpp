@@ -0,0 +1,58 @@
+#ifndef BENCH_RESULT_HPP
+#define BENCH_RESULT_HPP
+
+#include "utils/Histogram.hpp"
+#include <map>
+#include <ostream>
+#include <string>
+#include <stdint.h>
+
+enum BenchError
+{
+  ERROR_CONNECT,
+  ERROR_READ,
+  ERROR_WRITE,
+  ERROR_TIMEOUT,
+  ERROR_PARSE,
+  ERROR_CLOSED, // the server closed with requests still unanswered
+  ERROR_KINDS
+};
+
+// What was sent and how it went; one per generator thread, merged at the
+// end. Latencies are in microseconds.
+struct BenchResult
+{
+  Histogram latency;
+  uint64_t responses;
+  uint64_t bytesRead;
+  std::map<int, uint64_t> statuses;
+  uint64_t errors[ERROR_KINDS];
+  uint64_t unanswered; // sent but still waiting when the run ended
+  uint64_t connects;
+  uint64_t maxBacklog; // open loop: most requests overdue at once
+  long long elapsedUs;
+
+  BenchResult();
+
+  void merge(const BenchResult &other);
+  uint64_t errorCount() const;
+
+  static const char *errorName(int kind);
+};
+
+// How the run was set up, for the report header
+struct BenchSummary
+{
+  std::string url;
+  unsigned threads;
+  unsigned connections;
+  unsigned pipeline;
+  double rate; // 0: closed loop
+  bool keepAlive;
+  size_t mixSize;
+};
+
+void printText(std::ostream &out, const BenchSummary &summary, const BenchResult &result);
+void printJson(std::ostream &out, const BenchSummary &summary, const BenchResult &result);
+
+#endif
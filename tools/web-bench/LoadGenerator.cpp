@@ -0,0 +1,467 @@
+#include "LoadGenerator.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static const size_t ReadBufferSize = 65536;
+static const int MaxEvents = 256;
+static const int ReadsPerEvent = 16;
+static const long long RetryDelayUs = 10000; // after a refused connect
+static const long long TickUs = 10000;       // timeouts and retries are checked this often
+static const uint64_t TimerEvent = ~static_cast<uint64_t>(0);
+
+static bool isHead(const InFlight &request)
+{
+  return request.entry->method == "HEAD";
+}
+
+BenchConnection::BenchConnection()
+    : fd(-1), generation(0), events(0), connecting(false), ready(false), outSent(0), retryAtUs(0)
+{
+}
+
+LoadGenerator::LoadGenerator(const BenchOptions &options, const RequestMix &mix, uint64_t seed)
+    : options(options), mix(mix), epollFd(epoll_create1(EPOLL_CLOEXEC)), timerFd(-1), timerDueUs(0),
+      connections(options.connections), random(seed | 1), issued(0), scheduled(0), unanswered(0), retrying(0),
+      readBuffer(new char[ReadBufferSize])
+{
+  if (options.rate > 0)
+  {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = TimerEvent;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+  }
+}
+
+LoadGenerator::~LoadGenerator()
+{
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    if (connections[i].fd != -1)
+      ::close(connections[i].fd);
+  }
+  if (timerFd != -1)
+    ::close(timerFd);
+  if (epollFd != -1)
+    ::close(epollFd);
+  delete[] readBuffer;
+}
+
+// xorshift64*: plenty for picking from the mix
+uint64_t LoadGenerator::nextRandom()
+{
+  random ^= random >> 12;
+  random ^= random << 25;
+  random ^= random >> 27;
+  return random * 2685821657736338717ULL;
+}
+
+void LoadGenerator::open(BenchConnection &connection, long long nowUs)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    result.errors[ERROR_CONNECT]++;
+    connection.retryAtUs = nowUs + RetryDelayUs;
+    retrying++;
+    return;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int status = connect(fd, reinterpret_cast<const struct sockaddr *>(&options.address), sizeof(options.address));
+  if (status == -1 && errno != EINPROGRESS)
+  {
+    ::close(fd);
+    result.errors[ERROR_CONNECT]++;
+    connection.retryAtUs = nowUs + RetryDelayUs;
+    retrying++;
+    return;
+  }
+  connection.fd = fd;
+  connection.generation++;
+  connection.events = 0;
+  connection.connecting = status == -1;
+  result.connects++;
+  watch(connection, EPOLLIN | EPOLLOUT);
+  if (options.rate > 0)
+    markReady(connection);
+  else
+    fill(connection, nowUs);
+}
+
+// Requests still unanswered count as failed with error; a connection
+// that was idle going away is no error. The connection is reopened
+// unless the run is over.
+void LoadGenerator::close(BenchConnection &connection, int error, long long nowUs)
+{
+  if (connection.fd != -1)
+  {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, NULL);
+    ::close(connection.fd);
+    connection.fd = -1;
+  }
+  if (nowUs >= options.recordFromUs)
+  {
+    if (!connection.inFlight.empty())
+      result.errors[error] += connection.inFlight.size();
+    else if (error != ERROR_CLOSED)
+      result.errors[error]++;
+  }
+  unanswered -= connection.inFlight.size();
+  connection.inFlight.clear();
+  connection.out.clear();
+  connection.outSent = 0;
+  connection.connecting = false;
+  if (error == ERROR_CONNECT)
+  {
+    connection.retryAtUs = nowUs + RetryDelayUs;
+    retrying++;
+  }
+  else if (!finished(nowUs))
+    open(connection, nowUs);
+}
+
+void LoadGenerator::watch(BenchConnection &connection, uint32_t events)
+{
+  if (events == connection.events)
+    return;
+  struct epoll_event event;
+  event.events = events;
+  event.data.u64 = (static_cast<uint64_t>(&connection - &connections[0]) << 32) | connection.generation;
+  epoll_ctl(epollFd, connection.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, connection.fd, &event);
+  connection.events = events;
+}
+
+void LoadGenerator::markReady(BenchConnection &connection)
+{
+  if (connection.ready || connection.fd == -1 || connection.inFlight.size() >= options.pipeline)
+    return;
+  connection.ready = true;
+  ready.push_back(&connection);
+}
+
+void LoadGenerator::issue(BenchConnection &connection, long long startUs)
+{
+  const MixEntry &entry = mix.pick(nextRandom());
+  connection.out += entry.wire;
+  InFlight request;
+  request.entry = &entry;
+  request.startUs = startUs;
+  connection.inFlight.push_back(request);
+  if (connection.inFlight.size() == 1)
+    connection.reader.start(isHead(request));
+  issued++;
+  unanswered++;
+}
+
+// Closed loop: tops the connection up to the pipeline depth. Requests
+// are timed from now rather than from when the events were collected.
+void LoadGenerator::fill(BenchConnection &connection, long long nowUs)
+{
+  long long startUs = Timer::monotonicUs();
+  while (connection.fd != -1 && connection.inFlight.size() < options.pipeline && nowUs < options.endUs &&
+         (options.requestLimit == 0 || issued < options.requestLimit))
+    issue(connection, startUs);
+  if (!connection.connecting)
+    flush(connection, nowUs);
+}
+
+// Open loop: every request that has fallen due so far joins the backlog
+void LoadGenerator::schedule(long long nowUs)
+{
+  double intervalUs = 1e6 / options.rate;
+  while (options.requestLimit == 0 || scheduled < options.requestLimit)
+  {
+    long long dueUs = options.startUs + static_cast<long long>(scheduled * intervalUs);
+    if (dueUs > nowUs || dueUs >= options.endUs)
+      break;
+    backlog.push_back(dueUs);
+    scheduled++;
+  }
+  if (backlog.size() > result.maxBacklog)
+    result.maxBacklog = backlog.size();
+}
+
+// Open loop: overdue requests go to connections with room, oldest first
+void LoadGenerator::dispatch(long long nowUs)
+{
+  while (!backlog.empty() && !ready.empty())
+  {
+    BenchConnection &connection = *ready.back();
+    while (!backlog.empty() && connection.fd != -1 && connection.inFlight.size() < options.pipeline)
+    {
+      issue(connection, backlog.front());
+      backlog.pop_front();
+    }
+    if (connection.fd == -1 || connection.inFlight.size() >= options.pipeline)
+    {
+      connection.ready = false;
+      ready.pop_back();
+    }
+    if (!connection.connecting && connection.fd != -1)
+      flush(connection, nowUs);
+  }
+}
+
+void LoadGenerator::flush(BenchConnection &connection, long long nowUs)
+{
+  while (connection.outSent < connection.out.size())
+  {
+    ssize_t sent = send(connection.fd, connection.out.data() + connection.outSent,
+                        connection.out.size() - connection.outSent, MSG_NOSIGNAL);
+    if (sent > 0)
+      connection.outSent += sent;
+    else if (sent == -1 && errno == EINTR)
+      continue;
+    else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    else
+    {
+      close(connection, ERROR_WRITE, nowUs);
+      return;
+    }
+  }
+  if (connection.outSent == connection.out.size())
+  {
+    connection.out.clear();
+    connection.outSent = 0;
+  }
+  watch(connection, connection.out.empty() ? uint32_t(EPOLLIN) : uint32_t(EPOLLIN | EPOLLOUT));
+}
+
+void LoadGenerator::connected(BenchConnection &connection, long long nowUs)
+{
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+  {
+    result.errors[ERROR_CONNECT]++;
+    unanswered -= connection.inFlight.size();
+    connection.inFlight.clear();
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, NULL);
+    ::close(connection.fd);
+    connection.fd = -1;
+    connection.out.clear();
+    connection.outSent = 0;
+    connection.connecting = false;
+    connection.retryAtUs = nowUs + RetryDelayUs;
+    retrying++;
+    return;
+  }
+  connection.connecting = false;
+  flush(connection, nowUs);
+}
+
+// A reply can already be waiting for a request sent a moment ago in this
+// same loop, so the clock is read again after every recv
+void LoadGenerator::receive(BenchConnection &connection, long long nowUs)
+{
+  for (int reads = 0; reads < ReadsPerEvent; reads++)
+  {
+    ssize_t received = recv(connection.fd, readBuffer, ReadBufferSize, 0);
+    nowUs = Timer::monotonicUs();
+    if (received == -1 && errno == EINTR)
+      continue;
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (received == -1)
+    {
+      close(connection, ERROR_READ, nowUs);
+      return;
+    }
+    if (received == 0)
+    {
+      // complete() closes and reopens for a reply read until close
+      if (!connection.inFlight.empty() && connection.reader.finishAtEof())
+        complete(connection, nowUs);
+      else
+        close(connection, ERROR_CLOSED, nowUs);
+      return;
+    }
+    if (nowUs >= options.recordFromUs)
+      result.bytesRead += received;
+    unsigned generation = connection.generation;
+    size_t used = 0;
+    while (used < static_cast<size_t>(received))
+    {
+      if (connection.inFlight.empty())
+      {
+        close(connection, ERROR_PARSE, nowUs); // a response nobody asked for
+        return;
+      }
+      bool done;
+      used += connection.reader.feed(readBuffer + used, received - used, &done);
+      if (connection.reader.hasFailed())
+      {
+        close(connection, ERROR_PARSE, nowUs);
+        return;
+      }
+      if (done)
+        complete(connection, nowUs);
+      if (connection.generation != generation || connection.fd == -1)
+        return; // closed and maybe reopened: the rest is for the old socket
+    }
+  }
+}
+
+void LoadGenerator::complete(BenchConnection &connection, long long nowUs)
+{
+  InFlight request = connection.inFlight.front();
+  connection.inFlight.pop_front();
+  unanswered--;
+  if (request.startUs >= options.recordFromUs && nowUs <= options.endUs)
+  {
+    result.latency.record(static_cast<uint64_t>(nowUs - request.startUs));
+    result.responses++;
+    result.statuses[connection.reader.getStatus()]++;
+  }
+  bool closing = connection.reader.wantsClose() || !options.keepAlive;
+  if (!connection.inFlight.empty())
+    connection.reader.start(isHead(connection.inFlight.front()));
+  if (closing)
+    close(connection, ERROR_CLOSED, nowUs);
+  else if (options.rate > 0)
+    markReady(connection);
+  else
+    fill(connection, nowUs);
+}
+
+// A connection whose oldest request is overdue is given up on
+void LoadGenerator::expire(long long nowUs)
+{
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    BenchConnection &connection = connections[i];
+    if (connection.fd != -1 && !connection.inFlight.empty() &&
+        nowUs - connection.inFlight.front().startUs > options.timeoutUs)
+      close(connection, ERROR_TIMEOUT, nowUs);
+  }
+}
+
+void LoadGenerator::retry(long long nowUs)
+{
+  for (size_t i = 0; i < connections.size() && retrying > 0; i++)
+  {
+    BenchConnection &connection = connections[i];
+    if (connection.fd == -1 && connection.retryAtUs != 0 && connection.retryAtUs <= nowUs)
+    {
+      connection.retryAtUs = 0;
+      retrying--;
+      open(connection, nowUs);
+    }
+  }
+}
+
+bool LoadGenerator::finished(long long nowUs) const
+{
+  if (nowUs >= options.endUs)
+    return true;
+  if (options.requestLimit == 0 || unanswered > 0)
+    return false;
+  if (options.rate > 0)
+    return scheduled >= options.requestLimit && backlog.empty();
+  return issued >= options.requestLimit;
+}
+
+// Open loop: epoll_wait only counts milliseconds, far too coarse at a
+// few thousand requests a second, so the next due time is a timerfd
+void LoadGenerator::armTimer(long long nowUs)
+{
+  long long dueUs = options.startUs + static_cast<long long>(scheduled * (1e6 / options.rate));
+  if (!backlog.empty() || dueUs == timerDueUs || dueUs <= nowUs || dueUs >= options.endUs)
+    return; // nothing can be sent before a connection frees up anyway
+  struct itimerspec due;
+  std::memset(&due, 0, sizeof(due));
+  due.it_value.tv_sec = dueUs / 1000000;
+  due.it_value.tv_nsec = (dueUs % 1000000) * 1000;
+  timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &due, NULL);
+  timerDueUs = dueUs;
+}
+
+// At least every tick; at once while overdue requests have a connection
+int LoadGenerator::waitTimeout(long long nowUs) const
+{
+  if (!backlog.empty() && !ready.empty())
+    return 0;
+  long long waitUs = std::min(TickUs, options.endUs - nowUs);
+  return waitUs > 0 ? static_cast<int>((waitUs + 999) / 1000) : 0;
+}
+
+void LoadGenerator::run(volatile const int *interrupted)
+{
+  long long nowUs = Timer::monotonicUs();
+  if (nowUs < options.startUs)
+    usleep(options.startUs - nowUs);
+  nowUs = Timer::monotonicUs();
+  for (size_t i = 0; i < connections.size(); i++)
+    open(connections[i], nowUs);
+
+  struct epoll_event events[MaxEvents];
+  long long lastTickUs = nowUs;
+  while (!*interrupted)
+  {
+    nowUs = Timer::monotonicUs();
+    if (finished(nowUs))
+      break;
+    if (nowUs - lastTickUs >= TickUs)
+    {
+      expire(nowUs);
+      retry(nowUs);
+      lastTickUs = nowUs;
+    }
+    if (options.rate > 0)
+    {
+      schedule(nowUs);
+      dispatch(nowUs);
+      armTimer(nowUs);
+    }
+
+    int count = epoll_wait(epollFd, events, MaxEvents, waitTimeout(nowUs));
+    nowUs = Timer::monotonicUs();
+    for (int i = 0; i < count; i++)
+    {
+      if (events[i].data.u64 == TimerEvent)
+      {
+        uint64_t expirations; // only drained; the schedule is worked out from the clock
+        ssize_t drained = read(timerFd, &expirations, sizeof(expirations));
+        (void)drained;
+        continue;
+      }
+      BenchConnection &connection = connections[events[i].data.u64 >> 32];
+      if (connection.fd == -1 || static_cast<unsigned>(events[i].data.u64) != connection.generation)
+        continue;
+      if (connection.connecting)
+      {
+        connected(connection, nowUs);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        receive(connection, nowUs);
+      if (connection.fd != -1 && static_cast<unsigned>(events[i].data.u64) == connection.generation &&
+          (events[i].events & EPOLLOUT))
+        flush(connection, nowUs);
+    }
+  }
+
+  // Whatever is still in flight never got an answer: a response cut off
+  // by the end of the run, or one the server will never send
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    const std::deque<InFlight> &inFlight = connections[i].inFlight;
+    for (size_t j = 0; j < inFlight.size(); j++)
+      if (inFlight[j].startUs >= options.recordFromUs)
+        result.unanswered++;
+  }
+  long long stopUs = std::min(Timer::monotonicUs(), options.endUs);
+  result.elapsedUs = stopUs > options.recordFromUs ? stopUs - options.recordFromUs : 0;
+}
+
+const BenchResult &LoadGenerator::getResult() const { return result; }
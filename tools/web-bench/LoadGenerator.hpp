@@ -0,0 +1,101 @@
+#ifndef LOAD_GENERATOR_HPP
+#define LOAD_GENERATOR_HPP
+
+#include "BenchResult.hpp"
+#include "RequestMix.hpp"
+#include "ResponseReader.hpp"
+#include <deque>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <stdint.h>
+
+struct BenchOptions
+{
+  struct sockaddr_in address;
+  unsigned connections;   // this generator's share
+  unsigned pipeline;      // requests in flight per connection; 1 without keep-alive
+  double rate;            // requests/s for this generator; 0: closed loop
+  uint64_t requestLimit;  // 0: until the deadline
+  long long startUs;      // shared by all generators
+  long long recordFromUs; // after the warmup
+  long long endUs;
+  long long timeoutUs;
+  bool keepAlive;
+};
+
+// A request sent (or queued to be) and not yet answered
+struct InFlight
+{
+  const MixEntry *entry;
+  long long startUs; // scheduled time in open loop, else when it was queued
+};
+
+struct BenchConnection
+{
+  int fd;
+  unsigned generation; // tells events for an earlier socket apart
+  uint32_t events;
+  bool connecting;
+  bool ready; // on the generator's ready list
+  std::string out;
+  size_t outSent;
+  std::deque<InFlight> inFlight;
+  ResponseReader reader;
+  long long retryAtUs; // after a failed connect
+
+  BenchConnection();
+};
+
+// One thread's worth of load: its connections on its own epoll instance.
+// Closed loop keeps every connection `pipeline` requests deep. Open loop
+// sends at a fixed rate whatever the server does: requests fall due on
+// a schedule, wait for a free connection if none has room, and their
+// latency counts from when they fell due, so a stalled server shows up
+// in the percentiles instead of slowing the load down.
+class LoadGenerator
+{
+  const BenchOptions &options;
+  const RequestMix &mix;
+  int epollFd;
+  int timerFd;        // open loop: wakes when the next request falls due
+  long long timerDueUs;
+  std::vector<BenchConnection> connections;
+  std::vector<BenchConnection *> ready; // connected, with room for a request
+  std::deque<long long> backlog;        // open loop: due times not yet sent
+  BenchResult result;
+  uint64_t random;
+  uint64_t issued;
+  uint64_t scheduled;
+  uint64_t unanswered; // requests in flight on all connections
+  size_t retrying;     // connections waiting to reconnect
+  char *readBuffer;
+
+  uint64_t nextRandom();
+  void open(BenchConnection &connection, long long nowUs);
+  void close(BenchConnection &connection, int error, long long nowUs);
+  void watch(BenchConnection &connection, uint32_t events);
+  void markReady(BenchConnection &connection);
+  void issue(BenchConnection &connection, long long startUs);
+  void fill(BenchConnection &connection, long long nowUs);
+  void dispatch(long long nowUs);
+  void schedule(long long nowUs);
+  void flush(BenchConnection &connection, long long nowUs);
+  void connected(BenchConnection &connection, long long nowUs);
+  void receive(BenchConnection &connection, long long nowUs);
+  void complete(BenchConnection &connection, long long nowUs);
+  void expire(long long nowUs);
+  void retry(long long nowUs);
+  bool finished(long long nowUs) const;
+  void armTimer(long long nowUs);
+  int waitTimeout(long long nowUs) const;
+
+public:
+  LoadGenerator(const BenchOptions &options, const RequestMix &mix, uint64_t seed);
+  ~LoadGenerator();
+
+  void run(volatile const int *interrupted);
+  const BenchResult &getResult() const;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "RequestMix.hpp"
+#include "utils/Number.hpp"
+#include <fstream>
+
+// Just enough JSON for one flat object per line: string and number
+// members, and an object of strings for headers. Anything else is an
+// error naming the line.
+class MixLineReader
+{
+  const std::string &text;
+  size_t pos;
+
+public:
+  MixLineReader(const std::string &text) : text(text), pos(0) {}
+
+  void skipSpace()
+  {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r'))
+      pos++;
+  }
+
+  bool consume(char c)
+  {
+    skipSpace();
+    if (pos < text.size() && text[pos] == c)
+    {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool atEnd()
+  {
+    skipSpace();
+    return pos == text.size();
+  }
+
+  bool peek(char c)
+  {
+    skipSpace();
+    return pos < text.size() && text[pos] == c;
+  }
+
+  // \uXXXX outside ASCII becomes '?': paths and headers are ASCII anyway
+  bool readString(std::string *out)
+  {
+    if (!consume('"'))
+      return false;
+    out->clear();
+    while (pos < text.size() && text[pos] != '"')
+    {
+      char c = text[pos++];
+      if (c != '\\')
+      {
+        *out += c;
+        continue;
+      }
+      if (pos == text.size())
+        return false;
+      c = text[pos++];
+      if (c == 'n')
+        *out += '\n';
+      else if (c == 'r')
+        *out += '\r';
+      else if (c == 't')
+        *out += '\t';
+      else if (c == 'b')
+        *out += '\b';
+      else if (c == 'f')
+        *out += '\f';
+      else if (c == 'u')
+      {
+        if (pos + 4 > text.size())
+          return false;
+        unsigned code = 0;
+        for (int i = 0; i < 4; i++)
+        {
+          char h = text[pos++];
+          code <<= 4;
+          if (h >= '0' && h <= '9')
+            code |= h - '0';
+          else if (h >= 'a' && h <= 'f')
+            code |= h - 'a' + 10;
+          else if (h >= 'A' && h <= 'F')
+            code |= h - 'A' + 10;
+          else
+            return false;
+        }
+        *out += code < 0x80 ? static_cast<char>(code) : '?';
+      }
+      else
+        *out += c;
+    }
+    return consume('"');
+  }
+
+  bool readNumber(std::string *out)
+  {
+    skipSpace();
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+      pos++;
+    *out = text.substr(start, pos - start);
+    return !out->empty();
+  }
+
+  // Skips a value of a member the mix does not use
+  bool skipValue()
+  {
+    std::string ignored;
+    if (peek('"'))
+      return readString(&ignored);
+    skipSpace();
+    size_t start = pos;
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != '{' && text[pos] != '[')
+      pos++;
+    return pos > start;
+  }
+};
+
+static bool readHeaders(MixLineReader &reader, std::vector<std::string> *headers)
+{
+  if (!reader.consume('{'))
+    return false;
+  if (reader.consume('}'))
+    return true;
+  do
+  {
+    std::string name;
+    std::string value;
+    if (!reader.readString(&name) || !reader.consume(':') || !reader.readString(&value))
+      return false;
+    headers->push_back(name + ": " + value);
+  } while (reader.consume(','));
+  return reader.consume('}');
+}
+
+static bool readEntry(const std::string &line, MixEntry *entry)
+{
+  MixLineReader reader(line);
+  entry->method = "GET";
+  entry->weight = 1;
+  if (!reader.consume('{'))
+    return false;
+  if (reader.consume('}'))
+    return false;
+  do
+  {
+    std::string key;
+    if (!reader.readString(&key) || !reader.consume(':'))
+      return false;
+    bool ok;
+    if (key == "method")
+      ok = reader.readString(&entry->method);
+    else if (key == "path")
+      ok = reader.readString(&entry->path);
+    else if (key == "body")
+      ok = reader.readString(&entry->body);
+    else if (key == "headers")
+      ok = readHeaders(reader, &entry->headers);
+    else if (key == "weight")
+    {
+      std::string digits;
+      ok = reader.readNumber(&digits);
+      entry->weight = ok ? Number::toInt(digits, &ok) : 0;
+    }
+    else
+      ok = reader.skipValue();
+    if (!ok)
+      return false;
+  } while (reader.consume(','));
+  return reader.consume('}') && reader.atEnd() && !entry->path.empty() && entry->path[0] == '/' &&
+         !entry->method.empty();
+}
+
+RequestMix RequestMix::single(const std::string &path)
+{
+  RequestMix mix;
+  MixEntry entry;
+  entry.method = "GET";
+  entry.path = path;
+  entry.weight = 1;
+  mix.entries.push_back(entry);
+  return mix;
+}
+
+RequestMix RequestMix::load(const std::string &fileName)
+{
+  std::ifstream file(fileName.c_str());
+  if (!file)
+    throw MixFileException("Cannot open request mix '" + fileName + "'");
+  RequestMix mix;
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line))
+  {
+    lineNumber++;
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#')
+      continue;
+    MixEntry entry;
+    if (!readEntry(line, &entry))
+      throw MixFileException(fileName + ":" + Number::toString(lineNumber) +
+                             ": expected {\"path\": \"/...\"} with optional method, headers, body, weight");
+    if (entry.weight > 0)
+      mix.entries.push_back(entry);
+  }
+  if (mix.entries.empty())
+    throw MixFileException("No requests in '" + fileName + "'");
+  return mix;
+}
+
+void RequestMix::prepare(const std::string &host, const std::vector<std::string> &headers, bool keepAlive)
+{
+  cumulative.clear();
+  uint64_t running = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    MixEntry &entry = entries[i];
+    std::string &wire = entry.wire;
+    wire = entry.method + " " + entry.path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+    for (size_t j = 0; j < headers.size(); j++)
+      wire += headers[j] + "\r\n";
+    for (size_t j = 0; j < entry.headers.size(); j++)
+      wire += entry.headers[j] + "\r\n";
+    if (!entry.body.empty() || entry.method == "POST" || entry.method == "PUT")
+      wire += "Content-Length: " + Number::toString(entry.body.size()) + "\r\n";
+    wire += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    wire += entry.body;
+    running += entry.weight;
+    cumulative.push_back(running);
+  }
+}
+
+const MixEntry &RequestMix::pick(uint64_t random) const
+{
+  if (entries.size() == 1)
+    return entries[0];
+  uint64_t point = random % cumulative.back();
+  size_t low = 0;
+  size_t high = cumulative.size() - 1;
+  while (low < high)
+  {
+    size_t middle = (low + high) / 2;
+    if (cumulative[middle] > point)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+  return entries[low];
+}
+
+size_t RequestMix::size() const { return entries.size(); }
+const MixEntry &RequestMix::operator[](size_t index) const { return entries[index]; }
@@ -0,0 +1,51 @@
+#ifndef REQUEST_MIX_HPP
+#define REQUEST_MIX_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// One kind of request in the mix, serialized once up front
+struct MixEntry
+{
+  std::string method;
+  std::string path;
+  std::vector<std::string> headers; // "Name: value"
+  std::string body;
+  unsigned weight;
+  std::string wire; // the request as sent
+};
+
+// What the benchmark sends: a single GET, or weighted requests read from
+// a JSON-lines file, one object per line:
+//
+//   {"method": "GET", "path": "/index.html", "weight": 8}
+//   {"method": "POST", "path": "/up/a.txt", "headers": {"Content-Type": "text/plain"}, "body": "hello"}
+//
+// Only path is required; blank lines and lines starting with # are
+// skipped.
+class RequestMix
+{
+  std::vector<MixEntry> entries;
+  std::vector<uint64_t> cumulative; // running weight totals, for picking
+
+public:
+  static RequestMix single(const std::string &path);
+  static RequestMix load(const std::string &fileName);
+
+  // Builds every entry's wire form for host, with the extra headers
+  void prepare(const std::string &host, const std::vector<std::string> &headers, bool keepAlive);
+  // The entry for a uniform random number
+  const MixEntry &pick(uint64_t random) const;
+  size_t size() const;
+  const MixEntry &operator[](size_t index) const;
+
+  class MixFileException : public std::runtime_error
+  {
+  public:
+    MixFileException(const std::string &msg) : std::runtime_error(msg) {}
+  };
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "ResponseReader.hpp"
+#include "utils/String.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t MaxHead = 65536;
+static const uint64_t FnvOffset = 14695981039346656037ULL;
+static const uint64_t FnvPrime = 1099511628211ULL;
+
+ResponseReader::ResponseReader()
+    : phase(READER_HEAD), lineStart(0), left(0), status(0), headRequest(false), closeAfter(false),
+      digest(false), bodyHash(FnvOffset), bodyLength(0)
+{
+}
+
+void ResponseReader::start(bool headRequest)
+{
+  phase = READER_HEAD;
+  head.clear();
+  lineStart = 0;
+  left = 0;
+  status = 0;
+  this->headRequest = headRequest;
+  closeAfter = false;
+  bodyHash = FnvOffset;
+  bodyLength = 0;
+}
+
+void ResponseReader::setDigest(bool digest) { this->digest = digest; }
+
+void ResponseReader::consumeBody(const char *data, size_t length)
+{
+  bodyLength += length;
+  if (!digest)
+    return;
+  uint64_t hash = bodyHash;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * FnvPrime;
+  bodyHash = hash;
+}
+
+// Appends to head up to and including the next LF
+size_t ResponseReader::readLine(const char *data, size_t length, bool *complete)
+{
+  const char *newline = static_cast<const char *>(std::memchr(data, '\n', length));
+  size_t used = newline ? newline - data + 1 : length;
+  head.append(data, used);
+  *complete = newline != NULL;
+  if (head.size() > MaxHead)
+    phase = READER_FAILED;
+  return used;
+}
+
+// Status line and framing headers; decides how the body is delimited
+bool ResponseReader::parseHead()
+{
+  if (head.compare(0, 7, "HTTP/1.") != 0 || head.size() < 12)
+    return false;
+  status = std::atoi(head.c_str() + 9);
+  if (status < 100 || status > 599)
+    return false;
+  bool chunked = false;
+  bool hasLength = false;
+  size_t length = 0;
+  size_t pos = head.find('\n') + 1;
+  while (pos < head.size())
+  {
+    size_t end = head.find('\n', pos);
+    if (end == std::string::npos)
+      break;
+    size_t valueEnd = end > pos && head[end - 1] == '\r' ? end - 1 : end;
+    size_t colon = head.find(':', pos);
+    if (colon != std::string::npos && colon < valueEnd)
+    {
+      std::string name = head.substr(pos, colon - pos);
+      std::string value = String::trim(head.substr(colon + 1, valueEnd - colon - 1));
+      if (String::equalsIgnoreCase(name, "content-length"))
+      {
+        hasLength = true;
+        length = std::strtoul(value.c_str(), NULL, 10);
+      }
+      else if (String::equalsIgnoreCase(name, "transfer-encoding"))
+        chunked = String::equalsIgnoreCase(value, "chunked");
+      else if (String::equalsIgnoreCase(name, "connection"))
+        closeAfter = String::equalsIgnoreCase(value, "close");
+    }
+    pos = end + 1;
+  }
+  head.clear();
+  lineStart = 0;
+  if (status < 200)
+  {
+    phase = READER_HEAD;
+    return true;
+  }
+  if (headRequest || status == 204 || status == 304)
+    phase = READER_BODY;
+  else if (chunked)
+    phase = READER_CHUNK_SIZE;
+  else if (hasLength)
+  {
+    phase = READER_BODY;
+    left = length;
+  }
+  else
+  {
+    phase = READER_UNTIL_CLOSE;
+    closeAfter = true;
+  }
+  return true;
+}
+
+size_t ResponseReader::feed(const char *data, size_t length, bool *done)
+{
+  *done = false;
+  size_t used = 0;
+  while (used < length && phase != READER_FAILED)
+  {
+    bool complete;
+    if (phase == READER_HEAD)
+    {
+      used += readLine(data + used, length - used, &complete);
+      if (!complete)
+        continue;
+      // A blank line ends the head; one before any head is stray
+      size_t start = lineStart;
+      lineStart = head.size();
+      if (head.size() - start > 2 || (head[start] != '\n' && head[start] != '\r'))
+        continue;
+      if (start == 0)
+      {
+        head.clear();
+        lineStart = 0;
+        continue;
+      }
+      if (!parseHead())
+      {
+        phase = READER_FAILED;
+        break;
+      }
+      if (phase == READER_BODY && left == 0)
+      {
+        *done = true;
+        return used;
+      }
+    }
+    else if (phase == READER_BODY)
+    {
+      size_t take = std::min(left, length - used);
+      consumeBody(data + used, take);
+      used += take;
+      left -= take;
+      if (left == 0)
+      {
+        *done = true;
+        return used;
+      }
+    }
+    else if (phase == READER_CHUNK_SIZE)
+    {
+      used += readLine(data + used, length - used, &complete);
+      if (!complete)
+        continue;
+      char *end;
+      left = std::strtoul(head.c_str(), &end, 16);
+      if (end == head.c_str())
+      {
+        phase = READER_FAILED;
+        break;
+      }
+      head.clear();
+      phase = left == 0 ? READER_TRAILERS : READER_CHUNK_DATA;
+    }
+    else if (phase == READER_CHUNK_DATA)
+    {
+      size_t take = std::min(left, length - used);
+      consumeBody(data + used, take);
+      used += take;
+      left -= take;
+      if (left == 0)
+        phase = READER_CHUNK_END;
+    }
+    else if (phase == READER_CHUNK_END)
+    {
+      used += readLine(data + used, length - used, &complete);
+      if (!complete)
+        continue;
+      head.clear();
+      phase = READER_CHUNK_SIZE;
+    }
+    else if (phase == READER_TRAILERS)
+    {
+      used += readLine(data + used, length - used, &complete);
+      if (!complete)
+        continue;
+      bool last = head == "\r\n" || head == "\n";
+      head.clear();
+      if (last)
+      {
+        phase = READER_HEAD;
+        *done = true;
+        return used;
+      }
+    }
+    else
+    {
+      consumeBody(data + used, length - used); // READER_UNTIL_CLOSE
+      used = length;
+    }
+  }
+  return used;
+}
+
+bool ResponseReader::finishAtEof()
+{
+  return phase == READER_UNTIL_CLOSE;
+}
+
+int ResponseReader::getStatus() const { return status; }
+bool ResponseReader::wantsClose() const { return closeAfter; }
+bool ResponseReader::hasFailed() const { return phase == READER_FAILED; }
+bool ResponseReader::isIdle() const { return phase == READER_HEAD && head.empty(); }
+uint64_t ResponseReader::getBodyHash() const { return bodyHash; }
+uint64_t ResponseReader::getBodyLength() const { return bodyLength; }
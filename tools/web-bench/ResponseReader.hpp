@@ -0,0 +1,60 @@
+#ifndef RESPONSE_READER_HPP
+#define RESPONSE_READER_HPP
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+enum ReaderPhase
+{
+  READER_HEAD,
+  READER_BODY,        // Content-Length bytes left
+  READER_CHUNK_SIZE,
+  READER_CHUNK_DATA,
+  READER_CHUNK_END,   // the CRLF after a chunk
+  READER_TRAILERS,
+  READER_UNTIL_CLOSE,
+  READER_FAILED
+};
+
+// Finds where each HTTP/1.1 response on a connection ends, in whatever
+// pieces it arrives. Only the head is kept; body bytes are counted off
+// and dropped, optionally hashed on the way (web-replay compares bodies
+// by length and FNV-1a digest). Interim 1xx responses are skipped.
+class ResponseReader
+{
+  ReaderPhase phase;
+  std::string head; // the head so far, or the current chunk-size/trailer line
+  size_t lineStart; // where the head's current line begins
+  size_t left;
+  int status;
+  bool headRequest;
+  bool closeAfter;
+  bool digest;
+  uint64_t bodyHash;
+  uint64_t bodyLength;
+
+  bool parseHead();
+  void consumeBody(const char *data, size_t length);
+  size_t readLine(const char *data, size_t length, bool *complete);
+
+public:
+  ResponseReader();
+
+  void start(bool headRequest);
+  void setDigest(bool digest);
+  // Consumes up to the end of the current response; *done is set when
+  // it ended there
+  size_t feed(const char *data, size_t length, bool *done);
+  // The connection closed: true if that ends the response
+  bool finishAtEof();
+
+  int getStatus() const;
+  bool wantsClose() const;
+  bool hasFailed() const;
+  bool isIdle() const; // nothing of a response has arrived yet
+  uint64_t getBodyHash() const;
+  uint64_t getBodyLength() const;
+};
+
+#endif
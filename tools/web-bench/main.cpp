@@ -0,0 +1,279 @@
+#include "BenchResult.hpp"
+#include "LoadGenerator.hpp"
+#include "RequestMix.hpp"
+#include "utils/Number.hpp"
+#include "utils/Timer.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+static volatile int g_interrupted = 0;
+
+static void handle_sigint(int sig)
+{
+  (void)sig;
+  g_interrupted = 1;
+}
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name << " [options] http://host[:port]/path\n"
+            << "  -c, --connections N   connections kept open (default 50)\n"
+            << "  -d, --duration TIME   how long to run, e.g. 30s or 2m (default 10s)\n"
+            << "  -n, --requests N      stop after N requests instead\n"
+            << "  -p, --pipeline N      requests in flight per connection (default 1)\n"
+            << "  -r, --rate N          open loop: send N requests/s whatever the latency\n"
+            << "  -m, --mix FILE        weighted requests, one JSON object per line\n"
+            << "  -H, --header LINE     extra request header, repeatable\n"
+            << "  -t, --timeout TIME    a request unanswered this long fails (default 5s)\n"
+            << "  -w, --warmup TIME     run this long before recording\n"
+            << "  -T, --threads N       generator threads (default 1)\n"
+            << "      --no-keepalive    one request per connection\n"
+            << "      --json            print the report as JSON" << std::endl;
+}
+
+static bool parseCount(const char *text, unsigned long long *out)
+{
+  std::string digits(text);
+  if (!Number::isDigits(digits) || digits.size() > 12)
+    return false;
+  *out = std::strtoull(text, NULL, 10);
+  return true;
+}
+
+static bool parseMs(const char *text, long long *outUs)
+{
+  bool ok;
+  long ms = Number::parseDuration(text, &ok);
+  *outUs = ms * 1000LL;
+  return ok;
+}
+
+// http://host[:port][/path] into an IPv4 address, the Host header and
+// the request target
+static bool parseUrl(const std::string &url, struct sockaddr_in *address, std::string *host, std::string *path)
+{
+  if (url.compare(0, 7, "http://") != 0)
+    return false;
+  size_t slash = url.find('/', 7);
+  std::string authority = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+  *path = slash == std::string::npos ? "/" : url.substr(slash);
+  std::string name = authority;
+  std::string port = "80";
+  size_t colon = authority.rfind(':');
+  if (colon != std::string::npos)
+  {
+    name = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+  if (name.empty() || port.empty())
+    return false;
+
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *found = NULL;
+  if (getaddrinfo(name.c_str(), port.c_str(), &hints, &found) != 0 || !found)
+    return false;
+  std::memcpy(address, found->ai_addr, sizeof(*address));
+  freeaddrinfo(found);
+  *host = port == "80" ? name : authority;
+  return true;
+}
+
+struct BenchThread
+{
+  pthread_t thread;
+  BenchOptions options;
+  const RequestMix *mix;
+  uint64_t seed;
+  BenchResult result;
+};
+
+static void *runThread(void *arg)
+{
+  BenchThread *bench = static_cast<BenchThread *>(arg);
+  LoadGenerator generator(bench->options, *bench->mix, bench->seed);
+  generator.run(&g_interrupted);
+  bench->result = generator.getResult();
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  enum
+  {
+    OPT_NO_KEEPALIVE = 256,
+    OPT_JSON
+  };
+  static const struct option longOptions[] = {
+      {"connections", required_argument, NULL, 'c'}, {"duration", required_argument, NULL, 'd'},
+      {"requests", required_argument, NULL, 'n'},    {"pipeline", required_argument, NULL, 'p'},
+      {"rate", required_argument, NULL, 'r'},        {"mix", required_argument, NULL, 'm'},
+      {"header", required_argument, NULL, 'H'},      {"timeout", required_argument, NULL, 't'},
+      {"warmup", required_argument, NULL, 'w'},      {"threads", required_argument, NULL, 'T'},
+      {"no-keepalive", no_argument, NULL, OPT_NO_KEEPALIVE},
+      {"json", no_argument, NULL, OPT_JSON},
+      {NULL, 0, NULL, 0}};
+
+  unsigned long long connections = 50, pipeline = 1, threads = 1, rate = 0, requests = 0;
+  long long durationUs = 10000000, timeoutUs = 5000000, warmupUs = 0;
+  bool keepAlive = true, json = false, durationSet = false;
+  std::string mixFile;
+  std::vector<std::string> headers;
+
+  int option;
+  while ((option = getopt_long(argc, argv, "c:d:n:p:r:m:H:t:w:T:", longOptions, NULL)) != -1)
+  {
+    bool ok = true;
+    switch (option)
+    {
+    case 'c':
+      ok = parseCount(optarg, &connections) && connections > 0;
+      break;
+    case 'd':
+      ok = parseMs(optarg, &durationUs) && durationUs > 0;
+      durationSet = true;
+      break;
+    case 'n':
+      ok = parseCount(optarg, &requests) && requests > 0;
+      break;
+    case 'p':
+      ok = parseCount(optarg, &pipeline) && pipeline > 0 && pipeline <= 1024;
+      break;
+    case 'r':
+      ok = parseCount(optarg, &rate) && rate > 0;
+      break;
+    case 'm':
+      mixFile = optarg;
+      break;
+    case 'H':
+      ok = std::strchr(optarg, ':') != NULL;
+      headers.push_back(optarg);
+      break;
+    case 't':
+      ok = parseMs(optarg, &timeoutUs) && timeoutUs > 0;
+      break;
+    case 'w':
+      ok = parseMs(optarg, &warmupUs);
+      break;
+    case 'T':
+      ok = parseCount(optarg, &threads) && threads > 0 && threads <= 256;
+      break;
+    case OPT_NO_KEEPALIVE:
+      keepAlive = false;
+      break;
+    case OPT_JSON:
+      json = true;
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok)
+    {
+      if (option != '?')
+        std::cerr << argv[0] << ": bad value for -" << static_cast<char>(option) << ": " << optarg << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string url = argv[optind];
+  struct sockaddr_in address;
+  std::string host, path;
+  if (!parseUrl(url, &address, &host, &path))
+  {
+    std::cerr << argv[0] << ": cannot use " << url << std::endl;
+    return 1;
+  }
+  RequestMix mix;
+  try
+  {
+    mix = mixFile.empty() ? RequestMix::single(path) : RequestMix::load(mixFile);
+  }
+  catch (const RequestMix::MixFileException &e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  if (!keepAlive)
+    pipeline = 1;
+  if (threads > connections)
+    threads = connections;
+  // With a request count and no duration the count decides; the deadline
+  // only guards against a server that stopped answering
+  if (requests > 0 && !durationSet)
+    durationUs = 24LL * 3600 * 1000000;
+  mix.prepare(host, headers, keepAlive);
+
+  signal(SIGINT, handle_sigint);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Every thread starts together, a little from now, so the schedules
+  // of the open loop line up
+  long long startUs = Timer::monotonicUs() + 20000;
+  std::vector<BenchThread> benches(threads);
+  for (unsigned i = 0; i < threads; i++)
+  {
+    BenchOptions &options = benches[i].options;
+    options.address = address;
+    options.connections = connections / threads + (i < connections % threads ? 1 : 0);
+    options.pipeline = pipeline;
+    options.rate = static_cast<double>(rate) / threads;
+    options.requestLimit = requests / threads + (i < requests % threads ? 1 : 0);
+    options.startUs = startUs;
+    options.recordFromUs = startUs + warmupUs;
+    options.endUs = options.recordFromUs + durationUs;
+    options.timeoutUs = timeoutUs;
+    options.keepAlive = keepAlive;
+    benches[i].mix = &mix;
+    benches[i].seed = (static_cast<uint64_t>(startUs) << 8) ^ (i + 1) * 0x9E3779B97F4A7C15ULL;
+  }
+  if (requests > 0 && requests < threads)
+  {
+    std::cerr << argv[0] << ": fewer requests than threads" << std::endl;
+    return 1;
+  }
+  for (unsigned i = 0; i < threads; i++)
+  {
+    if (pthread_create(&benches[i].thread, NULL, runThread, &benches[i]) != 0)
+    {
+      std::cerr << argv[0] << ": cannot start thread " << i << std::endl;
+      g_interrupted = 1;
+      threads = i;
+      break;
+    }
+  }
+  BenchResult total;
+  for (unsigned i = 0; i < threads; i++)
+  {
+    pthread_join(benches[i].thread, NULL);
+    total.merge(benches[i].result);
+  }
+
+  BenchSummary summary;
+  summary.url = url;
+  summary.threads = threads;
+  summary.connections = connections;
+  summary.pipeline = pipeline;
+  summary.rate = rate;
+  summary.keepAlive = keepAlive;
+  summary.mixSize = mix.size();
+  if (json)
+    printJson(std::cout, summary, total);
+  else
+    printText(std::cout, summary, total);
+  return total.responses > 0 ? 0 : 1;
+}
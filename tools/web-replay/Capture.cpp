@@ -0,0 +1,178 @@
+#include "Capture.hpp"
+#include "core/TrafficCapture.hpp"
+#include "utils/String.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+Capture::Capture() : wallStartUs(0) {}
+
+Capture Capture::load(const std::string &fileName)
+{
+  std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+  if (!file.is_open())
+    throw CaptureFileException("cannot read " + fileName);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  const std::string data = contents.str();
+  if (data.size() < CaptureFormat::FileHeaderSize ||
+      std::memcmp(data.data(), CaptureFormat::Magic, sizeof(CaptureFormat::Magic)) != 0)
+    throw CaptureFileException(fileName + ": not a capture file");
+
+  Capture capture;
+  std::memcpy(&capture.wallStartUs, data.data() + 8, 8);
+  std::map<uint32_t, size_t> byId;
+  size_t pos = CaptureFormat::FileHeaderSize;
+  // A server stopped mid-write leaves a short last record; drop it
+  while (pos + CaptureRecord::HeaderSize <= data.size())
+  {
+    CaptureRecord record;
+    record.decode(data.data() + pos);
+    pos += CaptureRecord::HeaderSize;
+    if (record.length > data.size() - pos)
+      break;
+    const char *payload = data.data() + pos;
+    pos += record.length;
+
+    std::map<uint32_t, size_t>::iterator it = byId.find(record.connection);
+    if (record.type == CAPTURE_OPEN)
+    {
+      byId[record.connection] = capture.connections.size();
+      CapturedConnection connection;
+      connection.id = record.connection;
+      connection.port = record.port;
+      connection.clientIp.assign(payload, record.length);
+      connection.openUs = record.timeUs;
+      connection.closeUs = -1;
+      connection.truncated = false;
+      capture.connections.push_back(connection);
+      continue;
+    }
+    if (it == byId.end())
+      continue; // opened before a restart of the capture
+    CapturedConnection &connection = capture.connections[it->second];
+    if (record.type == CAPTURE_DATA)
+    {
+      CapturedChunk chunk;
+      chunk.timeUs = record.timeUs;
+      chunk.offset = connection.stream.size();
+      chunk.length = record.length;
+      connection.chunks.push_back(chunk);
+      connection.stream.append(payload, record.length);
+    }
+    else if (record.type == CAPTURE_CLOSE)
+    {
+      connection.closeUs = record.timeUs;
+      byId.erase(it);
+    }
+  }
+  for (size_t i = 0; i < capture.connections.size(); i++)
+    frameRequests(capture.connections[i]);
+  return capture;
+}
+
+// Offset just past the next CRLF at or after pos, or npos
+static size_t lineEnd(const std::string &stream, size_t pos)
+{
+  size_t end = stream.find("\r\n", pos);
+  return end == std::string::npos ? end : end + 2;
+}
+
+// Where a chunked body starting at pos ends, trailers included, or npos
+static size_t chunkedEnd(const std::string &stream, size_t pos)
+{
+  while (true)
+  {
+    size_t next = lineEnd(stream, pos);
+    if (next == std::string::npos)
+      return next;
+    char *end;
+    unsigned long size = std::strtoul(stream.c_str() + pos, &end, 16);
+    if (end == stream.c_str() + pos)
+      return std::string::npos;
+    pos = next;
+    if (size == 0)
+      break;
+    if (stream.size() - pos < size + 2)
+      return std::string::npos;
+    pos += size + 2;
+  }
+  // Trailers, up to the blank line
+  while (true)
+  {
+    size_t next = lineEnd(stream, pos);
+    if (next == std::string::npos)
+      return next;
+    if (next == pos + 2)
+      return next;
+    pos = next;
+  }
+}
+
+void Capture::frameRequests(CapturedConnection &connection)
+{
+  const std::string &stream = connection.stream;
+  size_t pos = 0;
+  while (pos < stream.size())
+  {
+    // Stray line breaks between requests are ignored by the server too
+    if (stream[pos] == '\r' || stream[pos] == '\n')
+    {
+      pos++;
+      continue;
+    }
+    size_t headEnd = stream.find("\r\n\r\n", pos);
+    if (headEnd == std::string::npos)
+      break;
+    headEnd += 4;
+
+    CapturedRequest request;
+    request.start = pos;
+    size_t lineStop = stream.find("\r\n", pos);
+    std::istringstream requestLine(stream.substr(pos, lineStop - pos));
+    requestLine >> request.method >> request.target;
+
+    bool chunked = false;
+    size_t length = 0;
+    size_t line = lineStop + 2;
+    while (line < headEnd - 2)
+    {
+      size_t next = stream.find("\r\n", line);
+      size_t colon = stream.find(':', line);
+      if (colon != std::string::npos && colon < next)
+      {
+        std::string name = stream.substr(line, colon - line);
+        std::string value = String::trim(stream.substr(colon + 1, next - colon - 1));
+        if (String::equalsIgnoreCase(name, "content-length"))
+          length = std::strtoul(value.c_str(), NULL, 10);
+        else if (String::equalsIgnoreCase(name, "transfer-encoding"))
+          chunked = String::equalsIgnoreCase(value, "chunked");
+      }
+      line = next + 2;
+    }
+
+    if (chunked)
+      request.end = chunkedEnd(stream, headEnd);
+    else
+      request.end = stream.size() - headEnd >= length ? headEnd + length : std::string::npos;
+    if (request.end == std::string::npos)
+      break;
+    connection.requests.push_back(request);
+    pos = request.end;
+  }
+  connection.truncated = pos < stream.size();
+}
+
+const std::vector<CapturedConnection> &Capture::getConnections() const { return connections; }
+
+long long Capture::getWallStartUs() const { return wallStartUs; }
+
+size_t Capture::requestCount() const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < connections.size(); i++)
+    count += connections[i].requests.size();
+  return count;
+}
@@ -0,0 +1,67 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes that arrived in one read, when they arrived
+struct CapturedChunk
+{
+  long long timeUs; // since the capture was opened
+  size_t offset;    // into the connection's stream
+  size_t length;
+};
+
+// One request framed out of a connection's stream
+struct CapturedRequest
+{
+  size_t start;
+  size_t end; // one past its last byte
+  std::string method;
+  std::string target;
+};
+
+// Everything one client sent, in order
+struct CapturedConnection
+{
+  uint32_t id;
+  int port;
+  std::string clientIp;
+  long long openUs;
+  long long closeUs; // -1: still open when the capture ended
+  std::string stream;
+  std::vector<CapturedChunk> chunks;
+  std::vector<CapturedRequest> requests;
+  bool truncated; // the stream ends inside a request
+};
+
+// A capture file written by the server's `capture` directive, split into
+// connections and their requests. Request framing follows the server's:
+// the head up to the blank line, then Content-Length bytes or chunks.
+class Capture
+{
+  std::vector<CapturedConnection> connections;
+  long long wallStartUs;
+
+  static void frameRequests(CapturedConnection &connection);
+
+public:
+  Capture();
+
+  static Capture load(const std::string &fileName);
+
+  const std::vector<CapturedConnection> &getConnections() const;
+  long long getWallStartUs() const;
+  size_t requestCount() const;
+
+  class CaptureFileException : public std::runtime_error
+  {
+  public:
+    CaptureFileException(const std::string &msg) : std::runtime_error(msg) {}
+  };
+};
+
+#endif
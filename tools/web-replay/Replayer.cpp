@@ -0,0 +1,383 @@
+#include "Replayer.hpp"
+#include "utils/Timer.hpp"
+#include <cerrno>
+#include <cstring>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const size_t ReadBufferSize = 65536;
+static const int MaxEvents = 256;
+static const long long MaxWaitUs = 100000;
+
+RequestOutcome::RequestOutcome() : status(0), bodyLength(0), bodyHash(0), latencyUs(-1), error(REPLAY_OK) {}
+
+ReplayResult::ReplayResult() : responses(0), unexpected(0), elapsedUs(0)
+{
+  for (int i = 0; i < REPLAY_ERROR_KINDS; i++)
+    errors[i] = 0;
+}
+
+uint64_t ReplayResult::errorCount() const
+{
+  uint64_t count = 0;
+  for (int i = 0; i < REPLAY_ERROR_KINDS; i++)
+    count += errors[i];
+  return count;
+}
+
+const char *ReplayResult::errorName(int kind)
+{
+  static const char *const names[] = {"ok", "connect", "io", "timeout", "parse", "closed", "not-sent"};
+  return names[kind];
+}
+
+Replayer::Slot::Slot()
+    : fd(-1), connecting(false), done(false), closeAfterResponse(false), events(0), nextChunk(0),
+      releasedEnd(0), sent(0), sentRequests(0), answered(0), lagUs(0), lastProgressUs(0)
+{
+}
+
+Replayer::Replayer(const Capture &capture, const ReplayOptions &options)
+    : capture(capture), options(options), epollFd(epoll_create1(EPOLL_CLOEXEC)), startUs(0),
+      slots(capture.getConnections().size()), remaining(0), readBuffer(new char[ReadBufferSize])
+{
+  const std::vector<CapturedConnection> &connections = capture.getConnections();
+  result.outcomes.resize(connections.size());
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    size_t requests = connections[i].requests.size();
+    result.outcomes[i].resize(requests);
+    slots[i].startedUs.resize(requests, 0);
+    slots[i].sentUs.resize(requests, 0);
+    slots[i].reader.setDigest(true);
+    slots[i].reader.start(requests > 0 && connections[i].requests[0].method == "HEAD");
+  }
+}
+
+Replayer::~Replayer()
+{
+  for (size_t i = 0; i < slots.size(); i++)
+  {
+    if (slots[i].fd != -1)
+      ::close(slots[i].fd);
+  }
+  if (epollFd != -1)
+    ::close(epollFd);
+  delete[] readBuffer;
+}
+
+// When something captured at captureUs is due, before any lag
+long long Replayer::scheduled(long long captureUs) const
+{
+  if (options.speed <= 0)
+    return startUs;
+  return startUs + static_cast<long long>(captureUs / options.speed);
+}
+
+void Replayer::wakeAt(long long timeUs, size_t index)
+{
+  wakes.push(Wake(timeUs, index));
+}
+
+void Replayer::open(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  slot.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (slot.fd == -1)
+  {
+    finish(index, REPLAY_CONNECT);
+    return;
+  }
+  int one = 1;
+  setsockopt(slot.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int status = connect(slot.fd, reinterpret_cast<const struct sockaddr *>(&options.address), sizeof(options.address));
+  if (status == -1 && errno != EINPROGRESS)
+  {
+    finish(index, REPLAY_CONNECT);
+    return;
+  }
+  struct epoll_event event;
+  event.events = EPOLLOUT;
+  event.data.u64 = index;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, slot.fd, &event);
+  slot.events = EPOLLOUT;
+  slot.connecting = true;
+  slot.lastProgressUs = nowUs;
+  wakeAt(nowUs + options.timeoutUs, index);
+}
+
+// Ends the connection; requests still unanswered get the error
+void Replayer::finish(size_t index, int error)
+{
+  Slot &slot = slots[index];
+  if (slot.done)
+    return;
+  if (slot.fd != -1)
+  {
+    ::close(slot.fd);
+    slot.fd = -1;
+  }
+  slot.done = true;
+  remaining--;
+  std::vector<RequestOutcome> &outcomes = result.outcomes[index];
+  for (size_t i = slot.answered; i < outcomes.size(); i++)
+  {
+    outcomes[i].error = error == REPLAY_OK ? REPLAY_CLOSED : error;
+    result.errors[outcomes[i].error]++;
+  }
+}
+
+void Replayer::watch(size_t index, uint32_t events)
+{
+  Slot &slot = slots[index];
+  if (slot.events == events)
+    return;
+  struct epoll_event event;
+  event.events = events;
+  event.data.u64 = index;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, slot.fd, &event);
+  slot.events = events;
+}
+
+// Lets out the chunks that are due. A chunk that begins after a request
+// ended waits for that request's response.
+void Replayer::release(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  const CapturedConnection &connection = capture.getConnections()[index];
+  while (slot.nextChunk < connection.chunks.size())
+  {
+    const CapturedChunk &chunk = connection.chunks[slot.nextChunk];
+    if (slot.answered < connection.requests.size() && connection.requests[slot.answered].end <= chunk.offset)
+      return;
+    long long dueUs = options.speed <= 0 ? nowUs : scheduled(chunk.timeUs) + slot.lagUs;
+    if (dueUs > nowUs)
+    {
+      wakeAt(dueUs, index);
+      return;
+    }
+    slot.lagUs += nowUs - dueUs;
+    slot.releasedEnd = chunk.offset + chunk.length;
+    slot.nextChunk++;
+  }
+}
+
+// Sends what has been released; false if the connection failed
+bool Replayer::flush(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  const CapturedConnection &connection = capture.getConnections()[index];
+  while (slot.sent < slot.releasedEnd)
+  {
+    ssize_t n = send(slot.fd, connection.stream.data() + slot.sent, slot.releasedEnd - slot.sent, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      finish(index, REPLAY_IO);
+      return false;
+    }
+    size_t sentEnd = slot.sent + n;
+    for (size_t i = slot.sentRequests; i < connection.requests.size() && connection.requests[i].start < sentEnd; i++)
+    {
+      if (slot.startedUs[i] == 0)
+        slot.startedUs[i] = nowUs;
+    }
+    slot.sent = sentEnd;
+    while (slot.sentRequests < connection.requests.size() && connection.requests[slot.sentRequests].end <= slot.sent)
+      slot.sentUs[slot.sentRequests++] = nowUs;
+    slot.lastProgressUs = nowUs;
+  }
+  return true;
+}
+
+bool Replayer::settled(size_t index) const
+{
+  const Slot &slot = slots[index];
+  const CapturedConnection &connection = capture.getConnections()[index];
+  return slot.nextChunk == connection.chunks.size() && slot.sent == slot.releasedEnd &&
+         slot.answered >= connection.requests.size();
+}
+
+// Moves a connection along its schedule: open, send what is due, close
+// when the client did, or give up after the timeout
+void Replayer::advance(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  const CapturedConnection &connection = capture.getConnections()[index];
+  if (slot.done)
+    return;
+  if (slot.fd == -1)
+  {
+    if (nowUs >= scheduled(connection.openUs))
+      open(index, nowUs);
+    else
+      wakeAt(scheduled(connection.openUs), index);
+    return;
+  }
+  if (slot.connecting)
+  {
+    if (nowUs - slot.lastProgressUs >= options.timeoutUs)
+      finish(index, REPLAY_CONNECT);
+    return;
+  }
+  release(index, nowUs);
+  if (!flush(index, nowUs))
+    return;
+  if (settled(index))
+  {
+    long long closeUs = connection.closeUs < 0 ? nowUs : scheduled(connection.closeUs) + slot.lagUs;
+    if (closeUs <= nowUs)
+    {
+      finish(index, REPLAY_OK);
+      return;
+    }
+    wakeAt(closeUs, index);
+  }
+  else if (slot.answered < slot.sentRequests || slot.sent < slot.releasedEnd)
+  {
+    if (nowUs - slot.lastProgressUs >= options.timeoutUs)
+    {
+      finish(index, REPLAY_TIMEOUT);
+      return;
+    }
+    wakeAt(slot.lastProgressUs + options.timeoutUs, index);
+  }
+  watch(index, static_cast<uint32_t>(EPOLLIN) | (slot.sent < slot.releasedEnd ? static_cast<uint32_t>(EPOLLOUT) : 0));
+}
+
+void Replayer::complete(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  const CapturedConnection &connection = capture.getConnections()[index];
+  if (slot.answered >= connection.requests.size())
+  {
+    // An error page for a request cut off at the end of the capture
+    result.unexpected++;
+    slot.closeAfterResponse = slot.reader.wantsClose();
+    slot.reader.start(false);
+    return;
+  }
+  RequestOutcome &outcome = result.outcomes[index][slot.answered];
+  outcome.status = slot.reader.getStatus();
+  outcome.bodyLength = slot.reader.getBodyLength();
+  outcome.bodyHash = slot.reader.getBodyHash();
+  long long fromUs = slot.sentUs[slot.answered] ? slot.sentUs[slot.answered] : slot.startedUs[slot.answered];
+  outcome.latencyUs = fromUs ? nowUs - fromUs : 0;
+  result.latency.record(static_cast<uint64_t>(outcome.latencyUs));
+  result.statuses[outcome.status]++;
+  result.responses++;
+  slot.answered++;
+  slot.closeAfterResponse = slot.reader.wantsClose();
+  slot.reader.start(slot.answered < connection.requests.size() &&
+                    connection.requests[slot.answered].method == "HEAD");
+}
+
+void Replayer::receive(size_t index, long long nowUs)
+{
+  Slot &slot = slots[index];
+  while (true)
+  {
+    ssize_t n = recv(slot.fd, readBuffer, ReadBufferSize, 0);
+    if (n == 0)
+    {
+      if (slot.reader.finishAtEof())
+        complete(index, nowUs);
+      finish(index, REPLAY_OK);
+      return;
+    }
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      finish(index, REPLAY_IO);
+      return;
+    }
+    slot.lastProgressUs = nowUs;
+    size_t offset = 0;
+    while (offset < static_cast<size_t>(n))
+    {
+      bool done;
+      offset += slot.reader.feed(readBuffer + offset, n - offset, &done);
+      if (slot.reader.hasFailed())
+      {
+        finish(index, REPLAY_PARSE);
+        return;
+      }
+      if (!done)
+        continue;
+      complete(index, nowUs);
+      if (slot.closeAfterResponse)
+      {
+        finish(index, REPLAY_OK);
+        return;
+      }
+    }
+  }
+  advance(index, nowUs);
+}
+
+const ReplayResult &Replayer::run(volatile const int *interrupted)
+{
+  startUs = Timer::monotonicUs();
+  remaining = slots.size();
+  for (size_t i = 0; i < slots.size(); i++)
+    wakeAt(scheduled(capture.getConnections()[i].openUs), i);
+
+  struct epoll_event events[MaxEvents];
+  while (remaining > 0 && !*interrupted)
+  {
+    long long nowUs = Timer::monotonicUs();
+    while (!wakes.empty() && wakes.top().first <= nowUs)
+    {
+      size_t index = wakes.top().second;
+      wakes.pop();
+      advance(index, nowUs);
+    }
+    if (remaining == 0)
+      break;
+    long long waitUs = wakes.empty() ? MaxWaitUs : wakes.top().first - nowUs;
+    if (waitUs > MaxWaitUs)
+      waitUs = MaxWaitUs;
+    int count = epoll_wait(epollFd, events, MaxEvents, static_cast<int>((waitUs + 999) / 1000));
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < count; i++)
+    {
+      size_t index = static_cast<size_t>(events[i].data.u64);
+      Slot &slot = slots[index];
+      if (slot.done)
+        continue;
+      nowUs = Timer::monotonicUs();
+      if (slot.connecting)
+      {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(slot.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+          finish(index, REPLAY_CONNECT);
+          continue;
+        }
+        slot.connecting = false;
+        slot.lastProgressUs = nowUs;
+        advance(index, nowUs);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        receive(index, nowUs);
+      else if (events[i].events & EPOLLOUT)
+        advance(index, nowUs);
+    }
+  }
+  for (size_t i = 0; i < slots.size(); i++)
+    finish(i, REPLAY_NOT_SENT);
+  result.elapsedUs = Timer::monotonicUs() - startUs;
+  return result;
+}
@@ -0,0 +1,122 @@
+#ifndef REPLAYER_HPP
+#define REPLAYER_HPP
+
+#include "Capture.hpp"
+#include "../web-bench/ResponseReader.hpp"
+#include "utils/Histogram.hpp"
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+#include <netinet/in.h>
+#include <stdint.h>
+
+enum ReplayError
+{
+  REPLAY_OK,
+  REPLAY_CONNECT,
+  REPLAY_IO,
+  REPLAY_TIMEOUT,
+  REPLAY_PARSE,
+  REPLAY_CLOSED,  // the server closed before answering
+  REPLAY_NOT_SENT, // interrupted first
+  REPLAY_ERROR_KINDS
+};
+
+// How one captured request fared. Latency counts from when its last byte
+// was sent (its first, if the answer came sooner) to the end of the
+// response, in microseconds.
+struct RequestOutcome
+{
+  int status; // 0 without a response
+  uint64_t bodyLength;
+  uint64_t bodyHash;
+  long long latencyUs;
+  int error;
+
+  RequestOutcome();
+};
+
+struct ReplayResult
+{
+  std::vector<std::vector<RequestOutcome> > outcomes; // by connection, then request
+  Histogram latency;
+  std::map<int, uint64_t> statuses;
+  uint64_t responses;
+  uint64_t unexpected; // responses beyond the framed requests
+  uint64_t errors[REPLAY_ERROR_KINDS];
+  long long elapsedUs;
+
+  ReplayResult();
+
+  uint64_t errorCount() const;
+  static const char *errorName(int kind);
+};
+
+struct ReplayOptions
+{
+  struct sockaddr_in address;
+  double speed;       // 1: as captured, 2: twice as fast; 0: no waiting
+  long long timeoutUs; // without progress on a connection with requests out
+};
+
+// Replays every captured connection on its own socket at the captured
+// times, scaled by the speed. A connection keeps its think times: a
+// chunk that starts the next request is held until the responses to the
+// ones before it arrive, and everything after it shifts by the wait, so
+// a slower server is not sent requests its client never pipelined.
+class Replayer
+{
+  struct Slot
+  {
+    int fd;
+    bool connecting;
+    bool done;
+    bool closeAfterResponse;
+    uint32_t events;
+    size_t nextChunk;
+    size_t releasedEnd; // stream bytes that may be sent
+    size_t sent;
+    size_t sentRequests; // requests whose last byte is out
+    size_t answered;
+    long long lagUs;     // how far behind the captured schedule it runs
+    long long lastProgressUs;
+    std::vector<long long> startedUs;
+    std::vector<long long> sentUs;
+    ResponseReader reader;
+
+    Slot();
+  };
+
+  typedef std::pair<long long, size_t> Wake; // time, slot
+
+  const Capture &capture;
+  const ReplayOptions &options;
+  int epollFd;
+  long long startUs;
+  std::vector<Slot> slots;
+  std::priority_queue<Wake, std::vector<Wake>, std::greater<Wake> > wakes;
+  size_t remaining;
+  ReplayResult result;
+  char *readBuffer;
+
+  long long scheduled(long long captureUs) const;
+  void wakeAt(long long timeUs, size_t index);
+  void open(size_t index, long long nowUs);
+  void finish(size_t index, int error);
+  void watch(size_t index, uint32_t events);
+  void advance(size_t index, long long nowUs);
+  void release(size_t index, long long nowUs);
+  bool flush(size_t index, long long nowUs);
+  void receive(size_t index, long long nowUs);
+  void complete(size_t index, long long nowUs);
+  bool settled(size_t index) const;
+
+public:
+  Replayer(const Capture &capture, const ReplayOptions &options);
+  ~Replayer();
+
+  const ReplayResult &run(volatile const int *interrupted);
+};
+
+#endif
@@ -0,0 +1,287 @@
+#include "Capture.hpp"
+#include "Replayer.hpp"
+#include "utils/Number.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <netdb.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+static volatile int g_interrupted = 0;
+
+static void handle_sigint(int sig)
+{
+  (void)sig;
+  g_interrupted = 1;
+}
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name << " [options] -t host:port [-t host:port] CAPTURE\n"
+            << "  -t, --target HOST:PORT  server to replay against; with two, replay against each\n"
+            << "                          in turn and report the responses that differ\n"
+            << "  -s, --speed X           time scale: 2 replays twice as fast, 0 without waiting (default 1)\n"
+            << "  -T, --timeout TIME      a connection stuck this long fails (default 5s)\n"
+            << "  -l, --log FILE          one line per request and target, tab separated\n"
+            << "  -D, --max-diffs N       differences listed (default 20)" << std::endl;
+}
+
+static bool parseTarget(const std::string &target, struct sockaddr_in *address)
+{
+  size_t colon = target.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == target.size())
+    return false;
+  std::string name = target.substr(0, colon);
+  std::string port = target.substr(colon + 1);
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *found = NULL;
+  if (getaddrinfo(name.c_str(), port.c_str(), &hints, &found) != 0 || !found)
+    return false;
+  std::memcpy(address, found->ai_addr, sizeof(*address));
+  freeaddrinfo(found);
+  return true;
+}
+
+static const double Percentiles[] = {50, 90, 99, 99.9};
+static const size_t PercentileCount = sizeof(Percentiles) / sizeof(Percentiles[0]);
+
+static std::string milliseconds(uint64_t us)
+{
+  char text[32];
+  snprintf(text, sizeof(text), "%.3fms", us / 1000.0);
+  return text;
+}
+
+static void printResult(std::ostream &out, const std::string &target, const ReplayResult &result)
+{
+  char line[256];
+  snprintf(line, sizeof(line), "%s: %.2fs, %llu responses", target.c_str(), result.elapsedUs / 1e6,
+           static_cast<unsigned long long>(result.responses));
+  out << line;
+  if (result.unexpected > 0)
+    out << " (+" << result.unexpected << " to cut-off requests)";
+  out << "\n";
+  const Histogram &latency = result.latency;
+  out << "  Latency    min " << milliseconds(latency.getMin()) << "  mean " << milliseconds(latency.getMean())
+      << "  max " << milliseconds(latency.getMax()) << "\n            ";
+  for (size_t i = 0; i < PercentileCount; i++)
+  {
+    snprintf(line, sizeof(line), "p%g %s", Percentiles[i], milliseconds(latency.valueAtPercentile(Percentiles[i])).c_str());
+    out << line << (i + 1 < PercentileCount ? "  " : "\n");
+  }
+  out << "  Status    ";
+  for (std::map<int, uint64_t>::const_iterator it = result.statuses.begin(); it != result.statuses.end(); ++it)
+    out << " " << it->first << " " << it->second;
+  out << "\n  Errors    ";
+  for (int i = REPLAY_OK + 1; i < REPLAY_ERROR_KINDS; i++)
+    out << " " << ReplayResult::errorName(i) << " " << result.errors[i];
+  out << "\n";
+}
+
+static std::string describe(const RequestOutcome &outcome)
+{
+  char text[96];
+  if (outcome.error != REPLAY_OK)
+    return ReplayResult::errorName(outcome.error);
+  snprintf(text, sizeof(text), "%d, %llu bytes, body %016llx", outcome.status,
+           static_cast<unsigned long long>(outcome.bodyLength), static_cast<unsigned long long>(outcome.bodyHash));
+  return text;
+}
+
+static bool sameOutcome(const RequestOutcome &a, const RequestOutcome &b)
+{
+  return a.error == b.error && a.status == b.status && a.bodyLength == b.bodyLength && a.bodyHash == b.bodyHash;
+}
+
+// Lists the requests answered differently; returns how many were
+static size_t compareResults(std::ostream &out, const Capture &capture, const std::vector<std::string> &targets,
+                             const ReplayResult &first, const ReplayResult &second, size_t maxDiffs)
+{
+  const std::vector<CapturedConnection> &connections = capture.getConnections();
+  size_t differences = 0;
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    for (size_t j = 0; j < connections[i].requests.size(); j++)
+    {
+      const RequestOutcome &a = first.outcomes[i][j];
+      const RequestOutcome &b = second.outcomes[i][j];
+      if (sameOutcome(a, b))
+        continue;
+      if (differences++ >= maxDiffs)
+        continue;
+      const CapturedRequest &request = connections[i].requests[j];
+      out << "  connection " << connections[i].id << " request " << j + 1 << ": " << request.method << " "
+          << request.target << "\n    " << targets[0] << ": " << describe(a) << "\n    " << targets[1] << ": "
+          << describe(b) << "\n";
+    }
+  }
+  if (differences > maxDiffs)
+    out << "  ... and " << differences - maxDiffs << " more\n";
+  return differences;
+}
+
+static void writeLog(std::ostream &log, const Capture &capture, const std::string &target, const ReplayResult &result)
+{
+  const std::vector<CapturedConnection> &connections = capture.getConnections();
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    for (size_t j = 0; j < connections[i].requests.size(); j++)
+    {
+      const CapturedRequest &request = connections[i].requests[j];
+      const RequestOutcome &outcome = result.outcomes[i][j];
+      char hash[24];
+      snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(outcome.bodyHash));
+      log << target << "\t" << connections[i].id << "\t" << j + 1 << "\t" << request.method << "\t"
+          << request.target << "\t" << outcome.status << "\t" << outcome.bodyLength << "\t" << hash << "\t"
+          << outcome.latencyUs << "\t" << ReplayResult::errorName(outcome.error) << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option longOptions[] = {
+      {"target", required_argument, NULL, 't'},    {"speed", required_argument, NULL, 's'},
+      {"timeout", required_argument, NULL, 'T'},   {"log", required_argument, NULL, 'l'},
+      {"max-diffs", required_argument, NULL, 'D'}, {NULL, 0, NULL, 0}};
+
+  std::vector<std::string> targets;
+  std::vector<struct sockaddr_in> addresses;
+  double speed = 1.0;
+  long long timeoutUs = 5000000;
+  unsigned long maxDiffs = 20;
+  std::string logFile;
+  int option;
+  while ((option = getopt_long(argc, argv, "t:s:T:l:D:", longOptions, NULL)) != -1)
+  {
+    bool ok = true;
+    switch (option)
+    {
+    case 't':
+    {
+      struct sockaddr_in address;
+      ok = targets.size() < 2 && parseTarget(optarg, &address);
+      targets.push_back(optarg);
+      addresses.push_back(address);
+      break;
+    }
+    case 's':
+    {
+      char *end;
+      speed = std::strtod(optarg, &end);
+      ok = *end == '\0' && end != optarg && speed >= 0;
+      break;
+    }
+    case 'T':
+      timeoutUs = Number::parseDuration(optarg, &ok) * 1000LL;
+      ok = ok && timeoutUs > 0;
+      break;
+    case 'l':
+      logFile = optarg;
+      break;
+    case 'D':
+      ok = Number::isDigits(optarg);
+      maxDiffs = std::strtoul(optarg, NULL, 10);
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind + 1 != argc || targets.empty())
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Capture capture;
+  try
+  {
+    capture = Capture::load(argv[optind]);
+  }
+  catch (const Capture::CaptureFileException &e)
+  {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  std::ofstream log;
+  if (!logFile.empty())
+  {
+    log.open(logFile.c_str());
+    if (!log.is_open())
+    {
+      std::cerr << argv[0] << ": cannot write " << logFile << std::endl;
+      return 1;
+    }
+    log << "target\tconnection\trequest\tmethod\ttarget\tstatus\tbytes\tbody\tlatency_us\terror\n";
+  }
+
+  const std::vector<CapturedConnection> &connections = capture.getConnections();
+  size_t truncated = 0;
+  long long spanUs = 0;
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    truncated += connections[i].truncated ? 1 : 0;
+    if (!connections[i].chunks.empty() && connections[i].chunks.back().timeUs > spanUs)
+      spanUs = connections[i].chunks.back().timeUs;
+  }
+  char line[256];
+  snprintf(line, sizeof(line), "%s: %lu connections, %lu requests over %.2fs", argv[optind],
+           static_cast<unsigned long>(connections.size()), static_cast<unsigned long>(capture.requestCount()),
+           spanUs / 1e6);
+  std::cout << line;
+  if (truncated > 0)
+    std::cout << " (" << truncated << " cut off mid-request)";
+  std::cout << "\n";
+  if (speed > 0)
+    snprintf(line, sizeof(line), "replaying at %gx", speed);
+  else
+    snprintf(line, sizeof(line), "replaying without waiting: each request follows the last response");
+  std::cout << line << std::endl;
+
+  signal(SIGINT, handle_sigint);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<ReplayResult> results(targets.size());
+  for (size_t i = 0; i < targets.size() && !g_interrupted; i++)
+  {
+    ReplayOptions options;
+    options.address = addresses[i];
+    options.speed = speed;
+    options.timeoutUs = timeoutUs;
+    Replayer replayer(capture, options);
+    results[i] = replayer.run(&g_interrupted);
+    printResult(std::cout, targets[i], results[i]);
+    if (log.is_open())
+      writeLog(log, capture, targets[i], results[i]);
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i].errorCount() > 0)
+      status = 1;
+  }
+  if (targets.size() == 2 && !g_interrupted)
+  {
+    std::cout << "Differences\n";
+    size_t differences = compareResults(std::cout, capture, targets, results[0], results[1], maxDiffs);
+    std::cout << "  " << differences << " of " << capture.requestCount() << " requests answered differently"
+              << std::endl;
+    if (differences > 0)
+      status = 1;
+  }
+  return g_interrupted ? 1 : status;
+}